@@ -0,0 +1,389 @@
+#include "async_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define IMAGE_PROCESSOR_IO_URING 1
+#endif
+
+namespace {
+
+std::atomic<IoBackend> g_backend(IoBackend::Uring);
+
+const char* const kReadOpenError = "This file cannot be opened";
+const char* const kWriteOpenError = "File cannot be opened";
+const char* const kWriteError = "Failed to write the file";
+
+// Запасной вариант: операции выполняются блокирующими вызовами в depth потоках
+class ThreadedFileIo : public AsyncFileIo {
+public:
+    explicit ThreadedFileIo(int depth)
+        : m_requests_(std::numeric_limits<size_t>::max()), m_completions_(std::numeric_limits<size_t>::max()) {
+        for (int i = 0; i < depth; ++i) {
+            m_threads_.emplace_back([this] { Work(); });
+        }
+    }
+
+    ~ThreadedFileIo() override {
+        m_requests_.Close();
+        for (auto& thread : m_threads_) {
+            thread.join();
+        }
+    }
+
+    const char* Name() const override {
+        return "threads";
+    }
+
+    void SubmitRead(size_t tag, const std::string& path, std::string buffer) override {
+        ++m_pending_;
+        m_requests_.Push(Request{tag, path, false, std::move(buffer)});
+    }
+
+    void SubmitWrite(size_t tag, const std::string& path, std::string data) override {
+        ++m_pending_;
+        m_requests_.Push(Request{tag, path, true, std::move(data)});
+    }
+
+    bool Wait(IoCompletion& completion) override {
+        if (m_pending_ == 0) {
+            return false;
+        }
+        completion = std::move(*m_completions_.Pop());
+        --m_pending_;
+        return true;
+    }
+
+private:
+    struct Request {
+        size_t tag;
+        std::string path;
+        bool write;
+        std::string data;
+    };
+
+    void Work() {
+        while (std::optional<Request> request = m_requests_.Pop()) {
+            IoCompletion completion;
+            completion.tag = request->tag;
+            completion.data = std::move(request->data);
+            if (request->write) {
+                std::ofstream file(request->path, std::ios::out | std::ios::binary);
+                if (!file.is_open()) {
+                    completion.error = kWriteOpenError;
+                } else {
+                    file.write(completion.data.data(), static_cast<std::streamsize>(completion.data.size()));
+                    file.close();
+                    if (!file) {
+                        completion.error = kWriteError;
+                    }
+                }
+            } else {
+                std::ifstream file(request->path, std::ios::in | std::ios::binary | std::ios::ate);
+                if (!file.is_open()) {
+                    completion.error = kReadOpenError;
+                } else {
+                    completion.data.resize(static_cast<size_t>(file.tellg()));
+                    file.seekg(0);
+                    file.read(completion.data.data(), static_cast<std::streamsize>(completion.data.size()));
+                    if (file.gcount() != static_cast<std::streamsize>(completion.data.size())) {
+                        completion.error = "Failed to read the file";
+                    }
+                }
+            }
+            m_completions_.Push(std::move(completion));
+        }
+    }
+
+    BoundedQueue<Request> m_requests_;
+    BoundedQueue<IoCompletion> m_completions_;
+    std::vector<std::thread> m_threads_;
+};
+
+#if defined(IMAGE_PROCESSOR_IO_URING)
+
+// io_uring без liburing: кольца отправки и завершения отображаются в память, операции - readv и writev
+// целого файла (короткие чтения и записи дочитываются повторной отправкой). Открытие файла и fstat
+// остаются синхронными: это обращения к метаданным, а не к данным файла
+class UringFileIo : public AsyncFileIo {
+public:
+    // nullptr, если ядро не поддерживает io_uring или он запрещён
+    static std::unique_ptr<UringFileIo> Create(int depth) {
+        std::unique_ptr<UringFileIo> io(new UringFileIo());
+        return io->Setup(static_cast<unsigned>(std::max(depth, 1))) ? std::move(io) : nullptr;
+    }
+
+    ~UringFileIo() override {
+        // Ядро может ещё писать в буферы начатых операций, поэтому сначала дожидаемся их
+        IoCompletion completion;
+        while (Wait(completion)) {
+        }
+        if (m_sqes_ != nullptr) {
+            munmap(m_sqes_, m_sqes_size_);
+        }
+        if (m_cq_ring_ != nullptr && m_cq_ring_ != m_sq_ring_) {
+            munmap(m_cq_ring_, m_cq_ring_size_);
+        }
+        if (m_sq_ring_ != nullptr) {
+            munmap(m_sq_ring_, m_sq_ring_size_);
+        }
+        if (m_ring_ >= 0) {
+            close(m_ring_);
+        }
+    }
+
+    const char* Name() const override {
+        return "io_uring";
+    }
+
+    void SubmitRead(size_t tag, const std::string& path, std::string buffer) override {
+        ++m_pending_;
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat status;
+        if (fd < 0 || fstat(fd, &status) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            Fail(tag, kReadOpenError);
+            return;
+        }
+        Operation& operation = Allocate(tag, fd, false);
+        operation.data = std::move(buffer);
+        operation.data.resize(static_cast<size_t>(status.st_size));
+        Start(operation);
+    }
+
+    void SubmitWrite(size_t tag, const std::string& path, std::string data) override {
+        ++m_pending_;
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            Fail(tag, kWriteOpenError);
+            return;
+        }
+        Operation& operation = Allocate(tag, fd, true);
+        operation.data = std::move(data);
+        Start(operation);
+    }
+
+    bool Wait(IoCompletion& completion) override {
+        while (m_ready_.empty()) {
+            if (m_pending_ == 0) {
+                return false;
+            }
+            Reap();
+        }
+        completion = std::move(m_ready_.front());
+        m_ready_.pop_front();
+        --m_pending_;
+        return true;
+    }
+
+private:
+    struct Operation {
+        size_t tag = 0;
+        int fd = -1;
+        bool write = false;
+        std::string data;
+        size_t done = 0;
+        size_t slot = 0;  // место в m_operations_
+        iovec vector{};  // должен жить до отправки в ядро
+    };
+
+    UringFileIo() = default;
+
+    bool Setup(unsigned depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_ring_ = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (m_ring_ < 0) {
+            return false;
+        }
+        m_sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            m_sq_ring_size_ = m_cq_ring_size_ = std::max(m_sq_ring_size_, m_cq_ring_size_);
+        }
+        m_sq_ring_ = Map(m_sq_ring_size_, IORING_OFF_SQ_RING);
+        m_cq_ring_ = single_mmap ? m_sq_ring_ : Map(m_cq_ring_size_, IORING_OFF_CQ_RING);
+        m_sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes_ = static_cast<io_uring_sqe*>(Map(m_sqes_size_, IORING_OFF_SQES));
+        if (m_sq_ring_ == nullptr || m_cq_ring_ == nullptr || m_sqes_ == nullptr) {
+            return false;
+        }
+        char* sq = static_cast<char*>(m_sq_ring_);
+        char* cq = static_cast<char*>(m_cq_ring_);
+        m_sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        m_sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_sq_entries_ = params.sq_entries;
+        m_cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void* Map(size_t size, off_t offset) {
+        void* pointer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_, offset);
+        return pointer == MAP_FAILED ? nullptr : pointer;
+    }
+
+    // Передаёт ядру все ещё не отправленные записи кольца и, если wait, ждёт одно завершение
+    void Enter(bool wait) {
+        const unsigned submit = *m_sq_tail_ - __atomic_load_n(m_sq_head_, __ATOMIC_ACQUIRE);
+        const unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+        while (syscall(__NR_io_uring_enter, m_ring_, submit, wait ? 1 : 0, flags, nullptr, 0) < 0 && errno == EINTR) {
+        }
+    }
+
+    Operation& Allocate(size_t tag, int fd, bool write) {
+        if (m_free_.empty()) {
+            m_free_.push_back(m_operations_.size());
+            m_operations_.push_back(std::make_unique<Operation>());
+            m_operations_.back()->slot = m_operations_.size() - 1;
+        }
+        Operation& operation = *m_operations_[m_free_.back()];
+        m_free_.pop_back();
+        operation.tag = tag;
+        operation.fd = fd;
+        operation.write = write;
+        operation.done = 0;
+        return operation;
+    }
+
+    void Fail(size_t tag, const std::string& error) {
+        IoCompletion completion;
+        completion.tag = tag;
+        completion.error = error;
+        m_ready_.push_back(std::move(completion));
+    }
+
+    // Отправляет оставшуюся часть операции
+    void Start(Operation& operation) {
+        if (operation.done == operation.data.size()) {
+            Finish(operation, 0);
+            return;
+        }
+        // Результат операции - int, поэтому за раз передаётся не больше 1 ГБ
+        const size_t chunk = std::min(operation.data.size() - operation.done, static_cast<size_t>(1) << 30);
+        operation.vector.iov_base = operation.data.data() + operation.done;
+        operation.vector.iov_len = chunk;
+
+        const unsigned tail = *m_sq_tail_;
+        if (tail - __atomic_load_n(m_sq_head_, __ATOMIC_ACQUIRE) == m_sq_entries_) {
+            Enter(false);
+        }
+        const unsigned index = tail & m_sq_mask_;
+        io_uring_sqe& sqe = m_sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = operation.write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.fd = operation.fd;
+        sqe.off = operation.done;
+        sqe.addr = reinterpret_cast<unsigned long long>(&operation.vector);
+        sqe.len = 1;
+        sqe.user_data = reinterpret_cast<unsigned long long>(&operation);
+        m_sq_array_[index] = index;
+        __atomic_store_n(m_sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        Enter(false);
+    }
+
+    // Забирает завершения из кольца, при необходимости ждёт хотя бы одно
+    void Reap() {
+        unsigned head = *m_cq_head_;
+        if (head == __atomic_load_n(m_cq_tail_, __ATOMIC_ACQUIRE)) {
+            Enter(true);
+        }
+        while (head != __atomic_load_n(m_cq_tail_, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe& cqe = m_cqes_[head & m_cq_mask_];
+            Operation& operation = *reinterpret_cast<Operation*>(cqe.user_data);
+            const int result = cqe.res;
+            __atomic_store_n(m_cq_head_, ++head, __ATOMIC_RELEASE);
+
+            if (result == -EINTR || result == -EAGAIN) {
+                Start(operation);
+            } else if (result < 0) {
+                Finish(operation, -result);
+            } else if (result == 0 && !operation.write) {
+                Finish(operation, ENODATA);  // файл стал короче, пока читался
+            } else {
+                operation.done += static_cast<size_t>(result);
+                Start(operation);
+            }
+        }
+    }
+
+    void Finish(Operation& operation, int error_code) {
+        IoCompletion completion;
+        completion.tag = operation.tag;
+        if (close(operation.fd) != 0 && operation.write && error_code == 0) {
+            error_code = errno;
+        }
+        if (error_code != 0) {
+            completion.error = std::string(operation.write ? kWriteError : "Failed to read the file") + ": " +
+                               std::strerror(error_code);
+        }
+        completion.data = std::move(operation.data);
+        operation.data.clear();
+        m_ready_.push_back(std::move(completion));
+        m_free_.push_back(operation.slot);
+    }
+
+    int m_ring_ = -1;
+    void* m_sq_ring_ = nullptr;
+    void* m_cq_ring_ = nullptr;
+    size_t m_sq_ring_size_ = 0;
+    size_t m_cq_ring_size_ = 0;
+    io_uring_sqe* m_sqes_ = nullptr;
+    size_t m_sqes_size_ = 0;
+    unsigned* m_sq_head_ = nullptr;
+    unsigned* m_sq_tail_ = nullptr;
+    unsigned* m_sq_array_ = nullptr;
+    unsigned m_sq_mask_ = 0;
+    unsigned m_sq_entries_ = 0;
+    unsigned* m_cq_head_ = nullptr;
+    unsigned* m_cq_tail_ = nullptr;
+    unsigned m_cq_mask_ = 0;
+    io_uring_cqe* m_cqes_ = nullptr;
+
+    std::vector<std::unique_ptr<Operation>> m_operations_;
+    std::vector<size_t> m_free_;
+    std::deque<IoCompletion> m_ready_;
+};
+
+#endif
+
+}  // namespace
+
+void SetIoBackend(IoBackend backend) {
+    g_backend.store(backend);
+}
+
+std::unique_ptr<AsyncFileIo> CreateAsyncFileIo(int depth) {
+#if defined(IMAGE_PROCESSOR_IO_URING)
+    if (g_backend.load() == IoBackend::Uring) {
+        if (std::unique_ptr<UringFileIo> io = UringFileIo::Create(depth)) {
+            return io;
+        }
+    }
+#endif
+    return std::make_unique<ThreadedFileIo>(std::max(depth, 1));
+}
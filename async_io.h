@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Асинхронное чтение и запись файлов целиком. Пока диск выполняет начатые операции, вызывающий поток
+// свободен, поэтому пакетная обработка держит в работе одновременно диск и ядра.
+// На Linux используется io_uring, если ядро его поддерживает, иначе - пул потоков с блокирующим вводом-выводом
+
+enum class IoBackend { Uring, Threads };
+
+// Выбор реализации (--io), по умолчанию Uring. Вызывать до CreateAsyncFileIo
+void SetIoBackend(IoBackend backend);
+
+// Завершённая операция
+struct IoCompletion {
+    size_t tag = 0;
+    // Для чтения - содержимое файла, для записи - переданные данные, чтобы их память можно было использовать снова
+    std::string data;
+    std::string error;  // пусто, если операция удалась
+};
+
+// Операции завершаются в любом порядке. Объект используется из одного потока
+class AsyncFileIo {
+public:
+    virtual ~AsyncFileIo() = default;
+
+    virtual const char* Name() const = 0;
+    // tag возвращается в IoCompletion и нужен только вызывающему. buffer - память под содержимое файла:
+    // если её хватает, чтение обходится без выделения и заполнения памяти
+    virtual void SubmitRead(size_t tag, const std::string& path, std::string buffer) = 0;
+    virtual void SubmitWrite(size_t tag, const std::string& path, std::string data) = 0;
+    // Ждёт завершения одной из начатых операций. false, если незавершённых операций нет
+    virtual bool Wait(IoCompletion& completion) = 0;
+
+    // Начатые и ещё не возвращённые Wait операции
+    size_t Pending() const {
+        return m_pending_;
+    }
+
+protected:
+    size_t m_pending_ = 0;
+};
+
+// depth - сколько операций могут выполняться одновременно
+std::unique_ptr<AsyncFileIo> CreateAsyncFileIo(int depth);
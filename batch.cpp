@@ -0,0 +1,306 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+
+#include "async_io.h"
+#include "bmp.h"
+#include "bounded_queue.h"
+#include "planar_image.h"
+#include "profile.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Сколько файлов одновременно читается и сколько записывается. Несколько запросов в очереди диска
+// скрывают задержку каждого, а память ограничена несколькими файлами
+const size_t kIoDepth = 4;
+
+// Файл BMP в памяти: прочитанный с диска или закодированный для записи
+struct FileData {
+    size_t job = 0;
+    std::string bytes;
+};
+
+// Сопоставление имени файла с маской из символов * и ?
+bool MatchesMask(const std::string& name, const std::string& mask) {
+    size_t n = 0;
+    size_t m = 0;
+    size_t star = std::string::npos;
+    size_t resume = 0;
+    while (n < name.size()) {
+        if (m < mask.size() && (mask[m] == '?' || mask[m] == name[n])) {
+            ++n;
+            ++m;
+        } else if (m < mask.size() && mask[m] == '*') {
+            star = m++;
+            resume = n;
+        } else if (star != std::string::npos) {
+            m = star + 1;
+            n = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*') {
+        ++m;
+    }
+    return m == mask.size();
+}
+
+bool HasBmpExtension(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".bmp";
+}
+
+std::string ExpandOutputPattern(const std::string& pattern, const std::string& input) {
+    const std::string stem = std::filesystem::path(input).stem().string();
+    if (std::filesystem::is_directory(pattern)) {
+        return (std::filesystem::path(pattern) / (stem + ".bmp")).string();
+    }
+    std::string output = pattern;
+    const std::string key = "{name}";
+    for (size_t pos = output.find(key); pos != std::string::npos; pos = output.find(key, pos + stem.size())) {
+        output.replace(pos, key.size(), stem);
+    }
+    return output;
+}
+
+}  // namespace
+
+bool CollectBatchJobs(const std::string& source, const std::string& output_pattern, std::vector<BatchJob>& jobs,
+                      std::string& error) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> inputs;
+    std::error_code code;
+
+    if (source.find_first_of("*?") != std::string::npos) {
+        const fs::path path(source);
+        const fs::path directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+        const std::string mask = path.filename().string();
+        for (const auto& entry : fs::directory_iterator(directory, code)) {
+            if (entry.is_regular_file() && MatchesMask(entry.path().filename().string(), mask)) {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    } else if (fs::is_directory(source)) {
+        for (const auto& entry : fs::directory_iterator(source, code)) {
+            if (entry.is_regular_file() && HasBmpExtension(entry.path())) {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    } else {
+        // Манифест: по файлу в строке, пустые строки и строки с # пропускаются
+        std::ifstream manifest(source);
+        if (!manifest.is_open()) {
+            error = "Manifest " + source + " cannot be opened";
+            return false;
+        }
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            const size_t tab = line.find('\t');
+            if (tab != std::string::npos) {
+                jobs.push_back(BatchJob{line.substr(0, tab), line.substr(tab + 1)});
+            } else {
+                inputs.push_back(line);
+            }
+        }
+    }
+    if (code) {
+        error = "Cannot list " + source + ": " + code.message();
+        return false;
+    }
+
+    // Без {name} все файлы записались бы в один и тот же выходной файл
+    const bool distinct = output_pattern.find("{name}") != std::string::npos || fs::is_directory(output_pattern);
+    if (!distinct && inputs.size() + jobs.size() > 1 && !inputs.empty()) {
+        error = "Output pattern must contain {name} or be a directory";
+        return false;
+    }
+    for (const auto& input : inputs) {
+        jobs.push_back(BatchJob{input, ExpandOutputPattern(output_pattern, input)});
+    }
+    if (jobs.empty()) {
+        error = "No input files found in " + source;
+        return false;
+    }
+    return true;
+}
+
+bool RunBatch(const std::vector<BatchJob>& jobs, const std::vector<PipelineStage>& plan, Storage storage) {
+    // Каждый обработчик ведёт свой файл; фильтры внутри файла дополнительно делят работу через общий пул,
+    // что важно для больших изображений. Маленькие изображения выполняются одним куском без накладных расходов
+    const int workers = GetThreadPool().Size();
+    BoundedQueue<FileData> loaded(2 * workers);
+    BoundedQueue<FileData> processed(2 * workers);
+    // Буферы записанных файлов идут под чтение следующих. Их столько, сколько файлов одновременно в работе
+    BoundedQueue<std::string> spare_buffers(2 * kIoDepth + 5 * workers);
+
+    std::atomic<size_t> failed(0);
+    std::atomic<size_t> succeeded(0);
+    // Пиксели входа каждого файла; в сводку идут только записанные файлы
+    std::vector<unsigned long long> job_pixels(jobs.size(), 0);
+    std::atomic<unsigned long long> pixels(0);
+    std::mutex error_mutex;
+    auto report = [&](size_t job, const std::string& error) {
+        failed.fetch_add(1);
+        std::lock_guard<std::mutex> lock(error_mutex);
+        std::cerr << "Error: " << jobs[job].input << ": " << error << std::endl;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<AsyncFileIo> reader = CreateAsyncFileIo(static_cast<int>(kIoDepth));
+    std::unique_ptr<AsyncFileIo> writer = CreateAsyncFileIo(static_cast<int>(kIoDepth));
+
+    // Чтение: следующие файлы уже читаются с диска, пока обработчики заняты текущими
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        size_t next_job = 0;
+        IoCompletion completion;
+        while (true) {
+            while (next_job < jobs.size() && reader->Pending() < kIoDepth) {
+                bool drained = false;
+                std::optional<std::string> buffer = spare_buffers.TryPop(drained);
+                reader->SubmitRead(next_job, jobs[next_job].input, buffer ? std::move(*buffer) : std::string());
+                ++next_job;
+            }
+            if (!reader->Wait(completion)) {
+                break;
+            }
+            if (!completion.error.empty()) {
+                report(completion.tag, completion.error);
+                continue;
+            }
+            loaded.Push(FileData{completion.tag, std::move(completion.data)});
+        }
+        loaded.Close();
+    });
+
+    // Обработчики декодируют файл из памяти, применяют фильтры и кодируют результат обратно в память
+    std::atomic<int> workers_left(workers);
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back([&] {
+            // Изображения живут между файлами, поэтому память под пиксели выделяется заново только для
+            // изображений больше прежних
+            Image image(0, 0);
+            ImageU8 image_u8(0, 0);
+            const bool u8 = storage == Storage::U8;
+            // Во float декодируется только область интереса плана
+            const ImageRegion region = storage == Storage::Interleaved ? InputRegion(plan) : ImageRegion{};
+            // Декодирование, фильтры и кодирование одного файла. false - ошибка, её причина в error
+            auto process = [&](FileData& file, std::string& error) {
+                StageTimer read_timer("Read");
+                const char* data = file.bytes.data();
+                const size_t size = file.bytes.size();
+                const bool decoded = u8 ? image_u8.Decode(data, size, error)
+                                        : image.Decode(data, size, region.width, region.height, error);
+                if (!decoded) {
+                    return false;
+                }
+                int width = u8 ? image_u8.Width() : image.Width();
+                int height = u8 ? image_u8.Height() : image.Height();
+                read_timer.Finish(static_cast<double>(width) * height,
+                                  BmpCodecBytes(width, height, u8 ? 3 : sizeof(Color)));
+                job_pixels[file.job] = static_cast<unsigned long long>(width) * height;
+
+                if (storage == Storage::Planar) {
+                    PlanarImage planar_image(image);
+                    image = Image(0, 0);
+                    ExecutePipeline(planar_image, plan);
+                    image = planar_image.ToImage();
+                } else if (u8) {
+                    ExecutePipeline(image_u8, plan);
+                } else {
+                    ExecutePipeline(image, plan);
+                }
+
+                // Результат кодируется в буфер прочитанного файла: обычно его ёмкости уже хватает
+                StageTimer export_timer("Export");
+                if (!(u8 ? image_u8.Encode(file.bytes, error) : image.Encode(file.bytes, error))) {
+                    return false;
+                }
+                width = u8 ? image_u8.Width() : image.Width();
+                height = u8 ? image_u8.Height() : image.Height();
+                export_timer.Finish(static_cast<double>(width) * height,
+                                    BmpCodecBytes(width, height, u8 ? 3 : sizeof(Color)));
+                return true;
+            };
+            while (std::optional<FileData> file = loaded.Pop()) {
+                std::string error;
+                bool done = false;
+                try {
+                    done = process(*file, error);
+                } catch (const std::exception& e) {
+                    // Например, нехватка памяти на большом файле: он считается неудачным, остальные обрабатываются.
+                    // Изображения могли остаться в промежуточном состоянии, начинаем следующий файл с пустых
+                    error = e.what();
+                    image = Image(0, 0);
+                    image_u8 = ImageU8(0, 0);
+                }
+                if (!done) {
+                    report(file->job, error);
+                    continue;
+                }
+                processed.Push(std::move(*file));
+            }
+            if (workers_left.fetch_sub(1) == 1) {
+                processed.Close();
+            }
+        });
+    }
+
+    // Запись: пока на диск уходят прошлые результаты, принимаются новые
+    threads.emplace_back([&] {
+        bool drained = false;
+        IoCompletion completion;
+        while (!drained || writer->Pending() > 0) {
+            std::optional<FileData> file;
+            if (!drained && writer->Pending() == 0) {
+                // Незавершённых записей нет, ждать можно только новый файл
+                file = processed.Pop();
+                drained = !file;
+            } else if (!drained && writer->Pending() < kIoDepth) {
+                file = processed.TryPop(drained);
+            }
+            if (file) {
+                writer->SubmitWrite(file->job, jobs[file->job].output, std::move(file->bytes));
+            } else if (writer->Wait(completion)) {
+                if (completion.error.empty()) {
+                    succeeded.fetch_add(1);
+                    pixels.fetch_add(job_pixels[completion.tag]);
+                } else {
+                    report(completion.tag, completion.error);
+                }
+                spare_buffers.TryPush(completion.data);
+            }
+        }
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const double seconds =
+        std::max(1e-9, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    const double megapixels = static_cast<double>(pixels.load()) / 1e6;
+    // Пропускная способность - по записанным файлам: неудачные не должны её завышать
+    std::cout << "Batch: " << succeeded.load() << " of " << jobs.size() << " files processed, " << failed.load()
+              << " failed, " << std::fixed << std::setprecision(2) << seconds << " s ("
+              << static_cast<double>(succeeded.load()) / seconds << " files/s, " << megapixels / seconds
+              << " MP/s, I/O " << reader->Name() << ")" << std::endl;
+    return failed.load() == 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+// Пара входной и выходной файл для пакетной обработки
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// Составляет список файлов. source - файл-манифест (в строке входной путь и, через табуляцию, выходной),
+// каталог (все файлы .bmp в нём) или маска вида dir/*.bmp. В output_pattern подстрока {name} заменяется
+// именем входного файла без расширения; если output_pattern - каталог, файлы пишутся в него под тем же именем
+bool CollectBatchJobs(const std::string& source, const std::string& output_pattern, std::vector<BatchJob>& jobs,
+                      std::string& error);
+
+// Обрабатывает все файлы одним планом. Чтение, фильтры и запись идут параллельно через ограниченные очереди,
+// поэтому в памяти одновременно держится лишь несколько изображений. Диск читает следующие файлы и пишет
+// готовые асинхронно (async_io.h), пока обработчики декодируют, фильтруют и кодируют файлы в памяти.
+// Ошибка в одном файле не останавливает остальные. В конце печатает сводку с пропускной способностью.
+// Возвращает false, если хотя бы один файл не обработан
+bool RunBatch(const std::vector<BatchJob>& jobs, const std::vector<PipelineStage>& plan, Storage storage);
@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+#include "bmp.h"
+#include "graph.h"
+#include "image.h"
+#include "image_u8.h"
+#include "pipeline.h"
+#include "simd.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+// Замеры скорости чтения, записи и фильтров на синтетических изображениях.
+// Результаты печатаются таблицей и, по запросу, в JSON для сравнения между версиями
+
+namespace {
+
+struct BenchOptions {
+    std::vector<double> sizes = {0.3, 12};  // мегапиксели
+    double aspect = 4.0 / 3;                 // отношение ширины к высоте, у панорам 50 и больше
+    int warmup = 1;
+    int repetitions = 5;
+    int threads = 0;
+    std::string json_path;  // пусто - без JSON, "-" - в stdout
+    bool check = false;     // ошибка, если 8-битное представление вышло за допуск
+};
+
+// Допуск отличия 8-битного представления от float (--check), в уровнях 0..255. Отдельный фильтр округляет
+// результат один раз, поэтому отличается не больше чем на уровень
+const int kFilterTolerance = 1;
+// В цепочке ошибки округления промежуточных результатов складываются, а -sharp усиливает их
+// в 5 раз: -gs -neg -sharp даёт 5 уровней
+const int kChainTolerance = 5;
+// -edge выдаёт только 0 и 255, и ошибка в уровень на входе порога переворачивает пиксель. Для цепочек
+// с -edge ограничена доля каналов, отличающихся больше kChainTolerance
+const double kThresholdShare = 0.01;
+// -thermo во float оставляет значения вне [0, 1], а в 8 битах они насыщаются. Фильтры после него получают
+// другой вход, и такие цепочки не проверяются
+
+struct BenchResult {
+    std::string name;
+    std::string kind;  // io, filter, chain или graph, с префиксом u8 для 8-битного представления
+    int width = 0;
+    int height = 0;
+    // Оценка объёма памяти, прочитанной и записанной за один прогон
+    double bytes = 0;
+    std::vector<double> seconds;
+    // Для 8-битного представления: наибольшее отличие канала от результата во float, в уровнях 0..255,
+    // и доля каналов, отличающихся больше kChainTolerance
+    int max_difference = -1;
+    double difference_share = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const size_t middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+double Mean(const std::vector<double>& values) {
+    double sum = 0;
+    for (double value : values) {
+        sum += value;
+    }
+    return sum / static_cast<double>(values.size());
+}
+
+// Плавные градиенты с шумом: однотонное изображение нечестно ускорило бы пороговые фильтры
+Image SynthesizeImage(int width, int height) {
+    Image image(width, height);
+    ParallelFor(height, 8, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            Color* row = image.Row(y);
+            for (int x = 0; x < width; ++x) {
+                uint32_t hash = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u;
+                hash ^= hash >> 13;
+                hash *= 0x5bd1e995u;
+                const float noise = static_cast<float>(hash >> 24) / 255.0f * 0.2f;
+                row[x] = Color(static_cast<float>(x) / static_cast<float>(width) * 0.8f + noise,
+                               static_cast<float>(y) / static_cast<float>(height) * 0.8f + noise,
+                               static_cast<float>((x + y) % 256) / 255.0f * 0.8f + noise);
+            }
+        }
+    });
+    return image;
+}
+
+// Разбирает цепочку фильтров из строки так же, как из командной строки
+std::vector<FilterInfo> ParseChain(const std::string& chain) {
+    std::istringstream stream(chain);
+    std::vector<std::string> tokens = {"bench"};
+    for (std::string token; stream >> token;) {
+        tokens.push_back(token);
+    }
+    std::vector<char*> argv;
+    for (auto& token : tokens) {
+        argv.push_back(token.data());
+    }
+    return ParseCommandLine(static_cast<int>(argv.size()), argv.data());
+}
+
+// Повторяет run warmup + repetitions раз, prepare вызывается перед каждым прогоном и в замер не входит
+template <typename Prepare, typename Run>
+std::vector<double> Measure(const BenchOptions& options, Prepare prepare, Run run) {
+    std::vector<double> seconds;
+    for (int i = 0; i < options.warmup + options.repetitions; ++i) {
+        prepare();
+        const auto start = Clock::now();
+        run();
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (i >= options.warmup) {
+            seconds.push_back(elapsed);
+        }
+    }
+    return seconds;
+}
+
+// Объём памяти, который план читает и пишет: каждый этап читает вход и пишет выход хотя бы по разу.
+// Размеры после каждого этапа узнаём пробным прогоном. Обрезка без поточечных фильтров пикселей не трогает
+double EstimateBytes(const Image& source, const std::vector<PipelineStage>& plan) {
+    Image probe = source;
+    double bytes = 0;
+    for (const auto& stage : plan) {
+        const double input = static_cast<double>(probe.Width()) * probe.Height();
+        ExecutePipeline(probe, {stage});
+        const double output = static_cast<double>(probe.Width()) * probe.Height();
+        if (!stage.core || stage.core->name != "-crop") {
+            bytes += (input + output) * sizeof(Color);
+        } else if (!stage.prologue.empty() || !stage.epilogue.empty()) {
+            bytes += 2 * output * sizeof(Color);
+        }
+    }
+    return bytes;
+}
+
+// Сравнивает каналы с результатом плана во float на том же квантованном входе
+void CompareWithFloat(const ImageU8& source, const std::vector<PipelineStage>& plan, const ImageU8& image,
+                      BenchResult& result) {
+    Image reference = source.ToImage();
+    ExecutePipeline(reference, plan);
+    const ImageU8 quantized(reference);
+    int difference = 0;
+    size_t beyond = 0;
+    for (int y = 0; y < image.Height(); ++y) {
+        const unsigned char* expected = quantized.Row(y);
+        const unsigned char* actual = image.Row(y);
+        for (int i = 0; i < image.Width() * 3; ++i) {
+            const int channel = std::abs(expected[i] - actual[i]);
+            difference = std::max(difference, channel);
+            beyond += channel > kChainTolerance;
+        }
+    }
+    result.max_difference = difference;
+    result.difference_share = static_cast<double>(beyond) / (3.0 * image.Width() * image.Height());
+}
+
+// Проверяет отличие 8-битного результата от float по допускам выше
+bool WithinTolerance(const BenchResult& result, std::string& error) {
+    const size_t thermo = result.name.find("-thermo");
+    if (result.kind.rfind("u8 ", 0) != 0 ||
+        (thermo != std::string::npos && result.name.find(" -", thermo + 1) != std::string::npos)) {
+        return true;
+    }
+    std::ostringstream message;
+    if (result.name.find("-edge") != std::string::npos) {
+        if (result.difference_share > kThresholdShare) {
+            message << "differs from float by more than " << kChainTolerance << " levels in "
+                    << result.difference_share * 100 << "% of channels, tolerance " << kThresholdShare * 100 << "%";
+        }
+    } else {
+        const int tolerance = result.kind == "u8 filter" ? kFilterTolerance : kChainTolerance;
+        if (result.max_difference > tolerance) {
+            message << "differs from float by " << result.max_difference << " levels, tolerance " << tolerance;
+        }
+    }
+    if (message.str().empty()) {
+        return true;
+    }
+    error = "u8 " + result.name + " at " + std::to_string(result.width) + "x" + std::to_string(result.height) +
+            " " + message.str();
+    return false;
+}
+
+// Переписывает 24-битный BMP без сжатия в вариант со строками сверху вниз
+bool WriteTopDown(const std::string& path, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BmpInfo info;
+    if (!ParseBmpHeader(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), info, error)) {
+        return false;
+    }
+    const size_t row_size = BmpStoredRowSize(info);
+    std::string flipped = bytes;
+    for (int y = 0; y < info.height; ++y) {
+        bytes.copy(&flipped[info.data_offset + (info.height - 1 - y) * row_size], row_size,
+                   info.data_offset + y * row_size);
+    }
+    const int height = -info.height;
+    for (int i = 0; i < 4; ++i) {
+        flipped[kBmpFileHeaderSize + 8 + i] = static_cast<char>(height >> (8 * i));
+    }
+    std::ofstream out(path, std::ios::binary);
+    out.write(flipped.data(), static_cast<std::streamsize>(flipped.size()));
+    out.close();
+    if (!out) {
+        error = "Failed to write the file";
+        return false;
+    }
+    return true;
+}
+
+// Трёхмерная таблица цветов 33^3 для -lut: своя кривая у каждого канала и примесь соседних каналов
+bool WriteBenchLut(const std::string& path) {
+    const int size = 33;
+    std::ofstream out(path);
+    out << "LUT_3D_SIZE " << size << "\n";
+    for (int b = 0; b < size; ++b) {
+        for (int g = 0; g < size; ++g) {
+            for (int r = 0; r < size; ++r) {
+                const double red = static_cast<double>(r) / (size - 1);
+                const double green = static_cast<double>(g) / (size - 1);
+                const double blue = static_cast<double>(b) / (size - 1);
+                out << std::sqrt(red) * 0.9 + blue * 0.1 << " " << green * green * 0.8 + red * 0.2 << " "
+                    << blue * (1.0 - 0.3 * green) << "\n";
+            }
+        }
+    }
+    out.close();
+    return static_cast<bool>(out);
+}
+
+void BenchmarkSize(const BenchOptions& options, double megapixels, std::vector<BenchResult>& results) {
+    const int width = std::max(1, static_cast<int>(std::lround(std::sqrt(megapixels * 1e6 * options.aspect))));
+    const int height = std::max(1, static_cast<int>(std::lround(width / options.aspect)));
+    const Image source = SynthesizeImage(width, height);
+    const ImageU8 source_u8(source);
+
+    // Чтение и запись идут через временный файл, он обычно остаётся в кэше страниц
+    const std::string path =
+        (std::filesystem::temp_directory_path() / ("image_processor_bench_" + std::to_string(width) + ".bmp")).string();
+    std::string error;
+    auto fail = [&](const std::string& what) { std::cerr << "Error: " << what << ": " << error << std::endl; };
+
+    BenchResult export_result{"Export", "io", width, height, BmpCodecBytes(width, height), {}};
+    bool ok = true;
+    export_result.seconds = Measure(options, [] {}, [&] { ok = source.Save(path.c_str(), error) && ok; });
+    if (!ok) {
+        fail("Export");
+        return;
+    }
+    results.push_back(export_result);
+
+    BenchResult read_result{"Read", "io", width, height, BmpCodecBytes(width, height), {}};
+    Image loaded(0, 0);
+    read_result.seconds = Measure(options, [] {}, [&] { ok = loaded.Load(path.c_str(), error) && ok; });
+    if (!ok) {
+        fail("Read");
+        return;
+    }
+    results.push_back(read_result);
+
+    BenchResult read_u8_result{"Read", "u8 io", width, height, BmpCodecBytes(width, height, 3), {}};
+    ImageU8 loaded_u8(0, 0);
+    read_u8_result.seconds = Measure(options, [] {}, [&] { ok = loaded_u8.Load(path.c_str(), error) && ok; });
+    std::filesystem::remove(path);
+    if (!ok) {
+        fail("Read u8");
+        return;
+    }
+    results.push_back(read_u8_result);
+
+    BenchResult export_u8_result{"Export", "u8 io", width, height, BmpCodecBytes(width, height, 3), {}};
+    export_u8_result.seconds = Measure(options, [] {}, [&] { ok = source_u8.Save(path.c_str(), error) && ok; });
+    std::filesystem::remove(path);
+    if (!ok) {
+        fail("Export u8");
+        return;
+    }
+    results.push_back(export_u8_result);
+
+    // Другие варианты BMP: 32 бита на пиксель и строки сверху вниз
+    SetBmpOutputBits(32);
+    BenchResult export_32_result{"Export --bits 32", "io", width, height, BmpCodecBytes(width, height), {}};
+    export_32_result.seconds = Measure(options, [] {}, [&] { ok = source.Save(path.c_str(), error) && ok; });
+    BenchResult read_32_result{"Read 32-bit", "io", width, height, BmpCodecBytes(width, height), {}};
+    SetBmpOutputBits(24);
+    if (!ok) {
+        fail("Export --bits 32");
+        return;
+    }
+    results.push_back(export_32_result);
+    read_32_result.seconds = Measure(options, [] {}, [&] { ok = loaded.Load(path.c_str(), error) && ok; });
+    if (!ok) {
+        fail("Read 32-bit");
+        return;
+    }
+    results.push_back(read_32_result);
+
+    BenchResult read_top_down_result{"Read top-down", "io", width, height, BmpCodecBytes(width, height), {}};
+    ok = source.Save(path.c_str(), error) && WriteTopDown(path, error);
+    read_top_down_result.seconds = Measure(options, [] {}, [&] { ok = loaded.Load(path.c_str(), error) && ok; });
+    std::filesystem::remove(path);
+    if (!ok) {
+        fail("Read top-down");
+        return;
+    }
+    results.push_back(read_top_down_result);
+
+    // Статистика каналов (--stats): гистограммы, минимум, максимум и среднее за один проход
+    BenchResult stats_result{"Stats", "reduce", width, height, static_cast<double>(width) * height * sizeof(Color), {}};
+    std::array<ValueStats, 3> stats;
+    stats_result.seconds = Measure(options, [] {}, [&] { stats = ComputeStats(source); });
+    results.push_back(stats_result);
+
+    const std::string crop = "-crop " + std::to_string(width / 2) + " " + std::to_string(height / 2);
+    const std::string resize = "-resize " + std::to_string(width / 2) + " " + std::to_string(height / 2);
+    const std::string lut_path = (std::filesystem::temp_directory_path() / "image_processor_bench.cube").string();
+    if (!WriteBenchLut(lut_path)) {
+        error = "Failed to write the file";
+        fail("LUT");
+        return;
+    }
+    const std::vector<std::pair<std::string, std::string>> cases = {
+        {"filter", crop},
+        {"filter", resize},
+        {"filter", "-gs"},
+        {"filter", "-neg"},
+        {"filter", "-blur 2"},
+        {"filter", "-blur 30"},
+        {"filter", "-sharp"},
+        {"filter", "-thermo"},
+        {"filter", "-edge 0.1"},
+        {"filter", "-edge auto"},
+        {"filter", "-lut " + lut_path},
+        {"filter", "-median 1"},
+        {"filter", "-median 4"},
+        {"filter", "-median 16"},
+        {"filter", "-median 64"},
+        {"filter", "-bilateral 4 0.1"},
+        {"filter", "-bilateral 16 0.1"},
+        {"filter", "-bilateral 64 0.1"},
+        {"chain", "-gs -neg"},
+        {"chain", "-gs -neg -sharp"},
+        {"chain", "-neg -blur 2 -gs"},
+        {"chain", "-gs -blur 2 -sharp -thermo -edge 0.1"},
+        {"chain", "-gs -blur 2 -sharp -edge 0.1"},
+        {"chain", "-blur 1 -sharp"},
+        {"chain", "-sharp -thermo -edge 0.1 -sharp"},
+        {"chain", crop + " -gs -blur 2 -sharp -thermo -edge 0.1"},
+        {"chain", "-gs -blur 2 -sharp -thermo -edge 0.1 " + crop},
+        {"chain", "-lut " + lut_path + " -neg -gs"},
+        {"chain", "-median 2 -sharp"},
+    };
+    for (const auto& [kind, chain] : cases) {
+        const std::vector<PipelineStage> plan = PlanPipeline(ParseChain(chain));
+        BenchResult result{chain, kind, width, height, EstimateBytes(source, plan), {}};
+        Image image(0, 0);
+        result.seconds = Measure(options, [&] { image = source; }, [&] { ExecutePipeline(image, plan); });
+        results.push_back(result);
+
+        // Тот же план в 8-битном представлении: байт на канал вместо float
+        BenchResult u8_result{chain, "u8 " + kind, width, height, result.bytes * 3 / sizeof(Color), {}};
+        ImageU8 image_u8(0, 0);
+        u8_result.seconds =
+            Measure(options, [&] { image_u8 = source_u8; }, [&] { ExecutePipeline(image_u8, plan); });
+        CompareWithFloat(source_u8, plan, image_u8, u8_result);
+        results.push_back(u8_result);
+    }
+    std::filesystem::remove(lut_path);
+
+    // Граф из нескольких выходов (--output) с общим началом цепочек
+    const std::vector<std::string> branches = {"-gs -blur 2", "-gs -edge 0.1", "-gs -sharp"};
+    std::vector<GraphOutput> outputs;
+    for (const auto& chain : branches) {
+        outputs.push_back(GraphOutput{"", ParseChain(chain)});
+    }
+    const FilterGraph graph = BuildFilterGraph(outputs);
+    BenchResult graph_result{"-gs -blur 2 | -gs -edge 0.1 | -gs -sharp", "graph", width, height, 0, {}};
+    for (const auto& node : graph.nodes) {
+        graph_result.bytes += EstimateBytes(source, node.plan);
+    }
+    Image image(0, 0);
+    graph_result.seconds = Measure(
+        options, [&] { image = source; },
+        [&] { ExecuteFilterGraph(std::move(image), graph, [](size_t, const Image&) {}); });
+    results.push_back(graph_result);
+}
+
+void PrintTable(const std::vector<BenchResult>& results, std::ostream& out) {
+    out << std::left << std::setw(60) << "benchmark" << std::right << std::setw(12) << "size" << std::setw(12)
+        << "median ms" << std::setw(12) << "ns/pixel" << std::setw(10) << "MP/s" << std::setw(10) << "GB/s"
+        << std::setw(8) << "diff" << "\n";
+    for (const auto& result : results) {
+        const double pixels = static_cast<double>(result.width) * result.height;
+        const double median = Median(result.seconds);
+        std::ostringstream size;
+        size << result.width << "x" << result.height;
+        const std::string name = result.kind.substr(0, 3) == "u8 " ? "[u8] " + result.name : result.name;
+        out << std::left << std::setw(60) << name << std::right << std::setw(12) << size.str() << std::fixed
+            << std::setprecision(3) << std::setw(12) << median * 1e3 << std::setw(12) << median * 1e9 / pixels
+            << std::setprecision(1) << std::setw(10) << pixels / median / 1e6 << std::setprecision(2)
+            << std::setw(10) << result.bytes / median / 1e9 << std::setw(8);
+        if (result.max_difference >= 0) {
+            out << result.max_difference;
+        } else {
+            out << "";
+        }
+        out << "\n";
+    }
+}
+
+void PrintJson(const BenchOptions& options, const std::vector<BenchResult>& results, std::ostream& out) {
+    out << std::setprecision(9);
+    out << "{\n  \"threads\": " << GetThreadPool().Size() << ",\n  \"simd\": \"" << GetSimdKernels().name
+        << "\",\n  \"warmup\": " << options.warmup << ",\n  \"repetitions\": " << options.repetitions
+        << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        const double pixels = static_cast<double>(result.width) * result.height;
+        const double median = Median(result.seconds);
+        out << "    {\"name\": \"" << result.name << "\", \"kind\": \"" << result.kind << "\", \"width\": "
+            << result.width << ", \"height\": " << result.height << ", \"bytes\": " << result.bytes
+            << ", \"seconds\": {\"min\": " << *std::min_element(result.seconds.begin(), result.seconds.end())
+            << ", \"median\": " << median << ", \"mean\": " << Mean(result.seconds)
+            << "}, \"ns_per_pixel\": " << median * 1e9 / pixels << ", \"mp_per_s\": " << pixels / median / 1e6
+            << ", \"gb_per_s\": " << result.bytes / median / 1e9;
+        if (result.max_difference >= 0) {
+            out << ", \"max_difference\": " << result.max_difference
+                << ", \"difference_share\": " << result.difference_share;
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+bool ParseOptions(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            options.sizes.clear();
+            std::istringstream list(argv[++i]);
+            for (std::string item; std::getline(list, item, ',');) {
+                options.sizes.push_back(std::atof(item.c_str()));
+            }
+        } else if (arg == "--aspect" && has_value) {
+            options.aspect = std::atof(argv[++i]);
+        } else if (arg == "--warmup" && has_value) {
+            options.warmup = std::atoi(argv[++i]);
+        } else if (arg == "--repeat" && has_value) {
+            options.repetitions = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--json" && has_value) {
+            options.json_path = argv[++i];
+        } else if (arg == "--check") {
+            options.check = true;
+        } else {
+            std::cerr << "Error: Incorrect option " << arg << std::endl;
+            return false;
+        }
+    }
+    const bool sizes_valid = !options.sizes.empty() &&
+                             std::all_of(options.sizes.begin(), options.sizes.end(), [](double s) { return s > 0; });
+    if (!sizes_valid || options.aspect <= 0 || options.warmup < 0 || options.repetitions < 1 || options.threads < 0) {
+        std::cerr << "Error: sizes, aspect and repetitions must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--sizes MP1,MP2,...] [--aspect R] [--warmup N] [--repeat N]"
+                  << " [--threads N]"
+                  << " [--json out.json|-] [--check]" << std::endl;
+        return 1;
+    }
+    SetThreadCount(options.threads);
+
+    std::vector<BenchResult> results;
+    for (double megapixels : options.sizes) {
+        BenchmarkSize(options, megapixels, results);
+    }
+
+    if (options.json_path != "-") {
+        std::cout << "threads: " << GetThreadPool().Size() << ", SIMD kernels: " << GetSimdKernels().name << "\n";
+        PrintTable(results, std::cout);
+    }
+    if (options.json_path == "-") {
+        PrintJson(options, results, std::cout);
+    } else if (!options.json_path.empty()) {
+        std::ofstream json(options.json_path);
+        PrintJson(options, results, json);
+        if (!json) {
+            std::cerr << "Error: Failed to write " << options.json_path << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.check) {
+        bool within = true;
+        for (const auto& result : results) {
+            std::string error;
+            if (!WithinTolerance(result, error)) {
+                std::cerr << "Error: " << error << std::endl;
+                within = false;
+            }
+        }
+        if (!within) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,341 @@
+#include "blur.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+std::vector<float> GaussianKernel(float sigma) {
+    const int radius = std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+    std::vector<float> kernel(2 * radius + 1);
+    float total = 0.0f;
+    for (int k = -radius; k <= radius; ++k) {
+        const float x = static_cast<float>(k);
+        kernel[k + radius] = std::exp(-(x * x) / (2.0f * sigma * sigma));
+        total += kernel[k + radius];
+    }
+    for (float& weight : kernel) {
+        weight /= total;
+    }
+    return kernel;
+}
+
+bool UseBoxCascade(float sigma) {
+    return static_cast<int>(std::ceil(3.0f * sigma)) > kMaxGaussianRadius;
+}
+
+std::vector<int> BoxCascadeRadii(float sigma) {
+    // Подбор ширин по дисперсии: часть окон шириной lower, остальные lower + 2
+    const float n = static_cast<float>(kBoxCascadePasses);
+    const float ideal = std::sqrt(12.0f * sigma * sigma / n + 1.0f);
+    int lower = static_cast<int>(std::floor(ideal));
+    if (lower % 2 == 0) {
+        --lower;
+    }
+    const float l = static_cast<float>(lower);
+    const int narrow =
+        static_cast<int>(std::round((12.0f * sigma * sigma - n * l * l - 4.0f * n * l - 3.0f * n) / (-4.0f * l - 4.0f)));
+
+    std::vector<int> radii(kBoxCascadePasses);
+    for (int i = 0; i < kBoxCascadePasses; ++i) {
+        const int size = i < narrow ? lower : lower + 2;
+        radii[i] = size / 2;
+    }
+    return radii;
+}
+
+void ConvolveRowHorizontal(const float* src, float* dst, int width, int channels, const std::vector<float>& kernel) {
+    ConvolveRowHorizontal(src, dst, width, channels, kernel, 0, width);
+}
+
+void ConvolveRowHorizontal(const float* src, float* dst, int width, int channels, const std::vector<float>& kernel,
+                           int begin, int end) {
+    const int radius = static_cast<int>(kernel.size()) / 2;
+
+    // Пиксели у краёв: часть ядра выходит за строку, перенормируем по использованным весам.
+    // Индексы в src и dst отсчитываются от пикселя begin
+    auto border_pixel = [&](int x) {
+        const int from = std::max(-radius, -x);
+        const int to = std::min(radius, width - 1 - x);
+        float total = 0.0f;
+        for (int k = from; k <= to; ++k) {
+            total += kernel[k + radius];
+        }
+        for (int c = 0; c < channels; ++c) {
+            float sum = 0.0f;
+            for (int k = from; k <= to; ++k) {
+                sum += kernel[k + radius] * src[(x + k - begin) * channels + c];
+            }
+            dst[(x - begin) * channels + c] = sum / total;
+        }
+    };
+
+    const int row_inner_begin = std::min(radius, width);
+    const int inner_begin = std::clamp(row_inner_begin, begin, end);
+    const int inner_end = std::clamp(std::max(row_inner_begin, width - radius), inner_begin, end);
+    for (int x = begin; x < inner_begin; ++x) {
+        border_pixel(x);
+    }
+
+    // Внутренняя часть: ядро целиком внутри строки, каналы не различаются, цикл векторизуется
+    float total = 0.0f;
+    for (float weight : kernel) {
+        total += weight;
+    }
+    const SimdKernels& simd = GetSimdKernels();
+    const int first = (inner_begin - begin) * channels;
+    const int count = (inner_end - inner_begin) * channels;
+    if (count > 0) {
+        simd.scale(dst + first, src + first - radius * channels, kernel[0], count);
+        for (int k = -radius + 1; k <= radius; ++k) {
+            simd.axpy(dst + first, src + first + k * channels, kernel[k + radius], count);
+        }
+        simd.divide(dst + first, total, count);
+    }
+
+    for (int x = inner_end; x < end; ++x) {
+        border_pixel(x);
+    }
+}
+
+void ConvolveRowsVertical(const float* const* rows, const std::vector<float>& kernel, float* dst, int count) {
+    const SimdKernels& simd = GetSimdKernels();
+    const int taps = static_cast<int>(kernel.size());
+    float total = 0.0f;
+    bool first = true;
+    for (int k = 0; k < taps; ++k) {
+        if (rows[k] == nullptr) {
+            continue;
+        }
+        total += kernel[k];
+        if (first) {
+            simd.scale(dst, rows[k], kernel[k], count);
+            first = false;
+        } else {
+            simd.axpy(dst, rows[k], kernel[k], count);
+        }
+    }
+    simd.divide(dst, total, count);
+}
+
+void BoxBlurRowHorizontal(const float* src, float* dst, int width, int channels, int radius) {
+    for (int c = 0; c < channels; ++c) {
+        float sum = 0.0f;
+        int count = 0;
+        for (int x = 0; x < std::min(radius, width); ++x) {
+            sum += src[x * channels + c];
+            ++count;
+        }
+        for (int x = 0; x < width; ++x) {
+            if (x + radius < width) {
+                sum += src[(x + radius) * channels + c];
+                ++count;
+            }
+            if (x - radius - 1 >= 0) {
+                sum -= src[(x - radius - 1) * channels + c];
+                --count;
+            }
+            dst[x * channels + c] = sum / static_cast<float>(count);
+        }
+    }
+}
+
+void AccumulateRow(float* sum, const float* row, float sign, int count) {
+    for (int i = 0; i < count; ++i) {
+        sum[i] += sign * row[i];
+    }
+}
+
+void AverageRow(const float* sum, float* dst, int window, int count) {
+    const float inverse = 1.0f / static_cast<float>(window);
+    for (int i = 0; i < count; ++i) {
+        dst[i] = sum[i] * inverse;
+    }
+}
+
+void BoxBlurVertical(const float* src, int src_stride, float* dst, int dst_stride, int rows, int count, int radius) {
+    std::vector<float> sum(count, 0.0f);
+    auto row = [&](int y) { return src + static_cast<size_t>(y) * src_stride; };
+
+    int window = 0;
+    for (int y = 0; y < std::min(radius, rows); ++y) {
+        AccumulateRow(sum.data(), row(y), 1.0f, count);
+        ++window;
+    }
+    for (int y = 0; y < rows; ++y) {
+        if (y + radius < rows) {
+            AccumulateRow(sum.data(), row(y + radius), 1.0f, count);
+            ++window;
+        }
+        if (y - radius - 1 >= 0) {
+            AccumulateRow(sum.data(), row(y - radius - 1), -1.0f, count);
+            --window;
+        }
+        AverageRow(sum.data(), dst + static_cast<size_t>(y) * dst_stride, window, count);
+    }
+}
+
+std::vector<int> FixedPointKernel(const std::vector<float>& kernel) {
+    std::vector<int> weights(kernel.size());
+    int total = 0;
+    for (size_t k = 0; k < kernel.size(); ++k) {
+        weights[k] = static_cast<int>(std::lround(kernel[k] * kFixedKernelOne));
+        total += weights[k];
+    }
+    weights[kernel.size() / 2] += kFixedKernelOne - total;
+    return weights;
+}
+
+void ConvolveRowHorizontalU8(const unsigned char* src, uint16_t* dst, int width, int channels,
+                             const std::vector<int>& kernel) {
+    const int radius = static_cast<int>(kernel.size()) / 2;
+    auto border_pixel = [&](int x) {
+        const int from = std::max(-radius, -x);
+        const int to = std::min(radius, width - 1 - x);
+        int total = 0;
+        for (int k = from; k <= to; ++k) {
+            total += kernel[k + radius];
+        }
+        for (int c = 0; c < channels; ++c) {
+            int64_t sum = 0;
+            for (int k = from; k <= to; ++k) {
+                sum += kernel[k + radius] * src[(x + k) * channels + c];
+            }
+            dst[x * channels + c] = static_cast<uint16_t>((sum * 256 + total / 2) / total);
+        }
+    };
+
+    const int inner_begin = std::min(radius, width);
+    const int inner_end = std::max(inner_begin, width - radius);
+    for (int x = 0; x < inner_begin; ++x) {
+        border_pixel(x);
+    }
+    // Внутренняя часть: сумма весов ровно kFixedKernelOne, деление заменяется сдвигом
+    GetSimdKernels().convolve_row_u8(src + inner_begin * channels, channels, kernel.data(),
+                                     static_cast<int>(kernel.size()), dst + inner_begin * channels,
+                                     (inner_end - inner_begin) * channels);
+    for (int x = inner_end; x < width; ++x) {
+        border_pixel(x);
+    }
+}
+
+void ConvolveRowsVerticalU16(const uint16_t* const* rows, const std::vector<int>& kernel, unsigned char* dst,
+                             int count) {
+    const int taps = static_cast<int>(kernel.size());
+    uint32_t total = 0;
+    for (int k = 0; k < taps; ++k) {
+        total += rows[k] != nullptr ? kernel[k] : 0;
+    }
+    if (std::none_of(rows, rows + taps, [](const uint16_t* row) { return row == nullptr; })) {
+        GetSimdKernels().convolve_rows_u16(rows, kernel.data(), taps, dst, count);
+        return;
+    }
+    // Строки у края изображения: часть окна за границей. Суммы копятся кусками на стеке, максимум суммы
+    // 65280 * kFixedKernelOne < 2^31, переполнения нет
+    const int block = 512;
+    uint32_t sum[block];
+    for (int begin = 0; begin < count; begin += block) {
+        const int size = std::min(block, count - begin);
+        std::fill(sum, sum + size, 0);
+        for (int k = 0; k < taps; ++k) {
+            if (rows[k] == nullptr) {
+                continue;
+            }
+            const uint32_t weight = kernel[k];
+            const uint16_t* row = rows[k] + begin;
+            for (int i = 0; i < size; ++i) {
+                sum[i] += weight * row[i];
+            }
+        }
+        unsigned char* out = dst + begin;
+        if (total == kFixedKernelOne) {
+            for (int i = 0; i < size; ++i) {
+                out[i] = static_cast<unsigned char>(std::min<uint32_t>(255, sum[i] >> (kFixedKernelShift + 8)));
+            }
+        } else {
+            for (int i = 0; i < size; ++i) {
+                out[i] = static_cast<unsigned char>(std::min<uint32_t>(255, sum[i] / total >> 8));
+            }
+        }
+    }
+}
+
+void BoxBlurRowHorizontalU16(const uint16_t* src, uint16_t* dst, int width, int channels, int radius) {
+    std::vector<float> inverse(2 * radius + 2);
+    for (size_t count = 1; count < inverse.size(); ++count) {
+        inverse[count] = 1.0f / static_cast<float>(count);
+    }
+    // Внутри строки окно целиком помещается в неё: ни ветвлений, ни изменения размера окна
+    const int inner_begin = std::min(radius + 1, width);
+    const int inner_end = std::max(inner_begin, width - radius);
+    for (int c = 0; c < channels; ++c) {
+        uint32_t sum = 0;
+        uint32_t count = 0;
+        // Умножение на обратную величину вместо деления: значения до 2^24 представимы во float точно
+        auto store = [&](int x) {
+            dst[x * channels + c] = static_cast<uint16_t>(static_cast<float>(sum + count / 2) * inverse[count]);
+        };
+        auto step = [&](int x) {
+            if (x + radius < width) {
+                sum += src[(x + radius) * channels + c];
+                ++count;
+            }
+            if (x - radius - 1 >= 0) {
+                sum -= src[(x - radius - 1) * channels + c];
+                --count;
+            }
+            store(x);
+        };
+        for (int x = 0; x < std::min(radius, width); ++x) {
+            sum += src[x * channels + c];
+            ++count;
+        }
+        for (int x = 0; x < inner_begin; ++x) {
+            step(x);
+        }
+        const float window_inverse = inverse[2 * radius + 1];
+        const uint32_t half = static_cast<uint32_t>(radius);
+        for (int x = inner_begin; x < inner_end; ++x) {
+            sum += src[(x + radius) * channels + c];
+            sum -= src[(x - radius - 1) * channels + c];
+            dst[x * channels + c] = static_cast<uint16_t>(static_cast<float>(sum + half) * window_inverse);
+        }
+        for (int x = inner_end; x < width; ++x) {
+            step(x);
+        }
+    }
+}
+
+void BoxBlurVerticalU16(const uint16_t* src, int src_stride, uint16_t* dst, int dst_stride, int rows, int count,
+                        int radius) {
+    std::vector<uint32_t> sum(count, 0);
+    auto row = [&](int y) { return src + static_cast<size_t>(y) * src_stride; };
+    auto add = [&](int y, bool subtract) {
+        const uint16_t* values = row(y);
+        for (int i = 0; i < count; ++i) {
+            sum[i] = subtract ? sum[i] - values[i] : sum[i] + values[i];
+        }
+    };
+
+    uint32_t window = 0;
+    for (int y = 0; y < std::min(radius, rows); ++y) {
+        add(y, false);
+        ++window;
+    }
+    for (int y = 0; y < rows; ++y) {
+        if (y + radius < rows) {
+            add(y + radius, false);
+            ++window;
+        }
+        if (y - radius - 1 >= 0) {
+            add(y - radius - 1, true);
+            --window;
+        }
+        uint16_t* out = dst + static_cast<size_t>(y) * dst_stride;
+        const uint32_t half = window / 2;
+        const float inverse = 1.0f / static_cast<float>(window);
+        for (int i = 0; i < count; ++i) {
+            out[i] = static_cast<uint16_t>(static_cast<float>(sum[i] + half) * inverse);
+        }
+    }
+}
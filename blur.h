@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Строительные блоки размытия. Функции работают со строками float, где у каждого пикселя channels
+// подряд идущих значений, поэтому подходят и для чередующихся каналов Color, и для отдельных плоскостей.
+
+// Если радиус гауссова ядра больше этого значения, размытие приближается каскадом box-фильтров
+const int kMaxGaussianRadius = 24;
+// Число box-фильтров в каскаде
+const int kBoxCascadePasses = 3;
+
+// Нормированные веса одномерного гауссова ядра радиуса ceil(3 * sigma), всего 2 * radius + 1 значений
+std::vector<float> GaussianKernel(float sigma);
+
+// true, если для данной sigma выгоднее каскад box-фильтров, чем прямая свёртка
+bool UseBoxCascade(float sigma);
+
+// Радиусы box-фильтров каскада, дисперсия которого совпадает с дисперсией гаусса
+std::vector<int> BoxCascadeRadii(float sigma);
+
+// dst[x] = сумма kernel[k] * src[x + k] по соседям внутри строки, делённая на сумму использованных весов
+void ConvolveRowHorizontal(const float* src, float* dst, int width, int channels, const std::vector<float>& kernel);
+// То же для пикселей [begin, end) строки ширины width: src и dst указывают на пиксель begin, в src должны быть
+// доступны соседи в пределах радиуса ядра. Результат совпадает с обработкой всей строки
+void ConvolveRowHorizontal(const float* src, float* dst, int width, int channels, const std::vector<float>& kernel,
+                           int begin, int end);
+
+// Вертикальная свёртка count значений: rows[k] - строка со сдвигом k - radius или nullptr за границей изображения
+void ConvolveRowsVertical(const float* const* rows, const std::vector<float>& kernel, float* dst, int count);
+
+// Вертикальный box-фильтр для count значений в каждой из rows строк; соседние строки src и dst отстоят
+// на src_stride и dst_stride значений. Скользящая сумма строк окна, O(1) на значение
+void BoxBlurVertical(const float* src, int src_stride, float* dst, int dst_stride, int rows, int count, int radius);
+
+// Шаги скользящей суммы вертикального box-фильтра, общие для обработки целого изображения и потоковой:
+// sum[i] += sign * row[i] и dst[i] = sum[i] / window
+void AccumulateRow(float* sum, const float* row, float sign, int count);
+void AverageRow(const float* sum, float* dst, int window, int count);
+
+// Среднее по окну [x - radius, x + radius] внутри строки (скользящая сумма, O(1) на пиксель)
+void BoxBlurRowHorizontal(const float* src, float* dst, int width, int channels, int radius);
+
+// Целочисленные варианты для 8-битного режима. Промежуточные строки хранятся в uint16_t с фиксированной точкой
+// 8.8 (значение канала, умноженное на 256), веса ядра - целые с суммой kFixedKernelOne
+
+const int kFixedKernelShift = 14;
+const int kFixedKernelOne = 1 << kFixedKernelShift;
+
+// Веса kernel, умноженные на kFixedKernelOne и округлённые; погрешность округления добавляется к центру,
+// чтобы сумма была ровно kFixedKernelOne
+std::vector<int> FixedPointKernel(const std::vector<float>& kernel);
+
+// То же, что ConvolveRowHorizontal: из байтов в значения 8.8 с округлением
+void ConvolveRowHorizontalU8(const unsigned char* src, uint16_t* dst, int width, int channels,
+                             const std::vector<int>& kernel);
+
+// То же, что ConvolveRowsVertical: из значений 8.8 в байты с отбрасыванием дробной части, как при экспорте
+void ConvolveRowsVerticalU16(const uint16_t* const* rows, const std::vector<int>& kernel, unsigned char* dst,
+                             int count);
+
+// Box-фильтры над значениями 8.8, результат округляется
+void BoxBlurRowHorizontalU16(const uint16_t* src, uint16_t* dst, int width, int channels, int radius);
+void BoxBlurVerticalU16(const uint16_t* src, int src_stride, uint16_t* dst, int dst_stride, int rows, int count,
+                        int radius);
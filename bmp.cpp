@@ -0,0 +1,607 @@
+#include "bmp.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be three packed floats");
+
+namespace {
+
+const float kMaxColor = 255.0f;
+
+// Заголовки с палитрой длиннее этого считаются повреждёнными: у V5 с палитрой на 256 цветов 1162 байта
+const int kMaxBmpHeaderBytes = 1 << 16;
+
+// Стандартные маски каналов 32-битного BMP: байты B, G, R, A
+const unsigned int kBmpRedMask = 0x00FF0000u;
+const unsigned int kBmpGreenMask = 0x0000FF00u;
+const unsigned int kBmpBlueMask = 0x000000FFu;
+
+// Размер блока при чтении пиксельных данных из потока
+const int kReadBlockBytes = 1 << 22;
+
+// Число пикселей, которые строки с палитрой переводят в BGR за один шаг
+const int kIndexedChunk = 1024;
+
+int g_output_bits = 24;
+
+int ReadLe16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+int ReadLe32(const unsigned char* p) {
+    return static_cast<int>(static_cast<unsigned int>(p[0]) | (static_cast<unsigned int>(p[1]) << 8) |
+                            (static_cast<unsigned int>(p[2]) << 16) | (static_cast<unsigned int>(p[3]) << 24));
+}
+
+void WriteLe16(unsigned char* p, int value) {
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+}
+
+void WriteLe32(unsigned char* p, int value) {
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+// Линейный перевод байтов в float: dst[i] = src[i] / 255
+void BytesToFloats(const unsigned char* src, float* dst, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 max_color = _mm_set1_ps(kMaxColor);
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        _mm_storeu_ps(dst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), max_color));
+        _mm_storeu_ps(dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), max_color));
+        _mm_storeu_ps(dst + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), max_color));
+        _mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), max_color));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = static_cast<float>(src[i]) / kMaxColor;
+    }
+}
+
+// Линейный перевод float в байты: dst[i] = clamp(src[i], 0, 1) * 255 с отбрасыванием дробной части
+void FloatsToBytes(const float* src, unsigned char* dst, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 max_color = _mm_set1_ps(kMaxColor);
+    auto quantize = [&](const float* p) {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p), zero), one);
+        return _mm_cvttps_epi32(_mm_mul_ps(v, max_color));
+    };
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo = _mm_packs_epi32(quantize(src + i), quantize(src + i + 4));
+        __m128i hi = _mm_packs_epi32(quantize(src + i + 8), quantize(src + i + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; ++i) {
+        // NaN - в 0, как у _mm_max_ps выше
+        const float v = src[i] > 0.0f ? std::min(src[i], 1.0f) : 0.0f;
+        dst[i] = static_cast<unsigned char>(v * kMaxColor);
+    }
+}
+
+// Номер цвета пикселя x в строке с палитрой; старшие биты байта - левые пиксели
+int PaletteIndex(const unsigned char* row, int x, int bit_count) {
+    switch (bit_count) {
+        case 8:
+            return row[x];
+        case 4:
+            return (row[x >> 1] >> ((x & 1) ? 0 : 4)) & 0x0F;
+        default:
+            return (row[x >> 3] >> (7 - (x & 7))) & 0x01;
+    }
+}
+
+// Пиксели [begin, begin + count) строки с палитрой в байты BGR
+void ExpandIndexedRow(const BmpInfo& info, const unsigned char* src, int begin, int count, unsigned char* dst) {
+    const unsigned char* palette = info.palette.data();
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(dst + i * 3, palette + PaletteIndex(src, begin + i, info.bit_count) * 3, 3);
+    }
+}
+
+// Номер строки изображения (снизу вверх) для строки файла с номером row; отображение обратно самому себе
+int ImageRow(const BmpInfo& info, int row) {
+    return info.top_down ? info.height - 1 - row : row;
+}
+
+// Строки файла [begin, end), в которых лежат строки изображения [first_row, last_row)
+std::pair<int, int> FileRows(const BmpInfo& info, int first_row, int last_row) {
+    if (info.top_down) {
+        return {info.height - last_row, info.height - first_row};
+    }
+    return {first_row, last_row};
+}
+
+void EmitRows(const unsigned char* pixels, const BmpInfo& info, int first_row, int last_row,
+              const BmpRowHandler& handler) {
+    const size_t row_size = BmpStoredRowSize(info);
+    const auto [begin, end] = FileRows(info, first_row, last_row);
+    for (int row = begin; row < end; ++row) {
+        handler(ImageRow(info, row), pixels + row * row_size);
+    }
+}
+
+}  // namespace
+
+bool ParseBmpHeader(const unsigned char* data, size_t size, BmpInfo& info, std::string& error) {
+    return ParseBmpHeader(data, size, size, info, error);
+}
+
+bool ParseBmpHeader(const unsigned char* data, size_t size, size_t file_size, BmpInfo& info, std::string& error) {
+    if (size < static_cast<size_t>(kBmpFileHeaderSize + kBmpInfoHeaderSize)) {
+        error = "File is too small to be a bitmap image";
+        return false;
+    }
+    if (data[0] != 'B' || data[1] != 'M') {
+        error = "This path does not lead to a bitmap image";
+        return false;
+    }
+
+    const unsigned char* information_header = data + kBmpFileHeaderSize;
+    const int header_size = ReadLe32(information_header);
+    if (header_size < kBmpInfoHeaderSize || header_size > kMaxBmpHeaderBytes) {
+        error = "Unsupported bitmap header";
+        return false;
+    }
+
+    info.data_offset = ReadLe32(data + 10);
+    info.width = ReadLe32(information_header + 4);
+    const int height = ReadLe32(information_header + 8);
+    info.bit_count = ReadLe16(information_header + 14);
+    info.compression = ReadLe32(information_header + 16);
+
+    if (info.width <= 0 || info.width > kMaxBmpWidth || height == 0 || height == INT_MIN) {
+        error = "Unsupported bitmap dimensions";
+        return false;
+    }
+    info.top_down = height < 0;
+    info.height = info.top_down ? -height : height;
+
+    const int bits = info.bit_count;
+    if (bits != 1 && bits != 4 && bits != 8 && bits != 24 && bits != 32) {
+        error = "Unsupported bitmap format: " + std::to_string(bits) + " bits per pixel";
+        return false;
+    }
+    const bool rle = info.compression == kBmpRle8 || info.compression == kBmpRle4;
+    const bool supported = info.compression == kBmpRgb || (info.compression == kBmpRle8 && bits == 8) ||
+                           (info.compression == kBmpRle4 && bits == 4) ||
+                           (info.compression == kBmpBitfields && bits == 32);
+    if (!supported) {
+        error = "Unsupported bitmap compression";
+        return false;
+    }
+    if (rle && info.top_down) {
+        error = "Compressed bitmaps cannot be top-down";
+        return false;
+    }
+
+    // Маски каналов идут сразу за BITMAPINFOHEADER, в заголовках V2-V5 они его часть
+    size_t tables = kBmpFileHeaderSize + header_size;
+    if (info.compression == kBmpBitfields) {
+        const size_t masks = kBmpFileHeaderSize + kBmpInfoHeaderSize;
+        if (header_size == kBmpInfoHeaderSize) {
+            tables += 12;
+        }
+        if (size < masks + 12) {
+            error = "Invalid bitmap header";
+            return false;
+        }
+        if (static_cast<unsigned int>(ReadLe32(data + masks)) != kBmpRedMask ||
+            static_cast<unsigned int>(ReadLe32(data + masks + 4)) != kBmpGreenMask ||
+            static_cast<unsigned int>(ReadLe32(data + masks + 8)) != kBmpBlueMask) {
+            error = "Unsupported bitmap channel masks";
+            return false;
+        }
+    }
+
+    info.palette.clear();
+    if (bits <= 8) {
+        const int colors_used = ReadLe32(information_header + 32);
+        const int colors = colors_used > 0 && colors_used < (1 << bits) ? colors_used : 1 << bits;
+        if (size < tables + 4 * static_cast<size_t>(colors)) {
+            error = "Invalid bitmap palette";
+            return false;
+        }
+        // Цвета палитры хранятся как BGRX, лишний байт отбрасываем
+        info.palette.assign(256 * 3, 0);
+        for (int i = 0; i < colors; ++i) {
+            std::memcpy(&info.palette[i * 3], data + tables + 4 * i, 3);
+        }
+        tables += 4 * static_cast<size_t>(colors);
+    }
+
+    if (info.data_offset < 0 || static_cast<size_t>(info.data_offset) < tables) {
+        error = "Invalid pixel data offset";
+        return false;
+    }
+
+    // Размеры проверяются в 64 битах, пока по ним ничего не выделено
+    if (rle && static_cast<long long>(info.width) * info.height > kMaxBmpRlePixels) {
+        error = "Unsupported bitmap dimensions";
+        return false;
+    }
+    const unsigned long long pixel_bytes = static_cast<unsigned long long>(BmpStoredRowSize(info)) * info.height;
+    if (!rle && (file_size < static_cast<size_t>(info.data_offset) || pixel_bytes > file_size - info.data_offset)) {
+        error = "Unexpected end of bitmap pixel data";
+        return false;
+    }
+    return true;
+}
+
+bool ReadBmpHeader(std::istream& in, BmpInfo& info, std::string& error) {
+    // Заголовки и палитра лежат перед пиксельными данными, их размер известен из смещения данных
+    // Размер файла от текущей позиции; у потока без перемотки он неизвестен и не ограничивает строки
+    size_t file_size = SIZE_MAX;
+    const std::streampos start = in.tellg();
+    if (start != std::streampos(-1) && in.seekg(0, std::ios::end)) {
+        file_size = static_cast<size_t>(in.tellg() - start);
+        in.seekg(start);
+    }
+    in.clear();
+
+    std::vector<unsigned char> header(kBmpFileHeaderSize + kBmpInfoHeaderSize);
+    in.read(reinterpret_cast<char*>(header.data()), kBmpFileHeaderSize);
+    size_t size = static_cast<size_t>(in.gcount());
+    if (size == static_cast<size_t>(kBmpFileHeaderSize)) {
+        const int data_offset = ReadLe32(header.data() + 10);
+        if (data_offset > static_cast<int>(header.size()) && data_offset <= kMaxBmpHeaderBytes) {
+            header.resize(data_offset);
+        }
+        in.read(reinterpret_cast<char*>(header.data() + size), static_cast<std::streamsize>(header.size() - size));
+        size += static_cast<size_t>(in.gcount());
+    }
+    if (!ParseBmpHeader(header.data(), size, file_size, info, error)) {
+        return false;
+    }
+    if (static_cast<size_t>(info.data_offset) != size) {
+        // Смещение меньше размера заголовков отклоняет ParseBmpHeader, остаётся слишком большое
+        error = "Invalid pixel data offset";
+        return false;
+    }
+    return true;
+}
+
+bool DecodeBmpRle(const unsigned char* data, size_t size, BmpInfo& info, std::vector<unsigned char>& pixels,
+                  std::string& error) {
+    const bool rle4 = info.compression == kBmpRle4;
+    BmpInfo decoded = info;
+    decoded.bit_count = 8;
+    decoded.compression = kBmpRgb;
+    const size_t row_size = BmpStoredRowSize(decoded);
+    pixels.assign(row_size * info.height, 0);
+
+    // Пары (число, значение): серия одинаковых пикселей или, при нулевом числе, команда: конец строки,
+    // конец изображения, сдвиг или несжатый участок, выровненный до 2 байт. Всё, что выходит за
+    // изображение, отбрасывается
+    int x = 0;
+    int y = 0;
+    auto put = [&](int index) {
+        if (x < info.width) {
+            pixels[y * row_size + x] = static_cast<unsigned char>(index);
+        }
+        ++x;
+    };
+    size_t i = 0;
+    while (i + 1 < size && y < info.height) {
+        const int count = data[i];
+        const int value = data[i + 1];
+        i += 2;
+        if (count > 0) {
+            if (!rle4 && x + count <= info.width) {
+                std::memset(&pixels[y * row_size + x], value, count);
+                x += count;
+                continue;
+            }
+            for (int k = 0; k < count; ++k) {
+                put(rle4 ? (k % 2 == 0 ? value >> 4 : value & 0x0F) : value);
+            }
+        } else if (value == 0) {
+            x = 0;
+            ++y;
+        } else if (value == 1) {
+            break;
+        } else if (value == 2) {
+            if (i + 1 >= size) {
+                break;
+            }
+            x += data[i];
+            y += data[i + 1];
+            i += 2;
+        } else {
+            const size_t bytes = rle4 ? (value + 1) / 2 : value;
+            if (i + bytes > size) {
+                error = "Unexpected end of bitmap pixel data";
+                return false;
+            }
+            for (int k = 0; k < value; ++k) {
+                put(rle4 ? (k % 2 == 0 ? data[i + k / 2] >> 4 : data[i + k / 2] & 0x0F) : data[i + k]);
+            }
+            i += (bytes + 1) / 2 * 2;
+        }
+    }
+    info = decoded;
+    return true;
+}
+
+bool DecodeBmpRows(const unsigned char* data, size_t size, BmpInfo& info, const BmpRowHandler& handler,
+                   std::string& error) {
+    return DecodeBmpRows(data, size, info, 0, info.height, handler, error);
+}
+
+bool DecodeBmpRows(const unsigned char* data, size_t size, BmpInfo& info, int first_row, int last_row,
+                   const BmpRowHandler& handler, std::string& error) {
+    const size_t offset = info.data_offset;
+    if (info.compression == kBmpRle8 || info.compression == kBmpRle4) {
+        std::vector<unsigned char> pixels;
+        if (!DecodeBmpRle(data + offset, size - std::min(size, offset), info, pixels, error)) {
+            return false;
+        }
+        EmitRows(pixels.data(), info, first_row, last_row, handler);
+        return true;
+    }
+    if (size < offset + static_cast<size_t>(BmpStoredRowSize(info)) * info.height) {
+        error = "Unexpected end of bitmap pixel data";
+        return false;
+    }
+    EmitRows(data + offset, info, first_row, last_row, handler);
+    return true;
+}
+
+bool ReadBmpRows(std::istream& in, BmpInfo& info, const BmpRowHandler& handler, std::string& error) {
+    return ReadBmpRows(in, info, 0, info.height, handler, error);
+}
+
+bool ReadBmpRows(std::istream& in, BmpInfo& info, int first_row, int last_row, const BmpRowHandler& handler,
+                 std::string& error) {
+    if (info.compression == kBmpRle8 || info.compression == kBmpRle4) {
+        // Сжатые данные обычно малы, читаем их целиком
+        std::vector<unsigned char> data;
+        while (in) {
+            const size_t size = data.size();
+            data.resize(size + kReadBlockBytes);
+            in.read(reinterpret_cast<char*>(data.data() + size), kReadBlockBytes);
+            data.resize(size + static_cast<size_t>(in.gcount()));
+        }
+        std::vector<unsigned char> pixels;
+        if (!DecodeBmpRle(data.data(), data.size(), info, pixels, error)) {
+            return false;
+        }
+        EmitRows(pixels.data(), info, first_row, last_row, handler);
+        return true;
+    }
+
+    // Строки до нужных пропускаются без чтения, нужные читаются блоками по несколько строк
+    const int row_size = BmpStoredRowSize(info);
+    const auto [begin, end] = FileRows(info, first_row, last_row);
+    const std::streamoff data_start = in.tellg();
+    if (begin > 0) {
+        in.seekg(static_cast<std::streamoff>(begin) * row_size, std::ios::cur);
+    }
+    const int rows_per_block = std::max(1, kReadBlockBytes / row_size);
+    const int block_rows = std::max(0, std::min(rows_per_block, end - begin));
+    std::vector<unsigned char> block(static_cast<size_t>(row_size) * block_rows);
+    for (int row = begin; row < end; row += rows_per_block) {
+        const int rows = std::min(rows_per_block, end - row);
+        const std::streamsize bytes = static_cast<std::streamsize>(row_size) * rows;
+        in.read(reinterpret_cast<char*>(block.data()), bytes);
+        if (in.gcount() != bytes) {
+            error = "Unexpected end of bitmap pixel data";
+            return false;
+        }
+        for (int i = 0; i < rows; ++i) {
+            handler(ImageRow(info, row + i), block.data() + static_cast<size_t>(i) * row_size);
+        }
+    }
+    if (end < info.height && data_start >= 0) {
+        // Обрезанный файл отклоняется так же, как при чтении всех строк: проверяем последний байт данных
+        in.seekg(data_start + static_cast<std::streamoff>(info.height) * row_size - 1);
+        if (in.get() == std::char_traits<char>::eof()) {
+            error = "Unexpected end of bitmap pixel data";
+            return false;
+        }
+    }
+    return true;
+}
+
+int BmpStoredRowSize(const BmpInfo& info) {
+    return static_cast<int>((static_cast<long long>(info.width) * info.bit_count + 31) / 32 * 4);
+}
+
+void UnpackBmpRow(const BmpInfo& info, const unsigned char* src, Color* dst, int width) {
+    if (info.bit_count == 24) {
+        UnpackBgr24Row(src, dst, width);
+    } else if (info.bit_count == 32) {
+        UnpackBgra32Row(src, dst, width);
+    } else {
+        // Цвета палитры раскрываются кусками в байты BGR, а те переводятся в float общим векторным путём
+        unsigned char chunk[kIndexedChunk * 3];
+        for (int begin = 0; begin < width; begin += kIndexedChunk) {
+            const int count = std::min(kIndexedChunk, width - begin);
+            ExpandIndexedRow(info, src, begin, count, chunk);
+            UnpackBgr24Row(chunk, dst + begin, count);
+        }
+    }
+}
+
+void UnpackBmpRowBgr24(const BmpInfo& info, const unsigned char* src, unsigned char* dst) {
+    if (info.bit_count == 24) {
+        std::memcpy(dst, src, static_cast<size_t>(info.width) * 3);
+    } else if (info.bit_count == 32) {
+        for (int x = 0; x < info.width; ++x) {
+            std::memcpy(dst + x * 3, src + x * 4, 3);
+        }
+    } else {
+        ExpandIndexedRow(info, src, 0, info.width, dst);
+    }
+}
+
+void SetBmpOutputBits(int bits) {
+    g_output_bits = bits;
+}
+
+int BmpOutputBits() {
+    return g_output_bits;
+}
+
+size_t BmpRowSize(int width) {
+    return (static_cast<size_t>(width) * 3 + 3) / 4 * 4;
+}
+
+void UnpackBgr24Row(const unsigned char* src, Color* dst, int width) {
+    // Сначала переводим байты строки подряд (это хорошо векторизуется), затем меняем местами каналы B и R
+    BytesToFloats(src, &dst[0].r, width * 3);
+    for (int x = 0; x < width; ++x) {
+        std::swap(dst[x].r, dst[x].b);
+    }
+}
+
+void UnpackBgra32Row(const unsigned char* src, Color* dst, int width) {
+    int x = 0;
+    float* out = &dst[0].r;
+#if defined(__SSE2__)
+    // Четыре пикселя за шаг. Пиксель переставляется из BGRA в RGBA и пишется четырьмя float, последний
+    // из которых затирает следующий пиксель; поэтому последний пиксель строки считается отдельно
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 max_color = _mm_set1_ps(kMaxColor);
+    auto store = [&](float* p, __m128i pixel) {
+        const __m128 v = _mm_div_ps(_mm_cvtepi32_ps(pixel), max_color);
+        _mm_storeu_ps(p, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)));
+    };
+    for (; x + 4 < width; x += 4) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        store(out + x * 3, _mm_unpacklo_epi16(lo, zero));
+        store(out + x * 3 + 3, _mm_unpackhi_epi16(lo, zero));
+        store(out + x * 3 + 6, _mm_unpacklo_epi16(hi, zero));
+        store(out + x * 3 + 9, _mm_unpackhi_epi16(hi, zero));
+    }
+#endif
+    for (; x < width; ++x) {
+        out[x * 3] = static_cast<float>(src[x * 4 + 2]) / kMaxColor;
+        out[x * 3 + 1] = static_cast<float>(src[x * 4 + 1]) / kMaxColor;
+        out[x * 3 + 2] = static_cast<float>(src[x * 4]) / kMaxColor;
+    }
+}
+
+size_t BmpOutputRowSize(int width) {
+    return g_output_bits == 32 ? static_cast<size_t>(width) * 4 : BmpRowSize(width);
+}
+
+size_t BmpFileSize(int width, int height) {
+    return kBmpFileHeaderSize + kBmpInfoHeaderSize + BmpOutputRowSize(width) * height;
+}
+
+double BmpCodecBytes(int width, int height, int pixel_bytes) {
+    return static_cast<double>(BmpFileSize(width, height)) + static_cast<double>(width) * height * pixel_bytes;
+}
+
+bool CheckBmpOutputSize(int width, int height, std::string& error) {
+    if (BmpFileSize(width, height) > UINT32_MAX) {
+        error = "Image is too large for a bitmap file";
+        return false;
+    }
+    return true;
+}
+
+bool WriteBmpHeader(unsigned char* header, int width, int height, std::string& error) {
+    if (!CheckBmpOutputSize(width, height, error)) {
+        return false;
+    }
+    const size_t image_size = BmpFileSize(width, height) - kBmpFileHeaderSize - kBmpInfoHeaderSize;
+    const int data_offset = kBmpFileHeaderSize + kBmpInfoHeaderSize;
+    std::memset(header, 0, kBmpFileHeaderSize + kBmpInfoHeaderSize);
+
+    // Файловый заголовок: тип, размер файла, смещение пиксельных данных
+    header[0] = 'B';
+    header[1] = 'M';
+    WriteLe32(header + 2, static_cast<int>(data_offset + image_size));
+    WriteLe32(header + 10, data_offset);
+
+    // Информационный заголовок: размеры, 1 плоскость, 24 или 32 бита на пиксель, без сжатия
+    unsigned char* information_header = header + kBmpFileHeaderSize;
+    WriteLe32(information_header, kBmpInfoHeaderSize);
+    WriteLe32(information_header + 4, width);
+    WriteLe32(information_header + 8, height);
+    WriteLe16(information_header + 12, 1);
+    WriteLe16(information_header + 14, g_output_bits);
+    WriteLe32(information_header + 20, static_cast<int>(image_size));
+    return true;
+}
+
+void PackBgr24Row(const Color* src, unsigned char* dst, int width) {
+    FloatsToBytes(&src[0].r, dst, width * 3);
+    for (int x = 0; x < width; ++x) {
+        std::swap(dst[x * 3], dst[x * 3 + 2]);
+    }
+}
+
+void PackBgra32Row(const Color* src, unsigned char* dst, int width) {
+    int x = 0;
+    const float* in = &src[0].r;
+#if defined(__SSE2__)
+    // Квантование как в FloatsToBytes. Пиксель читается четырьмя float, последний из которых принадлежит
+    // следующему пикселю и заменяется альфой; у последнего пикселя строки следующего нет
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 max_color = _mm_set1_ps(kMaxColor);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    auto quantize = [&](const float* p) {
+        __m128 v = _mm_loadu_ps(p);
+        v = _mm_min_ps(_mm_max_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2)), zero), one);
+        return _mm_cvttps_epi32(_mm_mul_ps(v, max_color));
+    };
+    for (; x + 4 < width; x += 4) {
+        __m128i lo = _mm_packs_epi32(quantize(in + x * 3), quantize(in + x * 3 + 3));
+        __m128i hi = _mm_packs_epi32(quantize(in + x * 3 + 6), quantize(in + x * 3 + 9));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+    }
+#endif
+    for (; x < width; ++x) {
+        FloatsToBytes(in + x * 3, dst + x * 4, 3);
+        std::swap(dst[x * 4], dst[x * 4 + 2]);
+        dst[x * 4 + 3] = 255;
+    }
+}
+
+void PackBmpRow(const Color* src, unsigned char* dst, int width) {
+    if (g_output_bits == 32) {
+        PackBgra32Row(src, dst, width);
+        return;
+    }
+    PackBgr24Row(src, dst, width);
+    const size_t pixel_bytes = static_cast<size_t>(width) * 3;
+    std::memset(dst + pixel_bytes, 0, BmpRowSize(width) - pixel_bytes);
+}
+
+void PackBmpRowBgr24(const unsigned char* src, unsigned char* dst, int width) {
+    if (g_output_bits == 32) {
+        for (int x = 0; x < width; ++x) {
+            std::memcpy(dst + x * 4, src + x * 3, 3);
+            dst[x * 4 + 3] = 255;
+        }
+        return;
+    }
+    const size_t pixel_bytes = static_cast<size_t>(width) * 3;
+    std::memcpy(dst, src, pixel_bytes);
+    std::memset(dst + pixel_bytes, 0, BmpRowSize(width) - pixel_bytes);
+}
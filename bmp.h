@@ -0,0 +1,124 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+// Размеры заголовков BMP (BITMAPFILEHEADER и BITMAPINFOHEADER). Более длинные заголовки V4 и V5 начинаются
+// так же, как BITMAPINFOHEADER
+const int kBmpFileHeaderSize = 14;
+const int kBmpInfoHeaderSize = 40;
+
+// Наибольшая ширина: строка в 4 байта на пиксель с выравниванием помещается в int
+const int kMaxBmpWidth = (INT_MAX - 3) / 4;
+// Наибольшее число пикселей сжатого изображения. Размер строк без сжатия ограничен размером файла, а RLE
+// описывает сколь угодно большое изображение несколькими байтами
+const long long kMaxBmpRlePixels = 1LL << 28;
+
+// Значения поля biCompression
+const int kBmpRgb = 0;
+const int kBmpRle8 = 1;
+const int kBmpRle4 = 2;
+const int kBmpBitfields = 3;
+
+// Сведения из заголовка BMP, нужные для декодирования пикселей
+struct BmpInfo {
+    int width = 0;
+    int height = 0;         // всегда положительная, направление строк - в top_down
+    bool top_down = false;  // отрицательная высота в заголовке: первая строка файла - верхняя
+    int bit_count = 0;
+    int compression = 0;
+    int data_offset = 0;
+    // Палитра для 1, 4 и 8 бит на пиксель: 256 цветов по 3 байта BGR, недостающие цвета чёрные
+    std::vector<unsigned char> palette;
+};
+
+// Разбирает заголовки BMP по первым size байтам файла; заголовки и палитра должны уместиться целиком.
+// Поддерживаются 24 и 32 бита на пиксель (32 - и с масками каналов BGRA), 1, 4 и 8 бит с палитрой, RLE8 и RLE4,
+// строки снизу вверх и сверху вниз. Размеры проверяются до выделения памяти: строки без сжатия должны
+// уместиться в file_size байт файла. При ошибке возвращает false и пишет причину в error
+bool ParseBmpHeader(const unsigned char* data, size_t size, size_t file_size, BmpInfo& info, std::string& error);
+
+// Файл целиком в памяти: file_size = size
+bool ParseBmpHeader(const unsigned char* data, size_t size, BmpInfo& info, std::string& error);
+
+// Читает заголовки из потока и оставляет его на начале пиксельных данных. Размер файла для проверки
+// размеров берётся из потока, если тот поддерживает перемотку
+bool ReadBmpHeader(std::istream& in, BmpInfo& info, std::string& error);
+
+// Строка пикселей файла без сжатия: вызывается для каждой строки в порядке файла, y - номер строки
+// изображения (снизу вверх), row - байты строки в виде, который описывает info
+using BmpRowHandler = std::function<void(int y, const unsigned char* row)>;
+
+// Пиксельные данные файла, целиком лежащего в памяти (data - начало файла). Сжатые данные сначала
+// распаковываются в 8-битные строки с палитрой, и к вызовам handler info уже описывает их
+bool DecodeBmpRows(const unsigned char* data, size_t size, BmpInfo& info, const BmpRowHandler& handler,
+                   std::string& error);
+
+// То же из потока, стоящего на начале пиксельных данных. Строки без сжатия читаются блоками
+bool ReadBmpRows(std::istream& in, BmpInfo& info, const BmpRowHandler& handler, std::string& error);
+
+// Только строки изображения [first_row, last_row) (номера снизу вверх). Остальные строки без сжатия
+// не декодируются, а из потока и не читаются
+bool DecodeBmpRows(const unsigned char* data, size_t size, BmpInfo& info, int first_row, int last_row,
+                   const BmpRowHandler& handler, std::string& error);
+bool ReadBmpRows(std::istream& in, BmpInfo& info, int first_row, int last_row, const BmpRowHandler& handler,
+                 std::string& error);
+
+// Распаковка RLE8 и RLE4 в 8-битные строки с палитрой: pixels получает строки снизу вверх по
+// BmpStoredRowSize байт, info переписывается под них. Пропущенные сжатием пиксели получают цвет 0
+bool DecodeBmpRle(const unsigned char* data, size_t size, BmpInfo& info, std::vector<unsigned char>& pixels,
+                  std::string& error);
+
+// Размер строки файла без сжатия в байтах, с выравниванием до 4 байт
+int BmpStoredRowSize(const BmpInfo& info);
+
+// Перевод первых width пикселей строки файла без сжатия во внутреннее представление
+void UnpackBmpRow(const BmpInfo& info, const unsigned char* src, Color* dst, int width);
+// Перевод строки файла без сжатия в строку BGR по байту на канал (ImageU8)
+void UnpackBmpRowBgr24(const BmpInfo& info, const unsigned char* src, unsigned char* dst);
+
+// Глубина цвета при записи (--bits): 24 или 32 бита на пиксель, по умолчанию 24.
+// Вызывать до начала записи файлов
+void SetBmpOutputBits(int bits);
+int BmpOutputBits();
+
+// Размер строки BGR по байту на канал с выравниванием до 4 байт (строки 24-битного BMP и ImageU8).
+// Считается в size_t: ширину, из которой он берётся, не всегда уже проверил заголовок
+size_t BmpRowSize(int width);
+
+// Размер строки и всего файла BMP, который записывают Save и Encode (глубина из BmpOutputBits)
+size_t BmpOutputRowSize(int width);
+size_t BmpFileSize(int width, int height);
+
+// Объём памяти, который трогает чтение или запись изображения: байты файла и пиксели во внутреннем
+// представлении по pixel_bytes байт. Нужен для оценки пропускной способности в профиле и бенчмарке
+double BmpCodecBytes(int width, int height, int pixel_bytes = sizeof(Color));
+
+// Заполняет заголовки BMP без сжатия с глубиной BmpOutputBits (kBmpFileHeaderSize + kBmpInfoHeaderSize байт).
+// Возвращает false и пишет причину в error, если размер файла не помещается в 32-битные поля заголовка
+bool CheckBmpOutputSize(int width, int height, std::string& error);
+bool WriteBmpHeader(unsigned char* header, int width, int height, std::string& error);
+
+// Перевод строки BGR8 во внутреннее представление (float в диапазоне [0, 1])
+void UnpackBgr24Row(const unsigned char* src, Color* dst, int width);
+
+// Перевод строки BGRA8 (32 бита на пиксель) во внутреннее представление, альфа-канал отбрасывается.
+// Значения совпадают с UnpackBgr24Row для тех же B, G, R
+void UnpackBgra32Row(const unsigned char* src, Color* dst, int width);
+
+// Перевод строки во BGR8 с ограничением значений отрезком [0, 1]. Байты выравнивания не трогает
+void PackBgr24Row(const Color* src, unsigned char* dst, int width);
+
+// То же в BGRA8 с непрозрачной альфой
+void PackBgra32Row(const Color* src, unsigned char* dst, int width);
+
+// Строка файла для записи с глубиной BmpOutputBits, вместе с нулевыми байтами выравнивания:
+// из внутреннего представления и из строки BGR по байту на канал
+void PackBmpRow(const Color* src, unsigned char* dst, int width);
+void PackBmpRowBgr24(const unsigned char* src, unsigned char* dst, int width);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Очередь ограниченного размера между потоками. Push ждёт, пока есть место, поэтому быстрый читатель
+// не загрузит в память все файлы; TryPush вместо ожидания сообщает о переполнении
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : m_capacity_(capacity), m_closed_(false) {
+    }
+
+    void Push(T value) {
+        std::unique_lock<std::mutex> lock(m_mutex_);
+        m_not_full_.wait(lock, [this] { return m_items_.size() < m_capacity_; });
+        m_items_.push_back(std::move(value));
+        m_not_empty_.notify_one();
+    }
+
+    // Не ждёт: возвращает false, если очередь заполнена
+    bool TryPush(T& value) {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        if (m_items_.size() >= m_capacity_) {
+            return false;
+        }
+        m_items_.push_back(std::move(value));
+        m_not_empty_.notify_one();
+        return true;
+    }
+
+    // Возвращает пустое значение, когда очередь закрыта и опустела
+    std::optional<T> Pop() {
+        std::unique_lock<std::mutex> lock(m_mutex_);
+        m_not_empty_.wait(lock, [this] { return m_closed_ || !m_items_.empty(); });
+        if (m_items_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(m_items_.front());
+        m_items_.pop_front();
+        m_not_full_.notify_one();
+        return value;
+    }
+
+    // Не ждёт: пустое значение, если очередь сейчас пуста. drained - очередь закрыта и новых значений не будет
+    std::optional<T> TryPop(bool& drained) {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        drained = m_closed_ && m_items_.empty();
+        if (m_items_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(m_items_.front());
+        m_items_.pop_front();
+        m_not_full_.notify_one();
+        return value;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        m_closed_ = true;
+        m_not_empty_.notify_all();
+    }
+
+private:
+    size_t m_capacity_;
+    bool m_closed_;
+    std::deque<T> m_items_;
+    std::mutex m_mutex_;
+    std::condition_variable m_not_empty_;
+    std::condition_variable m_not_full_;
+};
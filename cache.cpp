@@ -0,0 +1,391 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <thread>
+
+#include "bmp.h"
+#include "profile.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+
+// Заголовок записи: метка формата, ширина и высота. Дальше строки изображения подряд, снизу вверх
+const char kEntryMagic[4] = {'I', 'P', 'C', '1'};
+const size_t kEntryHeaderSize = 12;
+const char* const kEntryExtension = ".bin";
+
+// Хеш в духе xxHash64: четыре независимые полосы по 8 байт, поэтому умножения идут параллельно
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+
+uint64_t Rotate(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+uint64_t Round(uint64_t lane, uint64_t word) {
+    return Rotate(lane + word * kPrime2, 31) * kPrime1;
+}
+
+uint64_t ReadWord(const unsigned char* data) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// Потоковый хеш: данные подаются блоками, длина всех блоков, кроме последнего, кратна 32 байтам
+class Hasher {
+public:
+    static const size_t kBlock = 32;
+
+    explicit Hasher(uint64_t seed) : m_lanes_{seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1} {
+    }
+
+    // Обрабатывает кратную kBlock часть данных, возвращает число обработанных байт
+    size_t Update(const unsigned char* data, size_t size) {
+        size_t position = 0;
+        for (; position + kBlock <= size; position += kBlock) {
+            for (int lane = 0; lane < 4; ++lane) {
+                m_lanes_[lane] = Round(m_lanes_[lane], ReadWord(data + position + 8 * lane));
+            }
+        }
+        m_size_ += position;
+        return position;
+    }
+
+    // Хеш с учётом хвоста короче kBlock
+    uint64_t Finish(const unsigned char* tail, size_t size) const {
+        uint64_t hash = Rotate(m_lanes_[0], 1) + Rotate(m_lanes_[1], 7) + Rotate(m_lanes_[2], 12) +
+                        Rotate(m_lanes_[3], 18);
+        hash += m_size_ + size;
+        size_t position = 0;
+        for (; position + 8 <= size; position += 8) {
+            hash = Rotate(hash ^ Round(0, ReadWord(tail + position)), 27) * kPrime1 + kPrime3;
+        }
+        for (; position < size; ++position) {
+            hash = Rotate(hash ^ (tail[position] * kPrime3), 11) * kPrime1;
+        }
+        // Перемешивание, чтобы каждый бит входа влиял на все биты результата
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    uint64_t m_lanes_[4];
+    uint64_t m_size_ = 0;
+};
+
+uint64_t HashBytes(const unsigned char* data, size_t size, uint64_t seed) {
+    Hasher hasher(seed);
+    const size_t done = hasher.Update(data, size);
+    return hasher.Finish(data + done, size - done);
+}
+
+// Параметры записываются точно (шестнадцатеричной записью float), чтобы -blur 2 и -blur 2.0000001
+// не получили один ключ
+void AppendFilters(std::string& text, char role, const std::vector<FilterInfo>& filters) {
+    for (const auto& filter : filters) {
+        text += role;
+        text += filter.name;
+        for (float parameter : filter.parameters) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), " %a", static_cast<double>(parameter));
+            text += buffer;
+        }
+        text += ';';
+    }
+}
+
+}  // namespace
+
+CacheStats& CacheStats::operator+=(const CacheStats& other) {
+    hits += other.hits;
+    partial_hits += other.partial_hits;
+    misses += other.misses;
+    stores += other.stores;
+    evictions += other.evictions;
+    return *this;
+}
+
+ResultCache::ResultCache(std::string directory, long long capacity_bytes)
+    : m_directory_(std::move(directory)), m_capacity_bytes_(capacity_bytes) {
+}
+
+bool ResultCache::Open(std::string& error) {
+    std::error_code code;
+    fs::create_directories(m_directory_, code);
+    if (!fs::is_directory(m_directory_, code)) {
+        error = "Cache directory " + m_directory_ + " cannot be created";
+        return false;
+    }
+    std::ifstream file(StatsPath());
+    std::string name;
+    long long value = 0;
+    while (file >> name >> value) {
+        if (name == "hits") {
+            m_total_.hits = value;
+        } else if (name == "partial_hits") {
+            m_total_.partial_hits = value;
+        } else if (name == "misses") {
+            m_total_.misses = value;
+        } else if (name == "stores") {
+            m_total_.stores = value;
+        } else if (name == "evictions") {
+            m_total_.evictions = value;
+        }
+    }
+    return true;
+}
+
+bool ResultCache::HashFile(const char* path, uint64_t& key, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        error = "This file cannot be opened";
+        return false;
+    }
+    // Файл читается блоками по 1 МБ, кратными блоку хеша, так что весь файл в памяти не нужен
+    std::vector<unsigned char> block(1 << 20);
+    Hasher hasher(0);
+    while (true) {
+        file.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size()));
+        const size_t size = static_cast<size_t>(file.gcount());
+        const size_t done = hasher.Update(block.data(), size);
+        if (size < block.size()) {
+            if (file.bad()) {
+                error = "This file cannot be read";
+                return false;
+            }
+            key = hasher.Finish(block.data() + done, size - done);
+            return true;
+        }
+    }
+}
+
+uint64_t ResultCache::StageKey(uint64_t input_key, const PipelineStage& stage) {
+    std::string text;
+    AppendFilters(text, '<', stage.prologue);
+    if (stage.core) {
+        AppendFilters(text, '=', {*stage.core});
+    }
+    AppendFilters(text, '>', stage.epilogue);
+    return HashBytes(reinterpret_cast<const unsigned char*>(text.data()), text.size(), input_key);
+}
+
+std::string ResultCache::EntryPath(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+    return (fs::path(m_directory_) / (name + std::string(kEntryExtension))).string();
+}
+
+std::string ResultCache::StatsPath() const {
+    return (fs::path(m_directory_) / "stats.txt").string();
+}
+
+bool ResultCache::Load(uint64_t key, Image& image) {
+    const std::string path = EntryPath(key);
+    std::error_code code;
+    const uintmax_t file_size = fs::file_size(path, code);
+    if (code) {
+        return false;
+    }
+    StageTimer timer("Cache load");
+    std::ifstream file(path, std::ios::binary);
+    char header[kEntryHeaderSize];
+    file.read(header, sizeof(header));
+    int32_t width = 0;
+    int32_t height = 0;
+    std::memcpy(&width, header + 4, sizeof(width));
+    std::memcpy(&height, header + 8, sizeof(height));
+    const uintmax_t pixel_bytes = static_cast<uintmax_t>(width) * height * sizeof(Color);
+    if (file.gcount() != static_cast<std::streamsize>(sizeof(header)) ||
+        std::memcmp(header, kEntryMagic, sizeof(kEntryMagic)) != 0 || width <= 0 || height <= 0 ||
+        file_size != kEntryHeaderSize + pixel_bytes) {
+        // Недописанная или чужая запись: удаляем, чтобы не проверять её снова
+        file.close();
+        fs::remove(path, code);
+        return false;
+    }
+    Image loaded(width, height);
+    file.read(reinterpret_cast<char*>(loaded.Row(0)), static_cast<std::streamsize>(pixel_bytes));
+    if (file.gcount() != static_cast<std::streamsize>(pixel_bytes)) {
+        return false;
+    }
+    image = std::move(loaded);
+    // Время изменения файла служит отметкой последнего использования для вытеснения
+    fs::last_write_time(path, fs::file_time_type::clock::now(), code);
+    timer.Finish(static_cast<double>(width) * height, static_cast<double>(pixel_bytes) * 2);
+    return true;
+}
+
+void ResultCache::Store(uint64_t key, const Image& image) {
+    StageTimer timer("Cache store");
+    const std::string path = EntryPath(key);
+    // Запись идёт во временный файл и переименовывается: другие процессы не увидят недописанную запись
+    const std::string temporary =
+        path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::ofstream file(temporary, std::ios::binary);
+    const int32_t width = image.Width();
+    const int32_t height = image.Height();
+    char header[kEntryHeaderSize];
+    std::memcpy(header, kEntryMagic, sizeof(kEntryMagic));
+    std::memcpy(header + 4, &width, sizeof(width));
+    std::memcpy(header + 8, &height, sizeof(height));
+    file.write(header, sizeof(header));
+    const std::streamsize row_bytes = static_cast<std::streamsize>(width) * sizeof(Color);
+    for (int y = 0; y < height; ++y) {
+        file.write(reinterpret_cast<const char*>(image.Row(y)), row_bytes);
+    }
+    file.close();
+    std::error_code code;
+    if (!file) {
+        fs::remove(temporary, code);
+        return;
+    }
+    fs::rename(temporary, path, code);
+    if (code) {
+        fs::remove(temporary, code);
+        return;
+    }
+    ++m_run_.stores;
+    timer.Finish(static_cast<double>(width) * height, static_cast<double>(row_bytes) * height * 2);
+}
+
+void ResultCache::Evict() {
+    struct Entry {
+        fs::file_time_type used;
+        uintmax_t size;
+        fs::path path;
+    };
+    std::vector<Entry> entries;
+    long long total = 0;
+    std::error_code code;
+    for (const auto& item : fs::directory_iterator(m_directory_, code)) {
+        if (!item.is_regular_file(code) || item.path().extension() != kEntryExtension) {
+            continue;
+        }
+        Entry entry{item.last_write_time(code), item.file_size(code), item.path()};
+        total += static_cast<long long>(entry.size);
+        entries.push_back(std::move(entry));
+    }
+    if (total <= m_capacity_bytes_) {
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const auto& entry : entries) {
+        if (total <= m_capacity_bytes_) {
+            break;
+        }
+        if (fs::remove(entry.path, code)) {
+            total -= static_cast<long long>(entry.size);
+            ++m_run_.evictions;
+        }
+    }
+}
+
+CacheStats& ResultCache::RunStats() {
+    return m_run_;
+}
+
+void ResultCache::SaveStats() {
+    m_total_ += m_run_;
+    m_run_ = CacheStats();
+    const std::string path = StatsPath();
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        file << "hits " << m_total_.hits << "\npartial_hits " << m_total_.partial_hits << "\nmisses "
+             << m_total_.misses << "\nstores " << m_total_.stores << "\nevictions " << m_total_.evictions << "\n";
+    }
+    std::error_code code;
+    fs::rename(temporary, path, code);
+}
+
+void ResultCache::PrintStats(std::ostream& out) const {
+    long long entries = 0;
+    long long bytes = 0;
+    std::error_code code;
+    for (const auto& item : fs::directory_iterator(m_directory_, code)) {
+        if (item.is_regular_file(code) && item.path().extension() == kEntryExtension) {
+            ++entries;
+            bytes += static_cast<long long>(item.file_size(code));
+        }
+    }
+    CacheStats total = m_total_;
+    total += m_run_;
+    auto print = [&out](const char* title, const CacheStats& stats) {
+        const long long lookups = stats.hits + stats.partial_hits + stats.misses;
+        out << title << ": " << stats.hits << " hit(s), " << stats.partial_hits << " partial hit(s), "
+            << stats.misses << " miss(es)";
+        if (lookups > 0) {
+            out << " (" << std::fixed << std::setprecision(1)
+                << 100.0 * static_cast<double>(stats.hits + stats.partial_hits) / static_cast<double>(lookups)
+                << "% reused)";
+        }
+        out << ", " << stats.stores << " stored, " << stats.evictions << " evicted\n";
+    };
+    print("Cache (this run)", m_run_);
+    print("Cache (total)", total);
+    out << "Cache size: " << entries << " entries, " << std::fixed << std::setprecision(1)
+        << static_cast<double>(bytes) / (1 << 20) << " MB of " << static_cast<double>(m_capacity_bytes_) / (1 << 20)
+        << " MB\n";
+}
+
+bool ExecuteCachedPipeline(const char* input_path, const std::vector<PipelineStage>& plan, ResultCache& cache,
+                           Image& image, std::string& error) {
+    StageTimer hash_timer("Cache hash");
+    uint64_t key = 0;
+    if (!ResultCache::HashFile(input_path, key, error)) {
+        return false;
+    }
+    std::error_code code;
+    hash_timer.Finish(0, static_cast<double>(fs::file_size(input_path, code)));
+
+    std::vector<uint64_t> keys;
+    for (const auto& stage : plan) {
+        key = ResultCache::StageKey(key, stage);
+        keys.push_back(key);
+    }
+    // Ищем самый длинный префикс плана, результат которого уже есть
+    size_t resume = 0;
+    for (size_t i = plan.size(); i > 0 && resume == 0; --i) {
+        if (cache.Load(keys[i - 1], image)) {
+            resume = i;
+        }
+    }
+    if (!plan.empty()) {
+        CacheStats& stats = cache.RunStats();
+        if (resume == plan.size()) {
+            ++stats.hits;
+        } else if (resume > 0) {
+            ++stats.partial_hits;
+        } else {
+            ++stats.misses;
+        }
+    }
+
+    if (resume == 0) {
+        StageTimer read_timer("Read");
+        if (!image.Load(input_path, error)) {
+            return false;
+        }
+        read_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                          BmpCodecBytes(image.Width(), image.Height()));
+    }
+    for (size_t i = resume; i < plan.size(); ++i) {
+        ExecutePipeline(image, {plan[i]});
+        cache.Store(keys[i], image);
+    }
+    cache.Evict();
+    return true;
+}
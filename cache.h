@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "pipeline.h"
+
+// Кэш результатов на диске (--cache DIR). Ключ записи - хеш содержимого входного файла, последовательно
+// дополненный этапами плана с точными значениями параметров, поэтому у цепочек с общим началом общие
+// ключи первых этапов. Записи - результаты этапов во float, без потери точности: продолжение обработки
+// из кэша даёт тот же файл, что и обработка с нуля. Самые давно использованные записи удаляются, когда
+// размер кэша превышает заданный.
+
+// Счётчики обращений к кэшу
+struct CacheStats {
+    long long hits = 0;          // весь план взят из кэша
+    long long partial_hits = 0;  // из кэша взято начало плана
+    long long misses = 0;
+    long long stores = 0;
+    long long evictions = 0;
+
+    CacheStats& operator+=(const CacheStats& other);
+};
+
+class ResultCache {
+public:
+    ResultCache(std::string directory, long long capacity_bytes);
+
+    // Создаёт каталог и читает накопленную статистику. При ошибке возвращает false и пишет причину в error
+    bool Open(std::string& error);
+
+    // Ключ входного файла по его содержимому
+    static bool HashFile(const char* path, uint64_t& key, std::string& error);
+    // Ключ результата этапа по ключу его входа
+    static uint64_t StageKey(uint64_t input_key, const PipelineStage& stage);
+
+    // Загружает запись и отмечает её как использованную. false, если записи нет или она повреждена
+    bool Load(uint64_t key, Image& image);
+    // Сохраняет запись; ошибки записи не мешают обработке и только пропускают запись
+    void Store(uint64_t key, const Image& image);
+    // Удаляет самые давно использованные записи, пока размер кэша больше заданного
+    void Evict();
+
+    // Статистика этого запуска
+    CacheStats& RunStats();
+    // Прибавляет статистику запуска к накопленной в каталоге кэша
+    void SaveStats();
+    // Статистика запуска, накопленная статистика и занятое место
+    void PrintStats(std::ostream& out) const;
+
+private:
+    std::string EntryPath(uint64_t key) const;
+    std::string StatsPath() const;
+
+    std::string m_directory_;
+    long long m_capacity_bytes_;
+    CacheStats m_run_;
+    CacheStats m_total_;
+};
+
+// Выполняет план с кэшем: находит самый длинный закэшированный префикс плана, загружает его результат
+// (или входной файл, если префикса нет), выполняет оставшиеся этапы и сохраняет результат каждого из них.
+// Сообщения фильтров не печатает. При ошибке чтения входного файла возвращает false и пишет причину в error
+bool ExecuteCachedPipeline(const char* input_path, const std::vector<PipelineStage>& plan, ResultCache& cache,
+                           Image& image, std::string& error);
@@ -0,0 +1,166 @@
+// Клиент для проверки режима --serve: отправляет запросы и печатает ответы сервера и задержки
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "local_socket.h"
+
+namespace {
+
+struct ClientOptions {
+    std::string socket_path;
+    int repeat = 1;
+    int concurrency = 1;
+    bool send_inline = false;  // передавать содержимое входного файла в запросе, а не путь
+    std::vector<std::string> request;
+};
+
+void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program
+              << " <socket> [--repeat N] [--concurrency N] [--inline] <input_file> <output_file> [-filter ...]\n"
+              << "       " << program << " <socket> STATS|SHUTDOWN\n"
+              << "{n} in output_file is replaced by the request number" << std::endl;
+}
+
+bool ParseOptions(int argc, char* argv[], ClientOptions& options) {
+    if (argc < 3) {
+        return false;
+    }
+    options.socket_path = argv[1];
+    int i = 2;
+    for (; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "--repeat" || arg == "--concurrency") && i + 1 < argc) {
+            const int value = std::atoi(argv[++i]);
+            if (value < 1) {
+                return false;
+            }
+            (arg == "--repeat" ? options.repeat : options.concurrency) = value;
+        } else if (arg == "--inline") {
+            options.send_inline = true;
+        } else {
+            break;
+        }
+    }
+    options.request.assign(argv + i, argv + argc);
+    const bool command = options.request.size() == 1 &&
+                         (options.request[0] == "STATS" || options.request[0] == "SHUTDOWN");
+    return command || options.request.size() >= 2;
+}
+
+std::string Join(const std::vector<std::string>& tokens, size_t from) {
+    std::string line;
+    for (size_t i = from; i < tokens.size(); ++i) {
+        line += (i == from ? "" : " ") + tokens[i];
+    }
+    return line;
+}
+
+std::string OutputPath(const std::string& pattern, int number) {
+    std::string path = pattern;
+    const size_t position = path.find("{n}");
+    if (position != std::string::npos) {
+        path.replace(position, 3, std::to_string(number));
+    }
+    return path;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    ClientOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::string body;
+    if (options.send_inline && options.request.size() >= 2) {
+        std::ifstream file(options.request[0], std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Error: This file cannot be opened" << std::endl;
+            return 1;
+        }
+        body.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Каждый поток держит одно соединение и отправляет по нему свою часть запросов подряд
+    std::atomic<int> next(0);
+    std::atomic<int> failed(0);
+    std::mutex mutex;
+    std::vector<double> latencies;
+    const bool verbose = options.repeat == 1;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < options.concurrency; ++t) {
+        threads.emplace_back([&] {
+            std::string error;
+            const int socket = ConnectLocalSocket(options.socket_path, error);
+            if (socket < 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cerr << "Error: " << error << std::endl;
+                failed.fetch_add(1);
+                return;
+            }
+            SocketStream stream(socket);
+            for (int number = next.fetch_add(1); number < options.repeat; number = next.fetch_add(1)) {
+                std::string line;
+                if (options.request.size() == 1) {
+                    line = options.request[0];
+                } else {
+                    const std::string input = options.send_inline ? "@" + std::to_string(body.size())
+                                                                  : options.request[0];
+                    line = input + " " + OutputPath(options.request[1], number) + " " + Join(options.request, 2);
+                }
+                const auto sent = std::chrono::steady_clock::now();
+                // Ответ читается и после неудачной записи: при перегрузке сервер пишет BUSY и сразу закрывает сокет
+                if (stream.WriteLine(line) && options.send_inline) {
+                    stream.Write(body.data(), body.size());
+                }
+                std::string response;
+                if (!stream.ReadLine(response)) {
+                    response = "ERROR Connection closed by server";
+                }
+                const double milliseconds =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count();
+                std::lock_guard<std::mutex> lock(mutex);
+                latencies.push_back(milliseconds);
+                if (response.rfind("OK", 0) != 0 && response.rfind("STATS", 0) != 0) {
+                    failed.fetch_add(1);
+                }
+                if (verbose || response.rfind("OK", 0) != 0) {
+                    std::cout << response << std::endl;
+                }
+                // После BUSY и ошибок разбора сервер закрывает соединение
+                if (response == "BUSY" || response.rfind("ERROR Connection", 0) == 0) {
+                    break;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (!verbose && !latencies.empty()) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction) {
+            const size_t index = static_cast<size_t>(fraction * static_cast<double>(latencies.size() - 1));
+            return latencies[index];
+        };
+        std::cout << std::fixed << std::setprecision(3) << latencies.size() << " request(s), " << failed.load()
+                  << " failed, " << static_cast<double>(latencies.size()) / seconds << " req/s, round trip ms: p50 "
+                  << percentile(0.5) << ", p95 " << percentile(0.95) << ", max " << latencies.back() << std::endl;
+    }
+    return failed.load() == 0 ? 0 : 1;
+}
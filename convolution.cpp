@@ -0,0 +1,211 @@
+#include "convolution.h"
+
+#include <cmath>
+
+#include "simd.h"
+
+namespace {
+
+using RowFunction = void (*)(const float* const* rows, float* dst, int width, int step, BorderPolicy border);
+
+// Часто используемые ядра, для которых -conv берёт развёрнутый при компиляции вариант
+constexpr ConvolutionKernel<3> kLaplacianKernel{{{0, 1, 0}, {1, -4, 1}, {0, 1, 0}}};
+constexpr ConvolutionKernel<3> kEmbossKernel{{{-2, -1, 0}, {-1, 1, 1}, {0, 1, 2}}};
+
+template <const auto& K>
+void SpecializedConvolutionRow(const float* const* rows, float* dst, int width, int step, BorderPolicy border) {
+    using Engine = ConvolutionEngine<K, TapOrder::RowMajor, ConvolutionOutput::Raw>;
+    if (step == 3) {
+        Engine::template Row<3>(rows, dst, width, border);
+    } else {
+        Engine::template Row<1>(rows, dst, width, border);
+    }
+}
+
+struct KnownKernel {
+    const ConvolutionKernel<3>& kernel;
+    RowFunction row;
+};
+
+const KnownKernel kKnownKernels[] = {
+    {kSharpeningKernel, SpecializedConvolutionRow<kSharpeningKernel>},
+    {kThermoKernel, SpecializedConvolutionRow<kThermoKernel>},
+    {kEdgeDetectionKernel, SpecializedConvolutionRow<kEdgeDetectionKernel>},
+    {kLaplacianKernel, SpecializedConvolutionRow<kLaplacianKernel>},
+    {kEmbossKernel, SpecializedConvolutionRow<kEmbossKernel>},
+};
+
+RowFunction FindSpecializedRow(int size, const std::vector<float>& weights) {
+    if (size != 3) {
+        return nullptr;
+    }
+    for (const auto& known : kKnownKernels) {
+        if (std::equal(weights.begin(), weights.end(), &known.kernel.weights[0][0])) {
+            return known.row;
+        }
+    }
+    return nullptr;
+}
+
+// Раскладывает ядро ранга 1 в произведение столбца на строку. Возвращает false, если ядро не разделимо
+bool Factorize(int size, const std::vector<float>& weights, std::vector<float>& vertical,
+               std::vector<float>& horizontal) {
+    const auto pivot = std::max_element(weights.begin(), weights.end(),
+                                        [](float a, float b) { return std::abs(a) < std::abs(b); });
+    if (*pivot == 0.0f) {
+        return false;
+    }
+    const int pivot_row = static_cast<int>(pivot - weights.begin()) / size;
+    const int pivot_col = static_cast<int>(pivot - weights.begin()) % size;
+    vertical.resize(size);
+    horizontal.resize(size);
+    for (int i = 0; i < size; ++i) {
+        vertical[i] = weights[i * size + pivot_col];
+        horizontal[i] = weights[pivot_row * size + i] / *pivot;
+    }
+    const float tolerance = 1e-6f * std::abs(*pivot);
+    for (int row = 0; row < size; ++row) {
+        for (int col = 0; col < size; ++col) {
+            if (std::abs(vertical[row] * horizontal[col] - weights[row * size + col]) > tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Слагаемое взвешенной суммы строк: первое записывает dst[i] = weight * src[i], следующие прибавляют
+void AddTerm(bool first, const float* src, float weight, float* dst, int count) {
+    const SimdKernels& simd = GetSimdKernels();
+    if (first) {
+        simd.scale(dst, src, weight, count);
+    } else {
+        simd.axpy(dst, src, weight, count);
+    }
+}
+
+}  // namespace
+
+Convolution::Convolution(int size, std::vector<float> weights, BorderPolicy border)
+    : m_size_(size), m_radius_(size / 2), m_border_(border), m_specialized_(FindSpecializedRow(size, weights)) {
+    for (int row = 0; row < size; ++row) {
+        for (int col = 0; col < size; ++col) {
+            const float weight = weights[row * size + col];
+            if (weight != 0.0f) {
+                m_taps_.push_back(ConvolutionTap{row, col, weight});
+            }
+        }
+    }
+    // Два прохода стоят 2 * size умножений на значение против числа ненулевых весов у прямой свёртки
+    if (!m_specialized_ && border != BorderPolicy::Skip && static_cast<int>(m_taps_.size()) > 2 * size &&
+        !Factorize(size, weights, m_vertical_, m_horizontal_)) {
+        m_vertical_.clear();
+        m_horizontal_.clear();
+    }
+}
+
+int Convolution::Radius() const {
+    return m_radius_;
+}
+
+BorderPolicy Convolution::Border() const {
+    return m_border_;
+}
+
+bool Convolution::Separable() const {
+    return !m_horizontal_.empty();
+}
+
+const char* Convolution::Variant() const {
+    if (m_specialized_) {
+        return "specialized";
+    }
+    return Separable() ? "separable" : "generic";
+}
+
+void Convolution::Row(const float* const* rows, float* dst, int width, int step) const {
+    if (m_specialized_) {
+        m_specialized_(rows, dst, width, step, m_border_);
+        return;
+    }
+    const int begin = std::min(m_radius_, width);
+    const int end = std::max(begin, width - m_radius_);
+    if (end > begin) {
+        float* out = dst + begin * step;
+        const int count = (end - begin) * step;
+        if (m_taps_.empty()) {
+            std::fill(out, out + count, 0.0f);
+        }
+        for (size_t t = 0; t < m_taps_.size(); ++t) {
+            const ConvolutionTap& tap = m_taps_[t];
+            AddTerm(t == 0, rows[tap.row] + (begin + tap.col - m_radius_) * step, tap.weight, out, count);
+        }
+    }
+    if (m_border_ == BorderPolicy::Skip) {
+        return;
+    }
+    auto border_pixel = [&](int x) {
+        for (int c = 0; c < step; ++c) {
+            float acc = 0.0f;
+            for (size_t t = 0; t < m_taps_.size(); ++t) {
+                const int neighbor = BorderIndex(x + m_taps_[t].col - m_radius_, width, m_border_);
+                const float term = m_taps_[t].weight * rows[m_taps_[t].row][neighbor * step + c];
+                acc = t == 0 ? term : acc + term;
+            }
+            dst[x * step + c] = acc;
+        }
+    };
+    for (int x = 0; x < begin; ++x) {
+        border_pixel(x);
+    }
+    for (int x = end; x < width; ++x) {
+        border_pixel(x);
+    }
+}
+
+void Convolution::Horizontal(const float* src, float* dst, int width, int step) const {
+    const int begin = std::min(m_radius_, width);
+    const int end = std::max(begin, width - m_radius_);
+    if (end > begin) {
+        bool first = true;
+        for (int col = 0; col < m_size_; ++col) {
+            if (m_horizontal_[col] != 0.0f) {
+                AddTerm(first, src + (begin + col - m_radius_) * step, m_horizontal_[col], dst + begin * step,
+                        (end - begin) * step);
+                first = false;
+            }
+        }
+    }
+    auto border_pixel = [&](int x) {
+        for (int c = 0; c < step; ++c) {
+            float acc = 0.0f;
+            bool first = true;
+            for (int col = 0; col < m_size_; ++col) {
+                if (m_horizontal_[col] == 0.0f) {
+                    continue;
+                }
+                const int neighbor = BorderIndex(x + col - m_radius_, width, m_border_);
+                const float term = m_horizontal_[col] * src[neighbor * step + c];
+                acc = first ? term : acc + term;
+                first = false;
+            }
+            dst[x * step + c] = acc;
+        }
+    };
+    for (int x = 0; x < begin; ++x) {
+        border_pixel(x);
+    }
+    for (int x = end; x < width; ++x) {
+        border_pixel(x);
+    }
+}
+
+void Convolution::Vertical(const float* const* rows, float* dst, int count) const {
+    bool first = true;
+    for (int row = 0; row < m_size_; ++row) {
+        if (m_vertical_[row] != 0.0f) {
+            AddTerm(first, rows[row], m_vertical_[row], dst, count);
+            first = false;
+        }
+    }
+}
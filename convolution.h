@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Свёртка изображения с квадратным ядром. Ядро известно либо на этапе компиляции (фильтры -sharp, -thermo,
+// -edge), и тогда ConvolutionEngine разворачивает сумму без нулевых весов, либо только во время выполнения
+// (фильтр -conv), и тогда Convolution выбирает специализированный, разделимый или общий вариант.
+// Строки передаются как массивы float, у каждого пикселя step подряд идущих значений: 3 для Color,
+// 1 для плоскости PlanarImage
+
+// Что делать с пикселями, окно которых выходит за край изображения
+enum class BorderPolicy {
+    Clamp,   // за краем повторяется крайний пиксель
+    Mirror,  // отражение относительно крайнего пикселя: -1 -> 1, width -> width - 2
+    Skip,    // такие пиксели не вычисляются, их значение задаёт вызывающий код
+};
+
+// Порядок сложения слагаемых. От него зависит округление, поэтому фильтры сохраняют свой прежний порядок
+enum class TapOrder { RowMajor, ColumnMajor };
+
+// Обработка суммы перед записью
+enum class ConvolutionOutput {
+    Raw,        // как есть
+    Clamp,      // ограничение отрезком [0, 1]
+    Threshold,  // 1, если сумма больше порога, иначе 0
+};
+
+// Индекс строки или столбца за краем изображения размера size по политике границ
+inline int BorderIndex(int index, int size, BorderPolicy border) {
+    if (border == BorderPolicy::Mirror && size > 1) {
+        const int period = 2 * (size - 1);
+        index %= period;
+        if (index < 0) {
+            index += period;
+        }
+        return index < size ? index : period - index;
+    }
+    return std::clamp(index, 0, size - 1);
+}
+
+// Ядро N x N с нечётным N, weights[row][col]; строка 0 - верхний сосед в смысле rows[0] движка
+template <int N>
+struct ConvolutionKernel {
+    static_assert(N % 2 == 1, "Convolution kernel size must be odd");
+    static constexpr int kSize = N;
+    static constexpr int kRadius = N / 2;
+
+    float weights[N][N];
+
+    constexpr int NonZeroTaps() const {
+        int count = 0;
+        for (int row = 0; row < N; ++row) {
+            for (int col = 0; col < N; ++col) {
+                count += weights[row][col] != 0.0f;
+            }
+        }
+        return count;
+    }
+
+    constexpr bool operator==(const ConvolutionKernel&) const = default;
+};
+
+// Ядра встроенных фильтров
+constexpr ConvolutionKernel<3> kSharpeningKernel{{{0, -1, 0}, {-1, 5, -1}, {0, -1, 0}}};
+constexpr ConvolutionKernel<3> kThermoKernel{{{-1, -1, -1}, {-1, 5, -1}, {-1, -1, -1}}};
+constexpr ConvolutionKernel<3> kEdgeDetectionKernel{{{-1, -1, -1}, {-1, 4, -1}, {-1, -1, -1}}};
+
+// Ненулевой вес ядра и его место в окне
+struct ConvolutionTap {
+    int row;
+    int col;
+    float weight;
+};
+
+// Ненулевые веса ядра K в порядке сложения kOrder
+template <const auto& K, TapOrder kOrder>
+constexpr auto NonZeroTaps() {
+    constexpr int n = std::remove_cvref_t<decltype(K)>::kSize;
+    std::array<ConvolutionTap, K.NonZeroTaps()> taps{};
+    int count = 0;
+    for (int outer = 0; outer < n; ++outer) {
+        for (int inner = 0; inner < n; ++inner) {
+            const int row = kOrder == TapOrder::RowMajor ? outer : inner;
+            const int col = kOrder == TapOrder::RowMajor ? inner : outer;
+            if (K.weights[row][col] != 0.0f) {
+                taps[count++] = ConvolutionTap{row, col, K.weights[row][col]};
+            }
+        }
+    }
+    return taps;
+}
+
+// Свёртка с ядром, известным при компиляции. Сумма раскрывается в последовательность умножений на константы
+// без нулевых весов; внутренний цикл идёт по значениям строки и векторизуется компилятором
+template <const auto& K, TapOrder kOrder, ConvolutionOutput kOutput>
+class ConvolutionEngine {
+public:
+    static constexpr int kSize = std::remove_cvref_t<decltype(K)>::kSize;
+    static constexpr int kRadius = std::remove_cvref_t<decltype(K)>::kRadius;
+    static constexpr auto kTaps = NonZeroTaps<K, kOrder>();
+    static_assert(kTaps.size() > 0, "Convolution kernel must have a non-zero weight");
+
+    // Строка результата по kSize строкам исходника: rows[k] - строка со сдвигом k - radius, уже выбранная по
+    // политике границ. Пиксели у левого и правого края при BorderPolicy::Skip не изменяются
+    template <int kStep>
+    static void Row(const float* const* rows, float* dst, int width, BorderPolicy border, float threshold = 0.0f) {
+        const int begin = std::min(kRadius, width);
+        const int end = std::max(begin, width - kRadius);
+        const float* src[kSize];
+        std::copy(rows, rows + kSize, src);
+        for (int i = begin * kStep; i < end * kStep; ++i) {
+            dst[i] = Finish(Sum<kStep>(src, i, std::make_index_sequence<kTaps.size() - 1>()), threshold);
+        }
+        if (border == BorderPolicy::Skip) {
+            return;
+        }
+        auto border_pixel = [&](int x) {
+            for (int c = 0; c < kStep; ++c) {
+                float acc = 0.0f;
+                for (size_t t = 0; t < kTaps.size(); ++t) {
+                    const int neighbor = BorderIndex(x + kTaps[t].col - kRadius, width, border);
+                    const float term = kTaps[t].weight * src[kTaps[t].row][neighbor * kStep + c];
+                    acc = t == 0 ? term : acc + term;
+                }
+                dst[x * kStep + c] = Finish(acc, threshold);
+            }
+        };
+        for (int x = 0; x < begin; ++x) {
+            border_pixel(x);
+        }
+        for (int x = end; x < width; ++x) {
+            border_pixel(x);
+        }
+    }
+
+private:
+    template <int kStep, size_t... T>
+    static float Sum(const float* const* src, int i, std::index_sequence<T...>) {
+        float acc = kTaps[0].weight * src[kTaps[0].row][i + (kTaps[0].col - kRadius) * kStep];
+        ((acc += kTaps[T + 1].weight * src[kTaps[T + 1].row][i + (kTaps[T + 1].col - kRadius) * kStep]), ...);
+        return acc;
+    }
+
+    static float Finish(float acc, float threshold) {
+        if constexpr (kOutput == ConvolutionOutput::Clamp) {
+            return std::min(1.0f, std::max(0.0f, acc));
+        } else if constexpr (kOutput == ConvolutionOutput::Threshold) {
+            return acc > threshold ? 1.0f : 0.0f;
+        } else {
+            return acc;
+        }
+    }
+};
+
+// Свёртка с ядром, заданным во время выполнения (фильтр -conv). Ядра, совпадающие с одним из встроенных,
+// считаются специализированным ConvolutionEngine; разделимые ядра (ранга 1) - двумя одномерными проходами,
+// если так выходит меньше умножений; остальные - общим вариантом, который складывает строки с весами
+// векторными примитивами simd.h. Все три варианта складывают слагаемые по строкам ядра
+class Convolution {
+public:
+    // weights - size * size весов по строкам ядра, size нечётное
+    Convolution(int size, std::vector<float> weights, BorderPolicy border);
+
+    int Radius() const;
+    BorderPolicy Border() const;
+    // Разделимое ядро применяется проходами Horizontal и Vertical вместо Row. При BorderPolicy::Skip
+    // разделение не используется
+    bool Separable() const;
+    // Название выбранного варианта: specialized, separable или generic
+    const char* Variant() const;
+
+    // Строка результата по 2 * radius + 1 строкам исходника, как ConvolutionEngine::Row
+    void Row(const float* const* rows, float* dst, int width, int step) const;
+    // Одномерные проходы разделимого ядра: по строке и по 2 * radius + 1 строкам для count значений
+    void Horizontal(const float* src, float* dst, int width, int step) const;
+    void Vertical(const float* const* rows, float* dst, int count) const;
+
+private:
+    using SpecializedRow = void (*)(const float* const* rows, float* dst, int width, int step, BorderPolicy border);
+
+    int m_size_;
+    int m_radius_;
+    BorderPolicy m_border_;
+    std::vector<ConvolutionTap> m_taps_;
+    SpecializedRow m_specialized_;
+    // Множители разделимого ядра: weights[row][col] = m_vertical_[row] * m_horizontal_[col]
+    std::vector<float> m_horizontal_;
+    std::vector<float> m_vertical_;
+};
@@ -0,0 +1,371 @@
+#include "denoise.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace {
+
+const float kMaxLevel = 255.0f;
+
+// Полос медианы не меньше чем по 4 окна строк: каждая полоса заново набирает 2r + 1 строк в гистограммы
+const int kMedianBandWindows = 4;
+
+// Гаусс с sigma в один шаг сетки: биномиальное ядро 1 4 6 4 1 (дисперсия 1). Нормировка не нужна,
+// результат делится на размытый вес
+const float kGridKernel[] = {1.0f, 4.0f, 6.0f, 4.0f, 1.0f};
+const int kGridRadius = 2;
+// Значений в ячейке сетки: сумма r, g, b и число пикселей
+const int kCellFloats = 4;
+// Строк сетки в полосе не больше kMaxBandCells, а вся память полосы - не больше kGridBandFloats float (32 МБ)
+const int kMaxBandCells = 16;
+const size_t kGridBandFloats = size_t(1) << 23;
+
+int ClampIndex(int index, int size) {
+    return std::min(std::max(index, 0), size - 1);
+}
+
+// Гистограммы медианы по 16 корзин: kernel[i] += added[i] - removed[i] (removed может быть nullptr).
+// Счётчики столбцов - байты, а байтовый указатель может указывать и на kernel, поэтому компилятор сам этот
+// цикл не векторизует: 16 байт как раз один регистр SSE2
+void ShiftCounts(uint16_t* kernel, const uint8_t* added, const uint8_t* removed) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i* kernel_lo = reinterpret_cast<__m128i*>(kernel);
+    __m128i* kernel_hi = reinterpret_cast<__m128i*>(kernel + 8);
+    const __m128i add = _mm_loadu_si128(reinterpret_cast<const __m128i*>(added));
+    __m128i lo = _mm_add_epi16(_mm_loadu_si128(kernel_lo), _mm_unpacklo_epi8(add, zero));
+    __m128i hi = _mm_add_epi16(_mm_loadu_si128(kernel_hi), _mm_unpackhi_epi8(add, zero));
+    if (removed) {
+        const __m128i remove = _mm_loadu_si128(reinterpret_cast<const __m128i*>(removed));
+        lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(remove, zero));
+        hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(remove, zero));
+    }
+    _mm_storeu_si128(kernel_lo, lo);
+    _mm_storeu_si128(kernel_hi, hi);
+#else
+    for (int i = 0; i < 16; ++i) {
+        kernel[i] = static_cast<uint16_t>(kernel[i] + added[i] - (removed ? removed[i] : 0));
+    }
+#endif
+}
+
+// Первая из 16 корзин, на которой накопленная сумма counts вместе с below превышает rank; below увеличивается
+// на сумму корзин до неё. Без SSE2 - обычный поиск с ветвлениями, с ним - префиксные суммы в регистре и одно
+// сравнение: на шумных изображениях корзина медианы меняется от пикселя к пикселю и ветвления не угадываются
+int FindRank(const uint16_t* counts, int rank, int& below) {
+#if defined(__SSE2__)
+    auto prefix = [](__m128i sums) {
+        sums = _mm_add_epi16(sums, _mm_slli_si128(sums, 2));
+        sums = _mm_add_epi16(sums, _mm_slli_si128(sums, 4));
+        return _mm_add_epi16(sums, _mm_slli_si128(sums, 8));
+    };
+    const __m128i lo = prefix(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counts)));
+    const __m128i hi = _mm_add_epi16(prefix(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counts + 8))),
+                                     _mm_set1_epi16(static_cast<int16_t>(_mm_extract_epi16(lo, 7))));
+    // Суммы до 65025 сравниваются без знака: сдвиг на 0x8000 переводит их в знаковые с тем же порядком
+    const __m128i bias = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    const __m128i target = _mm_set1_epi16(static_cast<int16_t>((rank - below) ^ 0x8000));
+    const __m128i above_lo = _mm_cmpgt_epi16(_mm_xor_si128(lo, bias), target);
+    const __m128i above_hi = _mm_cmpgt_epi16(_mm_xor_si128(hi, bias), target);
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(above_lo, above_hi)));
+    const int index = std::countr_zero(mask);
+    if (index > 0) {
+        alignas(16) uint16_t sums[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(sums), lo);
+        _mm_store_si128(reinterpret_cast<__m128i*>(sums + 8), hi);
+        below += sums[index - 1];
+    }
+    return index;
+#else
+    int index = 0;
+    while (below + counts[index] <= rank) {
+        below += counts[index];
+        ++index;
+    }
+    return index;
+#endif
+}
+
+// Яркость, по которой сравниваются пиксели билатерального фильтра: коэффициенты GrayscalePixels
+float Guide(const ChannelView& view, size_t index) {
+    const float gray = 0.299f * view.data[0][index] + 0.587f * view.data[1][index] + 0.114f * view.data[2][index];
+    // NaN - в нижний край, как и значения меньше 0
+    return gray > 0.0f ? std::min(gray, 1.0f) : 0.0f;
+}
+
+// Размытие count блоков по block float ядром kGridKernel: dst[i] - взвешенная сумма src[i - 2..i + 2].
+// За краями сетки ячейки пустые
+void BlurBlocks(const float* src, float* dst, int count, int block) {
+    for (int i = 0; i < count; ++i) {
+        float* out = dst + static_cast<size_t>(i) * block;
+        std::fill(out, out + block, 0.0f);
+        for (int k = std::max(-kGridRadius, -i); k <= std::min(kGridRadius, count - 1 - i); ++k) {
+            const float weight = kGridKernel[k + kGridRadius];
+            const float* in = src + static_cast<size_t>(i + k) * block;
+            for (int t = 0; t < block; ++t) {
+                out[t] += weight * in[t];
+            }
+        }
+    }
+}
+
+}  // namespace
+
+unsigned char QuantizeLevel(float value) {
+    return static_cast<unsigned char>((value > 0.0f ? std::min(value, 1.0f) : 0.0f) * kMaxLevel);
+}
+
+float LevelValue(unsigned char level) {
+    return static_cast<float>(level) / kMaxLevel;
+}
+
+MedianWindow::MedianWindow(int width, int channels, int radius)
+    : m_width_(width),
+      m_channels_(channels),
+      m_radius_(radius),
+      m_column_coarse_(static_cast<size_t>(width) * channels * kCoarse),
+      m_column_fine_(static_cast<size_t>(width) * channels * kCoarse * kFine),
+      m_kernel_coarse_(kCoarse),
+      m_kernel_fine_(kCoarse * kFine),
+      m_fine_column_(kCoarse) {
+}
+
+void MedianWindow::UpdateColumns(const unsigned char* row, int delta) {
+    const int count = m_width_ * m_channels_;
+    for (int i = 0; i < count; ++i) {
+        const int level = row[i];
+        uint8_t& fine = m_column_fine_[static_cast<size_t>(i) * kCoarse * kFine + level];
+        uint8_t& coarse = m_column_coarse_[static_cast<size_t>(i) * kCoarse + level / kFine];
+        fine = static_cast<uint8_t>(fine + delta);
+        coarse = static_cast<uint8_t>(coarse + delta);
+    }
+}
+
+void MedianWindow::AddRow(const unsigned char* row) {
+    UpdateColumns(row, 1);
+}
+
+void MedianWindow::RemoveRow(const unsigned char* row) {
+    UpdateColumns(row, -1);
+}
+
+void MedianWindow::MedianRow(unsigned char* dst) {
+    const int radius = m_radius_;
+    const int window = 2 * radius + 1;
+    // Номер медианы среди (2r + 1)^2 значений окна, считая с нуля
+    const int rank = window * window / 2;
+    uint16_t* kernel_coarse = m_kernel_coarse_.data();
+    for (int c = 0; c < m_channels_; ++c) {
+        auto column = [&](int x) { return static_cast<size_t>(ClampIndex(x, m_width_)) * m_channels_ + c; };
+        auto coarse = [&](int x) { return &m_column_coarse_[column(x) * kCoarse]; };
+        auto fine = [&](int x, int part) { return &m_column_fine_[(column(x) * kCoarse + part) * kFine]; };
+        std::fill(kernel_coarse, kernel_coarse + kCoarse, 0);
+        for (int dx = -radius; dx <= radius; ++dx) {
+            ShiftCounts(kernel_coarse, coarse(dx), nullptr);
+        }
+        // Точные части ядра в начале строки не набраны
+        std::fill(m_fine_column_.begin(), m_fine_column_.end(), INT_MIN / 2);
+
+        for (int x = 0; x < m_width_; ++x) {
+            // Гистограммы сдвигаются на столбец: прибавляется входящий столбец, вычитается вышедший
+            if (x > 0) {
+                ShiftCounts(kernel_coarse, coarse(x + radius), coarse(x - radius - 1));
+            }
+            int below = 0;
+            const int part = FindRank(kernel_coarse, rank, below);
+
+            // Точную часть догоняем до столбца x. Если с прошлого обновления пройдено больше r столбцов,
+            // дешевле набрать её заново: 2r + 1 сложений против двух на каждый пройденный столбец
+            uint16_t* kernel_fine = &m_kernel_fine_[part * kFine];
+            const int updated = m_fine_column_[part];
+            if (x - updated > radius) {
+                std::fill(kernel_fine, kernel_fine + kFine, 0);
+                for (int dx = -radius; dx <= radius; ++dx) {
+                    ShiftCounts(kernel_fine, fine(x + dx, part), nullptr);
+                }
+            } else {
+                for (int next = updated + 1; next <= x; ++next) {
+                    ShiftCounts(kernel_fine, fine(next + radius, part), fine(next - radius - 1, part));
+                }
+            }
+            m_fine_column_[part] = x;
+
+            const int level = FindRank(kernel_fine, rank, below);
+            dst[static_cast<size_t>(x) * m_channels_ + c] = static_cast<unsigned char>(part * kFine + level);
+        }
+    }
+}
+
+void MedianFilter(int width, int height, int channels, int radius,
+                  const std::function<const unsigned char*(int y)>& src,
+                  const std::function<void(int y, const unsigned char* median)>& row_done) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    // Гистограммы окна - точные мультимножества значений, поэтому результат от разбиения на полосы не зависит
+    const int bands =
+        std::clamp(height / (kMedianBandWindows * (2 * radius + 1)), 1, GetThreadPool().Size());
+    ParallelFor(bands, 1, [&](int begin, int end) {
+        std::vector<unsigned char> median(static_cast<size_t>(width) * channels);
+        for (int band = begin; band < end; ++band) {
+            const int first = static_cast<int>(static_cast<long long>(height) * band / bands);
+            const int last = static_cast<int>(static_cast<long long>(height) * (band + 1) / bands);
+            MedianWindow window(width, channels, radius);
+            for (int dy = -radius; dy <= radius; ++dy) {
+                window.AddRow(src(ClampIndex(first + dy, height)));
+            }
+            for (int y = first; y < last; ++y) {
+                if (y > first) {
+                    window.RemoveRow(src(ClampIndex(y - radius - 1, height)));
+                    window.AddRow(src(ClampIndex(y + radius, height)));
+                }
+                window.MedianRow(median.data());
+                row_done(y, median.data());
+            }
+        }
+    });
+}
+
+void BilateralFilter(const ChannelView& src, const ChannelView& dst, int width, int height, float sigma_spatial,
+                     float sigma_range, const std::function<void(int y)>& row_done) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    const float spatial_scale = 1.0f / sigma_spatial;
+    const float range_scale = 1.0f / sigma_range;
+    // Координаты пикселей в сетке: узел сетки i стоит в пикселе i * sigma_spatial. Пиксель суммируется
+    // в ближайший узел, а при интерполяции попадает между узлами cell и cell + 1
+    auto grid_axis = [spatial_scale](int size, std::vector<int>& nearest, std::vector<int>& cell,
+                                     std::vector<float>& fraction) {
+        nearest.resize(size);
+        cell.resize(size);
+        fraction.resize(size);
+        for (int i = 0; i < size; ++i) {
+            const float position = static_cast<float>(i) * spatial_scale;
+            nearest[i] = static_cast<int>(std::lround(position));
+            cell[i] = static_cast<int>(position);
+            fraction[i] = position - static_cast<float>(cell[i]);
+        }
+        return cell[size - 1] + 2;
+    };
+    std::vector<int> nearest_x;
+    std::vector<int> cell_x;
+    std::vector<float> fraction_x;
+    std::vector<int> nearest_y;
+    std::vector<int> cell_y;
+    std::vector<float> fraction_y;
+    const int grid_width = grid_axis(width, nearest_x, cell_x, fraction_x);
+    const int grid_height = grid_axis(height, nearest_y, cell_y, fraction_y);
+    const int grid_depth = static_cast<int>(range_scale) + 2;
+
+    const size_t row_floats = static_cast<size_t>(grid_width) * grid_depth * kCellFloats;
+    // Полоса из band_cells строк сетки держит band_cells + 1 размытых строк и band_cells + 5 исходных
+    const size_t budget_cells = kGridBandFloats / row_floats;
+    const int band_cells = std::clamp(static_cast<int>(std::min<size_t>(budget_cells, INT_MAX) / 2) - 3, 1,
+                                      kMaxBandCells);
+    const int slice_cells = cell_y[height - 1] + 1;
+    const int bands = (slice_cells + band_cells - 1) / band_cells;
+
+    ParallelFor(bands, 1, [&](int begin, int end) {
+        std::vector<float> raw((band_cells + 1 + 2 * kGridRadius) * row_floats);
+        std::vector<float> blurred((band_cells + 1) * row_floats);
+        std::vector<float> temporary(row_floats);
+        for (int band = begin; band < end; ++band) {
+            // Строки результата полосы интерполируются между узлами first..last, для их размытия нужны
+            // исходные строки сетки raw_first..raw_last
+            const int first = band * band_cells;
+            const int last = std::min(first + band_cells, grid_height - 1);
+            const int raw_first = std::max(first - kGridRadius, 0);
+            const int raw_last = std::min(last + kGridRadius, grid_height - 1);
+            auto raw_row = [&](int j) { return &raw[(j - raw_first) * row_floats]; };
+
+            std::fill(raw.begin(), raw.begin() + (raw_last - raw_first + 1) * row_floats, 0.0f);
+            const int y_begin =
+                static_cast<int>(std::lower_bound(nearest_y.begin(), nearest_y.end(), raw_first) - nearest_y.begin());
+            const int y_end =
+                static_cast<int>(std::upper_bound(nearest_y.begin(), nearest_y.end(), raw_last) - nearest_y.begin());
+            for (int y = y_begin; y < y_end; ++y) {
+                float* grid_row = raw_row(nearest_y[y]);
+                for (int x = 0; x < width; ++x) {
+                    const size_t index = static_cast<size_t>(y) * src.stride + static_cast<size_t>(x) * src.step;
+                    const int depth = static_cast<int>(std::lround(Guide(src, index) * range_scale));
+                    float* cell = grid_row + (static_cast<size_t>(nearest_x[x]) * grid_depth + depth) * kCellFloats;
+                    cell[0] += src.data[0][index];
+                    cell[1] += src.data[1][index];
+                    cell[2] += src.data[2][index];
+                    cell[3] += 1.0f;
+                }
+            }
+
+            // Размытие по яркости и по x внутри строк сетки, затем по y между строками
+            for (int j = raw_first; j <= raw_last; ++j) {
+                float* grid_row = raw_row(j);
+                const int depth_floats = grid_depth * kCellFloats;
+                for (int i = 0; i < grid_width; ++i) {
+                    BlurBlocks(grid_row + i * depth_floats, temporary.data() + i * depth_floats, grid_depth,
+                               kCellFloats);
+                }
+                BlurBlocks(temporary.data(), grid_row, grid_width, depth_floats);
+            }
+            for (int j = first; j <= last; ++j) {
+                float* out = &blurred[(j - first) * row_floats];
+                std::fill(out, out + row_floats, 0.0f);
+                for (int k = std::max(-kGridRadius, -j); k <= std::min(kGridRadius, grid_height - 1 - j); ++k) {
+                    const float weight = kGridKernel[k + kGridRadius];
+                    const float* in = raw_row(j + k);
+                    for (size_t t = 0; t < row_floats; ++t) {
+                        out[t] += weight * in[t];
+                    }
+                }
+            }
+
+            const int slice_begin =
+                static_cast<int>(std::lower_bound(cell_y.begin(), cell_y.end(), first) - cell_y.begin());
+            const int slice_end =
+                static_cast<int>(std::lower_bound(cell_y.begin(), cell_y.end(), first + band_cells) - cell_y.begin());
+            const size_t depth_stride = kCellFloats;
+            const size_t x_stride = static_cast<size_t>(grid_depth) * kCellFloats;
+            for (int y = slice_begin; y < slice_end; ++y) {
+                const float* grid_row = &blurred[(cell_y[y] - first) * row_floats];
+                const float fy = fraction_y[y];
+                for (int x = 0; x < width; ++x) {
+                    const size_t index = static_cast<size_t>(y) * src.stride + static_cast<size_t>(x) * src.step;
+                    const float position = Guide(src, index) * range_scale;
+                    const int depth = static_cast<int>(position);
+                    const float fz = position - static_cast<float>(depth);
+                    const float fx = fraction_x[x];
+                    const float* corner = grid_row + cell_x[x] * x_stride + depth * depth_stride;
+                    float sum[kCellFloats] = {};
+                    for (int dy = 0; dy < 2; ++dy) {
+                        for (int dx = 0; dx < 2; ++dx) {
+                            for (int dz = 0; dz < 2; ++dz) {
+                                const float weight = (dy ? fy : 1.0f - fy) * (dx ? fx : 1.0f - fx) *
+                                                     (dz ? fz : 1.0f - fz);
+                                const float* cell = corner + dy * row_floats + dx * x_stride + dz * depth_stride;
+                                for (int t = 0; t < kCellFloats; ++t) {
+                                    sum[t] += weight * cell[t];
+                                }
+                            }
+                        }
+                    }
+                    // Пиксель сам лежит в ближайшем узле с весом интерполяции не меньше 1/8, так что sum[3] > 0
+                    const size_t out = static_cast<size_t>(y) * dst.stride + static_cast<size_t>(x) * dst.step;
+                    for (int c = 0; c < 3; ++c) {
+                        dst.data[c][out] = sum[c] / sum[3];
+                    }
+                }
+                if (row_done) {
+                    row_done(y);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Нелинейные фильтры шумоподавления: медианный (-median) и билатеральный (-bilateral). Время обоих на пиксель
+// не растёт с радиусом.
+
+// Наибольший радиус медианы: в гистограмме столбца не больше 2r + 1 = 255 значений, они помещаются в байт
+const int kMaxMedianRadius = 127;
+
+// Значение канала в уровнях 0..255 так же, как при записи в файл: clamp(value, 0, 1) * 255 с отбрасыванием
+// дробной части, и обратно: level / 255
+unsigned char QuantizeLevel(float value);
+float LevelValue(unsigned char level);
+
+// Скользящее окно медианы (Perreault, Hebert): у каждого столбца гистограмма значений 2r + 1 строк окна,
+// у ядра - сумма гистограмм 2r + 1 столбцов. Гистограммы двухуровневые: 16 грубых корзин по 16 уровней.
+// Грубая гистограмма ядра сдвигается на каждом пикселе, точная - только у той грубой корзины, где лежит
+// медиана, и только на столбцы, пройденные с её прошлого обновления. Поэтому время на пиксель не зависит от r.
+// За краями изображения повторяются крайние строки и столбцы. Значения - уровни 0..255, по channels на
+// пиксель, каналы независимы
+class MedianWindow {
+public:
+    MedianWindow(int width, int channels, int radius);
+
+    // Добавляет строку в гистограммы столбцов или убирает её оттуда
+    void AddRow(const unsigned char* row);
+    void RemoveRow(const unsigned char* row);
+    // Медианы окон с центрами в пикселях строки, по строкам, добавленным сейчас
+    void MedianRow(unsigned char* dst);
+
+private:
+    // Корзин в грубой гистограмме и уровней в каждой из них
+    static const int kCoarse = 16;
+    static const int kFine = 16;
+
+    void UpdateColumns(const unsigned char* row, int delta);
+
+    int m_width_;
+    int m_channels_;
+    int m_radius_;
+    // Гистограммы столбцов: у значения i = x * channels + c грубая - 16 байт с 16 * i, точная - 256 байт с 256 * i
+    std::vector<uint8_t> m_column_coarse_;
+    std::vector<uint8_t> m_column_fine_;
+    // Гистограммы ядра одного канала и столбец, на котором обновлялась каждая часть точной
+    std::vector<uint16_t> m_kernel_coarse_;
+    std::vector<uint16_t> m_kernel_fine_;
+    std::vector<int> m_fine_column_;
+};
+
+// Медианный фильтр радиуса r изображения из уровней 0..255: src(y) - строка входа, row_done(y, median) получает
+// готовую строку результата. Строки делятся на полосы между потоками, у каждой полосы своё окно; входные
+// строки не должны меняться, пока фильтр работает
+void MedianFilter(int width, int height, int channels, int radius,
+                  const std::function<const unsigned char*(int y)>& src,
+                  const std::function<void(int y, const unsigned char* median)>& row_done);
+
+// Ячеек сетки билатерального фильтра на пиксель изображения - 1 / (sigma_spatial^2 * sigma_range). Размытие
+// сетки стоит около сотни операций на ячейку, поэтому при более частой сетке приближение теряет смысл
+const float kMaxBilateralCellsPerPixel = 4.0f;
+
+// Три канала изображения во float: значение канала c пикселя x строки y - data[c][y * stride + x * step].
+// У Color каналы идут через 3 значения (step 3), у плоскостей PlanarImage - подряд (step 1)
+struct ChannelView {
+    float* data[3];
+    int step;
+    int stride;
+};
+
+// Билатеральный фильтр приближением сеткой (Chen, Paris, Durand): пиксели суммируются в трёхмерную сетку
+// (x / sigma_spatial, y / sigma_spatial, яркость / sigma_range), сетка размывается гауссом в один шаг по каждой
+// оси, результат пикселя - трилинейная интерполяция сетки в его точке. Яркость - та же взвешенная сумма каналов,
+// что у -gs, ограниченная [0, 1]. Время на пиксель не растёт с sigma_spatial, память сетки ограничена:
+// она строится полосами строк с запасом на размытие, результат от разбиения на полосы не зависит.
+// src и dst - разные буферы; row_done(y) вызывается, когда строка y результата готова
+void BilateralFilter(const ChannelView& src, const ChannelView& dst, int width, int height, float sigma_spatial,
+                     float sigma_range, const std::function<void(int y)>& row_done);
@@ -0,0 +1,187 @@
+#include "graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+#include "profile.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Узел дерева префиксов цепочек: один фильтр, дети - различные продолжения цепочек после него
+struct PrefixNode {
+    FilterInfo filter;
+    bool valid = true;
+    std::vector<int> children;
+    std::vector<size_t> outputs;
+};
+
+bool SameFilter(const FilterInfo& left, const FilterInfo& right) {
+    return left.name == right.name && left.arguments == right.arguments;
+}
+
+// Сжимает участки дерева префиксов без ветвлений в узлы графа: узел заканчивается там, где цепочки
+// расходятся или где заканчивается цепочка одного из выходов
+void AddBranches(const std::vector<PrefixNode>& prefixes, int prefix, int parent, FilterGraph& graph) {
+    for (int start : prefixes[prefix].children) {
+        std::vector<FilterInfo> filters;
+        int end = start;
+        while (true) {
+            if (prefixes[end].valid) {
+                filters.push_back(prefixes[end].filter);
+            }
+            if (prefixes[end].children.size() != 1 || !prefixes[end].outputs.empty()) {
+                break;
+            }
+            end = prefixes[end].children.front();
+        }
+        GraphNode node;
+        node.parent = parent;
+        node.plan = PlanPipeline(filters);
+        node.outputs = prefixes[end].outputs;
+        const int index = static_cast<int>(graph.nodes.size());
+        graph.nodes.push_back(node);
+        graph.nodes[parent].children.push_back(index);
+        AddBranches(prefixes, end, index, graph);
+    }
+}
+
+// Результат узла, общий для его потребителей - выходов и дочерних узлов. Буфер освобождается, когда его
+// отпускает последний потребитель; потребитель, оставшийся последним, забирает буфер без копирования
+class SharedResult {
+public:
+    SharedResult(Image image, int users) : m_image_(std::move(image)), m_users_(users) {
+    }
+
+    const Image& Get() const {
+        return m_image_;
+    }
+
+    // Изображение, которое потребитель может менять. Отпускает результат
+    Image Take() {
+        if (m_users_.load(std::memory_order_acquire) == 1) {
+            m_users_.store(0, std::memory_order_relaxed);
+            return std::move(m_image_);
+        }
+        StageTimer copy_timer("Graph copy");
+        Image copy = m_image_;
+        copy_timer.Finish(static_cast<double>(copy.Width()) * copy.Height(),
+                          2.0 * copy.Width() * copy.Height() * sizeof(Color));
+        Release();
+        return copy;
+    }
+
+    void Release() {
+        if (m_users_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_image_ = Image(0, 0);
+        }
+    }
+
+private:
+    Image m_image_;
+    std::atomic<int> m_users_;
+};
+
+void RunNode(const FilterGraph& graph, int index, Image image,
+             const std::function<void(size_t output, const Image& image)>& save) {
+    const GraphNode& node = graph.nodes[index];
+    ExecutePipeline(image, node.plan);
+
+    // Выходы идут раньше дочерних узлов: при последовательном выполнении последний дочерний узел
+    // забирает буфер себе
+    const int outputs = static_cast<int>(node.outputs.size());
+    const int users = outputs + static_cast<int>(node.children.size());
+    SharedResult result(std::move(image), users);
+    ParallelFor(users, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            if (i < outputs) {
+                save(node.outputs[i], result.Get());
+                result.Release();
+            } else {
+                RunNode(graph, node.children[i - outputs], result.Take(), save);
+            }
+        }
+    });
+}
+
+}  // namespace
+
+FilterGraph BuildFilterGraph(const std::vector<GraphOutput>& outputs) {
+    FilterGraph graph;
+    std::vector<PrefixNode> prefixes(1);
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        int current = 0;
+        std::vector<FilterInfo> valid;
+        for (const auto& filter : outputs[i].filters) {
+            const auto& children = prefixes[current].children;
+            auto next = std::find_if(children.begin(), children.end(),
+                                     [&](int child) { return SameFilter(prefixes[child].filter, filter); });
+            if (next != children.end()) {
+                current = *next;
+            } else {
+                PrefixNode prefix;
+                prefix.filter = filter;
+                FilterInfo checked = filter;
+                std::string error;
+                if (!CheckFilter(checked, error)) {
+                    std::cerr << "Error: " << error << std::endl;
+                    prefix.valid = false;
+                }
+                prefixes.push_back(prefix);
+                prefixes[current].children.push_back(static_cast<int>(prefixes.size()) - 1);
+                current = static_cast<int>(prefixes.size()) - 1;
+            }
+            if (prefixes[current].valid) {
+                valid.push_back(filter);
+            }
+        }
+        prefixes[current].outputs.push_back(i);
+        graph.output_plans.push_back(PlanPipeline(valid));
+    }
+
+    graph.nodes.emplace_back();
+    graph.nodes.front().outputs = prefixes.front().outputs;
+    AddBranches(prefixes, 0, 0, graph);
+    return graph;
+}
+
+ImageRegion InputRegion(const FilterGraph& graph) {
+    ImageRegion region{0, 0};
+    for (const auto& plan : graph.output_plans) {
+        const ImageRegion needed = InputRegion(plan);
+        region.width = std::max(region.width, needed.width);
+        region.height = std::max(region.height, needed.height);
+    }
+    return region;
+}
+
+void ExplainFilterGraph(const FilterGraph& graph, const std::vector<GraphOutput>& outputs, std::ostream& out) {
+    out << "Filter graph: " << outputs.size() << " output(s), " << graph.nodes.size() - 1
+        << " node(s) after the input, each computed once\n";
+    for (size_t i = 0; i < graph.nodes.size(); ++i) {
+        const GraphNode& node = graph.nodes[i];
+        if (i == 0 && node.outputs.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            out << "Input";
+        } else if (node.parent == 0) {
+            out << "Node " << i << " (from the input)";
+        } else {
+            out << "Node " << i << " (from node " << node.parent << ")";
+        }
+        for (size_t j = 0; j < node.outputs.size(); ++j) {
+            out << (j == 0 ? " -> " : ", ") << outputs[node.outputs[j]].path;
+        }
+        out << "\n";
+        if (i > 0) {
+            ExplainPipeline(node.plan, out);
+        }
+    }
+}
+
+void ExecuteFilterGraph(Image image, const FilterGraph& graph,
+                        const std::function<void(size_t output, const Image& image)>& save) {
+    RunNode(graph, 0, std::move(image), save);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "pipeline.h"
+
+// Несколько результатов из одного входа (--output): цепочки фильтров выходов собираются в дерево, одинаковые
+// начала цепочек становятся общими узлами и считаются один раз. Вход читается один раз, независимые ветви
+// выполняются параллельно, а результат узла освобождается, как только его забрал последний потребитель.
+// Результат выхода совпадает с отдельным запуском его цепочки. Исключение - ветвление сразу после -lut:
+// поточечные фильтры ветвей применяются отдельно, а не через его таблицу, и уровни могут отличаться на 1.
+
+// Выход: файл и цепочка фильтров от входного изображения до него
+struct GraphOutput {
+    std::string path;
+    std::vector<FilterInfo> filters;
+};
+
+// Узел - участок цепочек без ветвлений, его план выполняется над результатом родителя.
+// Узел 0 - входное изображение, его план пуст
+struct GraphNode {
+    int parent = -1;
+    std::vector<PipelineStage> plan;
+    std::vector<int> children;
+    // Выходы, результат которых - результат этого узла
+    std::vector<size_t> outputs;
+};
+
+struct FilterGraph {
+    std::vector<GraphNode> nodes;
+    // План всей цепочки каждого выхода: для сообщений фильтров и области интереса
+    std::vector<std::vector<PipelineStage>> output_plans;
+};
+
+// Строит граф. Фильтры считаются одинаковыми при совпадении имени и параметров в исходном виде.
+// Неизвестные фильтры и фильтры с неверными параметрами пропускаются с сообщением об ошибке, по одному
+// сообщению на узел
+FilterGraph BuildFilterGraph(const std::vector<GraphOutput>& outputs);
+
+// Часть входа, нужная всем выходам: наибольшая из областей интереса их цепочек
+ImageRegion InputRegion(const FilterGraph& graph);
+
+// Печатает узлы графа с их планами (для --explain)
+void ExplainFilterGraph(const FilterGraph& graph, const std::vector<GraphOutput>& outputs, std::ostream& out);
+
+// Выполняет граф над входным изображением без вывода сообщений фильтров. save(output, image) получает
+// результат выхода с номером output; вызовы для разных выходов идут параллельно из разных потоков
+void ExecuteFilterGraph(Image image, const FilterGraph& graph,
+                        const std::function<void(size_t output, const Image& image)>& save);
@@ -1,87 +1,191 @@
 #include "image.h"
 
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <utility>
+
+#include "blur.h"
+#include "bmp.h"
+#include "convolution.h"
+#include "denoise.h"
+#include "resample.h"
+#include "simd.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "tiling.h"
+
+namespace {
+
+// Минимальные размеры кусков работы для пула потоков
+const int kRowGrain = 8;
+const int kPixelGrain = 1 << 14;
+
+}  // namespace
+
 Color::Color() : r(0), g(0), b(0) {
 }
 
 Color::Color(float r, float g, float b) : r(r), g(g), b(b) {
 }
 
-Color::~Color() {
+Image::Image(int width, int height)
+    : m_width_(width),
+      m_height_(height),
+      m_stride_(width),
+      m_offset_(0),
+      m_colors_(std::vector<Color>(width * height)) {
 }
 
-Image::Image(int width, int height)
-    : m_width_(width), m_height_(height), m_colors_(std::vector<Color>(width * height)) {
+Image::Image(const Image& other) : Image(other.m_width_, other.m_height_) {
+    // Копируется только видимая часть, без буфера для промежуточных результатов
+    for (int y = 0; y < m_height_; ++y) {
+        std::copy(other.Row(y), other.Row(y) + m_width_, Row(y));
+    }
+}
+
+Image& Image::operator=(const Image& other) {
+    if (this != &other) {
+        Image copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
 }
 
 Image::~Image() {
 }
 
 Color Image::GetColor(int x, int y) const {
-    return m_colors_[y * m_width_ + x];
+    return Row(y)[x];
+}
+
+int Image::Width() const {
+    return m_width_;
+}
+
+int Image::Height() const {
+    return m_height_;
+}
+
+Color* Image::Row(int y) {
+    return m_colors_.data() + m_offset_ + static_cast<size_t>(y) * m_stride_;
+}
+
+const Color* Image::Row(int y) const {
+    return m_colors_.data() + m_offset_ + static_cast<size_t>(y) * m_stride_;
+}
+
+int Image::Stride() const {
+    return m_stride_;
+}
+
+std::vector<Color>& Image::PrepareScratch() {
+    // resize не уменьшает ёмкость, поэтому после первого фильтра буфер больше не выделяется
+    m_scratch_.resize(static_cast<size_t>(m_width_) * m_height_);
+    return m_scratch_;
 }
 
-void Image::Read(const char* path) {
+void Image::SwapScratch() {
+    m_colors_.swap(m_scratch_);
+    m_stride_ = m_width_;
+    m_offset_ = 0;
+}
+
+bool Image::Read(const char* path) {
+    std::string error;
+    if (!Load(path, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    std::cout << "File read\n";
+    return true;
+}
 
+bool Image::Load(const char* path, std::string& error) {
+    return Load(path, INT_MAX, INT_MAX, error);
+}
+
+bool Image::Load(std::istream& f, std::string& error) {
+    return Load(f, INT_MAX, INT_MAX, error);
+}
+
+bool Image::Load(const char* path, int max_width, int max_height, std::string& error) {
     std::ifstream f;
     f.open(path, std::ios::in | std::ios::binary);
 
     if (!f.is_open()) {
-        std::cout << "This file cannot be opened" << std::endl;
-        return;
+        error = "This file cannot be opened";
+        return false;
     }
+    return Load(f, max_width, max_height, error);
+}
 
-    const int file_header_size = 14;
-    const int information_header_size = 40;
+bool Image::Load(std::istream& f, int max_width, int max_height, std::string& error) {
+    BmpInfo info;
+    if (!ReadBmpHeader(f, info, error)) {
+        return false;
+    }
 
-    unsigned char file_header[file_header_size];
-    f.read(reinterpret_cast<char*>(file_header), file_header_size);
+    // Декодируем в промежуточный буфер, чтобы при ошибке изображение осталось нетронутым.
+    // Левый верхний угол - это верхние строки, в хранении снизу вверх они последние
+    const int width = std::min(info.width, max_width);
+    const int height = std::min(info.height, max_height);
+    const int first_row = info.height - height;
+    std::vector<Color>& colors = m_scratch_;
+    colors.resize(static_cast<size_t>(width) * height);
+    const bool read = ReadBmpRows(
+        f, info, first_row, info.height,
+        [&](int y, const unsigned char* row) {
+            UnpackBmpRow(info, row, colors.data() + static_cast<size_t>(y - first_row) * width, width);
+        },
+        error);
+    if (!read) {
+        return false;
+    }
 
-    if (file_header[0] != 'B' || file_header[1] != 'M') {
-        std::cout << "This path does not lead to a bitmap image" << std::endl;
-        f.close();
-        return;
+    m_width_ = width;
+    m_height_ = height;
+    SwapScratch();
+    return true;
+}
+
+void GrayscalePixels(Color* pixels, int count) {
+    for (int i = 0; i < count; ++i) {
+        const float red = 0.299f;
+        const float green = 0.587f;
+        const float blue = 0.114f;
+        float gray = red * pixels[i].r + green * pixels[i].g + blue * pixels[i].b;
+        pixels[i].r = gray;
+        pixels[i].g = gray;
+        pixels[i].b = gray;
     }
+}
 
-    unsigned char information_header[information_header_size];
-    f.read(reinterpret_cast<char*>(information_header), information_header_size);
-    const unsigned char index_1 = 5;
-    const unsigned char value_1 = 8;
-    const unsigned char index_2 = 6;
-    const unsigned char value_2 = 16;
-    const unsigned char index_3 = 7;
-    const unsigned char value_3 = 24;
-    m_width_ = information_header[4] + (information_header[index_1] << value_1) +
-               (information_header[index_2] << value_2) + (information_header[index_3] << value_3);
-    const unsigned char index_4 = 8;
-    const unsigned char index_5 = 9;
-    const unsigned char index_6 = 10;
-    const unsigned char index_7 = 11;
-    m_height_ = information_header[index_4] + (information_header[index_5] << value_1) +
-                (information_header[index_6] << value_2) + (information_header[index_7] << value_3);
-
-    m_colors_.resize(m_width_ * m_height_);
-
-    const int padding_amount = ((4 - (m_width_ * 3) % 4) % 4);
+void NegativePixels(Color* pixels, int count) {
+    // Каналы не различаются, поэтому отрезок обрабатывается как сплошной массив float
+    GetSimdKernels().negative(&pixels[0].r, count * 3);
+}
 
-    for (int y = 0; y < m_height_; ++y) {
-        for (int x = 0; x < m_width_; ++x) {
-            unsigned char color[3];
-            f.read(reinterpret_cast<char*>(color), 3);
-            const float max_color = 255.0f;
-            m_colors_[y * m_width_ + x].r = static_cast<float>(color[2]) / max_color;
-            m_colors_[y * m_width_ + x].g = static_cast<float>(color[1]) / max_color;
-            m_colors_[y * m_width_ + x].b = static_cast<float>(color[0]) / max_color;
+void Image::ApplyPointOp(const PointOp& op) {
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            op(Row(y), m_width_);
         }
+    });
+}
 
-        f.ignore(padding_amount);
+// Эпилог для крайних строк, которые фильтры 3x3 не обрабатывают в основном цикле
+void Image::ApplyBorderEpilogue(std::vector<Color>& colors, const PointOp& epilogue) const {
+    if (!epilogue || m_height_ == 0) {
+        return;
+    }
+    epilogue(&colors[0], m_width_);
+    if (m_height_ > 1) {
+        epilogue(&colors[static_cast<size_t>(m_height_ - 1) * m_width_], m_width_);
     }
-
-    f.close();
-
-    std::cout << "File read\n";
 }
 
-void Image::Crop(int new_width, int new_height) {
+void Image::Crop(int new_width, int new_height, const PointOp& epilogue) {
     if (new_width > m_width_ || new_height > m_height_) {
         // Если запрошенные ширина или высота превышают размеры исходного изображения,
         // выдаем доступную часть изображения
@@ -89,348 +193,504 @@ void Image::Crop(int new_width, int new_height) {
         new_height = std::min(new_height, m_height_);
     }
 
-    std::vector<Color> cropped_colors(new_width * new_height);
-
     // Определяем координаты левого нижнего угла для обрезки
     int start_x = 0;
     int start_y = m_height_ - new_height;
 
-    // Копируем нужную часть изображения в новый буфер
-    for (int y = 0; y < new_height; ++y) {
-        for (int x = 0; x < new_width; ++x) {
-            cropped_colors[y * new_width + x] = m_colors_[(start_y + y) * m_width_ + (start_x + x)];
-        }
+    // Пиксели не копируются: изображение становится окном в прежний буфер.
+    // Следующий фильтр по окрестности запишет результат в компактный буфер
+    m_offset_ += static_cast<size_t>(start_y) * m_stride_ + start_x;
+    m_width_ = new_width;
+    m_height_ = new_height;
+
+    if (epilogue) {
+        ApplyPointOp(epilogue);
     }
+}
 
-    // Обновляем размеры и цвета изображения
+void Image::Resize(int new_width, int new_height, const PointOp& epilogue) {
+    // Масштабирование сепарабельно: по строкам в промежуточный буфер, затем по столбцам в основной.
+    // Исходные пиксели после первого прохода не нужны, поэтому основной буфер переиспользуется под результат
+    const ResampleWeights horizontal = LanczosWeights(m_width_, new_width);
+    const ResampleWeights vertical = LanczosWeights(m_height_, new_height);
+    const int row_floats = new_width * 3;
+    m_scratch_.resize(static_cast<size_t>(new_width) * m_height_);
+    auto temporary_row = [&](int y) { return &m_scratch_[static_cast<size_t>(y) * new_width].r; };
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            ResampleRowHorizontal(&Row(y)[0].r, temporary_row(y), horizontal, 3);
+        }
+    });
+
+    m_colors_.resize(static_cast<size_t>(new_width) * new_height);
     m_width_ = new_width;
     m_height_ = new_height;
-    m_colors_ = cropped_colors;
+    m_stride_ = new_width;
+    m_offset_ = 0;
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(vertical.taps);
+        for (int y = begin; y < end; ++y) {
+            for (int k = 0; k < vertical.taps; ++k) {
+                rows[k] = temporary_row(vertical.first[y] + k);
+            }
+            const float* weights = &vertical.weights[static_cast<size_t>(y) * vertical.taps];
+            ResampleRowsVertical(rows.data(), weights, vertical.taps, &Row(y)[0].r, row_floats);
+            if (epilogue) {
+                epilogue(Row(y), m_width_);
+            }
+        }
+    });
+}
 
-    std::cout << "File was cropped\n";
+Image Image::Downsample2x() const {
+    Image result(HalfSize(m_width_), HalfSize(m_height_));
+    ParallelFor(result.m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const Color* up = Row(2 * y);
+            const Color* down = Row(std::min(2 * y + 1, m_height_ - 1));
+            DownsampleRows2x(&up[0].r, &down[0].r, &result.Row(y)[0].r, m_width_, 3);
+        }
+    });
+    return result;
 }
 
 void Image::Grayscale() {
-    for (int i = 0; i < m_width_ * m_height_; ++i) {
-        const float red = 0.299f;
-        const float green = 0.587f;
-        const float blue = 0.114f;
-        float gray = red * m_colors_[i].r + green * m_colors_[i].g + blue * m_colors_[i].b;
-        m_colors_[i].r = gray;
-        m_colors_[i].g = gray;
-        m_colors_[i].b = gray;
-    }
-    std::cout << "Grayscale filter was applied\n";
+    ApplyPointOp(GrayscalePixels);
 }
 
 void Image::Negative() {
-    for (int i = 0; i < m_width_ * m_height_; ++i) {
-        m_colors_[i].r = 1.0f - m_colors_[i].r;
-        m_colors_[i].g = 1.0f - m_colors_[i].g;
-        m_colors_[i].b = 1.0f - m_colors_[i].b;
-    }
-    std::cout << "Negative filter was applied\n";
+    ApplyPointOp(NegativePixels);
 }
-#define float_two 2.0f
-void Image::GaussianBlur(float sigma) {
-    std::vector<Color> temporary_colors(m_width_ * m_height_);
-    auto gaussian = [sigma](float x, float y) {
-        return (1.0f / (float_two * M_PI * sigma * sigma)) *  // M_PI - число Пи
-               std::exp(-(x * x + y * y) / (float_two * sigma * sigma));
-    };
 
-    // Применяем фильтр к каждому пикселю
-    for (int y = 0; y < m_height_; ++y) {
-        for (int x = 0; x < m_width_; ++x) {
-            float r = 0.0f;
-            float g = 0.0f;
-            float b = 0.0f;
-            float total_weight = 0.0f;
-
-            // Проходим по окрестности пикселя и вычисляем взвешенную сумму значений цветов
-            for (int j = -1; j <= 1; ++j) {
-                for (int i = -1; i <= 1; ++i) {
-                    int neighbor_x = x + i;
-                    int neighbor_y = y + j;
-
-                    if (neighbor_x >= 0 && neighbor_x < m_width_ && neighbor_y >= 0 && neighbor_y < m_height_) {
-                        float weight = static_cast<float>(gaussian(static_cast<float>(i), static_cast<float>(j)));
-                        total_weight += weight;
-
-                        r += m_colors_[neighbor_y * m_width_ + neighbor_x].r * weight;
-                        g += m_colors_[neighbor_y * m_width_ + neighbor_x].g * weight;
-                        b += m_colors_[neighbor_y * m_width_ + neighbor_x].b * weight;
-                    }
+void Image::GaussianBlur(float sigma, const PointOp& prologue, const PointOp& epilogue) {
+    if (sigma <= 0.0f) {
+        std::cerr << "Error: sigma for filter -blur must be positive" << std::endl;
+        return;
+    }
+
+    // Гауссово размытие сепарабельно: сначала свёртка по строкам в промежуточный буфер,
+    // затем по столбцам обратно в строки изображения
+    float* temporary = &PrepareScratch()[0].r;
+    const int row_floats = m_width_ * 3;
+    const int stride_floats = m_stride_ * 3;
+    auto image_row = [&](int y) { return &Row(y)[0].r; };
+    auto temporary_row = [&](int y) { return temporary + static_cast<size_t>(y) * row_floats; };
+
+    if (UseBoxCascade(sigma)) {
+        // Для больших sigma прямое ядро слишком длинное, каскад box-фильтров стоит O(1) на пиксель
+        const std::vector<int> radii = BoxCascadeRadii(sigma);
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            std::vector<float> row_a(row_floats);
+            std::vector<float> row_b(row_floats);
+            for (int y = begin; y < end; ++y) {
+                if (prologue) {
+                    prologue(Row(y), m_width_);
                 }
+                BoxBlurRowHorizontal(image_row(y), row_a.data(), m_width_, 3, radii[0]);
+                BoxBlurRowHorizontal(row_a.data(), row_b.data(), m_width_, 3, radii[1]);
+                BoxBlurRowHorizontal(row_b.data(), temporary_row(y), m_width_, 3, radii[2]);
             }
-
-            temporary_colors[y * m_width_ + x].r = r / total_weight;
-            temporary_colors[y * m_width_ + x].g = g / total_weight;
-            temporary_colors[y * m_width_ + x].b = b / total_weight;
+        });
+        // Столбцы в вертикальном проходе независимы, делим их между потоками
+        auto vertical = [&](const float* src, int src_stride, float* dst, int dst_stride, int radius) {
+            ParallelFor(row_floats, kPixelGrain / m_height_ + 1, [&](int begin, int end) {
+                BoxBlurVertical(src + begin, src_stride, dst + begin, dst_stride, m_height_, end - begin, radius);
+            });
+        };
+        vertical(temporary, row_floats, image_row(0), stride_floats, radii[0]);
+        vertical(image_row(0), stride_floats, temporary, row_floats, radii[1]);
+        vertical(temporary, row_floats, image_row(0), stride_floats, radii[2]);
+        // Последний проход идёт по столбцам, поэтому эпилог выполняется отдельным проходом по строкам
+        if (epilogue) {
+            ApplyPointOp(epilogue);
         }
+        return;
     }
 
-    // Копируем результат обратно в основной массив цветов
-    m_colors_ = temporary_colors;
-    std::cout << "Gaussian Blur filter was applied\n";
+    const std::vector<float> kernel = GaussianKernel(sigma);
+    const int radius = static_cast<int>(kernel.size()) / 2;
+
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            // Пролог применяется к строке прямо перед горизонтальной свёрткой, которая читает только эту строку
+            if (prologue) {
+                prologue(Row(y), m_width_);
+            }
+            ConvolveRowHorizontal(image_row(y), temporary_row(y), m_width_, 3, kernel);
+        }
+    });
+
+    // Вертикальный проход идёт полосами столбцов, чтобы 2 * radius + 1 строк полосы помещались в кэш.
+    // Потоки получают полосы строк, внутри полосы обход идёт по полосам столбцов
+    const int strip_floats = 3 * 512;
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(kernel.size());
+        for (int strip = 0; strip < row_floats; strip += strip_floats) {
+            const int count = std::min(strip_floats, row_floats - strip);
+            for (int y = begin; y < end; ++y) {
+                for (int k = -radius; k <= radius; ++k) {
+                    const int neighbor_y = y + k;
+                    const bool inside = neighbor_y >= 0 && neighbor_y < m_height_;
+                    rows[k + radius] = inside ? temporary_row(neighbor_y) + strip : nullptr;
+                }
+                ConvolveRowsVertical(rows.data(), kernel, image_row(y) + strip, count);
+                if (epilogue) {
+                    epilogue(Row(y) + strip / 3, count / 3);
+                }
+            }
+        }
+    });
 }
 
-void Image::Thermo() {
-    std::vector<Color> processed_colors(m_width_ * m_height_);
+void ThermoRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width) {
+    const float* rows[3] = {&up[0].r, &mid[0].r, &down[0].r};
+    ConvolutionEngine<kThermoKernel, TapOrder::RowMajor, ConvolutionOutput::Raw>::Row<3>(
+        rows, &dst[0].r, width, BorderPolicy::Skip);
+}
 
-    for (int y = 1; y < m_height_ - 1; ++y) {
-        for (int x = 1; x < m_width_ - 1; ++x) {
-            const unsigned char c = 5;
-            float new_r = -1 * m_colors_[(y - 1) * m_width_ + (x - 1)].r + -1 * m_colors_[(y - 1) * m_width_ + x].r +
-                          -1 * m_colors_[(y - 1) * m_width_ + (x + 1)].r + -1 * m_colors_[y * m_width_ + (x - 1)].r +
-                          c * m_colors_[y * m_width_ + x].r + -1 * m_colors_[y * m_width_ + (x + 1)].r +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x - 1)].r + -1 * m_colors_[(y + 1) * m_width_ + x].r +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x + 1)].r;
+void SharpeningRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width) {
+    const float* rows[3] = {&up[0].r, &mid[0].r, &down[0].r};
+    ConvolutionEngine<kSharpeningKernel, TapOrder::ColumnMajor, ConvolutionOutput::Clamp>::Row<3>(
+        rows, &dst[0].r, width, BorderPolicy::Skip);
+}
 
-            float new_g = -1 * m_colors_[(y - 1) * m_width_ + (x - 1)].g + -1 * m_colors_[(y - 1) * m_width_ + x].g +
-                          -1 * m_colors_[(y - 1) * m_width_ + (x + 1)].g + -1 * m_colors_[y * m_width_ + (x - 1)].g +
-                          c * m_colors_[y * m_width_ + x].g + -1 * m_colors_[y * m_width_ + (x + 1)].g +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x - 1)].g + -1 * m_colors_[(y + 1) * m_width_ + x].g +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x + 1)].g;
+void EdgeDetectionRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width,
+                      float threshold) {
+    // После grayscale каналы равны, поэтому порог применяется к каждому из них с одинаковым результатом
+    const float* rows[3] = {&up[0].r, &mid[0].r, &down[0].r};
+    ConvolutionEngine<kEdgeDetectionKernel, TapOrder::ColumnMajor, ConvolutionOutput::Threshold>::Row<3>(
+        rows, &dst[0].r, width, BorderPolicy::Skip, threshold);
+}
 
-            float new_b = -1 * m_colors_[(y - 1) * m_width_ + (x - 1)].b + -1 * m_colors_[(y - 1) * m_width_ + x].b +
-                          -1 * m_colors_[(y - 1) * m_width_ + (x + 1)].b + -1 * m_colors_[y * m_width_ + (x - 1)].b +
-                          c * m_colors_[y * m_width_ + x].b + -1 * m_colors_[y * m_width_ + (x + 1)].b +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x - 1)].b + -1 * m_colors_[(y + 1) * m_width_ + x].b +
-                          -1 * m_colors_[(y + 1) * m_width_ + (x + 1)].b;
+void EdgeResponseRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width) {
+    const float* rows[3] = {&up[0].r, &mid[0].r, &down[0].r};
+    ConvolutionEngine<kEdgeDetectionKernel, TapOrder::ColumnMajor, ConvolutionOutput::Raw>::Row<3>(
+        rows, &dst[0].r, width, BorderPolicy::Skip);
+}
 
-            processed_colors[y * m_width_ + x] = Color(new_r, new_g, new_b);
+void Image::Thermo(const PointOp& epilogue) {
+    ApplyStencil(ThermoRow, epilogue);
+}
+
+void Image::Sharpening(const PointOp& epilogue) {
+    ApplyStencil(SharpeningRow, epilogue);
+}
+
+void Image::ApplyStencil(const StencilRow& stencil, const PointOp& epilogue) {
+    // Результат пишется в промежуточный буфер, который затем меняется местами с основным.
+    // Крайние строки и столбцы результата нулевые
+    std::vector<Color>& processed_colors = PrepareScratch();
+
+    // Каждая строка результата зависит только от трёх строк исходника, поэтому полосы строк независимы
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            Color* dst = &processed_colors[static_cast<size_t>(y) * m_width_];
+            dst[0] = Color();
+            dst[m_width_ - 1] = Color();
+            stencil(Row(y - 1), Row(y), Row(y + 1), dst, m_width_);
+            if (epilogue) {
+                epilogue(dst, m_width_);
+            }
         }
+    });
+    std::fill(processed_colors.begin(), processed_colors.begin() + m_width_, Color());
+    if (m_height_ > 1) {
+        std::fill(processed_colors.end() - m_width_, processed_colors.end(), Color());
+    }
+    ApplyBorderEpilogue(processed_colors, epilogue);
+
+    SwapScratch();
+}
+
+void Image::Convolve(const Convolution& convolution, const PointOp& epilogue) {
+    const int radius = convolution.Radius();
+    const BorderPolicy border = convolution.Border();
+    const int size = 2 * radius + 1;
+    const int row_floats = 3 * m_width_;
+    std::vector<Color>& processed_colors = PrepareScratch();
+    auto processed_row = [&](int y) { return &processed_colors[static_cast<size_t>(y) * m_width_]; };
+
+    if (convolution.Separable()) {
+        // Горизонтальный проход пишет в промежуточный буфер, вертикальный - обратно в изображение:
+        // исходные пиксели после первого прохода уже не нужны
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            for (int y = begin; y < end; ++y) {
+                convolution.Horizontal(&Row(y)[0].r, &processed_row(y)[0].r, m_width_, 3);
+            }
+        });
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            std::vector<const float*> rows(size);
+            for (int y = begin; y < end; ++y) {
+                for (int k = 0; k < size; ++k) {
+                    rows[k] = &processed_row(BorderIndex(y + k - radius, m_height_, border))[0].r;
+                }
+                convolution.Vertical(rows.data(), &Row(y)[0].r, row_floats);
+                if (epilogue) {
+                    epilogue(Row(y), m_width_);
+                }
+            }
+        });
+        return;
     }
 
-    m_colors_ = processed_colors;
-
-    std::cout << "Thermo filter was applied\n";
-}
-
-void Image::Sharpening() {
-    std::vector<Color> processed_colors(m_width_ * m_height_);
-
-    for (int y = 1; y < m_height_ - 1; ++y) {
-        for (int x = 1; x < m_width_ - 1; ++x) {
-            const unsigned char c = 5;
-            float new_r = std::min(
-                1.0f,
-                std::max(0.0f,
-                         0 * m_colors_[(y - 1) * m_width_ + (x - 1)].r + -1 * m_colors_[y * m_width_ + (x - 1)].r +
-                             0 * m_colors_[(y + 1) * m_width_ + (x - 1)].r + -1 * m_colors_[(y - 1) * m_width_ + x].r +
-                             c * m_colors_[y * m_width_ + x].r + -1 * m_colors_[(y + 1) * m_width_ + x].r +
-                             0 * m_colors_[(y - 1) * m_width_ + (x + 1)].r + -1 * m_colors_[y * m_width_ + (x + 1)].r +
-                             0 * m_colors_[(y + 1) * m_width_ + (x + 1)].r));
-
-            float new_g = std::min(
-                1.0f,
-                std::max(0.0f,
-                         0 * m_colors_[(y - 1) * m_width_ + (x - 1)].g + -1 * m_colors_[y * m_width_ + (x - 1)].g +
-                             0 * m_colors_[(y + 1) * m_width_ + (x - 1)].g + -1 * m_colors_[(y - 1) * m_width_ + x].g +
-                             c * m_colors_[y * m_width_ + x].g + -1 * m_colors_[(y + 1) * m_width_ + x].g +
-                             0 * m_colors_[(y - 1) * m_width_ + (x + 1)].g + -1 * m_colors_[y * m_width_ + (x + 1)].g +
-                             0 * m_colors_[(y + 1) * m_width_ + (x + 1)].g));
-
-            float new_b = std::min(
-                1.0f,
-                std::max(0.0f,
-                         0 * m_colors_[(y - 1) * m_width_ + (x - 1)].b + -1 * m_colors_[y * m_width_ + (x - 1)].b +
-                             0 * m_colors_[(y + 1) * m_width_ + (x - 1)].b + -1 * m_colors_[(y - 1) * m_width_ + x].b +
-                             c * m_colors_[y * m_width_ + x].b + -1 * m_colors_[(y + 1) * m_width_ + x].b +
-                             0 * m_colors_[(y - 1) * m_width_ + (x + 1)].b + -1 * m_colors_[y * m_width_ + (x + 1)].b +
-                             0 * m_colors_[(y + 1) * m_width_ + (x + 1)].b));
-
-            processed_colors[y * m_width_ + x] = Color(new_r, new_g, new_b);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(size);
+        for (int y = begin; y < end; ++y) {
+            Color* dst = processed_row(y);
+            if (border == BorderPolicy::Skip) {
+                // Пиксели, окно которых выходит за край, остаются как были
+                std::copy(Row(y), Row(y) + m_width_, dst);
+            }
+            if (border != BorderPolicy::Skip || (y >= radius && y < m_height_ - radius)) {
+                for (int k = 0; k < size; ++k) {
+                    rows[k] = &Row(BorderIndex(y + k - radius, m_height_, border))[0].r;
+                }
+                convolution.Row(rows.data(), &dst[0].r, m_width_, 3);
+            }
+            if (epilogue) {
+                epilogue(dst, m_width_);
+            }
         }
+    });
+    SwapScratch();
+}
+
+void Image::Median(int radius, const PointOp& prologue, const PointOp& epilogue) {
+    // Медиана считается по уровням 0..255, в которые значения переводятся при записи в файл. Перевод монотонный,
+    // поэтому уровень медианы совпадает с уровнем точной медианы значений
+    const int row_floats = 3 * m_width_;
+    std::vector<unsigned char> levels(static_cast<size_t>(row_floats) * m_height_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            if (prologue) {
+                prologue(Row(y), m_width_);
+            }
+            const float* values = &Row(y)[0].r;
+            unsigned char* row_levels = &levels[static_cast<size_t>(y) * row_floats];
+            for (int i = 0; i < row_floats; ++i) {
+                row_levels[i] = QuantizeLevel(values[i]);
+            }
+        }
+    });
+    std::vector<Color>& processed_colors = PrepareScratch();
+    MedianFilter(
+        m_width_, m_height_, 3, radius, [&](int y) { return &levels[static_cast<size_t>(y) * row_floats]; },
+        [&](int y, const unsigned char* median) {
+            Color* dst = &processed_colors[static_cast<size_t>(y) * m_width_];
+            float* values = &dst[0].r;
+            for (int i = 0; i < row_floats; ++i) {
+                values[i] = LevelValue(median[i]);
+            }
+            if (epilogue) {
+                epilogue(dst, m_width_);
+            }
+        });
+    SwapScratch();
+}
+
+void Image::Bilateral(float sigma_spatial, float sigma_range, const PointOp& epilogue) {
+    std::vector<Color>& processed_colors = PrepareScratch();
+    Color* src = Row(0);
+    Color* dst = processed_colors.data();
+    BilateralFilter({{&src[0].r, &src[0].g, &src[0].b}, 3, 3 * m_stride_},
+                    {{&dst[0].r, &dst[0].g, &dst[0].b}, 3, 3 * m_width_}, m_width_, m_height_, sigma_spatial,
+                    sigma_range, [&](int y) {
+                        if (epilogue) {
+                            epilogue(&processed_colors[static_cast<size_t>(y) * m_width_], m_width_);
+                        }
+                    });
+    SwapScratch();
+}
+
+void Image::ApplyTiled(const std::vector<TileStep>& steps) {
+    std::vector<Color>& processed_colors = PrepareScratch();
+    const TileRegion src{0, 0, m_width_, m_height_, Row(0), m_stride_};
+    const TileRegion dst{0, 0, m_width_, m_height_, processed_colors.data(), m_width_};
+    ExecuteTiles(steps, src, dst, m_width_, m_height_);
+    SwapScratch();
+}
+
+void Image::GrayscaleWithPrologue(const PointOp& prologue) {
+    // Применяем фильтр grayscale, пролог выполняется в том же проходе
+    if (prologue) {
+        ApplyPointOp([&prologue](Color* pixels, int count) {
+            prologue(pixels, count);
+            GrayscalePixels(pixels, count);
+        });
+    } else {
+        Grayscale();
     }
+}
 
-    m_colors_ = processed_colors;
+void Image::FinishEdgeDetection(std::vector<Color>& processed_colors, const PointOp& epilogue) {
+    std::copy(Row(0), Row(0) + m_width_, processed_colors.begin());
+    if (m_height_ > 1) {
+        std::copy(Row(m_height_ - 1), Row(m_height_ - 1) + m_width_, processed_colors.end() - m_width_);
+    }
+    ApplyBorderEpilogue(processed_colors, epilogue);
 
-    std::cout << "Sharpening filter was applied\n";
+    SwapScratch();
 }
 
-void Image::EdgeDetection(float threshold) {
-    // Применяем фильтр grayscale
-    Grayscale();
+void Image::EdgeDetection(float threshold, const PointOp& prologue, const PointOp& epilogue) {
+    GrayscaleWithPrologue(prologue);
+
+    // Результат пишем в отдельный буфер: соседи читаются из неизменённого серого изображения,
+    // поэтому итог не зависит от порядка обхода и строки можно обрабатывать параллельно.
+    // Крайние строки и столбцы остаются серыми, как и раньше
+    std::vector<Color>& processed_colors = PrepareScratch();
 
     // Применяем фильтр Edge Detection к каждому пикселю, начиная с (1, 1) и заканчивая (m_width_ - 2, m_height_ - 2)
-    for (int y = 1; y < m_height_ - 1; ++y) {
-        for (int x = 1; x < m_width_ - 1; ++x) {
-            // Вычисляем новое значение цвета пикселя, используя указанную матрицу
-            float new_value = -1 * m_colors_[(y - 1) * m_width_ + (x - 1)].r - m_colors_[y * m_width_ + (x - 1)].r -
-                              m_colors_[(y + 1) * m_width_ + (x - 1)].r + -1 * m_colors_[(y - 1) * m_width_ + x].r +
-                              4 * m_colors_[y * m_width_ + x].r - m_colors_[(y + 1) * m_width_ + x].r +
-                              -1 * m_colors_[(y - 1) * m_width_ + (x + 1)].r - m_colors_[y * m_width_ + (x + 1)].r -
-                              m_colors_[(y + 1) * m_width_ + (x + 1)].r;
-
-            // Определяем цвет пикселя в зависимости от порога
-            Color new_color = (new_value > threshold) ? Color(1.0f, 1.0f, 1.0f) : Color(0.0f, 0.0f, 0.0f);
-            m_colors_[y * m_width_ + x] = new_color;
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            Color* dst = &processed_colors[static_cast<size_t>(y) * m_width_];
+            dst[0] = Row(y)[0];
+            dst[m_width_ - 1] = Row(y)[m_width_ - 1];
+            EdgeDetectionRow(Row(y - 1), Row(y), Row(y + 1), dst, m_width_, threshold);
+            if (epilogue) {
+                epilogue(dst, m_width_);
+            }
         }
+    });
+    FinishEdgeDetection(processed_colors, epilogue);
+}
+
+void Image::AutoEdgeDetection(const PointOp& prologue, const PointOp& epilogue) {
+    if (m_width_ < 3 || m_height_ < 3) {
+        // Внутренних пикселей нет, порог ни на что не влияет
+        EdgeDetection(0.0f, prologue, epilogue);
+        return;
+    }
+    GrayscaleWithPrologue(prologue);
+
+    // Отклик фильтра без порога пишется в буфер. Заодно считаются его наименьшее и наибольшее значения
+    // по строкам: они задают отрезок гистограммы
+    std::vector<Color>& processed_colors = PrepareScratch();
+    std::vector<float> row_min(m_height_ - 2);
+    std::vector<float> row_max(m_height_ - 2);
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            Color* dst = &processed_colors[static_cast<size_t>(y) * m_width_];
+            EdgeResponseRow(Row(y - 1), Row(y), Row(y + 1), dst, m_width_);
+            const auto [low, high] = std::minmax_element(dst + 1, dst + m_width_ - 1,
+                                                         [](const Color& a, const Color& b) { return a.r < b.r; });
+            row_min[y - 1] = low->r;
+            row_max[y - 1] = high->r;
+        }
+    });
+    const ValueStats stats = ComputeStats(
+        [&](int y) { return &processed_colors[static_cast<size_t>(y + 1) * m_width_ + 1].r; }, m_height_ - 2,
+        m_width_ - 2, 3, 1, *std::min_element(row_min.begin(), row_min.end()),
+        *std::max_element(row_max.begin(), row_max.end()))[0];
+    const float threshold = OtsuThreshold(stats);
+
+    // Сравнение с порогом то же, что в EdgeDetectionRow, поэтому результат совпадает с -edge с этим порогом
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            Color* dst = &processed_colors[static_cast<size_t>(y) * m_width_];
+            dst[0] = Row(y)[0];
+            dst[m_width_ - 1] = Row(y)[m_width_ - 1];
+            for (int x = 1; x < m_width_ - 1; ++x) {
+                const float value = dst[x].r > threshold ? 1.0f : 0.0f;
+                dst[x] = Color(value, value, value);
+            }
+            if (epilogue) {
+                epilogue(dst, m_width_);
+            }
+        }
+    });
+    FinishEdgeDetection(processed_colors, epilogue);
+}
+
+bool Image::Export(const char* path) const {
+    std::string error;
+    if (!Save(path, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    std::cout << "The file has been created\n";
+    return true;
+}
+
+bool Image::Decode(const char* data, size_t size, std::string& error) {
+    return Decode(data, size, INT_MAX, INT_MAX, error);
+}
+
+bool Image::Decode(const char* data, size_t size, int max_width, int max_height, std::string& error) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    BmpInfo info;
+    if (!ParseBmpHeader(bytes, size, info, error)) {
+        return false;
     }
 
-    std::cout << "Edge Detection filter was applied\n";
+    const int width = std::min(info.width, max_width);
+    const int height = std::min(info.height, max_height);
+    const int first_row = info.height - height;
+    m_scratch_.resize(static_cast<size_t>(width) * height);
+    const bool decoded = DecodeBmpRows(
+        bytes, size, info, first_row, info.height,
+        [&](int y, const unsigned char* row) {
+            UnpackBmpRow(info, row, m_scratch_.data() + static_cast<size_t>(y - first_row) * width, width);
+        },
+        error);
+    if (!decoded) {
+        return false;
+    }
+    m_width_ = width;
+    m_height_ = height;
+    SwapScratch();
+    return true;
 }
 
-void Image::Export(const char* path) const {
+bool Image::Encode(std::string& bytes, std::string& error) const {
+    if (!CheckBmpOutputSize(m_width_, m_height_, error)) {
+        return false;
+    }
+    const size_t row_size = BmpOutputRowSize(m_width_);
+    bytes.resize(BmpFileSize(m_width_, m_height_));
+    unsigned char* data = reinterpret_cast<unsigned char*>(bytes.data());
+    WriteBmpHeader(data, m_width_, m_height_, error);
+    unsigned char* pixels = data + kBmpFileHeaderSize + kBmpInfoHeaderSize;
+    for (int y = 0; y < m_height_; ++y) {
+        PackBmpRow(Row(y), pixels + static_cast<size_t>(y) * row_size, m_width_);
+    }
+    return true;
+}
+
+bool Image::Save(const char* path, std::string& error) const {
+    if (!CheckBmpOutputSize(m_width_, m_height_, error)) {
+        return false;
+    }
     std::ofstream f;
     f.open(path, std::ios::out | std::ios::binary);
 
     if (!f.is_open()) {
-        std::cout << "File cannot be opened\n";
-        return;
+        error = "File cannot be opened";
+        return false;
     }
 
-    unsigned char bmp_pad[3] = {0, 0, 0};
-    const int padding_amount = ((4 - (m_width_ * 3) % 4) % 4);
-
-    const int file_header_size = 14;
-    const int information_header_size = 40;
-    const int file_size =
-        file_header_size + information_header_size + m_width_ * m_height_ * 3 + padding_amount * m_width_;
-    unsigned char file_header[file_header_size];
-
-    // Тип файл
-    file_header[0] = 'B';
-    file_header[1] = 'M';
-    // Размер файла
-    const unsigned char val_1 = 8;
-    const unsigned char val_2 = 16;
-    const unsigned char val_3 = 24;
-    file_header[2] = file_size;
-    file_header[3] = file_size >> val_1;
-    file_header[4] = file_size >> val_2;
-    const unsigned char idx_0 = 5;
-    file_header[idx_0] = file_size >> val_3;
-    // Резерв 1 - не используется
-    const unsigned char ind_1 = 6;
-    const unsigned char ind_2 = 7;
-    file_header[ind_1] = 0;
-    file_header[ind_2] = 0;
-    // Резерв 2 - не используется
-    const unsigned char ind_3 = 8;
-    const unsigned char ind_4 = 9;
-    file_header[ind_3] = 0;
-    file_header[ind_4] = 0;
-    // Пиксель инф offset
-    const unsigned char ind_5 = 10;
-    const unsigned char ind_6 = 11;
-    const unsigned char ind_7 = 12;
-    const unsigned char ind_8 = 13;
-    file_header[ind_5] = file_header_size + information_header_size;
-    file_header[ind_6] = 0;
-    file_header[ind_7] = 0;
-    file_header[ind_8] = 0;
-
-    unsigned char information_header[information_header_size];
-
-    // Размер хэдера
-    information_header[0] = information_header_size;
-    information_header[1] = 0;
-    information_header[2] = 0;
-    information_header[3] = 0;
-    // Ширина изображения
-    const unsigned char indx_1 = 4;
-    const unsigned char indx_2 = 5;
-    const unsigned char indx_3 = 6;
-    const unsigned char indx_4 = 7;
-    information_header[indx_1] = m_width_;
-    information_header[indx_2] = m_width_ >> val_1;
-    information_header[indx_3] = m_width_ >> val_2;
-    information_header[indx_4] = m_width_ >> val_3;
-    // Высота изображения
-    const unsigned char indx_5 = 8;
-    const unsigned char indx_6 = 9;
-    const unsigned char indx_7 = 10;
-    const unsigned char indx_8 = 11;
-    information_header[indx_5] = m_height_;
-    information_header[indx_6] = m_height_ >> val_1;
-    information_header[indx_7] = m_height_ >> val_2;
-    information_header[indx_8] = m_height_ >> val_3;
-    // Неисп
-    const unsigned char indx_9 = 12;
-    const unsigned char indx_10 = 13;
-    information_header[indx_9] = 1;
-    information_header[indx_10] = 0;
-    // Бит на пиксель RGB
-    const unsigned char indx_11 = 14;
-    const unsigned char indx_12 = 15;
-    information_header[indx_11] = val_3;
-    information_header[indx_12] = 0;
-    // Сжатие - без сжатия
-    const unsigned char indx_13 = 16;
-    const unsigned char indx_14 = 17;
-    const unsigned char indx_15 = 18;
-    const unsigned char indx_16 = 19;
-    information_header[indx_13] = 0;
-    information_header[indx_14] = 0;
-    information_header[indx_15] = 0;
-    information_header[indx_16] = 0;
-    // Размер изображения - без сжатия
-    const unsigned char indx_17 = 20;
-    const unsigned char indx_18 = 21;
-    const unsigned char indx_19 = 22;
-    const unsigned char indx_20 = 23;
-    information_header[indx_17] = 0;
-    information_header[indx_18] = 0;
-    information_header[indx_19] = 0;
-    information_header[indx_20] = 0;
-    // X пикселей на метр
-    const unsigned char indx_21 = 24;
-    const unsigned char indx_22 = 25;
-    const unsigned char indx_23 = 26;
-    const unsigned char indx_24 = 27;
-    information_header[indx_21] = 0;
-    information_header[indx_22] = 0;
-    information_header[indx_23] = 0;
-    information_header[indx_24] = 0;
-    // Y пикселей на метр
-    const unsigned char indx_25 = 28;
-    const unsigned char indx_26 = 29;
-    const unsigned char indx_27 = 30;
-    const unsigned char indx_28 = 31;
-    information_header[indx_25] = 0;
-    information_header[indx_26] = 0;
-    information_header[indx_27] = 0;
-    information_header[indx_28] = 0;
-    // Общее количество цветов
-    const unsigned char indx_29 = 32;
-    const unsigned char indx_30 = 33;
-    const unsigned char indx_31 = 34;
-    const unsigned char indx_32 = 35;
-    information_header[indx_29] = 0;
-    information_header[indx_30] = 0;
-    information_header[indx_31] = 0;
-    information_header[indx_32] = 0;
-    // Важные цвета
-    const unsigned char indx_33 = 36;
-    const unsigned char indx_34 = 37;
-    const unsigned char indx_35 = 38;
-    const unsigned char indx_36 = 39;
-    information_header[indx_33] = 0;
-    information_header[indx_34] = 0;
-    information_header[indx_35] = 0;
-    information_header[indx_36] = 0;
-
-    f.write(reinterpret_cast<char*>(file_header), file_header_size);
-    f.write(reinterpret_cast<char*>(information_header), information_header_size);
-
-    for (int y = 0; y < m_height_; y++) {
-        for (int x = 0; x < m_width_; x++) {
-            const float colorm = 255.0f;
-            unsigned char r = static_cast<unsigned char>(GetColor(x, y).r * colorm);
-            unsigned char g = static_cast<unsigned char>(GetColor(x, y).g * colorm);
-            unsigned char b = static_cast<unsigned char>(GetColor(x, y).b * colorm);
-
-            unsigned char color[] = {b, g, r};
-
-            f.write(reinterpret_cast<char*>(color), 3);
-        }
+    unsigned char header[kBmpFileHeaderSize + kBmpInfoHeaderSize];
+    WriteBmpHeader(header, m_width_, m_height_, error);
+    f.write(reinterpret_cast<char*>(header), sizeof(header));
 
-        f.write(reinterpret_cast<char*>(bmp_pad), padding_amount);
+    // Кодируем строки в переиспользуемый буфер на несколько строк и пишем его одним вызовом
+    const size_t row_size = BmpOutputRowSize(m_width_);
+    const size_t block_bytes = 1 << 22;
+    const int rows_per_block = static_cast<int>(std::max<size_t>(1, block_bytes / row_size));
+    std::vector<unsigned char> block(row_size * std::min(rows_per_block, m_height_));
+
+    for (int y = 0; y < m_height_; y += rows_per_block) {
+        const int rows = std::min(rows_per_block, m_height_ - y);
+        for (int i = 0; i < rows; ++i) {
+            PackBmpRow(Row(y + i), block.data() + static_cast<size_t>(i) * row_size, m_width_);
+        }
+        f.write(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(row_size) * rows);
     }
 
     f.close();
-    std::cout << "The file has been created\n";
+    if (!f) {
+        error = "Failed to write the file";
+        return false;
+    }
+    return true;
 }
@@ -5,39 +5,120 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <functional>
+#include <string>
 
 #ifndef M_PI  // число Пи (magic number)
 #define M_PI 3.14159265358979323846
 #endif
 
+class Convolution;
+struct TileStep;
+
 struct Color {
     float r, g, b;
 
     Color();
     Color(float r, float g, float b);
-    ~Color();
 };
 
+// Поточечная операция над отрезком из count подряд идущих пикселей.
+// Через такие операции фильтры принимают пролог и эпилог, слитые с основным проходом
+using PointOp = std::function<void(Color* pixels, int count)>;
+
+// Поточечные фильтры над отрезком пикселей
+void GrayscalePixels(Color* pixels, int count);
+void NegativePixels(Color* pixels, int count);
+
+// Построчные ядра фильтров 3x3 поверх ConvolutionEngine: пиксели 1..width-2 строки dst по трём соседним
+// строкам исходника. Крайние пиксели dst не изменяются
+void ThermoRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width);
+void SharpeningRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width);
+void EdgeDetectionRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width, float threshold);
+// Отклик ядра -edge без порога, в тех же единицах, с которыми сравнивается порог
+void EdgeResponseRow(const Color* up, const Color* mid, const Color* down, Color* dst, int width);
+
 class Image {
 public:
     Image(int width, int height);
+    // Копия хранит только видимые пиксели в компактном виде
+    Image(const Image& other);
+    Image(Image&& other) = default;
+    Image& operator=(const Image& other);
+    Image& operator=(Image&& other) = default;
     ~Image();
     //
     Color GetColor(int x, int y) const;
+    int Width() const;
+    int Height() const;
+    // Указатель на начало строки y (строки хранятся снизу вверх, как в файле).
+    // После Crop изображение может быть окном в больший буфер, поэтому строки идут через Stride() пикселей
+    Color* Row(int y);
+    const Color* Row(int y) const;
+    int Stride() const;
     // Чтение и экспорт
-    void Read(const char* path);
-    void Export(const char* path) const;
-    // Фильтры и изменение размера изображения
-    void Crop(int new_width, int new_height);
+    // Read возвращает false и не меняет изображение, если файл не удалось декодировать
+    bool Read(const char* path);
+    bool Export(const char* path) const;
+    // То же без вывода в консоль: при ошибке возвращают false и пишут причину в error
+    bool Load(const char* path, std::string& error);
+    // Чтение BMP из потока (например, из памяти). Пиксели декодируются в промежуточный буфер, поэтому
+    // при повторной загрузке в тот же объект память переиспользуется
+    bool Load(std::istream& in, std::string& error);
+    // Только левый верхний угол не больше max_width x max_height (область интереса плана, см. pipeline.h):
+    // остальные пиксели не декодируются, а строки вне угла не читаются из файла
+    bool Load(const char* path, int max_width, int max_height, std::string& error);
+    bool Load(std::istream& in, int max_width, int max_height, std::string& error);
+    bool Save(const char* path, std::string& error) const;
+    // Файл BMP целиком в памяти: пиксели распаковываются прямо из data и упаковываются прямо в bytes,
+    // без промежуточных блоков. Encode заменяет содержимое bytes, его ёмкость переиспользуется; false - если
+    // изображение не помещается в файл BMP
+    bool Decode(const char* data, size_t size, std::string& error);
+    bool Decode(const char* data, size_t size, int max_width, int max_height, std::string& error);
+    bool Encode(std::string& bytes, std::string& error) const;
+    // Фильтры и изменение размера изображения.
+    // prologue применяется к пикселям до фильтра, epilogue - к готовым пикселям результата,
+    // пока они ещё в кэше. Пустая операция означает отсутствие пролога или эпилога
+    void ApplyPointOp(const PointOp& op);
+    void Crop(int new_width, int new_height, const PointOp& epilogue = nullptr);
+    // Масштабирование фильтром Ланцоша (фильтр -resize)
+    void Resize(int new_width, int new_height, const PointOp& epilogue = nullptr);
+    // Следующий уровень пирамиды: вдвое меньшее изображение, каждый пиксель - среднее квадрата 2x2
+    Image Downsample2x() const;
     void Grayscale();
     void Negative();
-    void GaussianBlur(float sigma);
-    void Sharpening();
-    void Thermo();  // доп фильтр 1
-    void EdgeDetection(float threshold);
+    void GaussianBlur(float sigma, const PointOp& prologue = nullptr, const PointOp& epilogue = nullptr);
+    void Sharpening(const PointOp& epilogue = nullptr);
+    void Thermo(const PointOp& epilogue = nullptr);  // доп фильтр 1
+    void EdgeDetection(float threshold, const PointOp& prologue = nullptr, const PointOp& epilogue = nullptr);
+    // -edge auto: порог выбирается методом Оцу по гистограмме отклика ядра (stats.h)
+    void AutoEdgeDetection(const PointOp& prologue = nullptr, const PointOp& epilogue = nullptr);
+    // Свёртка с произвольным ядром (фильтр -conv); края обрабатываются по политике из convolution
+    void Convolve(const Convolution& convolution, const PointOp& epilogue = nullptr);
+    // Шумоподавление (denoise.h): медиана окна (2 * radius + 1)^2 и билатеральный фильтр сеткой
+    void Median(int radius, const PointOp& prologue = nullptr, const PointOp& epilogue = nullptr);
+    void Bilateral(float sigma_spatial, float sigma_range, const PointOp& epilogue = nullptr);
+    // Цепочка фильтров по окрестности, выполняемая блоками (см. tiling.h): промежуточные результаты
+    // между фильтрами цепочки не записываются в память изображения
+    void ApplyTiled(const std::vector<TileStep>& steps);
 
 private:
+    using StencilRow = void (*)(const Color* up, const Color* mid, const Color* down, Color* dst, int width);
+
+    // Промежуточный буфер на width * height пикселей, память переиспользуется между фильтрами
+    std::vector<Color>& PrepareScratch();
+    // Делает промежуточный буфер основным (компактным, без смещения)
+    void SwapScratch();
+    void ApplyStencil(const StencilRow& stencil, const PointOp& epilogue);
+    void ApplyBorderEpilogue(std::vector<Color>& colors, const PointOp& epilogue) const;
+    void GrayscaleWithPrologue(const PointOp& prologue);
+    // Крайние строки результата edge detection, эпилог для них и замена изображения буфером
+    void FinishEdgeDetection(std::vector<Color>& processed_colors, const PointOp& epilogue);
+
     int m_width_;
     int m_height_;
+    int m_stride_;
+    size_t m_offset_;
     std::vector<Color> m_colors_;
+    std::vector<Color> m_scratch_;
 };
@@ -1,105 +1,464 @@
-#include <map>
+#include <algorithm>
 #include <cstdlib>
-#include <functional>
-#include "image.h"
+#include <new>
 
-using Func = std::function<void(Image&, const std::vector<float>&)>;
+#include "async_io.h"
+#include "batch.h"
+#include "bmp.h"
+#include "cache.h"
+#include "graph.h"
+#include "image.h"
+#include "image_u8.h"
+#include "pipeline.h"
+#include "planar_image.h"
+#include "profile.h"
+#include "pyramid.h"
+#include "server.h"
+#include "simd.h"
+#include "stats.h"
+#include "thread_pool.h"
 
-struct FilterInfo {
-    std::string name;
-    std::vector<float> parameters;
-};
+// Замена operator new только в приложении: с --profile и --trace выделения памяти считаются по этапам.
+// Библиотека image_processing её не содержит, поэтому бенчмарк и клиент выделяют память как обычно
+void* operator new(std::size_t size) {
+    CountAllocation(size);
+    while (true) {
+        if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
 
-void HandleCropFilter(Image& image, const std::vector<float>& parameters) {
-    if (parameters.size() == 2) {
-        int new_width = static_cast<int>(parameters[0]);
-        int new_height = static_cast<int>(parameters[1]);
-        image.Crop(new_width, new_height);
-    } else {
-        std::cerr << "Error: Incorrect number of parameters for filter -crop" << std::endl;
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    CountAllocation(size);
+    // aligned_alloc требует размер, кратный выравниванию
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    const std::size_t rounded = std::max(align, (size + align - 1) / align * align);
+    while (true) {
+        if (void* pointer = std::aligned_alloc(align, rounded)) {
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
     }
 }
 
-void HandleGrayscaleFilter(Image& image, const std::vector<float>& parameters) {
-    image.Grayscale();
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
 }
 
-void HandleNegativeFilter(Image& image, const std::vector<float>& parameters) {
-    image.Negative();
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
 }
 
-void HandleBlurFilter(Image& image, const std::vector<float>& parameters) {
-    if (parameters.size() == 1) {
-        float sigma = parameters[0];
-        image.GaussianBlur(sigma);
-    } else {
-        std::cerr << "Error: Incorrect number of parameters for filter -blur" << std::endl;
-    }
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
 }
 
-void HandleSharpeningFilter(Image& image, const std::vector<float>& parameters) {
-    image.Sharpening();
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
 }
 
-void HandleThermoFilter(Image& image, const std::vector<float>& parameters) {
-    image.Thermo();
+// Параметры запуска, которые задаются аргументами вида --name value
+struct Options {
+    int threads = 0;  // 0 - по числу ядер
+    bool explain = false;
+    Storage storage = Storage::Interleaved;  // --planar или --precision u8
+    bool stream = false;
+    bool batch = false;  // входной и выходной аргументы - список файлов и шаблон имён
+    bool quiet = false;  // без сообщений о ходе обработки, только ошибки и запрошенные отчёты
+    bool profile = false;
+    bool stats = false;  // --stats: минимум, максимум и среднее каналов результата
+    std::string trace_path;
+    int pyramid_levels = 1;  // --pyramid N: кроме результата пишутся N - 1 уменьшенных вдвое копий
+    std::string cache_directory;  // --cache DIR: кэш результатов этапов на диске
+    double cache_megabytes = 1024;
+    bool cache_stats = false;
+    ServerOptions server;  // --serve PATH: режим демона, см. server.h
+    bool graph = false;  // --output PATH: за ним идёт цепочка фильтров ещё одного результата из того же входа
+};
+
+// Забирает из списка фильтров аргументы, начинающиеся с "--", и разбирает их как параметры запуска.
+// --output остаётся в списке: он разделяет цепочки выходов (SplitOutputs)
+bool ExtractOptions(std::vector<FilterInfo>& filters, Options& options) {
+    std::vector<FilterInfo> remaining;
+    for (const auto& filter : filters) {
+        if (filter.name.substr(0, 2) != "--") {
+            remaining.push_back(filter);
+            continue;
+        }
+        if (filter.name == "--output" && filter.arguments.size() == 1) {
+            options.graph = true;
+            remaining.push_back(filter);
+        } else if (filter.name == "--threads" && filter.parameters.size() == 1 && filter.parameters[0] >= 1) {
+            options.threads = static_cast<int>(filter.parameters[0]);
+        } else if (filter.name == "--pyramid" && filter.parameters.size() == 1 && filter.parameters[0] >= 1) {
+            options.pyramid_levels = static_cast<int>(filter.parameters[0]);
+        } else if (filter.name == "--cache" && filter.arguments.size() == 1) {
+            options.cache_directory = filter.arguments[0];
+        } else if (filter.name == "--cache-size" && filter.parameters.size() == 1 && filter.parameters[0] > 0) {
+            options.cache_megabytes = filter.parameters[0];
+        } else if (filter.name == "--cache-stats" && filter.parameters.empty()) {
+            options.cache_stats = true;
+        } else if (filter.name == "--serve" && filter.arguments.size() == 1) {
+            options.server.socket_path = filter.arguments[0];
+        } else if (filter.name == "--serve-workers" && filter.parameters.size() == 1 && filter.parameters[0] >= 1) {
+            options.server.workers = static_cast<int>(filter.parameters[0]);
+        } else if (filter.name == "--serve-queue" && filter.parameters.size() == 1 && filter.parameters[0] >= 1) {
+            options.server.queue = static_cast<size_t>(filter.parameters[0]);
+        } else if (filter.name == "--explain" && filter.parameters.empty()) {
+            options.explain = true;
+        } else if (filter.name == "--planar" && filter.parameters.empty() && options.storage != Storage::U8) {
+            options.storage = Storage::Planar;
+        } else if (filter.name == "--precision" && filter.arguments.size() == 1 && filter.arguments[0] == "f32") {
+            continue;
+        } else if (filter.name == "--precision" && filter.arguments.size() == 1 && filter.arguments[0] == "u8" &&
+                   options.storage != Storage::Planar) {
+            options.storage = Storage::U8;
+        } else if (filter.name == "--stream" && filter.parameters.empty()) {
+            options.stream = true;
+        } else if (filter.name == "--batch" && filter.parameters.empty()) {
+            options.batch = true;
+        } else if (filter.name == "--quiet" && filter.parameters.empty()) {
+            options.quiet = true;
+        } else if (filter.name == "--profile" && filter.parameters.empty()) {
+            options.profile = true;
+        } else if (filter.name == "--stats" && filter.parameters.empty()) {
+            options.stats = true;
+        } else if (filter.name == "--trace" && filter.arguments.size() == 1) {
+            options.trace_path = filter.arguments[0];
+        } else if (filter.name == "--simd" && filter.arguments.size() == 1 && filter.arguments[0] == "scalar") {
+            SetMaxSimdLevel(SimdLevel::Scalar);
+        } else if (filter.name == "--simd" && filter.arguments.size() == 1 && filter.arguments[0] == "sse2") {
+            SetMaxSimdLevel(SimdLevel::Sse2);
+        } else if (filter.name == "--simd" && filter.arguments.size() == 1 && filter.arguments[0] == "avx2") {
+            SetMaxSimdLevel(SimdLevel::Avx2);
+        } else if (filter.name == "--bits" && filter.parameters.size() == 1 &&
+                   (filter.parameters[0] == 24 || filter.parameters[0] == 32)) {
+            SetBmpOutputBits(static_cast<int>(filter.parameters[0]));
+        } else if (filter.name == "--io" && filter.arguments.size() == 1 && filter.arguments[0] == "uring") {
+            SetIoBackend(IoBackend::Uring);
+        } else if (filter.name == "--io" && filter.arguments.size() == 1 && filter.arguments[0] == "threads") {
+            SetIoBackend(IoBackend::Threads);
+        } else if ((filter.name == "--planar" || filter.name == "--precision") &&
+                   options.storage != Storage::Interleaved) {
+            std::cerr << "Error: --planar and --precision u8 cannot be combined" << std::endl;
+            return false;
+        } else {
+            std::cerr << "Error: Incorrect option " << filter.name << std::endl;
+            return false;
+        }
+    }
+    filters = remaining;
+    return true;
 }
 
-void HandleEdgeDetectionFilter(Image& image, const std::vector<float>& parameters) {
-    if (parameters.size() == 1) {
-        float threshold = parameters[0];
-        image.EdgeDetection(threshold);
-    } else {
-        std::cerr << "Error: Incorrect number of parameters for filter -edge" << std::endl;
+// Запись одного файла результата
+bool ExportResult(const Image& image, const char* output_filename, std::string& error) {
+    StageTimer export_timer("Export");
+    if (!image.Save(output_filename, error)) {
+        return false;
+    }
+    export_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                        BmpCodecBytes(image.Width(), image.Height()));
+    return true;
+}
+
+// Запись результата: один файл или пирамида уровней
+bool SaveResult(Image image, const char* output_filename, const Options& options, std::string& error) {
+    if (options.pyramid_levels > 1) {
+        return SavePyramid(std::move(image), output_filename, options.pyramid_levels, error);
     }
+    return ExportResult(image, output_filename, error);
 }
 
-void ApplyFilters(Image& image, const std::vector<FilterInfo>& filters) {
-    // Словарь для хранения функций-обработчиков для каждого типа фильтра
-    std::map<std::string, Func> filter_handlers = {{"-crop", HandleCropFilter},         {"-gs", HandleGrayscaleFilter},
-                                                   {"-neg", HandleNegativeFilter},      {"-blur", HandleBlurFilter},
-                                                   {"-sharp", HandleSharpeningFilter},  {"-thermo", HandleThermoFilter},
-                                                   {"-edge", HandleEdgeDetectionFilter}};
-    // Применяем каждый фильтр к изображению
+// Делит фильтры на цепочки выходов: первая цепочка пишется в output_filename, каждая следующая начинается
+// с --output PATH и тоже применяется ко входному изображению
+std::vector<GraphOutput> SplitOutputs(const char* output_filename, const std::vector<FilterInfo>& filters) {
+    std::vector<GraphOutput> outputs(1);
+    outputs.front().path = output_filename;
     for (const auto& filter : filters) {
-        if (filter_handlers.find(filter.name) != filter_handlers.end()) {
-            // Вызываем соответствующий обработчик фильтра с параметрами
-            filter_handlers[filter.name](image, filter.parameters);
+        if (filter.name == "--output") {
+            outputs.push_back(GraphOutput{filter.arguments.front(), {}});
         } else {
-            std::cerr << "Error: Unknown filter " << filter.name << std::endl;
+            outputs.back().filters.push_back(filter);
         }
     }
+    return outputs;
 }
 
-// Функция для обработки аргументов командной строки
-std::vector<FilterInfo> ParseCommandLine(int argc, char* argv[]) {
-    std::vector<FilterInfo> filters;
+// Несколько результатов из одного входа: вход читается один раз, общие начала цепочек считаются один раз,
+// независимые ветви выполняются параллельно
+int RunGraph(const char* input_filename, const std::vector<GraphOutput>& outputs, const Options& options) {
+    auto say = [&options](const char* message) {
+        if (!options.quiet) {
+            std::cout << message << "\n";
+        }
+    };
 
-    // Пропускаем первый аргумент (имя программы)
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
+    const FilterGraph graph = BuildFilterGraph(outputs);
+    const ImageRegion region = InputRegion(graph);
+    Image image(0, 0);
+    std::string error;
+    StageTimer read_timer("Read");
+    if (!image.Load(input_filename, region.width, region.height, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    read_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                      BmpCodecBytes(image.Width(), image.Height()));
+    say("File read");
 
-        // Проверяем, является ли аргумент именем фильтра
-        if (arg.substr(0, 1) == "-") {
-            FilterInfo filter_info;
-            filter_info.name = arg;
+    if (options.explain) {
+        ExplainFilterGraph(graph, outputs, std::cout);
+        std::cout << "Storage: " << StorageName(options.storage) << ", SIMD kernels: " << GetSimdKernels().name
+                  << "\n";
+    }
+    // Выходы пишутся из разных потоков, у каждого своя строка ошибки
+    std::vector<std::string> errors(outputs.size());
+    ExecuteFilterGraph(std::move(image), graph, [&](size_t output, const Image& result) {
+        const char* path = outputs[output].path.c_str();
+        if (options.pyramid_levels > 1) {
+            SaveResult(result, path, options, errors[output]);
+        } else {
+            ExportResult(result, path, errors[output]);
+        }
+    });
 
-            // Получаем параметры фильтра (если они есть)
-            for (int j = i + 1; j < argc; ++j) {
-                std::string param = argv[j];
-                // Если следующий аргумент начинается с "-", значит текущий аргумент является последним параметром
-                if (param.substr(0, 1) == "-") {
-                    break;
-                }
-                filter_info.parameters.push_back(static_cast<float>(std::atof(param.c_str())));
-                ++i;  // Переходим к следующему аргументу
-            }
+    int status = 0;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        if (!options.quiet) {
+            PrintPipelineMessages(graph.output_plans[i], std::cout);
+        }
+        if (!errors[i].empty()) {
+            std::cerr << "Error: " << errors[i] << std::endl;
+            status = 1;
+            continue;
+        }
+        say("The file has been created");
+    }
+    if (status == 0) {
+        say("Image processed successfully!");
+    }
+    return status;
+}
 
-            filters.push_back(filter_info);
+// Обработка с кэшем результатов: начало плана, посчитанное в прошлых запусках, берётся с диска
+int RunCached(const char* input_filename, const char* output_filename, const std::vector<FilterInfo>& filters,
+              const Options& options) {
+    auto say = [&options](const char* message) {
+        if (!options.quiet) {
+            std::cout << message << "\n";
         }
+    };
+
+    ResultCache cache(options.cache_directory, static_cast<long long>(options.cache_megabytes * (1 << 20)));
+    std::string error;
+    if (!cache.Open(error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::vector<PipelineStage> plan = PlanPipeline(filters);
+    Image image(0, 0);
+    if (!ExecuteCachedPipeline(input_filename, plan, cache, image, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    say("File read");
+    if (options.explain) {
+        ExplainPipeline(plan, std::cout, options.storage == Storage::Interleaved);
+        std::cout << "Storage: " << StorageName(options.storage) << ", SIMD kernels: " << GetSimdKernels().name
+                  << ", cache: " << options.cache_directory << "\n";
+    }
+    if (!options.quiet) {
+        PrintPipelineMessages(plan, std::cout);
+    }
+    if (options.stats) {
+        PrintStats(ComputeStats(image), std::cout);
+    }
+    if (options.cache_stats) {
+        cache.PrintStats(std::cout);
+    }
+    cache.SaveStats();
+
+    if (!SaveResult(std::move(image), output_filename, options, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    say("The file has been created");
+
+    say("Image processed successfully!");
+    return 0;
+}
+
+// Обработка в 8-битном представлении: байты BMP читаются и пишутся без перевода в float
+int RunU8(const char* input_filename, const char* output_filename, const std::vector<FilterInfo>& filters,
+          const Options& options) {
+    auto say = [&options](const char* message) {
+        if (!options.quiet) {
+            std::cout << message << "\n";
+        }
+    };
+
+    ImageU8 image(0, 0);
+    std::string error;
+    StageTimer read_timer("Read");
+    if (!image.Load(input_filename, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
     }
+    read_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                      BmpCodecBytes(image.Width(), image.Height(), 3));
+    say("File read");
 
-    return filters;
+    std::vector<PipelineStage> plan = PlanPipeline(filters);
+    if (options.explain) {
+        ExplainPipeline(plan, std::cout, options.storage == Storage::Interleaved);
+        std::cout << "Storage: " << StorageName(options.storage) << ", SIMD kernels: " << GetSimdKernels().name
+                  << "\n";
+    }
+    ExecutePipeline(image, plan);
+    if (!options.quiet) {
+        PrintPipelineMessages(plan, std::cout);
+    }
+    if (options.stats) {
+        PrintStats(ComputeStats(image.ToImage()), std::cout);
+    }
+
+    if (options.pyramid_levels > 1) {
+        // Уровни пирамиды строятся во float, как и в обычном режиме; перевод байтов во float точный
+        if (!SavePyramid(image.ToImage(), output_filename, options.pyramid_levels, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        say("The file has been created");
+        say("Image processed successfully!");
+        return 0;
+    }
+    StageTimer export_timer("Export");
+    if (!image.Save(output_filename, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    export_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                        BmpCodecBytes(image.Width(), image.Height(), 3));
+    say("The file has been created");
+
+    say("Image processed successfully!");
+    return 0;
+}
+
+// Обработка в выбранном режиме. Возвращает код завершения программы
+int Run(const char* input_filename, const char* output_filename, const std::vector<FilterInfo>& filters,
+        const Options& options) {
+    // Сообщения о ходе обработки, отключаются через --quiet
+    auto say = [&options](const char* message) {
+        if (!options.quiet) {
+            std::cout << message << "\n";
+        }
+    };
+
+    // Пакетный режим: input_file - манифест, каталог или маска, output_file - шаблон с {name} или каталог
+    if (options.batch) {
+        std::vector<BatchJob> jobs;
+        std::string error;
+        if (!CollectBatchJobs(input_filename, output_filename, jobs, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        std::vector<PipelineStage> plan = PlanPipeline(filters);
+        if (options.explain) {
+            ExplainPipeline(plan, std::cout, options.storage == Storage::Interleaved);
+            std::cout << "Storage: " << StorageName(options.storage) << ", SIMD kernels: " << GetSimdKernels().name
+                      << ", files: " << jobs.size() << "\n";
+        }
+        return RunBatch(jobs, plan, options.storage) ? 0 : 1;
+    }
+
+    // В потоковом режиме изображение целиком не загружается: строки читаются, обрабатываются и пишутся сразу
+    if (options.stream) {
+        std::vector<PipelineStage> plan = PlanPipeline(filters);
+        if (options.explain) {
+            ExplainPipeline(plan, std::cout, false);
+            std::cout << "Storage: streaming rows, SIMD kernels: " << GetSimdKernels().name << "\n";
+        }
+        if (!RunStreaming(input_filename, output_filename, plan)) {
+            return 1;
+        }
+        if (!options.quiet) {
+            PrintPipelineMessages(plan, std::cout);
+        }
+        say("Image processed successfully!");
+        return 0;
+    }
+
+    if (!options.cache_directory.empty()) {
+        return RunCached(input_filename, output_filename, filters, options);
+    }
+
+    if (options.graph) {
+        return RunGraph(input_filename, SplitOutputs(output_filename, filters), options);
+    }
+
+    if (options.storage == Storage::U8) {
+        return RunU8(input_filename, output_filename, filters, options);
+    }
+
+    // Строим план с объединёнными проходами. Во float из файла читается только его область интереса
+    std::vector<PipelineStage> plan = PlanPipeline(filters);
+    const ImageRegion region = options.storage == Storage::Interleaved ? InputRegion(plan) : ImageRegion{};
+
+    // Создаем объект изображения из входного файла
+    Image image(0, 0);
+    std::string error;
+    StageTimer read_timer("Read");
+    if (!image.Load(input_filename, region.width, region.height, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    read_timer.Finish(static_cast<double>(image.Width()) * image.Height(),
+                      BmpCodecBytes(image.Width(), image.Height()));
+    say("File read");
+
+    // Применяем фильтры к изображению
+    if (options.explain) {
+        ExplainPipeline(plan, std::cout, options.storage == Storage::Interleaved);
+        std::cout << "Storage: " << StorageName(options.storage) << ", SIMD kernels: " << GetSimdKernels().name
+                  << "\n";
+    }
+    if (options.storage == Storage::Planar) {
+        // Раздельные каналы: переводим изображение, применяем фильтры и переводим обратно
+        PlanarImage planar(image);
+        image = Image(0, 0);
+        ExecutePipeline(planar, plan);
+        image = planar.ToImage();
+    } else {
+        ExecutePipeline(image, plan);
+    }
+    if (!options.quiet) {
+        PrintPipelineMessages(plan, std::cout);
+    }
+    if (options.stats) {
+        PrintStats(ComputeStats(image), std::cout);
+    }
+
+    // Сохраняем изображение в выходной файл
+    if (!SaveResult(std::move(image), output_filename, options, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    say("The file has been created");
+
+    say("Image processed successfully!");
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -107,7 +466,13 @@ int main(int argc, char* argv[]) {
     if (argc < 3) {
         std::cerr << "Usage: " << argv[0]
                   << " <input_file> <output_file> [-filter1 param1 param2 ...] [-filter2 param1 param2 ...] ..."
-                  << std::endl;
+                  << " [--threads N] [--explain] [--planar] [--stream] [--batch] [--quiet] [--profile] [--stats]"
+                  << " [--trace out.json] [--precision f32|u8] [--pyramid N]"
+                  << " [--cache DIR [--cache-size MB] [--cache-stats]]"
+                  << " [--simd scalar|sse2|avx2] [--io uring|threads] [--bits 24|32]"
+                  << " [--output <output_file2> [-filter ...] ...] ..."
+                  << "\n       " << argv[0] << " --serve socket_path [--serve-workers N] [--serve-queue N]"
+                  << " [--threads N] [--planar | --precision u8] [--bits 24|32] [--quiet]" << std::endl;
         return 1;
     }
 
@@ -115,20 +480,72 @@ int main(int argc, char* argv[]) {
     const char* input_filename = argv[1];
     const char* output_filename = argv[2];
 
-    // Создаем объект изображения из входного файла
-    Image image(0, 0);
-    image.Read(input_filename);
-
-    // Получаем список фильтров из аргументов командной строки
+    // Получаем список фильтров и параметры запуска из аргументов командной строки
     std::vector<FilterInfo> filters = ParseCommandLine(argc, argv);
-
-    // Применяем фильтры к изображению
-    ApplyFilters(image, filters);
-
-    // Сохраняем изображение в выходной файл
-    image.Export(output_filename);
-
-    std::cout << "Image processed successfully!" << std::endl;
-
-    return 0;
+    Options options;
+    if (!ExtractOptions(filters, options)) {
+        return 1;
+    }
+    SetThreadCount(options.threads);
+    if (options.storage != Storage::Interleaved && options.stream) {
+        std::cerr << "Error: --" << (options.storage == Storage::Planar ? "planar" : "precision u8")
+                  << " and --stream cannot be combined" << std::endl;
+        return 1;
+    }
+    if (options.pyramid_levels > 1 && (options.batch || options.stream)) {
+        std::cerr << "Error: --pyramid cannot be combined with --" << (options.batch ? "batch" : "stream")
+                  << std::endl;
+        return 1;
+    }
+    if (!options.cache_directory.empty() &&
+        (options.batch || options.stream || options.storage != Storage::Interleaved)) {
+        std::cerr << "Error: --cache cannot be combined with --batch, --stream, --planar or --precision u8"
+                  << std::endl;
+        return 1;
+    }
+    if (options.cache_directory.empty() && options.cache_stats) {
+        std::cerr << "Error: --cache-stats requires --cache" << std::endl;
+        return 1;
+    }
+    if (options.batch && options.stream) {
+        std::cerr << "Error: --batch and --stream cannot be combined" << std::endl;
+        return 1;
+    }
+    if (options.stats && (options.batch || options.stream)) {
+        std::cerr << "Error: --stats cannot be combined with --" << (options.batch ? "batch" : "stream") << std::endl;
+        return 1;
+    }
+    if (options.graph && (options.batch || options.stream || !options.cache_directory.empty() ||
+                          options.storage != Storage::Interleaved || options.stats)) {
+        std::cerr << "Error: --output cannot be combined with --batch, --stream, --cache, --planar, --precision u8"
+                  << " or --stats" << std::endl;
+        return 1;
+    }
+    if (!options.server.socket_path.empty()) {
+        if (options.batch || options.stream || options.explain || options.profile || options.stats ||
+            !options.trace_path.empty() || !options.cache_directory.empty() || options.pyramid_levels > 1 ||
+            !filters.empty()) {
+            std::cerr << "Error: --serve accepts only --serve-workers, --serve-queue, --threads, --simd, --planar,"
+                      << " --precision, --bits and --quiet; filters are given in requests" << std::endl;
+            return 1;
+        }
+        options.server.storage = options.storage;
+        options.server.quiet = options.quiet;
+        return RunServer(options.server) ? 0 : 1;
+    }
+    if (options.profile || !options.trace_path.empty()) {
+        EnableProfiling();
+    }
+    const int status = Run(input_filename, output_filename, filters, options);
+    if (!options.trace_path.empty()) {
+        std::string error;
+        if (!WriteTrace(options.trace_path.c_str(), error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+    }
+    if (options.profile) {
+        PrintProfile(std::cout);
+    }
+    return status;
 }
@@ -0,0 +1,510 @@
+#include "image_u8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "blur.h"
+#include "bmp.h"
+#include "denoise.h"
+#include "lut.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace {
+
+const int kRowGrain = 8;
+
+// Яркость пикселя BGR в фиксированной точке 8.16
+int GrayValue(const unsigned char* pixel) {
+    return kGrayBlueFixed * pixel[0] + kGrayGreenFixed * pixel[1] + kGrayRedFixed * pixel[2];
+}
+
+unsigned char Saturate(int value) {
+    return static_cast<unsigned char>(std::clamp(value, 0, 255));
+}
+
+#if defined(__SSE2__)
+// 16 байт, начиная с p, расширенные до двух векторов int16
+void LoadWide(const unsigned char* p, __m128i& lo, __m128i& hi) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    lo = _mm_unpacklo_epi8(bytes, zero);
+    hi = _mm_unpackhi_epi8(bytes, zero);
+}
+#endif
+
+// Резкость: 5 * центр минус четыре соседа по стороне, с насыщением. Каналы соседних пикселей отстоят на 3 байта
+void SharpeningRowU8(const unsigned char* up, const unsigned char* mid, const unsigned char* down, unsigned char* dst,
+                     int width) {
+    int i = 3;
+    const int end = 3 * (width - 1);
+#if defined(__SSE2__)
+    for (; i + 16 <= end; i += 16) {
+        __m128i c_lo, c_hi, l_lo, l_hi, r_lo, r_hi, u_lo, u_hi, d_lo, d_hi;
+        LoadWide(mid + i, c_lo, c_hi);
+        LoadWide(mid + i - 3, l_lo, l_hi);
+        LoadWide(mid + i + 3, r_lo, r_hi);
+        LoadWide(up + i, u_lo, u_hi);
+        LoadWide(down + i, d_lo, d_hi);
+        auto combine = [](__m128i c, __m128i l, __m128i r, __m128i u, __m128i d) {
+            const __m128i five_c = _mm_add_epi16(_mm_slli_epi16(c, 2), c);
+            return _mm_sub_epi16(five_c, _mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(u, d)));
+        };
+        // packus насыщает int16 до [0, 255], как clamp в версии с float
+        const __m128i lo = combine(c_lo, l_lo, r_lo, u_lo, d_lo);
+        const __m128i hi = combine(c_hi, l_hi, r_hi, u_hi, d_hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < end; ++i) {
+        dst[i] = Saturate(5 * mid[i] - mid[i - 3] - mid[i + 3] - up[i] - down[i]);
+    }
+}
+
+// Thermo: 5 * центр минус все восемь соседей, с насыщением
+void ThermoRowU8(const unsigned char* up, const unsigned char* mid, const unsigned char* down, unsigned char* dst,
+                 int width) {
+    int i = 3;
+    const int end = 3 * (width - 1);
+#if defined(__SSE2__)
+    for (; i + 16 <= end; i += 16) {
+        __m128i c_lo, c_hi;
+        LoadWide(mid + i, c_lo, c_hi);
+        __m128i sum_lo = _mm_setzero_si128();
+        __m128i sum_hi = _mm_setzero_si128();
+        const unsigned char* neighbors[8] = {up + i - 3, up + i,   up + i + 3,   mid + i - 3,
+                                             mid + i + 3, down + i - 3, down + i, down + i + 3};
+        for (const unsigned char* neighbor : neighbors) {
+            __m128i lo, hi;
+            LoadWide(neighbor, lo, hi);
+            sum_lo = _mm_add_epi16(sum_lo, lo);
+            sum_hi = _mm_add_epi16(sum_hi, hi);
+        }
+        const __m128i lo = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(c_lo, 2), c_lo), sum_lo);
+        const __m128i hi = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(c_hi, 2), c_hi), sum_hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < end; ++i) {
+        const int neighbors = up[i - 3] + up[i] + up[i + 3] + mid[i - 3] + mid[i + 3] + down[i - 3] + down[i] +
+                              down[i + 3];
+        dst[i] = Saturate(5 * mid[i] - neighbors);
+    }
+}
+
+// Пиксели файла лежат так же, как в ImageU8: 24 бита без сжатия, строки снизу вверх
+bool IsBgr24Layout(const BmpInfo& info) {
+    return info.bit_count == 24 && info.compression == kBmpRgb && !info.top_down;
+}
+
+}  // namespace
+
+ImageU8::ImageU8(int width, int height)
+    : m_width_(width),
+      m_height_(height),
+      m_stride_(BmpRowSize(width)),
+      m_offset_(0),
+      m_pixels_(BmpRowSize(width) * height) {
+}
+
+ImageU8::ImageU8(const Image& image) : ImageU8(image.Width(), image.Height()) {
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            PackBgr24Row(image.Row(y), Row(y), m_width_);
+        }
+    });
+}
+
+Image ImageU8::ToImage() const {
+    Image image(m_width_, m_height_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            UnpackBgr24Row(Row(y), image.Row(y), m_width_);
+        }
+    });
+    return image;
+}
+
+int ImageU8::Width() const {
+    return m_width_;
+}
+
+int ImageU8::Height() const {
+    return m_height_;
+}
+
+unsigned char* ImageU8::Row(int y) {
+    return m_pixels_.data() + m_offset_ + static_cast<size_t>(y) * m_stride_;
+}
+
+const unsigned char* ImageU8::Row(int y) const {
+    return m_pixels_.data() + m_offset_ + static_cast<size_t>(y) * m_stride_;
+}
+
+std::vector<unsigned char>& ImageU8::PrepareScratch() {
+    m_scratch_.resize(BmpRowSize(m_width_) * m_height_);
+    return m_scratch_;
+}
+
+void ImageU8::SwapScratch() {
+    m_pixels_.swap(m_scratch_);
+    m_stride_ = BmpRowSize(m_width_);
+    m_offset_ = 0;
+}
+
+bool ImageU8::Load(const char* path, std::string& error) {
+    std::ifstream f;
+    f.open(path, std::ios::in | std::ios::binary);
+    if (!f.is_open()) {
+        error = "This file cannot be opened";
+        return false;
+    }
+    return Load(f, error);
+}
+
+bool ImageU8::Load(std::istream& f, std::string& error) {
+    BmpInfo info;
+    if (!ReadBmpHeader(f, info, error)) {
+        return false;
+    }
+
+    const size_t row_size = BmpRowSize(info.width);
+    std::vector<unsigned char>& pixels = m_scratch_;
+    pixels.resize(row_size * info.height);
+    if (IsBgr24Layout(info)) {
+        // Пиксельные данные файла уже в нужном виде: читаем их одним блоком
+        f.read(reinterpret_cast<char*>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+        if (f.gcount() != static_cast<std::streamsize>(pixels.size())) {
+            error = "Unexpected end of bitmap pixel data";
+            return false;
+        }
+    } else {
+        const bool read = ReadBmpRows(
+            f, info,
+            [&](int y, const unsigned char* row) {
+                UnpackBmpRowBgr24(info, row, pixels.data() + static_cast<size_t>(y) * row_size);
+            },
+            error);
+        if (!read) {
+            return false;
+        }
+    }
+
+    m_width_ = info.width;
+    m_height_ = info.height;
+    SwapScratch();
+    return true;
+}
+
+bool ImageU8::Decode(const char* data, size_t size, std::string& error) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    BmpInfo info;
+    if (!ParseBmpHeader(bytes, size, info, error)) {
+        return false;
+    }
+    const size_t row_size = BmpRowSize(info.width);
+    const size_t pixel_bytes = row_size * info.height;
+    if (IsBgr24Layout(info)) {
+        if (size < info.data_offset + pixel_bytes) {
+            error = "Unexpected end of bitmap pixel data";
+            return false;
+        }
+        m_scratch_.assign(data + info.data_offset, data + info.data_offset + pixel_bytes);
+    } else {
+        m_scratch_.resize(pixel_bytes);
+        const bool decoded = DecodeBmpRows(
+            bytes, size, info,
+            [&](int y, const unsigned char* row) {
+                UnpackBmpRowBgr24(info, row, m_scratch_.data() + static_cast<size_t>(y) * row_size);
+            },
+            error);
+        if (!decoded) {
+            return false;
+        }
+    }
+    m_width_ = info.width;
+    m_height_ = info.height;
+    SwapScratch();
+    return true;
+}
+
+bool ImageU8::Encode(std::string& bytes, std::string& error) const {
+    if (!CheckBmpOutputSize(m_width_, m_height_, error)) {
+        return false;
+    }
+    const size_t row_size = BmpOutputRowSize(m_width_);
+    bytes.resize(BmpFileSize(m_width_, m_height_));
+    unsigned char* data = reinterpret_cast<unsigned char*>(bytes.data());
+    WriteBmpHeader(data, m_width_, m_height_, error);
+    for (int y = 0; y < m_height_; ++y) {
+        PackBmpRowBgr24(Row(y), data + kBmpFileHeaderSize + kBmpInfoHeaderSize + static_cast<size_t>(y) * row_size,
+                        m_width_);
+    }
+    return true;
+}
+
+bool ImageU8::Save(const char* path, std::string& error) const {
+    if (!CheckBmpOutputSize(m_width_, m_height_, error)) {
+        return false;
+    }
+    std::ofstream f;
+    f.open(path, std::ios::out | std::ios::binary);
+    if (!f.is_open()) {
+        error = "File cannot be opened";
+        return false;
+    }
+
+    unsigned char header[kBmpFileHeaderSize + kBmpInfoHeaderSize];
+    WriteBmpHeader(header, m_width_, m_height_, error);
+    f.write(reinterpret_cast<char*>(header), sizeof(header));
+
+    // После обрезки строки идут не подряд, поэтому собираем их в блок с нулевыми байтами выравнивания
+    const size_t row_size = BmpOutputRowSize(m_width_);
+    const size_t block_bytes = 1 << 22;
+    const int rows_per_block = static_cast<int>(std::max<size_t>(1, block_bytes / row_size));
+    std::vector<unsigned char> block(row_size * std::min(rows_per_block, m_height_));
+    for (int y = 0; y < m_height_; y += rows_per_block) {
+        const int rows = std::min(rows_per_block, m_height_ - y);
+        for (int i = 0; i < rows; ++i) {
+            PackBmpRowBgr24(Row(y + i), block.data() + static_cast<size_t>(i) * row_size, m_width_);
+        }
+        f.write(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(row_size) * rows);
+    }
+
+    f.close();
+    if (!f) {
+        error = "Failed to write the file";
+        return false;
+    }
+    return true;
+}
+
+void ImageU8::Crop(int new_width, int new_height) {
+    new_width = std::min(new_width, m_width_);
+    new_height = std::min(new_height, m_height_);
+
+    // Как и в Image, остаётся левая верхняя часть, пиксели не копируются
+    m_offset_ += static_cast<size_t>(m_height_ - new_height) * m_stride_;
+    m_width_ = new_width;
+    m_height_ = new_height;
+}
+
+void ImageU8::Resize(int new_width, int new_height) {
+    // Веса Ланцоша дробные, поэтому, как и у -conv, масштабирование идёт во float
+    Image image = ToImage();
+    image.Resize(new_width, new_height);
+    *this = ImageU8(image);
+}
+
+void ImageU8::Grayscale() {
+    const SimdKernels& simd = GetSimdKernels();
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            simd.grayscale_bgr8(Row(y), m_width_);
+        }
+    });
+}
+
+void ImageU8::Negative() {
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        const int row_values = m_width_ * 3;
+        for (int y = begin; y < end; ++y) {
+            unsigned char* row = Row(y);
+            // 255 - v для байта - инверсия битов, цикл векторизуется компилятором
+            for (int i = 0; i < row_values; ++i) {
+                row[i] = static_cast<unsigned char>(~row[i]);
+            }
+        }
+    });
+}
+
+void ImageU8::GaussianBlur(float sigma) {
+    if (sigma <= 0.0f) {
+        return;
+    }
+    const int row_values = m_width_ * 3;
+    std::vector<uint16_t> temporary(static_cast<size_t>(row_values) * m_height_);
+    auto temporary_row = [&](int y) { return temporary.data() + static_cast<size_t>(y) * row_values; };
+
+    if (UseBoxCascade(sigma)) {
+        const std::vector<int> radii = BoxCascadeRadii(sigma);
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            std::vector<uint16_t> row_a(row_values);
+            std::vector<uint16_t> row_b(row_values);
+            for (int y = begin; y < end; ++y) {
+                const unsigned char* src = Row(y);
+                for (int i = 0; i < row_values; ++i) {
+                    row_a[i] = static_cast<uint16_t>(src[i] << 8);
+                }
+                BoxBlurRowHorizontalU16(row_a.data(), row_b.data(), m_width_, 3, radii[0]);
+                BoxBlurRowHorizontalU16(row_b.data(), row_a.data(), m_width_, 3, radii[1]);
+                BoxBlurRowHorizontalU16(row_a.data(), temporary_row(y), m_width_, 3, radii[2]);
+            }
+        });
+        std::vector<uint16_t> other(temporary.size());
+        auto vertical = [&](const uint16_t* src, uint16_t* dst, int radius) {
+            ParallelFor(row_values, 1 << 12, [&](int begin, int end) {
+                BoxBlurVerticalU16(src + begin, row_values, dst + begin, row_values, m_height_, end - begin, radius);
+            });
+        };
+        vertical(temporary.data(), other.data(), radii[0]);
+        vertical(other.data(), temporary.data(), radii[1]);
+        vertical(temporary.data(), other.data(), radii[2]);
+        ParallelFor(m_height_, kRowGrain, [&, row_values](int begin, int end) {
+            const int count = row_values;
+            for (int y = begin; y < end; ++y) {
+                const uint16_t* src = other.data() + static_cast<size_t>(y) * count;
+                unsigned char* dst = Row(y);
+                for (int i = 0; i < count; ++i) {
+                    dst[i] = static_cast<unsigned char>(src[i] >> 8);
+                }
+            }
+        });
+        return;
+    }
+
+    const std::vector<int> kernel = FixedPointKernel(GaussianKernel(sigma));
+    const int radius = static_cast<int>(kernel.size()) / 2;
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            ConvolveRowHorizontalU8(Row(y), temporary_row(y), m_width_, 3, kernel);
+        }
+    });
+    // Вертикальный проход читает только промежуточный буфер, поэтому пишет прямо в строки изображения
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const uint16_t*> rows(kernel.size());
+        for (int y = begin; y < end; ++y) {
+            for (int k = -radius; k <= radius; ++k) {
+                const int neighbor_y = y + k;
+                const bool inside = neighbor_y >= 0 && neighbor_y < m_height_;
+                rows[k + radius] = inside ? temporary_row(neighbor_y) : nullptr;
+            }
+            ConvolveRowsVerticalU16(rows.data(), kernel, Row(y), row_values);
+        }
+    });
+}
+
+void ImageU8::Sharpening() {
+    ApplyStencil(SharpeningRowU8);
+}
+
+void ImageU8::Thermo() {
+    ApplyStencil(ThermoRowU8);
+}
+
+void ImageU8::ApplyStencil(StencilRow stencil) {
+    std::vector<unsigned char>& processed = PrepareScratch();
+    const size_t row_size = BmpRowSize(m_width_);
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            unsigned char* dst = &processed[static_cast<size_t>(y) * row_size];
+            std::fill(dst, dst + 3, 0);
+            std::fill(dst + 3 * (m_width_ - 1), dst + 3 * m_width_, 0);
+            stencil(Row(y - 1), Row(y), Row(y + 1), dst, m_width_);
+        }
+    });
+    std::fill(processed.begin(), processed.begin() + row_size, 0);
+    if (m_height_ > 1) {
+        std::fill(processed.end() - row_size, processed.end(), 0);
+    }
+    SwapScratch();
+}
+
+void ImageU8::EdgeDetection(float threshold) {
+    // Яркость считаем с 8 дробными битами: порог сравнивается почти с той же точностью, что и во float
+    const SimdKernels& simd = GetSimdKernels();
+    std::vector<uint16_t> gray(static_cast<size_t>(m_width_) * m_height_);
+    auto gray_row = [&](int y) { return gray.data() + static_cast<size_t>(y) * m_width_; };
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            simd.luma_bgr8(Row(y), gray_row(y), m_width_);
+        }
+    });
+
+    // Значение стенсила в единицах 1/65280 сравнивается с порогом в тех же единицах. Отклик целый, поэтому
+    // порог округляется вниз; за пределами отклика (|отклик| < 2^20) он насыщается
+    const double limit = std::floor(static_cast<double>(threshold) * 255.0 * 256.0);
+    const int32_t bound = 1 << 20;
+    const int32_t level = !(limit < bound) ? bound : limit < -bound ? -bound : static_cast<int32_t>(limit);
+    std::vector<unsigned char>& processed = PrepareScratch();
+    const size_t row_size = BmpRowSize(m_width_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const unsigned char* src = Row(y);
+            unsigned char* dst = &processed[static_cast<size_t>(y) * row_size];
+            // Крайние пиксели остаются серыми
+            auto border = [&](int x) {
+                const unsigned char value = static_cast<unsigned char>(GrayValue(src + 3 * x) >> 16);
+                std::fill(dst + 3 * x, dst + 3 * x + 3, value);
+            };
+            if (y == 0 || y == m_height_ - 1 || m_width_ < 3) {
+                for (int x = 0; x < m_width_; ++x) {
+                    border(x);
+                }
+                continue;
+            }
+            border(0);
+            simd.edge_threshold_u16(gray_row(y - 1) + 1, gray_row(y) + 1, gray_row(y + 1) + 1, level, dst + 3,
+                                    m_width_ - 2);
+            border(m_width_ - 1);
+        }
+    });
+    SwapScratch();
+}
+
+void ImageU8::AutoEdgeDetection() {
+    // Порог выбирается по гистограмме отклика во float, поэтому и фильтр считается во float, как у Convolve
+    Image image = ToImage();
+    image.AutoEdgeDetection();
+    *this = ImageU8(image);
+}
+
+void ImageU8::Convolve(const Convolution& convolution) {
+    // Веса произвольного ядра дробные, поэтому свёртка идёт во float; результат совпадает с Image после записи
+    Image image = ToImage();
+    image.Convolve(convolution);
+    *this = ImageU8(image);
+}
+
+void ImageU8::ApplyLut(const ColorLut& lut) {
+    // Таблица интерполируется во float: строка переводится во float по частям и сразу записывается обратно
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        const int chunk = 256;
+        std::vector<Color> colors(chunk);
+        for (int y = begin; y < end; ++y) {
+            unsigned char* row = Row(y);
+            for (int x = 0; x < m_width_; x += chunk) {
+                const int count = std::min(chunk, m_width_ - x);
+                UnpackBgr24Row(row + 3 * x, colors.data(), count);
+                lut.Apply(colors.data(), count);
+                PackBgr24Row(colors.data(), row + 3 * x, count);
+            }
+        }
+    });
+}
+
+void ImageU8::Median(int radius) {
+    // Байты и есть уровни медианы, результат совпадает с Image после записи
+    std::vector<unsigned char>& processed = PrepareScratch();
+    const size_t row_size = BmpRowSize(m_width_);
+    MedianFilter(
+        m_width_, m_height_, 3, radius, [this](int y) { return Row(y); },
+        [&](int y, const unsigned char* median) {
+            std::copy(median, median + 3 * m_width_, &processed[static_cast<size_t>(y) * row_size]);
+        });
+    SwapScratch();
+}
+
+void ImageU8::Bilateral(float sigma_spatial, float sigma_range) {
+    // Сетка копит суммы во float, как у Convolve фильтр считается во float
+    Image image = ToImage();
+    image.Bilateral(sigma_spatial, sigma_range);
+    *this = ImageU8(image);
+}
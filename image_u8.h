@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+class ColorLut;
+
+// Изображение с 8-битными каналами в порядке BGR, как в файле BMP: строки хранятся снизу вверх и выровнены
+// до 4 байт, поэтому чтение и запись сводятся к копированию блоков. Памяти в 4 раза меньше, чем у Image.
+// Фильтры работают в целых числах, после каждого фильтра значения насыщаются до [0, 255]. Для поточечных
+// фильтров, резкости и размытия результат отличается от Image не больше чем на 1 уровень; пороговый
+// -edge может давать другой цвет у пикселей, значение которых совпадает с порогом с точностью до округления.
+// -thermo тоже насыщается, а в Image его результат выходит за [0, 1], поэтому фильтры после -thermo могут
+// давать совсем другой результат. -resize, -edge auto, -conv, -lut и -bilateral считаются во float через Image
+// и из-за преобразований медленнее, чем без --precision u8
+class ImageU8 {
+public:
+    ImageU8(int width, int height);
+    explicit ImageU8(const Image& image);
+
+    Image ToImage() const;
+
+    int Width() const;
+    int Height() const;
+    // Указатель на первый байт строки y (строки снизу вверх, как в файле)
+    unsigned char* Row(int y);
+    const unsigned char* Row(int y) const;
+
+    // При ошибке возвращают false и пишут причину в error
+    bool Load(const char* path, std::string& error);
+    // Чтение из потока; как и у Image, память прошлого изображения переиспользуется
+    bool Load(std::istream& in, std::string& error);
+    bool Save(const char* path, std::string& error) const;
+    // Файл BMP в памяти, как у Image
+    bool Decode(const char* data, size_t size, std::string& error);
+    bool Encode(std::string& bytes, std::string& error) const;
+
+    void Crop(int new_width, int new_height);
+    void Resize(int new_width, int new_height);
+    void Grayscale();
+    void Negative();
+    void GaussianBlur(float sigma);
+    void Sharpening();
+    void Thermo();
+    void EdgeDetection(float threshold);
+    void AutoEdgeDetection();
+    void Convolve(const Convolution& convolution);
+    void ApplyLut(const ColorLut& lut);
+    void Median(int radius);
+    void Bilateral(float sigma_spatial, float sigma_range);
+
+private:
+    using StencilRow = void (*)(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                unsigned char* dst, int width);
+
+    // Буфер под изображение текущего размера с выравниванием строк BMP, память переиспользуется
+    std::vector<unsigned char>& PrepareScratch();
+    void SwapScratch();
+    // Свёртка 3x3 в промежуточный буфер, крайние строки и столбцы результата чёрные
+    void ApplyStencil(StencilRow stencil);
+
+    int m_width_;
+    int m_height_;
+    size_t m_stride_;  // байт между началами соседних строк
+    size_t m_offset_;
+    std::vector<unsigned char> m_pixels_;
+    std::vector<unsigned char> m_scratch_;
+};
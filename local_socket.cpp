@@ -0,0 +1,233 @@
+#include "local_socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define IMAGE_PROCESSOR_LOCAL_SOCKETS 1
+#endif
+
+namespace {
+
+std::atomic<bool> g_stop_signal(false);
+
+}  // namespace
+
+bool StopSignalReceived() {
+    return g_stop_signal.load();
+}
+
+#if defined(IMAGE_PROCESSOR_LOCAL_SOCKETS)
+
+namespace {
+
+// Размер блока чтения из сокета
+const size_t kReadBlock = 1 << 16;
+
+#if defined(MSG_NOSIGNAL)
+const int kSendFlags = MSG_NOSIGNAL;  // закрытое клиентом соединение не должно завершать сервер сигналом
+#else
+const int kSendFlags = 0;
+#endif
+
+bool MakeAddress(const std::string& path, sockaddr_un& address, std::string& error) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        error = "Socket path must be non-empty and shorter than " + std::to_string(sizeof(address.sun_path)) +
+                " characters";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+}  // namespace
+
+int ListenLocalSocket(const std::string& path, int backlog, std::string& error) {
+    sockaddr_un address;
+    if (!MakeAddress(path, address, error)) {
+        return -1;
+    }
+    // Файл сокета остаётся после прошлого запуска; обычные файлы не трогаем
+    struct stat status;
+    if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path.c_str());
+    }
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        error = std::string("Cannot create socket: ") + std::strerror(errno);
+        return -1;
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, backlog) != 0) {
+        error = "Cannot listen on " + path + ": " + std::strerror(errno);
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int ConnectLocalSocket(const std::string& path, std::string& error) {
+    sockaddr_un address;
+    if (!MakeAddress(path, address, error)) {
+        return -1;
+    }
+    const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0) {
+        error = std::string("Cannot create socket: ") + std::strerror(errno);
+        return -1;
+    }
+    if (connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        error = "Cannot connect to " + path + ": " + std::strerror(errno);
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+int AcceptConnection(int listener) {
+    // Сигнал может прийти в любой поток, поэтому ожидание идёт короткими отрезками с проверкой флага
+    pollfd waiting{listener, POLLIN, 0};
+    while (!StopSignalReceived()) {
+        const int ready = poll(&waiting, 1, 200);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready > 0) {
+            return accept(listener, nullptr, nullptr);
+        }
+    }
+    return -1;
+}
+
+void StopListening(int listener) {
+    shutdown(listener, SHUT_RDWR);
+}
+
+void CloseSocket(int socket) {
+    close(socket);
+}
+
+void CatchStopSignals() {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = [](int) { g_stop_signal.store(true); };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+bool SocketStream::Fill() {
+    if (m_position_ > 0) {
+        m_buffer_.erase(0, m_position_);
+        m_position_ = 0;
+    }
+    const size_t size = m_buffer_.size();
+    m_buffer_.resize(size + kReadBlock);
+    ssize_t received;
+    do {
+        received = recv(m_socket_, &m_buffer_[size], kReadBlock, 0);
+    } while (received < 0 && errno == EINTR);
+    m_buffer_.resize(size + static_cast<size_t>(std::max<ssize_t>(received, 0)));
+    return received > 0;
+}
+
+bool SocketStream::Write(const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t sent = send(m_socket_, data, size, kSendFlags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+#else
+
+int ListenLocalSocket(const std::string& path, int backlog, std::string& error) {
+    error = "Local sockets are not supported on this system";
+    return -1;
+}
+
+int ConnectLocalSocket(const std::string& path, std::string& error) {
+    error = "Local sockets are not supported on this system";
+    return -1;
+}
+
+int AcceptConnection(int listener) {
+    return -1;
+}
+
+void StopListening(int listener) {
+}
+
+void CloseSocket(int socket) {
+}
+
+void CatchStopSignals() {
+}
+
+bool SocketStream::Fill() {
+    return false;
+}
+
+bool SocketStream::Write(const char* data, size_t size) {
+    return false;
+}
+
+#endif
+
+SocketStream::SocketStream(int socket) : m_socket_(socket), m_position_(0) {
+}
+
+SocketStream::~SocketStream() {
+    CloseSocket(m_socket_);
+}
+
+bool SocketStream::ReadLine(std::string& line, size_t max_length) {
+    while (true) {
+        const size_t end = m_buffer_.find('\n', m_position_);
+        if (end != std::string::npos) {
+            line.assign(m_buffer_, m_position_, end - m_position_);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            m_position_ = end + 1;
+            return true;
+        }
+        if (m_buffer_.size() - m_position_ > max_length || !Fill()) {
+            return false;
+        }
+    }
+}
+
+bool SocketStream::ReadBytes(size_t count, std::string& bytes) {
+    m_buffer_.reserve(m_position_ + count);
+    while (m_buffer_.size() - m_position_ < count) {
+        if (!Fill()) {
+            return false;
+        }
+    }
+    bytes.append(m_buffer_, m_position_, count);
+    m_position_ += count;
+    return true;
+}
+
+bool SocketStream::WriteLine(const std::string& line) {
+    const std::string data = line + "\n";
+    return Write(data.data(), data.size());
+}
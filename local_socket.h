@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Локальные сокеты (Unix domain) для режима --serve и его клиента. На системах без них функции
+// возвращают ошибку
+
+// Создаёт сокет по пути path и начинает принимать соединения; прежний файл сокета удаляется.
+// Возвращает дескриптор или -1 и пишет причину в error
+int ListenLocalSocket(const std::string& path, int backlog, std::string& error);
+int ConnectLocalSocket(const std::string& path, std::string& error);
+// Ждёт соединение; -1 при ошибке или если ожидание прервано сигналом или StopListening
+int AcceptConnection(int listener);
+// Прерывает AcceptConnection в другом потоке
+void StopListening(int listener);
+void CloseSocket(int socket);
+// После вызова SIGINT и SIGTERM не завершают процесс, а прерывают ожидание в AcceptConnection
+void CatchStopSignals();
+bool StopSignalReceived();
+
+// Соединение с буферизованным чтением: запросы и ответы - строки, за строкой могут идти байты файла
+class SocketStream {
+public:
+    explicit SocketStream(int socket);
+    ~SocketStream();
+    SocketStream(const SocketStream&) = delete;
+    SocketStream& operator=(const SocketStream&) = delete;
+
+    // Строка без перевода строки; false, если соединение закрыто или строка длиннее max_length
+    bool ReadLine(std::string& line, size_t max_length = 1 << 16);
+    // Ровно count байт, дописываются в конец bytes
+    bool ReadBytes(size_t count, std::string& bytes);
+    bool Write(const char* data, size_t size);
+    bool WriteLine(const std::string& line);
+
+private:
+    bool Fill();
+
+    int m_socket_;
+    std::string m_buffer_;
+    size_t m_position_;
+};
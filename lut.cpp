@@ -0,0 +1,179 @@
+#include "lut.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "simd.h"
+
+namespace {
+
+// Размер куска, который Apply переводит в раздельные каналы для векторных ядер
+const int kLutChunk = 256;
+
+// Число из строки файла целиком, без лишних символов
+bool ParseFloat(const std::string& text, float& value) {
+    char* end = nullptr;
+    value = std::strtof(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+bool ParseFloats(std::istringstream& line, float* values, int count) {
+    std::string token;
+    for (int i = 0; i < count; ++i) {
+        if (!(line >> token) || !ParseFloat(token, values[i])) {
+            return false;
+        }
+    }
+    return !(line >> token);
+}
+
+}  // namespace
+
+ColorLut::ColorLut(const std::vector<float>& packed) {
+    m_dimensions_ = static_cast<int>(packed[0]);
+    m_size_ = static_cast<int>(packed[1]);
+    std::copy(packed.begin() + 2, packed.begin() + 5, m_domain_min_);
+    std::copy(packed.begin() + 5, packed.begin() + 8, m_domain_max_);
+    m_table_.resize((packed.size() - 8) / 3);
+    for (size_t i = 0; i < m_table_.size(); ++i) {
+        m_table_[i] = Color(packed[8 + 3 * i], packed[9 + 3 * i], packed[10 + 3 * i]);
+    }
+}
+
+bool ColorLut::Load(const char* path, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "LUT file cannot be opened";
+        return false;
+    }
+    int size_1d = 0;
+    int size_3d = 0;
+    std::vector<Color> table;
+    std::string text;
+    int line_number = 0;
+    while (std::getline(file, text)) {
+        ++line_number;
+        text = text.substr(0, text.find('#'));
+        std::istringstream line(text);
+        std::string keyword;
+        if (!(line >> keyword)) {
+            continue;
+        }
+        const std::string where = " in line " + std::to_string(line_number) + " of the LUT file";
+        if (keyword == "LUT_1D_SIZE" || keyword == "LUT_3D_SIZE") {
+            float value = 0.0f;
+            const bool parsed = ParseFloats(line, &value, 1);
+            if (!parsed || !(value >= 0.0f && value <= kMax1dSize) || value != std::floor(value)) {
+                error = "Invalid " + keyword + where;
+                return false;
+            }
+            (keyword == "LUT_1D_SIZE" ? size_1d : size_3d) = static_cast<int>(value);
+        } else if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX") {
+            if (!ParseFloats(line, keyword == "DOMAIN_MIN" ? m_domain_min_ : m_domain_max_, 3)) {
+                error = "Invalid " + keyword + where;
+                return false;
+            }
+        } else if (keyword == "LUT_1D_INPUT_RANGE" || keyword == "LUT_3D_INPUT_RANGE") {
+            // Вариант Resolve: одна область для всех каналов
+            float range[2];
+            if (!ParseFloats(line, range, 2)) {
+                error = "Invalid " + keyword + where;
+                return false;
+            }
+            std::fill(m_domain_min_, m_domain_min_ + 3, range[0]);
+            std::fill(m_domain_max_, m_domain_max_ + 3, range[1]);
+        } else if (std::isalpha(static_cast<unsigned char>(keyword[0]))) {
+            // TITLE и ключевые слова других программ на таблицу не влияют
+            continue;
+        } else {
+            std::istringstream values(text);
+            float color[3];
+            if (!ParseFloats(values, color, 3)) {
+                error = "Invalid table entry" + where;
+                return false;
+            }
+            table.emplace_back(color[0], color[1], color[2]);
+        }
+    }
+
+    if ((size_1d == 0) == (size_3d == 0)) {
+        error = "LUT file must have exactly one of LUT_1D_SIZE and LUT_3D_SIZE";
+        return false;
+    }
+    m_dimensions_ = size_1d != 0 ? 1 : 3;
+    m_size_ = size_1d != 0 ? size_1d : size_3d;
+    const int max_size = m_dimensions_ == 1 ? kMax1dSize : kMax3dSize;
+    if (m_size_ < 2 || m_size_ > max_size) {
+        error = "LUT size must be from 2 to " + std::to_string(max_size);
+        return false;
+    }
+    const size_t entries = m_dimensions_ == 1 ? m_size_ : static_cast<size_t>(m_size_) * m_size_ * m_size_;
+    if (table.size() != entries) {
+        error = "LUT file must have " + std::to_string(entries) + " table entries";
+        return false;
+    }
+    for (int c = 0; c < 3; ++c) {
+        if (!(m_domain_min_[c] < m_domain_max_[c])) {
+            error = "LUT domain minimum must be less than its maximum";
+            return false;
+        }
+    }
+    m_table_ = std::move(table);
+    return true;
+}
+
+std::vector<float> ColorLut::Pack() const {
+    std::vector<float> packed = {static_cast<float>(m_dimensions_), static_cast<float>(m_size_)};
+    packed.insert(packed.end(), m_domain_min_, m_domain_min_ + 3);
+    packed.insert(packed.end(), m_domain_max_, m_domain_max_ + 3);
+    packed.reserve(packed.size() + 3 * m_table_.size());
+    for (const Color& color : m_table_) {
+        packed.insert(packed.end(), {color.r, color.g, color.b});
+    }
+    return packed;
+}
+
+int ColorLut::Dimensions() const {
+    return m_dimensions_;
+}
+
+int ColorLut::Size() const {
+    return m_size_;
+}
+
+void ColorLut::Transform(const PointOp& op) {
+    op(m_table_.data(), static_cast<int>(m_table_.size()));
+}
+
+void ColorLut::Apply(Color* pixels, int count) const {
+    float r[kLutChunk];
+    float g[kLutChunk];
+    float b[kLutChunk];
+    for (int begin = 0; begin < count; begin += kLutChunk) {
+        const int chunk = std::min(kLutChunk, count - begin);
+        Color* part = pixels + begin;
+        for (int i = 0; i < chunk; ++i) {
+            r[i] = part[i].r;
+            g[i] = part[i].g;
+            b[i] = part[i].b;
+        }
+        Apply(r, g, b, chunk);
+        for (int i = 0; i < chunk; ++i) {
+            part[i] = Color(r[i], g[i], b[i]);
+        }
+    }
+}
+
+void ColorLut::Apply(float* r, float* g, float* b, int count) const {
+    LutView view{&m_table_[0].r, m_size_, {}, {}};
+    for (int c = 0; c < 3; ++c) {
+        view.offset[c] = m_domain_min_[c];
+        view.scale[c] = static_cast<float>(m_size_ - 1) / (m_domain_max_[c] - m_domain_min_[c]);
+    }
+    const SimdKernels& simd = GetSimdKernels();
+    (m_dimensions_ == 1 ? simd.lut1d : simd.lut3d)(r, g, b, count, view);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+// Таблица цветов из файла .cube (формат Adobe/Resolve): одномерная - своя кривая для каждого канала,
+// или трёхмерная - цвет в узлах решётки size^3, между узлами тетраэдральная интерполяция.
+// Значения за пределами DOMAIN_MIN..DOMAIN_MAX берутся по краю таблицы
+class ColorLut {
+public:
+    // Наибольшие размеры: у трёхмерной таблицы индексы узлов должны помещаться во float без округления
+    static const int kMax1dSize = 65536;
+    static const int kMax3dSize = 128;
+
+    ColorLut() = default;
+    // Таблица из чисел, записанных Pack
+    explicit ColorLut(const std::vector<float>& packed);
+
+    // Чтение файла .cube. При ошибке возвращает false и пишет причину в error
+    bool Load(const char* path, std::string& error);
+
+    // Таблица одним массивом чисел (размерность, размер, границы области, узлы), чтобы передать её
+    // реализациям фильтра вместе с параметрами
+    std::vector<float> Pack() const;
+
+    int Dimensions() const;
+    int Size() const;
+
+    // Применяет поточечную операцию к цветам узлов. Для аффинных операций это то же, что применить её
+    // после таблицы к каждому пикселю: веса интерполяции в сумме дают 1. У одномерной таблицы каналы узла
+    // относятся к разным входным цветам, поэтому подходят только операции, не смешивающие каналы
+    void Transform(const PointOp& op);
+
+    void Apply(Color* pixels, int count) const;
+    // Для раздельных каналов
+    void Apply(float* r, float* g, float* b, int count) const;
+
+private:
+    int m_dimensions_ = 3;
+    int m_size_ = 0;
+    float m_domain_min_[3] = {0.0f, 0.0f, 0.0f};
+    float m_domain_max_[3] = {1.0f, 1.0f, 1.0f};
+    std::vector<Color> m_table_;
+};
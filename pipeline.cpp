@@ -0,0 +1,940 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include "blur.h"
+#include "bmp.h"
+#include "convolution.h"
+#include "denoise.h"
+#include "lut.h"
+#include "profile.h"
+#include "stream.h"
+#include "tiling.h"
+
+namespace {
+
+// Размер куска, на котором слитые поточечные фильтры выполняются друг за другом: 12 КБ, помещается в L1
+const int kFusedChunk = 1024;
+
+using PointOpFactory = std::function<PointOp(const std::vector<float>&)>;
+using CoreHandler =
+    std::function<void(Image&, const std::vector<float>&, const PointOp& prologue, const PointOp& epilogue)>;
+using PlanarHandler = std::function<void(PlanarImage&, const std::vector<float>&)>;
+using StreamFactory = std::function<std::unique_ptr<RowStage>(const std::vector<float>&, int width, int height)>;
+using U8Handler = std::function<void(ImageU8&, const std::vector<float>&)>;
+using TileFactory =
+    std::function<TileStep(const std::vector<float>&, const PointOp& prologue, const PointOp& epilogue)>;
+
+// Можно ли вычислить поточечный фильтр, идущий сразу за -lut, в узлах таблицы вместо каждого пикселя.
+// Для аффинных фильтров результат тот же с точностью до округления: веса интерполяции в сумме дают 1
+enum class LutFolding {
+    None,
+    PerChannel,  // канал результата зависит только от того же канала (-neg): подходит любая таблица
+    Color,       // каналы смешиваются (-gs): только трёхмерная таблица, у одномерной каналы узла независимы
+};
+
+struct FilterSpec {
+    size_t parameter_count;
+    bool positive_parameters;
+    std::string message;
+    // Есть только у поточечных фильтров
+    PointOpFactory point;
+    // Есть у остальных фильтров
+    CoreHandler core;
+    // Может ли основной фильтр выполнить пролог в своём проходе
+    bool fuses_prologue;
+    // Реализация для PlanarImage
+    PlanarHandler planar;
+    // Стадия потоковой обработки (для основных фильтров)
+    StreamFactory stream;
+    // Реализация для ImageU8
+    U8Handler u8;
+    // Для фильтров с переменным числом параметров: проверяет параметры и приводит их к виду, который
+    // ожидают реализации. При ошибке возвращает false и пишет причину в error
+    bool (*prepare)(FilterInfo& filter, std::string& error) = nullptr;
+    // Этап блочного выполнения для фильтров по окрестности. Фильтра в этапе нет, если при данных
+    // параметрах фильтр блоками не считается
+    TileFactory tile = nullptr;
+    // Радиус окрестности, от которой зависит пиксель результата, для области интереса (InputRegion).
+    // kWholeInput или нет функции - пиксель зависит от всего изображения или его размеров, как у -resize
+    int (*radius)(const std::vector<float>& parameters) = nullptr;
+    // Для поточечных фильтров
+    LutFolding lut_folding = LutFolding::None;
+};
+
+// Число параметров фильтра проверяет его prepare
+const size_t kVariableParameterCount = static_cast<size_t>(-1);
+
+// Радиус фильтра, пиксель результата которого зависит от всего входа
+const int kWholeInput = -1;
+// Сторона области интереса без ограничения
+const int kUnbounded = INT_MAX;
+
+// Размер изображения из параметра фильтра: дробная часть отбрасывается, но размер не меньше 1. Значения,
+// не помещающиеся в int, насыщаются до kUnbounded до приведения типа
+int Dimension(float parameter) {
+    if (!(parameter < static_cast<float>(kUnbounded))) {
+        return kUnbounded;
+    }
+    return std::max(1, static_cast<int>(parameter));
+}
+
+void HandleCropFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                      const PointOp& epilogue) {
+    const int new_width = Dimension(parameters[0]);
+    const int new_height = Dimension(parameters[1]);
+    // Поточечные фильтры перестановочны с обрезкой, поэтому пролог тоже применяется только к оставшимся пикселям
+    image.Crop(new_width, new_height, [&prologue, &epilogue](Color* pixels, int count) {
+        if (prologue) {
+            prologue(pixels, count);
+        }
+        if (epilogue) {
+            epilogue(pixels, count);
+        }
+    });
+}
+
+// Наибольший результат -resize: во float это 3 ГБ. Веса Ланцоша и промежуточный буфер растут со стороной
+// результата, поэтому ограничена и она
+const long long kMaxResizePixels = 1LL << 28;
+const int kMaxResizeSide = 1 << 16;
+
+// -resize width height: размеры положительные, в пределах ограничений выше, а результат можно записать в BMP
+bool PrepareResizeFilter(FilterInfo& filter, std::string& error) {
+    if (filter.parameters.size() != 2) {
+        error = "Incorrect number of parameters for filter -resize";
+        return false;
+    }
+    if (!(filter.parameters[0] > 0.0f) || !(filter.parameters[1] > 0.0f)) {
+        error = "Parameters for filter -resize must be positive";
+        return false;
+    }
+    const int width = Dimension(filter.parameters[0]);
+    const int height = Dimension(filter.parameters[1]);
+    if (width > kMaxResizeSide || height > kMaxResizeSide ||
+        static_cast<long long>(width) * height > kMaxResizePixels) {
+        error = "Size for filter -resize is too large: at most " + std::to_string(kMaxResizeSide) + " per side and " +
+                std::to_string(kMaxResizePixels) + " pixels";
+        return false;
+    }
+    return CheckBmpOutputSize(width, height, error);
+}
+
+void HandleResizeFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                        const PointOp& epilogue) {
+    image.Resize(Dimension(parameters[0]), Dimension(parameters[1]), epilogue);
+}
+
+PointOp MakeGrayscaleOp(const std::vector<float>& parameters) {
+    return GrayscalePixels;
+}
+
+PointOp MakeNegativeOp(const std::vector<float>& parameters) {
+    return NegativePixels;
+}
+
+void HandleBlurFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                      const PointOp& epilogue) {
+    float sigma = parameters[0];
+    image.GaussianBlur(sigma, prologue, epilogue);
+}
+
+void HandleSharpeningFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                            const PointOp& epilogue) {
+    image.Sharpening(epilogue);
+}
+
+void HandleThermoFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                        const PointOp& epilogue) {
+    image.Thermo(epilogue);
+}
+
+// -edge threshold | auto: порог числом или его выбор по изображению методом Оцу (Image::AutoEdgeDetection).
+// Реализации получают два числа: порог и 1 для auto
+bool PrepareEdgeDetectionFilter(FilterInfo& filter, std::string& error) {
+    if (filter.parameters.size() != 1) {
+        error = "Incorrect number of parameters for filter -edge";
+        return false;
+    }
+    const bool automatic = !filter.arguments.empty() && filter.arguments[0] == "auto";
+    filter.parameters = {automatic ? 0.0f : filter.parameters[0], automatic ? 1.0f : 0.0f};
+    return true;
+}
+
+bool AutoThreshold(const std::vector<float>& parameters) {
+    return parameters[1] != 0.0f;
+}
+
+void HandleEdgeDetectionFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                               const PointOp& epilogue) {
+    if (AutoThreshold(parameters)) {
+        image.AutoEdgeDetection(prologue, epilogue);
+        return;
+    }
+    float threshold = parameters[0];
+    image.EdgeDetection(threshold, prologue, epilogue);
+}
+
+// Каскад box-фильтров копит скользящие суммы от края изображения, поэтому его значения зависят от всего столбца
+int BlurRadius(const std::vector<float>& parameters) {
+    if (UseBoxCascade(parameters[0])) {
+        return kWholeInput;
+    }
+    return static_cast<int>(GaussianKernel(parameters[0]).size()) / 2;
+}
+
+int StencilRadius(const std::vector<float>& parameters) {
+    return 1;
+}
+
+// Порог -edge auto выбирается по всему изображению
+int EdgeDetectionRadius(const std::vector<float>& parameters) {
+    return AutoThreshold(parameters) ? kWholeInput : 1;
+}
+
+TileStep MakeBlurTileStep(const std::vector<float>& parameters, const PointOp& prologue, const PointOp& epilogue) {
+    return TileStep{MakeGaussianBlurTileFilter(parameters[0]), prologue, epilogue};
+}
+
+TileStep MakeSharpeningTileStep(const std::vector<float>& parameters, const PointOp& prologue,
+                                const PointOp& epilogue) {
+    return TileStep{MakeSharpeningTileFilter(), nullptr, epilogue};
+}
+
+TileStep MakeThermoTileStep(const std::vector<float>& parameters, const PointOp& prologue, const PointOp& epilogue) {
+    return TileStep{MakeThermoTileFilter(), nullptr, epilogue};
+}
+
+TileStep MakeEdgeDetectionTileStep(const std::vector<float>& parameters, const PointOp& prologue,
+                                   const PointOp& epilogue) {
+    if (AutoThreshold(parameters)) {
+        return TileStep{nullptr, prologue, epilogue};
+    }
+    // Grayscale входит в пролог этапа, как и в Image::EdgeDetection
+    PointOp grayscale = GrayscalePixels;
+    if (prologue) {
+        grayscale = [prologue](Color* pixels, int count) {
+            prologue(pixels, count);
+            GrayscalePixels(pixels, count);
+        };
+    }
+    return TileStep{MakeEdgeDetectionTileFilter(parameters[0]), grayscale, epilogue};
+}
+
+// -conv [clamp|mirror|skip] w11 w12 ... wNN: политика границ (по умолчанию clamp) и N * N весов по строкам
+// ядра сверху вниз, N нечётное. Политика заменяется числом в начале параметров, так что реализации получают
+// только числа: BorderPolicy, затем веса
+bool PrepareConvolutionFilter(FilterInfo& filter, std::string& error) {
+    const std::vector<std::pair<std::string, BorderPolicy>> policies = {
+        {"clamp", BorderPolicy::Clamp}, {"mirror", BorderPolicy::Mirror}, {"skip", BorderPolicy::Skip}};
+    BorderPolicy border = BorderPolicy::Clamp;
+    std::vector<float> weights = filter.parameters;
+    if (!filter.arguments.empty()) {
+        for (const auto& [name, policy] : policies) {
+            if (filter.arguments[0] == name) {
+                border = policy;
+                weights.erase(weights.begin());
+            }
+        }
+    }
+    const int size = static_cast<int>(std::lround(std::sqrt(static_cast<double>(weights.size()))));
+    if (weights.empty() || static_cast<size_t>(size) * size != weights.size() || size % 2 == 0) {
+        error = "Kernel for filter -conv must have N * N weights with odd N";
+        return false;
+    }
+    filter.parameters = {static_cast<float>(border)};
+    filter.parameters.insert(filter.parameters.end(), weights.begin(), weights.end());
+    return true;
+}
+
+// Свёртка из параметров, подготовленных PrepareConvolutionFilter
+Convolution MakeConvolution(const std::vector<float>& parameters) {
+    std::vector<float> weights(parameters.begin() + 1, parameters.end());
+    const int size = static_cast<int>(std::lround(std::sqrt(static_cast<double>(weights.size()))));
+    return Convolution(size, std::move(weights), static_cast<BorderPolicy>(static_cast<int>(parameters[0])));
+}
+
+void HandleConvolutionFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                             const PointOp& epilogue) {
+    image.Convolve(MakeConvolution(parameters), epilogue);
+}
+
+int ConvolutionRadius(const std::vector<float>& parameters) {
+    return MakeConvolution(parameters).Radius();
+}
+
+// -median radius: радиус - целое от 1 до kMaxMedianRadius
+bool PrepareMedianFilter(FilterInfo& filter, std::string& error) {
+    if (filter.parameters.size() != 1) {
+        error = "Incorrect number of parameters for filter -median";
+        return false;
+    }
+    const float radius = filter.parameters[0];
+    if (!(radius >= 1.0f && radius <= kMaxMedianRadius) || radius != std::floor(radius)) {
+        error = "Radius for filter -median must be an integer from 1 to " + std::to_string(kMaxMedianRadius);
+        return false;
+    }
+    return true;
+}
+
+void HandleMedianFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                        const PointOp& epilogue) {
+    image.Median(static_cast<int>(parameters[0]), prologue, epilogue);
+}
+
+int MedianRadius(const std::vector<float>& parameters) {
+    return static_cast<int>(parameters[0]);
+}
+
+// -bilateral sigma_spatial sigma_range: sigma_spatial в пикселях, sigma_range - в долях яркости [0, 1].
+// Узлы сетки не чаще пикселей и уровней яркости файла, а всего ячеек не больше kMaxBilateralCellsPerPixel
+// на пиксель
+bool PrepareBilateralFilter(FilterInfo& filter, std::string& error) {
+    if (filter.parameters.size() != 2) {
+        error = "Incorrect number of parameters for filter -bilateral";
+        return false;
+    }
+    if (!(filter.parameters[0] >= 1.0f)) {
+        error = "Spatial sigma for filter -bilateral must be at least 1";
+        return false;
+    }
+    if (!(filter.parameters[1] >= 1.0f / 255.0f)) {
+        error = "Range sigma for filter -bilateral must be at least 1/255";
+        return false;
+    }
+    const float sigma_spatial = filter.parameters[0];
+    if (sigma_spatial * sigma_spatial * filter.parameters[1] * kMaxBilateralCellsPerPixel < 1.0f) {
+        error = "Grid of filter -bilateral would be too fine: sigma_spatial^2 * sigma_range must be at least 1/" +
+                std::to_string(static_cast<int>(kMaxBilateralCellsPerPixel));
+        return false;
+    }
+    return true;
+}
+
+void HandleBilateralFilter(Image& image, const std::vector<float>& parameters, const PointOp& prologue,
+                           const PointOp& epilogue) {
+    image.Bilateral(parameters[0], parameters[1], epilogue);
+}
+
+// -lut file.cube: таблица читается при проверке фильтра, реализации получают её числами (ColorLut::Pack)
+bool PrepareLutFilter(FilterInfo& filter, std::string& error) {
+    if (filter.arguments.size() != 1) {
+        error = "Incorrect number of parameters for filter -lut";
+        return false;
+    }
+    ColorLut lut;
+    if (!lut.Load(filter.arguments[0].c_str(), error)) {
+        return false;
+    }
+    filter.parameters = lut.Pack();
+    return true;
+}
+
+PointOp MakeLutOp(const std::vector<float>& parameters) {
+    auto lut = std::make_shared<const ColorLut>(parameters);
+    return [lut](Color* pixels, int count) { lut->Apply(pixels, count); };
+}
+
+// Словарь с описанием каждого фильтра
+const std::map<std::string, FilterSpec>& FilterSpecs() {
+    static const std::map<std::string, FilterSpec> specs = {
+        {"-crop",
+         {2, true, "File was cropped", nullptr, HandleCropFilter, true,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Crop(Dimension(p[0]), Dimension(p[1])); },
+          [](const std::vector<float>& p, int width, int height) {
+              return MakeCropStage(Dimension(p[0]), Dimension(p[1]), width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) { image.Crop(Dimension(p[0]), Dimension(p[1])); }}},
+        {"-resize",
+         {2, true, "File was resized", nullptr, HandleResizeFilter, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Resize(Dimension(p[0]), Dimension(p[1])); },
+          [](const std::vector<float>& p, int width, int height) {
+              return MakeResizeStage(Dimension(p[0]), Dimension(p[1]), width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) { image.Resize(Dimension(p[0]), Dimension(p[1])); },
+          PrepareResizeFilter}},
+        {"-gs",
+         {0, false, "Grayscale filter was applied", MakeGrayscaleOp, nullptr, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Grayscale(); }, nullptr,
+          [](ImageU8& image, const std::vector<float>& p) { image.Grayscale(); }, nullptr, nullptr, nullptr,
+          LutFolding::Color}},
+        {"-neg",
+         {0, false, "Negative filter was applied", MakeNegativeOp, nullptr, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Negative(); }, nullptr,
+          [](ImageU8& image, const std::vector<float>& p) { image.Negative(); }, nullptr, nullptr, nullptr,
+          LutFolding::PerChannel}},
+        {"-lut",
+         {kVariableParameterCount, false, "Color lookup table was applied", MakeLutOp, nullptr, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.ApplyLut(ColorLut(p)); }, nullptr,
+          [](ImageU8& image, const std::vector<float>& p) { image.ApplyLut(ColorLut(p)); }, PrepareLutFilter}},
+        {"-blur",
+         {1, true, "Gaussian Blur filter was applied", nullptr, HandleBlurFilter, true,
+          [](PlanarImage& image, const std::vector<float>& p) { image.GaussianBlur(p[0]); },
+          [](const std::vector<float>& p, int width, int height) { return MakeBlurStage(p[0], width, height); },
+          [](ImageU8& image, const std::vector<float>& p) { image.GaussianBlur(p[0]); }, nullptr,
+          MakeBlurTileStep, BlurRadius}},
+        {"-sharp",
+         {0, false, "Sharpening filter was applied", nullptr, HandleSharpeningFilter, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Sharpening(); },
+          [](const std::vector<float>& p, int width, int height) { return MakeSharpeningStage(width, height); },
+          [](ImageU8& image, const std::vector<float>& p) { image.Sharpening(); }, nullptr,
+          MakeSharpeningTileStep, StencilRadius}},
+        {"-thermo",
+         {0, false, "Thermo filter was applied", nullptr, HandleThermoFilter, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Thermo(); },
+          [](const std::vector<float>& p, int width, int height) { return MakeThermoStage(width, height); },
+          [](ImageU8& image, const std::vector<float>& p) { image.Thermo(); }, nullptr, MakeThermoTileStep,
+          StencilRadius}},
+        {"-edge",
+         {kVariableParameterCount, false, "Edge Detection filter was applied", nullptr, HandleEdgeDetectionFilter,
+          true,
+          [](PlanarImage& image, const std::vector<float>& p) {
+              AutoThreshold(p) ? image.AutoEdgeDetection() : image.EdgeDetection(p[0]);
+          },
+          [](const std::vector<float>& p, int width, int height) {
+              return AutoThreshold(p) ? MakeAutoEdgeDetectionStage(width, height)
+                                      : MakeEdgeDetectionStage(p[0], width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) {
+              AutoThreshold(p) ? image.AutoEdgeDetection() : image.EdgeDetection(p[0]);
+          },
+          PrepareEdgeDetectionFilter, MakeEdgeDetectionTileStep, EdgeDetectionRadius}},
+        {"-conv",
+         {kVariableParameterCount, false, "Convolution filter was applied", nullptr, HandleConvolutionFilter, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Convolve(MakeConvolution(p)); },
+          [](const std::vector<float>& p, int width, int height) {
+              return MakeConvolutionStage(MakeConvolution(p), width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) { image.Convolve(MakeConvolution(p)); },
+          PrepareConvolutionFilter, nullptr, ConvolutionRadius}},
+        {"-median",
+         {1, true, "Median filter was applied", nullptr, HandleMedianFilter, true,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Median(static_cast<int>(p[0])); },
+          [](const std::vector<float>& p, int width, int height) {
+              return MakeMedianStage(static_cast<int>(p[0]), width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) { image.Median(static_cast<int>(p[0])); },
+          PrepareMedianFilter, nullptr, MedianRadius}},
+        {"-bilateral",
+         {2, true, "Bilateral filter was applied", nullptr, HandleBilateralFilter, false,
+          [](PlanarImage& image, const std::vector<float>& p) { image.Bilateral(p[0], p[1]); },
+          [](const std::vector<float>& p, int width, int height) {
+              return MakeBilateralStage(p[0], p[1], width, height);
+          },
+          [](ImageU8& image, const std::vector<float>& p) { image.Bilateral(p[0], p[1]); },
+          PrepareBilateralFilter}}};
+    return specs;
+}
+
+bool ValidateFilter(FilterInfo& filter) {
+    std::string error;
+    if (!CheckFilter(filter, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Сколько фильтров сразу после -lut с номером index вычисляются в узлах его таблицы
+size_t LutFoldedCount(const std::vector<FilterInfo>& filters, size_t index) {
+    const int dimensions = static_cast<int>(filters[index].parameters[0]);
+    size_t next = index + 1;
+    for (; next < filters.size(); ++next) {
+        const LutFolding folding = FilterSpecs().at(filters[next].name).lut_folding;
+        if (folding == LutFolding::None || (folding == LutFolding::Color && dimensions != 3)) {
+            break;
+        }
+    }
+    return next - index - 1;
+}
+
+// Компиляция таблиц цветов: поточечные фильтры, идущие за -lut, применяются к узлам его таблицы
+// (ColorLut::Transform), и вся цепочка выполняется одной интерполяцией по таблице. Остальные фильтры
+// остаются как есть, поэтому цепочки без -lut считаются побитово так же, как раньше
+std::vector<FilterInfo> CompileLutFilters(const std::vector<FilterInfo>& filters) {
+    std::vector<FilterInfo> compiled;
+    for (size_t i = 0; i < filters.size(); ++i) {
+        compiled.push_back(filters[i]);
+        if (filters[i].name != "-lut") {
+            continue;
+        }
+        const size_t folded = LutFoldedCount(filters, i);
+        if (folded == 0) {
+            continue;
+        }
+        ColorLut lut(filters[i].parameters);
+        for (size_t k = i + 1; k <= i + folded; ++k) {
+            lut.Transform(FilterSpecs().at(filters[k].name).point(filters[k].parameters));
+        }
+        compiled.back().parameters = lut.Pack();
+        i += folded;
+    }
+    return compiled;
+}
+
+// Объединяет поточечные фильтры в одну операцию: все фильтры применяются к куску пикселей, пока он в кэше
+PointOp ComposePointOps(const std::vector<FilterInfo>& filters) {
+    std::vector<PointOp> ops;
+    for (const auto& filter : CompileLutFilters(filters)) {
+        ops.push_back(FilterSpecs().at(filter.name).point(filter.parameters));
+    }
+    if (ops.empty()) {
+        return nullptr;
+    }
+    if (ops.size() == 1) {
+        return ops[0];
+    }
+    return [ops](Color* pixels, int count) {
+        for (int begin = 0; begin < count; begin += kFusedChunk) {
+            const int chunk = std::min(kFusedChunk, count - begin);
+            for (const auto& op : ops) {
+                op(pixels + begin, chunk);
+            }
+        }
+    };
+}
+
+void PrintFilters(const std::vector<FilterInfo>& filters, std::ostream& out) {
+    for (size_t i = 0; i < filters.size(); ++i) {
+        out << (i == 0 ? "" : " ") << filters[i].name;
+        // У фильтров с prepare параметры после проверки уже не совпадают с написанными в командной строке
+        if (FilterSpecs().at(filters[i].name).prepare && !filters[i].arguments.empty()) {
+            for (const auto& argument : filters[i].arguments) {
+                out << " " << argument;
+            }
+            continue;
+        }
+        for (float parameter : filters[i].parameters) {
+            out << " " << parameter;
+        }
+    }
+}
+
+// Фильтры этапа в порядке выполнения
+std::vector<FilterInfo> StageFilters(const PipelineStage& stage) {
+    std::vector<FilterInfo> filters = stage.prologue;
+    if (stage.core) {
+        filters.push_back(*stage.core);
+    }
+    filters.insert(filters.end(), stage.epilogue.begin(), stage.epilogue.end());
+    return filters;
+}
+
+// Имя этапа для профиля
+std::string StageName(const PipelineStage& stage) {
+    std::ostringstream name;
+    PrintFilters(StageFilters(stage), name);
+    return name.str();
+}
+
+// Обрезка без поточечных фильтров - только окно в прежний буфер, пиксели она не трогает
+bool IsCropView(const PipelineStage& stage) {
+    return stage.core && stage.core->name == "-crop" && stage.prologue.empty() && stage.epilogue.empty();
+}
+
+// Этап в виде шага блочной цепочки; пустой фильтр, если этап блоками не выполняется
+TileStep MakeTileStep(const PipelineStage& stage) {
+    if (!stage.core || !FilterSpecs().at(stage.core->name).tile) {
+        return TileStep{};
+    }
+    return FilterSpecs().at(stage.core->name).tile(stage.core->parameters, ComposePointOps(stage.prologue),
+                                                   ComposePointOps(stage.epilogue));
+}
+
+// Подряд идущие этапы с начала from, которые выгодно выполнить блоками одной цепочкой; пусто, если таких нет
+std::vector<TileStep> TiledChain(const std::vector<PipelineStage>& plan, size_t from) {
+    std::vector<TileStep> steps;
+    for (size_t i = from; i < plan.size(); ++i) {
+        TileStep step = MakeTileStep(plan[i]);
+        if (!step.filter) {
+            break;
+        }
+        steps.push_back(std::move(step));
+    }
+    if (!steps.empty() && !WorthTiling(steps)) {
+        steps.clear();
+    }
+    return steps;
+}
+
+// Область, нужная на входе этапа, по области, нужной на его выходе
+ImageRegion StageInputRegion(const PipelineStage& stage, const ImageRegion& output) {
+    if (!stage.core) {
+        return output;
+    }
+    const FilterSpec& spec = FilterSpecs().at(stage.core->name);
+    if (stage.core->name == "-crop") {
+        // -crop оставляет левый верхний угол, так что нужный угол его результата - тот же угол входа
+        return ImageRegion{std::min(output.width, Dimension(stage.core->parameters[0])),
+                           std::min(output.height, Dimension(stage.core->parameters[1]))};
+    }
+    const int radius = spec.radius ? spec.radius(stage.core->parameters) : kWholeInput;
+    if (radius == kWholeInput) {
+        return ImageRegion{};
+    }
+    auto grow = [radius](int side) { return side >= kUnbounded - radius ? kUnbounded : side + radius; };
+    return ImageRegion{grow(output.width), grow(output.height)};
+}
+
+// regions[i] - область, нужная на входе этапа i; последний элемент - весь результат плана
+std::vector<ImageRegion> StageRegions(const std::vector<PipelineStage>& plan) {
+    std::vector<ImageRegion> regions(plan.size() + 1);
+    for (size_t i = plan.size(); i-- > 0;) {
+        regions[i] = StageInputRegion(plan[i], regions[i + 1]);
+    }
+    return regions;
+}
+
+bool Bounded(const ImageRegion& region) {
+    return region.width != kUnbounded || region.height != kUnbounded;
+}
+
+// Таблицы цветов этапа и фильтры, которые вычисляются в их узлах
+void ExplainLuts(const PipelineStage& stage, std::ostream& out) {
+    const std::vector<FilterInfo> filters = StageFilters(stage);
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (filters[i].name != "-lut") {
+            continue;
+        }
+        const ColorLut lut(filters[i].parameters);
+        out << "     -lut " << filters[i].arguments[0] << ": " << lut.Dimensions() << "D table of size " << lut.Size()
+            << (lut.Dimensions() == 3 ? ", tetrahedral" : ", linear");
+        const size_t folded = LutFoldedCount(filters, i);
+        if (folded > 0) {
+            out << ", computes [";
+            PrintFilters({filters.begin() + i + 1, filters.begin() + i + 1 + folded}, out);
+            out << "] in its nodes";
+        }
+        out << "\n";
+    }
+}
+
+void ExplainStage(const PipelineStage& stage, size_t number, std::ostream& out) {
+    out << "  " << number << ". ";
+    if (!stage.core) {
+        out << "fused point pass [";
+        PrintFilters(stage.prologue, out);
+        out << "]\n";
+        ExplainLuts(stage, out);
+        return;
+    }
+    PrintFilters({*stage.core}, out);
+    if (stage.core->name == "-conv") {
+        out << " (" << MakeConvolution(stage.core->parameters).Variant() << " kernel)";
+    }
+    if (!stage.prologue.empty()) {
+        out << ", prologue [";
+        PrintFilters(stage.prologue, out);
+        out << "]";
+    }
+    if (!stage.epilogue.empty()) {
+        out << ", epilogue [";
+        PrintFilters(stage.epilogue, out);
+        out << "]";
+    }
+    out << "\n";
+    ExplainLuts(stage, out);
+}
+
+}  // namespace
+
+bool CheckFilter(FilterInfo& filter, std::string& error) {
+    const auto& specs = FilterSpecs();
+    auto it = specs.find(filter.name);
+    if (it == specs.end()) {
+        error = "Unknown filter " + filter.name;
+        return false;
+    }
+    const FilterSpec& spec = it->second;
+    if (!std::all_of(filter.parameters.begin(), filter.parameters.end(), [](float p) { return std::isfinite(p); })) {
+        error = "Parameters for filter " + filter.name + " must be finite";
+        return false;
+    }
+    if (spec.prepare) {
+        return spec.prepare(filter, error);
+    }
+    if (filter.parameters.size() != spec.parameter_count) {
+        error = "Incorrect number of parameters for filter " + filter.name;
+        return false;
+    }
+    if (spec.positive_parameters &&
+        std::any_of(filter.parameters.begin(), filter.parameters.end(), [](float p) { return p <= 0.0f; })) {
+        error = "Parameters for filter " + filter.name + " must be positive";
+        return false;
+    }
+    return true;
+}
+
+const char* StorageName(Storage storage) {
+    switch (storage) {
+        case Storage::Planar:
+            return "planar";
+        case Storage::U8:
+            return "u8";
+        default:
+            return "interleaved";
+    }
+}
+
+std::vector<FilterInfo> ParseCommandLine(int argc, char* argv[]) {
+    std::vector<FilterInfo> filters;
+
+    // Пропускаем первый аргумент (имя программы)
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        // Проверяем, является ли аргумент именем фильтра
+        if (arg.substr(0, 1) == "-") {
+            FilterInfo filter_info;
+            filter_info.name = arg;
+
+            // Получаем параметры фильтра (если они есть)
+            for (int j = i + 1; j < argc; ++j) {
+                std::string param = argv[j];
+                // Если следующий аргумент начинается с "-" и это не отрицательное число, значит текущий аргумент
+                // является последним параметром
+                const bool negative_number =
+                    param.size() > 1 && (std::isdigit(static_cast<unsigned char>(param[1])) || param[1] == '.');
+                if (param.substr(0, 1) == "-" && !negative_number) {
+                    break;
+                }
+                filter_info.parameters.push_back(static_cast<float>(std::atof(param.c_str())));
+                filter_info.arguments.push_back(param);
+                ++i;  // Переходим к следующему аргументу
+            }
+
+            filters.push_back(filter_info);
+        }
+    }
+
+    return filters;
+}
+
+std::vector<PipelineStage> PlanPipeline(const std::vector<FilterInfo>& filters) {
+    std::vector<PipelineStage> plan;
+    // Поточечные фильтры до первого основного фильтра
+    std::vector<FilterInfo> pending;
+
+    for (FilterInfo filter : filters) {
+        if (!ValidateFilter(filter)) {
+            continue;
+        }
+        const FilterSpec& spec = FilterSpecs().at(filter.name);
+        if (spec.point) {
+            // После основного фильтра поточечные фильтры уходят в его эпилог
+            if (plan.empty()) {
+                pending.push_back(filter);
+            } else {
+                plan.back().epilogue.push_back(filter);
+            }
+            continue;
+        }
+
+        PipelineStage stage;
+        stage.core = filter;
+        if (!pending.empty()) {
+            if (spec.fuses_prologue) {
+                stage.prologue = pending;
+            } else {
+                plan.push_back(PipelineStage{pending, std::nullopt, {}});
+            }
+            pending.clear();
+        }
+        plan.push_back(stage);
+    }
+
+    if (!pending.empty()) {
+        plan.push_back(PipelineStage{pending, std::nullopt, {}});
+    }
+    return plan;
+}
+
+ImageRegion InputRegion(const std::vector<PipelineStage>& plan) {
+    return StageRegions(plan).front();
+}
+
+void ExplainPipeline(const std::vector<PipelineStage>& plan, std::ostream& out, bool tiled) {
+    out << "Pipeline plan: " << plan.size() << " pass(es) over the image\n";
+    const std::vector<ImageRegion> regions = StageRegions(plan);
+    for (size_t i = 0; i < plan.size();) {
+        const size_t chain = tiled ? TiledChain(plan, i).size() : 0;
+        const size_t end = i + std::max<size_t>(chain, 1);
+        for (size_t j = i; j < end; ++j) {
+            ExplainStage(plan[j], j + 1, out);
+            // Внутри блочной цепочки область задаётся один раз, на входе цепочки
+            const bool crop = plan[j].core && plan[j].core->name == "-crop";
+            if (tiled && j == i && Bounded(regions[j]) && !crop) {
+                out << "     computes only the top-left " << regions[j].width << "x" << regions[j].height
+                    << " needed by the result\n";
+            }
+        }
+        if (chain > 0) {
+            out << "     passes " << i + 1 << "-" << end << " run tile by tile in one pass over memory\n";
+        }
+        i = end;
+    }
+}
+
+void ExecutePipeline(Image& image, const std::vector<PipelineStage>& plan) {
+    const auto& specs = FilterSpecs();
+    const std::vector<ImageRegion> regions = StageRegions(plan);
+    for (size_t i = 0; i < plan.size();) {
+        if (regions[i].width < image.Width() || regions[i].height < image.Height()) {
+            // Остальные пиксели на результат не влияют; обрезка - только окно в прежний буфер
+            image.Crop(regions[i].width, regions[i].height);
+        }
+        const double input = static_cast<double>(image.Width()) * image.Height();
+        std::vector<TileStep> steps = TiledChain(plan, i);
+        if (!steps.empty()) {
+            // Цепочка читает изображение и пишет результат один раз, сколько бы в ней ни было фильтров
+            std::string name;
+            for (size_t j = i; j < i + steps.size(); ++j) {
+                name += (j == i ? "tiled: " : " | ") + StageName(plan[j]);
+            }
+            StageTimer timer(ProfilingEnabled() ? name : std::string());
+            image.ApplyTiled(steps);
+            timer.Finish(input, 2 * input * sizeof(Color));
+            i += steps.size();
+            continue;
+        }
+
+        const PipelineStage& stage = plan[i++];
+        StageTimer timer(ProfilingEnabled() ? StageName(stage) : std::string());
+        const PointOp prologue = ComposePointOps(stage.prologue);
+        const PointOp epilogue = ComposePointOps(stage.epilogue);
+        if (stage.core) {
+            specs.at(stage.core->name).core(image, stage.core->parameters, prologue, epilogue);
+        } else {
+            image.ApplyPointOp(prologue);
+        }
+        const double output = static_cast<double>(image.Width()) * image.Height();
+        timer.Finish(input, IsCropView(stage) ? 0 : (input + output) * sizeof(Color));
+    }
+}
+
+void ExecutePipeline(PlanarImage& image, const std::vector<PipelineStage>& plan) {
+    const auto& specs = FilterSpecs();
+    for (const auto& stage : plan) {
+        for (const auto& filter : CompileLutFilters(StageFilters(stage))) {
+            StageTimer timer(ProfilingEnabled() ? StageName(PipelineStage{{}, filter, {}}) : std::string());
+            const double input = static_cast<double>(image.Width()) * image.Height();
+            specs.at(filter.name).planar(image, filter.parameters);
+            const double output = static_cast<double>(image.Width()) * image.Height();
+            timer.Finish(input, (input + output) * 3 * sizeof(float));
+        }
+    }
+}
+
+void ExecutePipeline(ImageU8& image, const std::vector<PipelineStage>& plan) {
+    const auto& specs = FilterSpecs();
+    for (const auto& stage : plan) {
+        for (const auto& filter : CompileLutFilters(StageFilters(stage))) {
+            StageTimer timer(ProfilingEnabled() ? StageName(PipelineStage{{}, filter, {}}) : std::string());
+            const double input = static_cast<double>(image.Width()) * image.Height();
+            specs.at(filter.name).u8(image, filter.parameters);
+            const double output = static_cast<double>(image.Width()) * image.Height();
+            timer.Finish(input, filter.name == "-crop" ? 0 : (input + output) * 3);
+        }
+    }
+}
+
+void PrintPipelineMessages(const std::vector<PipelineStage>& plan, std::ostream& out) {
+    const auto& specs = FilterSpecs();
+    for (const auto& stage : plan) {
+        for (const auto& filter : stage.prologue) {
+            out << specs.at(filter.name).message << "\n";
+        }
+        if (stage.core) {
+            out << specs.at(stage.core->name).message << "\n";
+        }
+        for (const auto& filter : stage.epilogue) {
+            out << specs.at(filter.name).message << "\n";
+        }
+    }
+}
+
+void RunPipeline(Image& image, const std::vector<PipelineStage>& plan) {
+    ExecutePipeline(image, plan);
+    PrintPipelineMessages(plan, std::cout);
+}
+
+void RunPipeline(PlanarImage& image, const std::vector<PipelineStage>& plan) {
+    ExecutePipeline(image, plan);
+    PrintPipelineMessages(plan, std::cout);
+}
+
+bool RunStreaming(const char* input_path, const char* output_path, const std::vector<PipelineStage>& plan) {
+    const auto& specs = FilterSpecs();
+    // Заголовок входа проверяется целиком, включая размеры против размера файла, до создания выходного файла
+    BmpRowReader reader;
+    std::string error;
+    if (!reader.Open(input_path, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+
+    // Строим цепочку стадий, отслеживая размеры изображения после каждой
+    std::vector<std::unique_ptr<RowStage>> stages;
+    int width = reader.Width();
+    int height = reader.Height();
+    auto add_stage = [&](std::unique_ptr<RowStage> stage) {
+        width = stage->OutputWidth();
+        height = stage->OutputHeight();
+        stages.push_back(std::move(stage));
+    };
+    for (const auto& stage : plan) {
+        if (!stage.prologue.empty()) {
+            add_stage(MakePointStage(ComposePointOps(stage.prologue), width, height));
+        }
+        if (stage.core) {
+            add_stage(specs.at(stage.core->name).stream(stage.core->parameters, width, height));
+        }
+        if (!stage.epilogue.empty()) {
+            add_stage(MakePointStage(ComposePointOps(stage.epilogue), width, height));
+        }
+    }
+
+    BmpRowWriter writer;
+    if (!writer.Open(output_path, width, height, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i]->SetNext(i + 1 < stages.size() ? static_cast<RowSink*>(stages[i + 1].get()) : &writer);
+    }
+    RowSink* first = stages.empty() ? static_cast<RowSink*>(&writer) : stages.front().get();
+
+    // Чтение, фильтры и запись идут вперемешку по строкам, поэтому в профиле это один этап
+    StageTimer timer("stream");
+    std::vector<Color> row(reader.Width());
+    for (int y = 0; y < reader.Height(); ++y) {
+        if (!reader.ReadRow(row.data())) {
+            // Недописанный файл не оставляем
+            writer.Discard();
+            std::cerr << "Error: Unexpected end of bitmap pixel data" << std::endl;
+            return false;
+        }
+        first->Push(row.data());
+    }
+    if (!writer.Close()) {
+        std::cerr << "Error: Failed to write the file" << std::endl;
+        return false;
+    }
+    timer.Finish(static_cast<double>(reader.Width()) * reader.Height(),
+                 static_cast<double>(BmpRowSize(reader.Width())) * reader.Height() +
+                     static_cast<double>(BmpOutputRowSize(width)) * height);
+    return true;
+}
+
+void ApplyFilters(Image& image, const std::vector<FilterInfo>& filters) {
+    RunPipeline(image, PlanPipeline(filters));
+}
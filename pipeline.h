@@ -0,0 +1,89 @@
+#pragma once
+
+#include <climits>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "image_u8.h"
+#include "planar_image.h"
+
+// Представление изображения в памяти при обработке
+enum class Storage {
+    Interleaved,  // Image: три float на пиксель подряд
+    Planar,       // PlanarImage: отдельная плоскость float на канал
+    U8,           // ImageU8: байты BGR, целочисленные фильтры
+};
+
+const char* StorageName(Storage storage);
+
+struct FilterInfo {
+    std::string name;
+    std::vector<float> parameters;
+    // Параметры в исходном виде, для параметров-строк (имён файлов и т.п.)
+    std::vector<std::string> arguments;
+};
+
+// Этап конвейера: основной фильтр вместе со слитыми с ним поточечными фильтрами.
+// Поточечные фильтры пролога выполняются в проходе основного фильтра до него, эпилога - после.
+// Этап без основного фильтра - один проход по изображению со всеми фильтрами пролога
+struct PipelineStage {
+    std::vector<FilterInfo> prologue;
+    std::optional<FilterInfo> core;
+    std::vector<FilterInfo> epilogue;
+};
+
+// Функция для обработки аргументов командной строки
+std::vector<FilterInfo> ParseCommandLine(int argc, char* argv[]);
+
+// Проверяет имя и параметры фильтра и приводит параметры к виду, который ожидают реализации.
+// При ошибке возвращает false и пишет причину в error
+bool CheckFilter(FilterInfo& filter, std::string& error);
+
+// Строит план выполнения: подряд идущие поточечные фильтры сливаются в один проход и, где возможно,
+// с соседними фильтрами по окрестности. Неизвестные фильтры и фильтры с неверными параметрами
+// пропускаются с сообщением об ошибке
+std::vector<PipelineStage> PlanPipeline(const std::vector<FilterInfo>& filters);
+
+// Левый верхний угол изображения размером width x height. Стороны, равные INT_MAX, не ограничены
+struct ImageRegion {
+    int width = INT_MAX;
+    int height = INT_MAX;
+};
+
+// Область интереса: часть входа, от которой зависит результат плана. -crop оставляет левый верхний угол,
+// поэтому фильтрам до него нужен тот же угол с запасом на радиусы фильтров по окрестности между ними.
+// Фильтры, пиксель результата которых зависит от всего изображения (-resize, размытие каскадом box-фильтров),
+// требуют весь вход
+ImageRegion InputRegion(const std::vector<PipelineStage>& plan);
+
+// Печатает план в читаемом виде (для --explain). tiled - план выполняется над Image, где подряд идущие
+// фильтры по окрестности выполняются блоками (tiling.h), а этапы считают только область интереса
+void ExplainPipeline(const std::vector<PipelineStage>& plan, std::ostream& out, bool tiled = true);
+
+// Выполнение плана без вывода сообщений фильтров. Подряд идущие фильтры по окрестности выполняются
+// блоками, если это экономит проходы по изображению (WorthTiling в tiling.h). Каждый этап считает только
+// область интереса оставшейся части плана, результат совпадает с обработкой всего изображения
+void ExecutePipeline(Image& image, const std::vector<PipelineStage>& plan);
+
+// Выполнение плана на изображении с раздельными каналами. Каждый фильтр - отдельный векторный проход
+void ExecutePipeline(PlanarImage& image, const std::vector<PipelineStage>& plan);
+
+// Выполнение плана на 8-битном изображении, каждый фильтр - отдельный целочисленный проход
+void ExecutePipeline(ImageU8& image, const std::vector<PipelineStage>& plan);
+
+// Сообщения о применённых фильтрах в порядке фильтров в командной строке
+void PrintPipelineMessages(const std::vector<PipelineStage>& plan, std::ostream& out);
+
+// ExecutePipeline + PrintPipelineMessages в std::cout
+void RunPipeline(Image& image, const std::vector<PipelineStage>& plan);
+void RunPipeline(PlanarImage& image, const std::vector<PipelineStage>& plan);
+
+// Потоковое выполнение плана: файл читается и пишется по строкам, в памяти держатся только окна строк,
+// нужные фильтрам. Сообщения фильтров не печатает. Возвращает false при ошибке чтения или записи
+bool RunStreaming(const char* input_path, const char* output_path, const std::vector<PipelineStage>& plan);
+
+// PlanPipeline + RunPipeline
+void ApplyFilters(Image& image, const std::vector<FilterInfo>& filters);
@@ -0,0 +1,412 @@
+#include "planar_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "blur.h"
+#include "convolution.h"
+#include "denoise.h"
+#include "lut.h"
+#include "resample.h"
+#include "simd.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+namespace {
+
+const int kRowGrain = 8;
+const int kStrideFloats = PlanarImage::kAlignment / static_cast<int>(sizeof(float));
+
+int PaddedStride(int width) {
+    return (width + kStrideFloats - 1) / kStrideFloats * kStrideFloats;
+}
+
+}  // namespace
+
+void PlanarImage::AlignedDeleter::operator()(float* data) const {
+    ::operator delete[](data, std::align_val_t(kAlignment));
+}
+
+PlanarImage::Buffer PlanarImage::Allocate(size_t count) {
+    auto* data = static_cast<float*>(::operator new[](std::max<size_t>(count, 1) * sizeof(float),
+                                                      std::align_val_t(kAlignment)));
+    return Buffer(data);
+}
+
+PlanarImage::PlanarImage(int width, int height)
+    : m_width_(width),
+      m_height_(height),
+      m_stride_(PaddedStride(width)),
+      m_data_(Allocate(static_cast<size_t>(PaddedStride(width)) * height * 3)) {
+    std::fill(m_data_.get(), m_data_.get() + static_cast<size_t>(m_stride_) * m_height_ * 3, 0.0f);
+}
+
+PlanarImage::PlanarImage(const Image& image) : PlanarImage(image.Width(), image.Height()) {
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const Color* src = image.Row(y);
+            float* r = Row(0, y);
+            float* g = Row(1, y);
+            float* b = Row(2, y);
+            for (int x = 0; x < m_width_; ++x) {
+                r[x] = src[x].r;
+                g[x] = src[x].g;
+                b[x] = src[x].b;
+            }
+        }
+    });
+}
+
+Image PlanarImage::ToImage() const {
+    Image image(m_width_, m_height_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            Color* dst = image.Row(y);
+            const float* r = Row(0, y);
+            const float* g = Row(1, y);
+            const float* b = Row(2, y);
+            for (int x = 0; x < m_width_; ++x) {
+                dst[x] = Color(r[x], g[x], b[x]);
+            }
+        }
+    });
+    return image;
+}
+
+int PlanarImage::Width() const {
+    return m_width_;
+}
+
+int PlanarImage::Height() const {
+    return m_height_;
+}
+
+int PlanarImage::Stride() const {
+    return m_stride_;
+}
+
+float* PlanarImage::Row(int channel, int y) {
+    return m_data_.get() + (static_cast<size_t>(channel) * m_height_ + y) * m_stride_;
+}
+
+const float* PlanarImage::Row(int channel, int y) const {
+    return m_data_.get() + (static_cast<size_t>(channel) * m_height_ + y) * m_stride_;
+}
+
+void PlanarImage::Crop(int new_width, int new_height) {
+    new_width = std::min(new_width, m_width_);
+    new_height = std::min(new_height, m_height_);
+
+    // Как и в Image, остаётся левая верхняя часть: при хранении снизу вверх это последние строки
+    PlanarImage cropped(new_width, new_height);
+    const int start_y = m_height_ - new_height;
+    ParallelFor(new_height, kRowGrain, [&](int begin, int end) {
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                std::memcpy(cropped.Row(c, y), Row(c, start_y + y), sizeof(float) * new_width);
+            }
+        }
+    });
+    *this = std::move(cropped);
+}
+
+void PlanarImage::Resize(int new_width, int new_height) {
+    const ResampleWeights horizontal = LanczosWeights(m_width_, new_width);
+    const ResampleWeights vertical = LanczosWeights(m_height_, new_height);
+    PlanarImage temporary(new_width, m_height_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                ResampleRowHorizontal(Row(c, y), temporary.Row(c, y), horizontal, 1);
+            }
+        }
+    });
+
+    PlanarImage resized(new_width, new_height);
+    ParallelFor(new_height, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(vertical.taps);
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                for (int k = 0; k < vertical.taps; ++k) {
+                    rows[k] = temporary.Row(c, vertical.first[y] + k);
+                }
+                const float* weights = &vertical.weights[static_cast<size_t>(y) * vertical.taps];
+                ResampleRowsVertical(rows.data(), weights, vertical.taps, resized.Row(c, y), new_width);
+            }
+        }
+    });
+    *this = std::move(resized);
+}
+
+void PlanarImage::Grayscale() {
+    const SimdKernels& simd = GetSimdKernels();
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            simd.grayscale(Row(0, y), Row(1, y), Row(2, y), m_width_);
+        }
+    });
+}
+
+void PlanarImage::Negative() {
+    const SimdKernels& simd = GetSimdKernels();
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                simd.negative(Row(c, y), m_width_);
+            }
+        }
+    });
+}
+
+void PlanarImage::ApplyLut(const ColorLut& lut) {
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            lut.Apply(Row(0, y), Row(1, y), Row(2, y), m_width_);
+        }
+    });
+}
+
+void PlanarImage::GaussianBlur(float sigma) {
+    if (sigma <= 0.0f) {
+        return;
+    }
+    PlanarImage temporary(m_width_, m_height_);
+
+    if (UseBoxCascade(sigma)) {
+        const std::vector<int> radii = BoxCascadeRadii(sigma);
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            std::vector<float> row_a(m_width_);
+            std::vector<float> row_b(m_width_);
+            for (int c = 0; c < 3; ++c) {
+                for (int y = begin; y < end; ++y) {
+                    BoxBlurRowHorizontal(Row(c, y), row_a.data(), m_width_, 1, radii[0]);
+                    BoxBlurRowHorizontal(row_a.data(), row_b.data(), m_width_, 1, radii[1]);
+                    BoxBlurRowHorizontal(row_b.data(), temporary.Row(c, y), m_width_, 1, radii[2]);
+                }
+            }
+        });
+        auto vertical = [&](PlanarImage& src, PlanarImage& dst, int radius) {
+            ParallelFor(m_width_ * 3, kRowGrain, [&](int begin, int end) {
+                for (int i = begin; i < end;) {
+                    // Куски не пересекают границу плоскости
+                    const int c = i / m_width_;
+                    const int x = i % m_width_;
+                    const int count = std::min(end - i, m_width_ - x);
+                    BoxBlurVertical(src.Row(c, 0) + x, m_stride_, dst.Row(c, 0) + x, m_stride_, m_height_, count,
+                                    radius);
+                    i += count;
+                }
+            });
+        };
+        vertical(temporary, *this, radii[0]);
+        vertical(*this, temporary, radii[1]);
+        vertical(temporary, *this, radii[2]);
+        return;
+    }
+
+    const std::vector<float> kernel = GaussianKernel(sigma);
+    const int radius = static_cast<int>(kernel.size()) / 2;
+
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                ConvolveRowHorizontal(Row(c, y), temporary.Row(c, y), m_width_, 1, kernel);
+            }
+        }
+    });
+
+    // Вертикальный проход полосами столбцов, как и в Image
+    const int strip_floats = 1024;
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(kernel.size());
+        for (int c = 0; c < 3; ++c) {
+            for (int strip = 0; strip < m_width_; strip += strip_floats) {
+                const int count = std::min(strip_floats, m_width_ - strip);
+                for (int y = begin; y < end; ++y) {
+                    for (int k = -radius; k <= radius; ++k) {
+                        const int neighbor_y = y + k;
+                        const bool inside = neighbor_y >= 0 && neighbor_y < m_height_;
+                        rows[k + radius] = inside ? temporary.Row(c, neighbor_y) + strip : nullptr;
+                    }
+                    ConvolveRowsVertical(rows.data(), kernel, Row(c, y) + strip, count);
+                }
+            }
+        }
+    });
+}
+
+void PlanarImage::Stencil(const float* weights, bool column_major, bool clamp) {
+    const SimdKernels& simd = GetSimdKernels();
+    PlanarImage processed(m_width_, m_height_);
+    if (m_width_ > 2) {
+        ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+            for (int c = 0; c < 3; ++c) {
+                for (int y = begin + 1; y < end + 1; ++y) {
+                    const float* rows[3] = {Row(c, y - 1) + 1, Row(c, y) + 1, Row(c, y + 1) + 1};
+                    simd.stencil3x3(rows, weights, processed.Row(c, y) + 1, m_width_ - 2, column_major, clamp);
+                }
+            }
+        });
+    }
+    *this = std::move(processed);
+}
+
+void PlanarImage::Sharpening() {
+    Stencil(&kSharpeningKernel.weights[0][0], true, true);
+}
+
+void PlanarImage::Thermo() {
+    Stencil(&kThermoKernel.weights[0][0], false, false);
+}
+
+void PlanarImage::EdgeDetection(float threshold) {
+    Grayscale();
+
+    // После grayscale все плоскости равны: считаем по первой, крайние пиксели остаются серыми
+    const SimdKernels& simd = GetSimdKernels();
+    const float* weights = &kEdgeDetectionKernel.weights[0][0];
+    std::vector<float> gray(static_cast<size_t>(m_stride_) * m_height_);
+    std::memcpy(gray.data(), Row(0, 0), sizeof(float) * gray.size());
+    if (m_width_ > 2) {
+        ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+            for (int y = begin + 1; y < end + 1; ++y) {
+                const float* rows[3] = {&gray[static_cast<size_t>(y - 1) * m_stride_ + 1],
+                                        &gray[static_cast<size_t>(y) * m_stride_ + 1],
+                                        &gray[static_cast<size_t>(y + 1) * m_stride_ + 1]};
+                float* dst = Row(0, y) + 1;
+                simd.stencil3x3(rows, weights, dst, m_width_ - 2, true, false);
+                simd.threshold(dst, dst, threshold, m_width_ - 2);
+                std::memcpy(Row(1, y) + 1, dst, sizeof(float) * (m_width_ - 2));
+                std::memcpy(Row(2, y) + 1, dst, sizeof(float) * (m_width_ - 2));
+            }
+        });
+    }
+}
+
+void PlanarImage::AutoEdgeDetection() {
+    Grayscale();
+    if (m_width_ < 3 || m_height_ < 3) {
+        return;
+    }
+
+    // Как EdgeDetection, но отклик без порога сначала пишется в плоскость 0 целиком, и порог выбирается
+    // по его гистограмме так же, как у Image::AutoEdgeDetection
+    const SimdKernels& simd = GetSimdKernels();
+    const float* weights = &kEdgeDetectionKernel.weights[0][0];
+    std::vector<float> gray(static_cast<size_t>(m_stride_) * m_height_);
+    std::memcpy(gray.data(), Row(0, 0), sizeof(float) * gray.size());
+    std::vector<float> row_min(m_height_ - 2);
+    std::vector<float> row_max(m_height_ - 2);
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            const float* rows[3] = {&gray[static_cast<size_t>(y - 1) * m_stride_ + 1],
+                                    &gray[static_cast<size_t>(y) * m_stride_ + 1],
+                                    &gray[static_cast<size_t>(y + 1) * m_stride_ + 1]};
+            float* response = Row(0, y) + 1;
+            simd.stencil3x3(rows, weights, response, m_width_ - 2, true, false);
+            const auto [low, high] = std::minmax_element(response, response + m_width_ - 2);
+            row_min[y - 1] = *low;
+            row_max[y - 1] = *high;
+        }
+    });
+    const ValueStats stats = ComputeStats([&](int y) { return Row(0, y + 1) + 1; }, m_height_ - 2, m_width_ - 2, 1, 1,
+                                          *std::min_element(row_min.begin(), row_min.end()),
+                                          *std::max_element(row_max.begin(), row_max.end()))[0];
+    const float threshold = OtsuThreshold(stats);
+
+    ParallelFor(m_height_ - 2, kRowGrain, [&](int begin, int end) {
+        for (int y = begin + 1; y < end + 1; ++y) {
+            float* dst = Row(0, y) + 1;
+            simd.threshold(dst, dst, threshold, m_width_ - 2);
+            std::memcpy(Row(1, y) + 1, dst, sizeof(float) * (m_width_ - 2));
+            std::memcpy(Row(2, y) + 1, dst, sizeof(float) * (m_width_ - 2));
+        }
+    });
+}
+
+void PlanarImage::Convolve(const Convolution& convolution) {
+    const int radius = convolution.Radius();
+    const BorderPolicy border = convolution.Border();
+    const int size = 2 * radius + 1;
+    PlanarImage processed(m_width_, m_height_);
+
+    if (convolution.Separable()) {
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            for (int c = 0; c < 3; ++c) {
+                for (int y = begin; y < end; ++y) {
+                    convolution.Horizontal(Row(c, y), processed.Row(c, y), m_width_, 1);
+                }
+            }
+        });
+        ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+            std::vector<const float*> rows(size);
+            for (int c = 0; c < 3; ++c) {
+                for (int y = begin; y < end; ++y) {
+                    for (int k = 0; k < size; ++k) {
+                        rows[k] = processed.Row(c, BorderIndex(y + k - radius, m_height_, border));
+                    }
+                    convolution.Vertical(rows.data(), Row(c, y), m_width_);
+                }
+            }
+        });
+        return;
+    }
+
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        std::vector<const float*> rows(size);
+        for (int c = 0; c < 3; ++c) {
+            for (int y = begin; y < end; ++y) {
+                float* dst = processed.Row(c, y);
+                if (border == BorderPolicy::Skip) {
+                    std::memcpy(dst, Row(c, y), sizeof(float) * m_width_);
+                }
+                if (border != BorderPolicy::Skip || (y >= radius && y < m_height_ - radius)) {
+                    for (int k = 0; k < size; ++k) {
+                        rows[k] = Row(c, BorderIndex(y + k - radius, m_height_, border));
+                    }
+                    convolution.Row(rows.data(), dst, m_width_, 1);
+                }
+            }
+        }
+    });
+    *this = std::move(processed);
+}
+
+void PlanarImage::Median(int radius) {
+    // Уровни каналов собираются в строки по пикселям, как у Image: одно окно на все три канала
+    const int row_levels = 3 * m_width_;
+    std::vector<unsigned char> levels(static_cast<size_t>(row_levels) * m_height_);
+    ParallelFor(m_height_, kRowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            unsigned char* row = &levels[static_cast<size_t>(y) * row_levels];
+            for (int c = 0; c < 3; ++c) {
+                const float* values = Row(c, y);
+                for (int x = 0; x < m_width_; ++x) {
+                    row[3 * x + c] = QuantizeLevel(values[x]);
+                }
+            }
+        }
+    });
+    PlanarImage processed(m_width_, m_height_);
+    MedianFilter(
+        m_width_, m_height_, 3, radius, [&](int y) { return &levels[static_cast<size_t>(y) * row_levels]; },
+        [&](int y, const unsigned char* median) {
+            for (int c = 0; c < 3; ++c) {
+                float* values = processed.Row(c, y);
+                for (int x = 0; x < m_width_; ++x) {
+                    values[x] = LevelValue(median[3 * x + c]);
+                }
+            }
+        });
+    *this = std::move(processed);
+}
+
+void PlanarImage::Bilateral(float sigma_spatial, float sigma_range) {
+    PlanarImage processed(m_width_, m_height_);
+    BilateralFilter({{Row(0, 0), Row(1, 0), Row(2, 0)}, 1, m_stride_},
+                    {{processed.Row(0, 0), processed.Row(1, 0), processed.Row(2, 0)}, 1, m_stride_}, m_width_,
+                    m_height_, sigma_spatial, sigma_range, nullptr);
+    *this = std::move(processed);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>
+
+#include "image.h"
+
+class ColorLut;
+
+// Изображение с раздельным хранением каналов (SoA): три плоскости float, каждая строка выровнена
+// по 64 байтам и дополнена до кратной 16 float длины. Фильтры работают через векторные примитивы simd.h.
+// Результаты фильтров совпадают с результатами Image
+class PlanarImage {
+public:
+    static const int kAlignment = 64;
+
+    PlanarImage(int width, int height);
+    explicit PlanarImage(const Image& image);
+
+    // Переводит изображение обратно в чередующееся представление
+    Image ToImage() const;
+
+    int Width() const;
+    int Height() const;
+    // Расстояние между началами соседних строк в float
+    int Stride() const;
+    float* Row(int channel, int y);
+    const float* Row(int channel, int y) const;
+
+    void Crop(int new_width, int new_height);
+    void Resize(int new_width, int new_height);
+    void Grayscale();
+    void Negative();
+    void GaussianBlur(float sigma);
+    void Sharpening();
+    void Thermo();
+    void EdgeDetection(float threshold);
+    void AutoEdgeDetection();
+    void Convolve(const Convolution& convolution);
+    void ApplyLut(const ColorLut& lut);
+    void Median(int radius);
+    void Bilateral(float sigma_spatial, float sigma_range);
+
+private:
+    struct AlignedDeleter {
+        void operator()(float* data) const;
+    };
+    using Buffer = std::unique_ptr<float[], AlignedDeleter>;
+
+    static Buffer Allocate(size_t count);
+    // Свёртка 3x3 каждой плоскости в новый буфер; крайние строки и столбцы результата обнуляются
+    void Stencil(const float* weights, bool column_major, bool clamp);
+
+    int m_width_;
+    int m_height_;
+    int m_stride_;
+    Buffer m_data_;
+};
@@ -0,0 +1,210 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+#include "thread_pool.h"
+
+namespace {
+
+std::atomic<bool> g_enabled(false);
+std::chrono::steady_clock::time_point g_origin;
+std::mutex g_records_mutex;
+std::vector<StageRecord> g_records;
+
+// Короткие номера потоков для trace: 0 - поток, первым записавший этап
+std::atomic<int> g_next_thread(0);
+thread_local int t_thread = -1;
+
+int ThreadNumber() {
+    if (t_thread < 0) {
+        t_thread = g_next_thread.fetch_add(1);
+    }
+    return t_thread;
+}
+
+// Имена этапов пишутся в JSON как есть, поэтому экранируем кавычки и обратную косую черту
+std::string EscapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Счётчики выделений памяти у каждого потока свои, в отдельной строке кэша, поэтому потоки не мешают друг
+// другу; StageTimer складывает их. Ячейки статические: выделять память для них внутри operator new нельзя.
+// Потоки сверх kAllocationSlots делят последнюю ячейку
+const int kAllocationSlots = 256;
+
+struct alignas(64) AllocationSlot {
+    std::atomic<long long> allocations{0};
+    std::atomic<long long> bytes{0};
+};
+
+AllocationSlot g_allocation_slots[kAllocationSlots];
+std::atomic<int> g_next_slot(0);
+thread_local AllocationSlot* t_allocation_slot = nullptr;
+
+// Сумма счётчиков всех потоков
+std::pair<long long, long long> AllocationTotals() {
+    const int slots = std::min(g_next_slot.load(std::memory_order_relaxed), kAllocationSlots);
+    long long allocations = 0;
+    long long bytes = 0;
+    for (int i = 0; i < slots; ++i) {
+        allocations += g_allocation_slots[i].allocations.load(std::memory_order_relaxed);
+        bytes += g_allocation_slots[i].bytes.load(std::memory_order_relaxed);
+    }
+    return {allocations, bytes};
+}
+
+}  // namespace
+
+void CountAllocation(std::size_t size) {
+    if (!ProfilingEnabled()) {
+        return;
+    }
+    if (!t_allocation_slot) {
+        t_allocation_slot = &g_allocation_slots[std::min(g_next_slot.fetch_add(1), kAllocationSlots - 1)];
+    }
+    t_allocation_slot->allocations.fetch_add(1, std::memory_order_relaxed);
+    t_allocation_slot->bytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+}
+
+void EnableProfiling() {
+    g_origin = std::chrono::steady_clock::now();
+    g_enabled = true;
+}
+
+bool ProfilingEnabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+StageTimer::StageTimer(const char* name) : StageTimer(ProfilingEnabled() ? std::string(name) : std::string()) {
+}
+
+StageTimer::StageTimer(std::string name)
+    : m_enabled_(ProfilingEnabled()),
+      m_name_(std::move(name)),
+      m_allocations_(0),
+      m_allocated_bytes_(0),
+      m_busy_ns_(0) {
+    if (!m_enabled_) {
+        return;
+    }
+    std::tie(m_allocations_, m_allocated_bytes_) = AllocationTotals();
+    m_busy_ns_ = GetThreadPool().BusyNanoseconds();
+    m_start_ = std::chrono::steady_clock::now();
+}
+
+void StageTimer::Finish(double pixels, double bytes) {
+    if (!m_enabled_) {
+        return;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    StageRecord record;
+    record.name = m_name_;
+    record.thread = ThreadNumber();
+    record.start = std::chrono::duration<double>(m_start_ - g_origin).count();
+    record.duration = std::chrono::duration<double>(end - m_start_).count();
+    record.pixels = pixels;
+    record.bytes = bytes;
+    // Складываются счётчики всех потоков: при параллельных этапах (пакетный режим) в них попадают и соседние
+    const auto [allocations, allocated_bytes] = AllocationTotals();
+    record.allocations = allocations - m_allocations_;
+    record.allocated_bytes = allocated_bytes - m_allocated_bytes_;
+    const double busy = static_cast<double>(GetThreadPool().BusyNanoseconds() - m_busy_ns_) * 1e-9;
+    const double capacity = record.duration * GetThreadPool().Size();
+    record.utilization = capacity > 0 ? std::min(1.0, busy / capacity) : 0;
+
+    std::lock_guard<std::mutex> lock(g_records_mutex);
+    g_records.push_back(std::move(record));
+    m_enabled_ = false;
+}
+
+void PrintProfile(std::ostream& out) {
+    struct Total {
+        int count = 0;
+        double duration = 0;
+        double pixels = 0;
+        double bytes = 0;
+        long long allocations = 0;
+        long long allocated_bytes = 0;
+        double busy = 0;  // utilization * duration
+    };
+    std::vector<std::string> order;
+    std::map<std::string, Total> totals;
+    double wall = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_records_mutex);
+        for (const auto& record : g_records) {
+            if (!totals.count(record.name)) {
+                order.push_back(record.name);
+            }
+            Total& total = totals[record.name];
+            ++total.count;
+            total.duration += record.duration;
+            total.pixels += record.pixels;
+            total.bytes += record.bytes;
+            total.allocations += record.allocations;
+            total.allocated_bytes += record.allocated_bytes;
+            total.busy += record.utilization * record.duration;
+            wall = std::max(wall, record.start + record.duration);
+        }
+    }
+
+    const std::ios_base::fmtflags flags = out.flags();
+    out << "Profile (" << GetThreadPool().Size() << " thread(s), " << std::fixed << std::setprecision(3)
+        << wall * 1e3 << " ms):\n";
+    out << std::left << std::setw(40) << "stage" << std::right << std::setw(7) << "count" << std::setw(12) << "total ms"
+        << std::setw(8) << "share" << std::setw(10) << "MP/s" << std::setw(9) << "GB/s" << std::setw(9) << "allocs"
+        << std::setw(11) << "alloc MB" << std::setw(7) << "util" << "\n";
+    for (const auto& name : order) {
+        const Total& total = totals[name];
+        const double duration = std::max(total.duration, 1e-12);
+        out << std::left << std::setw(40) << name << std::right << std::setw(7) << total.count << std::setw(12)
+            << std::setprecision(3) << total.duration * 1e3 << std::setprecision(1) << std::setw(7)
+            << (wall > 0 ? total.duration / wall * 100 : 0) << "%" << std::setw(10) << total.pixels / duration / 1e6
+            << std::setprecision(2) << std::setw(9) << total.bytes / duration / 1e9 << std::setw(9)
+            << total.allocations << std::setprecision(1) << std::setw(11)
+            << static_cast<double>(total.allocated_bytes) / (1 << 20) << std::setw(6)
+            << total.busy / duration * 100 << "%\n";
+    }
+    out.flags(flags);
+}
+
+bool WriteTrace(const char* path, std::string& error) {
+    std::ofstream f(path);
+    if (!f.is_open()) {
+        error = "Trace file cannot be opened";
+        return false;
+    }
+    f << std::setprecision(15);
+    f << "{\"traceEvents\": [\n";
+    std::lock_guard<std::mutex> lock(g_records_mutex);
+    for (size_t i = 0; i < g_records.size(); ++i) {
+        const StageRecord& record = g_records[i];
+        // Время в trace events задаётся в микросекундах
+        f << "  {\"name\": \"" << EscapeJson(record.name) << "\", \"cat\": \"stage\", \"ph\": \"X\", \"pid\": 1"
+          << ", \"tid\": " << record.thread << ", \"ts\": " << record.start * 1e6 << ", \"dur\": "
+          << record.duration * 1e6 << ", \"args\": {\"pixels\": " << record.pixels << ", \"bytes\": " << record.bytes
+          << ", \"allocations\": " << record.allocations << ", \"allocated_bytes\": " << record.allocated_bytes
+          << ", \"utilization\": " << record.utilization << "}}" << (i + 1 < g_records.size() ? "," : "") << "\n";
+    }
+    f << "], \"displayTimeUnit\": \"ms\"}\n";
+    f.close();
+    if (!f) {
+        error = "Failed to write the trace file";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Замеры этапов обработки (чтение, проходы фильтров, запись) для --profile и --trace
+
+struct StageRecord {
+    std::string name;
+    int thread = 0;
+    double start = 0;  // секунды от включения профилирования
+    double duration = 0;
+    double pixels = 0;
+    double bytes = 0;  // оценка объёма прочитанной и записанной памяти
+    long long allocations = 0;
+    long long allocated_bytes = 0;
+    double utilization = 0;  // доля времени этапа, в которую потоки пула выполняли задачи
+};
+
+// Пока профилирование выключено, StageTimer ничего не замеряет
+void EnableProfiling();
+bool ProfilingEnabled();
+
+// Учитывает выделение size байт в счётчиках текущего потока; пока профилирование выключено, ничего не делает.
+// Вызывается из замены operator new в приложении (image_processor.cpp): библиотека сама её не задаёт, чтобы
+// не менять выделение памяти в других программах
+void CountAllocation(std::size_t size);
+
+// Замер одного этапа от создания до Finish
+class StageTimer {
+public:
+    explicit StageTimer(const char* name);
+    explicit StageTimer(std::string name);
+
+    void Finish(double pixels, double bytes);
+
+private:
+    bool m_enabled_;
+    std::string m_name_;
+    std::chrono::steady_clock::time_point m_start_;
+    long long m_allocations_;
+    long long m_allocated_bytes_;
+    long long m_busy_ns_;
+};
+
+// Таблица со сводкой по этапам с одинаковыми именами
+void PrintProfile(std::ostream& out);
+
+// Файл в формате Chrome trace events (открывается в chrome://tracing и Perfetto)
+bool WriteTrace(const char* path, std::string& error);
@@ -0,0 +1,64 @@
+#include "pyramid.h"
+
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "bmp.h"
+#include "profile.h"
+
+std::string PyramidLevelPath(const std::string& output, int level) {
+    const std::string placeholder = "{level}";
+    const size_t position = output.find(placeholder);
+    if (position != std::string::npos) {
+        return output.substr(0, position) + std::to_string(level) + output.substr(position + placeholder.size());
+    }
+    if (level == 0) {
+        return output;
+    }
+    const size_t slash = output.find_last_of("/\\");
+    size_t dot = output.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        dot = output.size();
+    }
+    return output.substr(0, dot) + "_" + std::to_string(level) + output.substr(dot);
+}
+
+bool SavePyramid(Image image, const std::string& output, int levels, std::string& error) {
+    // deque не перемещает элементы при добавлении, поэтому потоки записи читают уровни без копий
+    std::deque<Image> images;
+    images.push_back(std::move(image));
+    std::vector<std::string> errors;
+    errors.reserve(levels);
+    std::vector<std::thread> writers;
+    for (int level = 0; level < levels; ++level) {
+        const Image& current = images.back();
+        errors.emplace_back();
+        writers.emplace_back([&current, &output, level, &level_error = errors.back()] {
+            StageTimer timer("Export level " + std::to_string(level));
+            if (current.Save(PyramidLevelPath(output, level).c_str(), level_error)) {
+                timer.Finish(static_cast<double>(current.Width()) * current.Height(),
+                             BmpCodecBytes(current.Width(), current.Height()));
+            }
+        });
+        if (current.Width() == 1 && current.Height() == 1) {
+            break;
+        }
+        if (level + 1 < levels) {
+            StageTimer timer("Downsample 2x");
+            images.push_back(current.Downsample2x());
+            const double pixels = static_cast<double>(current.Width()) * current.Height();
+            timer.Finish(pixels, pixels * 1.25 * sizeof(Color));
+        }
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    for (size_t level = 0; level < errors.size(); ++level) {
+        if (!errors[level].empty()) {
+            error = PyramidLevelPath(output, static_cast<int>(level)) + ": " + errors[level];
+            return false;
+        }
+    }
+    return true;
+}
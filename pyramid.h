@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include "image.h"
+
+// Пирамида уменьшенных копий (--pyramid N): уровень 0 - само изображение, каждый следующий вдвое меньше
+// предыдущего и строится из него, а не из исходного файла.
+
+// Имя файла уровня: подстрока {level} в output заменяется номером уровня, иначе номер добавляется перед
+// расширением (out.bmp, out_1.bmp, out_2.bmp, ...)
+std::string PyramidLevelPath(const std::string& output, int level);
+
+// Пишет до levels уровней, пока изображение не уменьшится до 1x1. Каждый уровень записывается в своём потоке,
+// а в это время строится следующий. При ошибке записи возвращает false и пишет причину в error
+bool SavePyramid(Image image, const std::string& output, int levels, std::string& error);
@@ -0,0 +1,138 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+namespace {
+
+const int kLanczosLobes = 3;
+
+float Sinc(float x) {
+    if (x == 0.0f) {
+        return 1.0f;
+    }
+    const float angle = static_cast<float>(M_PI) * x;
+    return std::sin(angle) / angle;
+}
+
+float Lanczos(float x) {
+    if (std::abs(x) >= kLanczosLobes) {
+        return 0.0f;
+    }
+    return Sinc(x) * Sinc(x / kLanczosLobes);
+}
+
+// Каналы пикселя считаются вместе: веса загружаются один раз на пиксель, а не на канал
+template <int kChannels>
+void ResampleRowHorizontalPixels(const float* src, float* dst, const ResampleWeights& weights) {
+    const int target_width = static_cast<int>(weights.first.size());
+    const int taps = weights.taps;
+    for (int x = 0; x < target_width; ++x) {
+        const float* tap_weights = &weights.weights[static_cast<size_t>(x) * taps];
+        const float* pixel = src + weights.first[x] * kChannels;
+        float sum[kChannels] = {};
+        for (int k = 0; k < taps; ++k) {
+            for (int c = 0; c < kChannels; ++c) {
+                sum[c] += tap_weights[k] * pixel[k * kChannels + c];
+            }
+        }
+        for (int c = 0; c < kChannels; ++c) {
+            dst[x * kChannels + c] = sum[c];
+        }
+    }
+}
+
+// Число каналов известно при компиляции: тогда обращения к паре пикселей идут с постоянным шагом,
+// и компилятор векторизует цикл перестановками внутри векторов
+template <int kChannels>
+void DownsampleRowsPairs(const float* up, const float* down, float* dst, int target_width) {
+    for (int x = 0; x < target_width; ++x) {
+        for (int c = 0; c < kChannels; ++c) {
+            const int left = 2 * kChannels * x + c;
+            dst[kChannels * x + c] =
+                0.25f * ((up[left] + up[left + kChannels]) + (down[left] + down[left + kChannels]));
+        }
+    }
+}
+
+}  // namespace
+
+ResampleWeights LanczosWeights(int source_size, int target_size) {
+    ResampleWeights result;
+    const float scale = static_cast<float>(source_size) / static_cast<float>(target_size);
+    const float stretch = std::max(1.0f, scale);
+    const float support = kLanczosLobes * stretch;
+    result.taps = std::min(source_size, 2 * static_cast<int>(std::ceil(support)) + 1);
+    result.first.resize(target_size);
+    result.weights.assign(static_cast<size_t>(target_size) * result.taps, 0.0f);
+
+    for (int i = 0; i < target_size; ++i) {
+        // Центр точки результата в координатах исходника: центры пикселей в половинах
+        const float center = (static_cast<float>(i) + 0.5f) * scale - 0.5f;
+        const int first =
+            std::clamp(static_cast<int>(std::floor(center)) - (result.taps - 1) / 2, 0, source_size - result.taps);
+        result.first[i] = first;
+        float* weights = &result.weights[static_cast<size_t>(i) * result.taps];
+
+        float total = 0.0f;
+        const int from = static_cast<int>(std::floor(center - support));
+        const int to = static_cast<int>(std::ceil(center + support));
+        for (int j = from; j <= to; ++j) {
+            const float weight = Lanczos((static_cast<float>(j) - center) / stretch);
+            if (weight == 0.0f) {
+                continue;
+            }
+            // Точки за краем исходника заменяются крайней, поэтому их вес добавляется к ней
+            const int source = std::clamp(std::clamp(j, 0, source_size - 1), first, first + result.taps - 1);
+            weights[source - first] += weight;
+            total += weight;
+        }
+        for (int k = 0; k < result.taps; ++k) {
+            weights[k] /= total;
+        }
+    }
+    return result;
+}
+
+void ResampleRowHorizontal(const float* src, float* dst, const ResampleWeights& weights, int channels) {
+    if (channels == 3) {
+        ResampleRowHorizontalPixels<3>(src, dst, weights);
+    } else {
+        ResampleRowHorizontalPixels<1>(src, dst, weights);
+    }
+}
+
+void ResampleRowsVertical(const float* const* rows, const float* weights, int taps, float* dst, int count) {
+    const SimdKernels& simd = GetSimdKernels();
+    simd.scale(dst, rows[0], weights[0], count);
+    for (int k = 1; k < taps; ++k) {
+        if (weights[k] != 0.0f) {
+            simd.axpy(dst, rows[k], weights[k], count);
+        }
+    }
+    // Отрицательные лепестки Ланцоша дают выбросы за [0, 1] у резких границ
+    for (int i = 0; i < count; ++i) {
+        dst[i] = std::min(1.0f, std::max(0.0f, dst[i]));
+    }
+}
+
+int HalfSize(int size) {
+    return std::max(1, size / 2);
+}
+
+void DownsampleRows2x(const float* up, const float* down, float* dst, int source_width, int channels) {
+    if (source_width == 1) {
+        for (int c = 0; c < channels; ++c) {
+            dst[c] = 0.5f * (up[c] + down[c]);
+        }
+        return;
+    }
+    const int target_width = HalfSize(source_width);
+    if (channels == 3) {
+        DownsampleRowsPairs<3>(up, down, dst, target_width);
+    } else {
+        DownsampleRowsPairs<1>(up, down, dst, target_width);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+// Изменение размера изображения. Как и в blur.h, функции работают со строками float, где у каждого пикселя
+// channels подряд идущих значений: 3 для Color, 1 для плоскости PlanarImage.
+
+// Веса одномерной передискретизации: точка результата i - взвешенная сумма taps подряд идущих точек
+// исходника, начиная с first[i]. За краем исходника повторяется крайняя точка
+struct ResampleWeights {
+    int taps = 0;
+    std::vector<int> first;
+    // taps весов на каждую точку результата, сумма весов точки равна 1
+    std::vector<float> weights;
+};
+
+// Фильтр Ланцоша с тремя лепестками. При уменьшении ядро растягивается в source_size / target_size раз,
+// чтобы мелкие детали усреднялись, а не давали муар
+ResampleWeights LanczosWeights(int source_size, int target_size);
+
+// Передискретизация строки по горизонтали: из source_width пикселей в weights.first.size()
+void ResampleRowHorizontal(const float* src, float* dst, const ResampleWeights& weights, int channels);
+
+// Строка результата по вертикали: rows[k] - строка исходника first + k, weights - taps весов этой строки
+// результата. Складывает строки векторными примитивами simd.h и ограничивает результат отрезком [0, 1]
+void ResampleRowsVertical(const float* const* rows, const float* weights, int taps, float* dst, int count);
+
+// Размер уровня пирамиды: вдвое меньше с округлением вниз, но не меньше 1
+int HalfSize(int size);
+
+// Уменьшение вдвое усреднением квадратов 2x2: строка результата по строкам исходника 2y и 2y + 1
+// (у изображения высотой 1 обе строки совпадают). Нечётный последний столбец отбрасывается
+void DownsampleRows2x(const float* up, const float* down, float* dst, int source_width, int channels);
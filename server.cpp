@@ -0,0 +1,381 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <istream>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "bmp.h"
+#include "bounded_queue.h"
+#include "image.h"
+#include "image_u8.h"
+#include "local_socket.h"
+#include "planar_image.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Самый большой файл, который принимается в теле запроса
+const size_t kMaxInlineBytes = static_cast<size_t>(1) << 30;
+// Наибольшее число пикселей изображения из тела запроса. Файл в 1 бит на пиксель или с RLE занимает
+// в памяти во много раз больше, чем в запросе, поэтому размер тела не ограничивает память
+const long long kMaxInlinePixels = 1LL << 28;
+// Начало тела, в котором умещаются заголовки, маски каналов и палитра BMP: размеры изображения проверяются
+// по нему до того, как читается и выделяется всё тело
+const size_t kInlineHeaderBytes = static_cast<size_t>(1) << 17;
+
+double Milliseconds(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Поток чтения поверх байтов в памяти, без копирования
+class MemoryBuffer : public std::streambuf {
+public:
+    MemoryBuffer(char* data, size_t size) {
+        setg(data, data, data + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override {
+        char* base = direction == std::ios_base::beg ? eback() : direction == std::ios_base::cur ? gptr() : egptr();
+        if (offset < eback() - base || offset > egptr() - base) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), base + offset, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+
+// Задержки запросов. Гистограмма с корзинами, растущими в 1.1 раза, занимает постоянную память
+// при любом числе запросов; процентили получаются с точностью до 10%
+class LatencyStats {
+public:
+    void Record(double milliseconds, bool ok) {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        ++(ok ? m_ok_ : m_errors_);
+        m_total_ += milliseconds;
+        m_max_ = std::max(m_max_, milliseconds);
+        ++m_buckets_[Bucket(milliseconds)];
+    }
+
+    void RecordBusy() {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        ++m_busy_;
+    }
+
+    std::string Summary() const {
+        std::lock_guard<std::mutex> lock(m_mutex_);
+        const long long count = m_ok_ + m_errors_;
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "requests=" << count << " ok=" << m_ok_ << " errors=" << m_errors_
+            << " busy=" << m_busy_ << " mean=" << (count > 0 ? m_total_ / static_cast<double>(count) : 0.0)
+            << " p50=" << Percentile(count, 0.5) << " p95=" << Percentile(count, 0.95)
+            << " p99=" << Percentile(count, 0.99) << " max=" << m_max_;
+        return out.str();
+    }
+
+private:
+    static constexpr int kBuckets = 200;
+    static constexpr double kFirst = 0.01;  // верхняя граница первой корзины, мс
+    static constexpr double kGrowth = 1.1;
+
+    static int Bucket(double milliseconds) {
+        if (milliseconds <= kFirst) {
+            return 0;
+        }
+        const int bucket = static_cast<int>(std::ceil(std::log(milliseconds / kFirst) / std::log(kGrowth)));
+        return std::min(bucket, kBuckets - 1);
+    }
+
+    // Верхняя граница корзины, в которую попадает доля fraction запросов
+    double Percentile(long long count, double fraction) const {
+        if (count == 0) {
+            return 0.0;
+        }
+        const long long rank = std::max(1LL, static_cast<long long>(std::ceil(fraction * static_cast<double>(count))));
+        long long seen = 0;
+        for (int bucket = 0; bucket < kBuckets; ++bucket) {
+            seen += m_buckets_[bucket];
+            if (seen >= rank) {
+                return std::min(m_max_, kFirst * std::pow(kGrowth, bucket));
+            }
+        }
+        return m_max_;
+    }
+
+    mutable std::mutex m_mutex_;
+    long long m_ok_ = 0;
+    long long m_errors_ = 0;
+    long long m_busy_ = 0;
+    double m_total_ = 0;
+    double m_max_ = 0;
+    long long m_buckets_[kBuckets] = {};
+};
+
+struct PendingConnection {
+    int socket;
+    Clock::time_point accepted;
+};
+
+// Изображения одного обработчика. Живут между запросами, поэтому память под пиксели выделяется только
+// когда приходит изображение больше прежних
+struct WorkerBuffers {
+    Image image{0, 0};
+    ImageU8 image_u8{0, 0};
+};
+
+std::vector<std::string> SplitTokens(const std::string& line) {
+    std::istringstream in(line);
+    std::vector<std::string> tokens;
+    std::string token;
+    while (in >> token) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Фильтры из токенов запроса в том же виде, что и из командной строки
+bool ParseRequestFilters(const std::vector<std::string>& tokens, std::vector<FilterInfo>& filters,
+                         std::string& error) {
+    std::vector<std::string> arguments = {"image_processor"};
+    arguments.insert(arguments.end(), tokens.begin(), tokens.end());
+    std::vector<char*> argv;
+    for (auto& argument : arguments) {
+        argv.push_back(argument.data());
+    }
+    filters = ParseCommandLine(static_cast<int>(argv.size()), argv.data());
+    for (const auto& filter : filters) {
+        if (filter.name.substr(0, 2) == "--") {
+            error = "Options are not accepted in requests: " + filter.name;
+            return false;
+        }
+        // PlanPipeline сам подготовит параметры, здесь проверяется копия
+        FilterInfo copy = filter;
+        if (!CheckFilter(copy, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Проверяет размеры изображения по началу тела запроса (header) и размеру всего тела
+bool CheckInlineHeader(const std::string& header, size_t size, std::string& error) {
+    BmpInfo info;
+    if (!ParseBmpHeader(reinterpret_cast<const unsigned char*>(header.data()), header.size(), size, info, error)) {
+        return false;
+    }
+    if (static_cast<long long>(info.width) * info.height > kMaxInlinePixels) {
+        error = "Inline image is too large: " + std::to_string(info.width) + "x" + std::to_string(info.height);
+        return false;
+    }
+    return true;
+}
+
+class Server {
+public:
+    explicit Server(const ServerOptions& options) : m_options_(options), m_connections_(options.queue) {
+    }
+
+    bool Run() {
+        std::string error;
+        m_listener_ = ListenLocalSocket(m_options_.socket_path, static_cast<int>(m_options_.queue), error);
+        if (m_listener_ < 0) {
+            std::cerr << "Error: " << error << std::endl;
+            return false;
+        }
+        CatchStopSignals();
+        if (!m_options_.quiet) {
+            std::cout << "Listening on " << m_options_.socket_path << " (" << m_options_.workers << " worker(s), "
+                      << "storage " << StorageName(m_options_.storage) << ")" << std::endl;
+        }
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < m_options_.workers; ++i) {
+            workers.emplace_back([this] { Work(); });
+        }
+        while (!m_stopping_.load()) {
+            const int socket = AcceptConnection(m_listener_);
+            if (socket < 0) {
+                break;
+            }
+            PendingConnection connection{socket, Clock::now()};
+            if (!m_connections_.TryPush(connection)) {
+                // Перегрузка: клиент сразу узнаёт об этом и может повторить запрос позже
+                SocketStream stream(socket);
+                stream.WriteLine("BUSY");
+                m_stats_.RecordBusy();
+            }
+        }
+        m_connections_.Close();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        CloseSocket(m_listener_);
+        std::remove(m_options_.socket_path.c_str());
+        std::cout << "Server stopped: " << m_stats_.Summary() << std::endl;
+        return true;
+    }
+
+private:
+    void Work() {
+        WorkerBuffers buffers;
+        while (std::optional<PendingConnection> pending = m_connections_.Pop()) {
+            SocketStream stream(pending->socket);
+            // Время ожидания в очереди относится к первому запросу соединения
+            Clock::time_point arrived = pending->accepted;
+            std::string line;
+            while (stream.ReadLine(line)) {
+                const std::vector<std::string> tokens = SplitTokens(line);
+                if (tokens.empty()) {
+                    continue;
+                }
+                if (tokens[0] == "STATS") {
+                    stream.WriteLine("STATS " + m_stats_.Summary());
+                } else if (tokens[0] == "SHUTDOWN") {
+                    m_stopping_.store(true);
+                    StopListening(m_listener_);
+                    stream.WriteLine("OK shutdown");
+                } else if (!Serve(stream, tokens, arrived, buffers)) {
+                    break;
+                }
+                arrived = Clock::time_point();
+            }
+        }
+    }
+
+    // Обрабатывает запрос и пишет ответ. false, если соединение больше нельзя использовать
+    bool Serve(SocketStream& stream, const std::vector<std::string>& tokens, Clock::time_point arrived,
+               WorkerBuffers& buffers) {
+        const Clock::time_point start = Clock::now();
+        const double queue_ms = arrived == Clock::time_point() ? 0.0 : Milliseconds(arrived, start);
+        std::string error;
+        std::string inline_bytes;
+        if (tokens[0][0] == '@') {
+            const unsigned long long size = std::strtoull(tokens[0].c_str() + 1, nullptr, 10);
+            if (size == 0 || size > kMaxInlineBytes) {
+                // Длина тела неизвестна, поэтому дальше читать из соединения нельзя
+                stream.WriteLine("ERROR Incorrect inline file size " + tokens[0]);
+                m_stats_.Record(Milliseconds(start, Clock::now()), false);
+                return false;
+            }
+            const size_t header_size = std::min(static_cast<size_t>(size), kInlineHeaderBytes);
+            if (!stream.ReadBytes(header_size, inline_bytes)) {
+                return false;
+            }
+            if (!CheckInlineHeader(inline_bytes, static_cast<size_t>(size), error)) {
+                // Остаток тела не прочитан, соединение закрывается
+                stream.WriteLine("ERROR " + error);
+                m_stats_.Record(Milliseconds(start, Clock::now()), false);
+                return false;
+            }
+            if (!stream.ReadBytes(static_cast<size_t>(size) - header_size, inline_bytes)) {
+                return false;
+            }
+        }
+
+        Clock::time_point read_end = start;
+        Clock::time_point filters_end = start;
+        int width = 0;
+        int height = 0;
+        bool ok = false;
+        std::vector<FilterInfo> filters;
+        if (tokens.size() < 2) {
+            error = "Request must contain input and output";
+        } else if (ParseRequestFilters(tokens, filters, error)) {
+            // Исключение в одном запросе, например нехватка памяти, становится ответом ERROR и не останавливает
+            // сервер. Буферы могли остаться в промежуточном состоянии, следующий запрос начинается с пустых
+            try {
+                ok = Process(tokens[0], tokens[1], inline_bytes, PlanPipeline(filters), buffers, read_end,
+                             filters_end, width, height, error);
+            } catch (const std::exception& e) {
+                ok = false;
+                error = e.what();
+                buffers = WorkerBuffers();
+            }
+        }
+        const Clock::time_point end = Clock::now();
+        const double total_ms = Milliseconds(start, end) + queue_ms;
+        m_stats_.Record(total_ms, ok);
+
+        std::ostringstream response;
+        if (ok) {
+            response << std::fixed << std::setprecision(3) << "OK total=" << total_ms << " queue=" << queue_ms
+                     << " read=" << Milliseconds(start, read_end) << " filters=" << Milliseconds(read_end, filters_end)
+                     << " write=" << Milliseconds(filters_end, end) << " size=" << width << "x" << height;
+        } else {
+            response << "ERROR " << error;
+        }
+        if (!m_options_.quiet) {
+            std::lock_guard<std::mutex> lock(m_log_mutex_);
+            std::cout << (tokens[0][0] == '@' ? "<inline>" : tokens[0]) << " -> "
+                      << (tokens.size() > 1 ? tokens[1] : "?") << ": " << response.str() << std::endl;
+        }
+        return stream.WriteLine(response.str());
+    }
+
+    bool Process(const std::string& input, const std::string& output, std::string& inline_bytes,
+                 const std::vector<PipelineStage>& plan, WorkerBuffers& buffers, Clock::time_point& read_end,
+                 Clock::time_point& filters_end, int& width, int& height, std::string& error) {
+        const bool u8 = m_options_.storage == Storage::U8;
+        // Во float читается только область интереса плана
+        const ImageRegion region =
+            m_options_.storage == Storage::Interleaved ? InputRegion(plan) : ImageRegion{};
+        bool loaded;
+        if (!inline_bytes.empty()) {
+            MemoryBuffer memory(inline_bytes.data(), inline_bytes.size());
+            std::istream in(&memory);
+            loaded = u8 ? buffers.image_u8.Load(in, error) : buffers.image.Load(in, region.width, region.height, error);
+        } else {
+            loaded = u8 ? buffers.image_u8.Load(input.c_str(), error)
+                        : buffers.image.Load(input.c_str(), region.width, region.height, error);
+        }
+        if (!loaded) {
+            return false;
+        }
+        read_end = Clock::now();
+
+        if (m_options_.storage == Storage::Planar) {
+            PlanarImage planar(buffers.image);
+            ExecutePipeline(planar, plan);
+            buffers.image = planar.ToImage();
+        } else if (u8) {
+            ExecutePipeline(buffers.image_u8, plan);
+        } else {
+            ExecutePipeline(buffers.image, plan);
+        }
+        filters_end = Clock::now();
+
+        width = u8 ? buffers.image_u8.Width() : buffers.image.Width();
+        height = u8 ? buffers.image_u8.Height() : buffers.image.Height();
+        return u8 ? buffers.image_u8.Save(output.c_str(), error) : buffers.image.Save(output.c_str(), error);
+    }
+
+    ServerOptions m_options_;
+    int m_listener_ = -1;
+    std::atomic<bool> m_stopping_{false};
+    BoundedQueue<PendingConnection> m_connections_;
+    LatencyStats m_stats_;
+    std::mutex m_log_mutex_;
+};
+
+}  // namespace
+
+bool RunServer(const ServerOptions& options) {
+    Server server(options);
+    return server.Run();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "pipeline.h"
+
+// Режим демона (--serve): процесс держит пул потоков и буферы изображений между запросами и принимает
+// запросы через локальный сокет. Запрос - строка вида
+//     <input> <output> [-filter1 param1 ...] [-filter2 ...]
+// с фильтрами в том же синтаксисе, что и в командной строке. Вместо входного файла можно передать
+// его содержимое: input вида @N означает, что сразу за строкой запроса идут N байт файла BMP.
+// Ответ - одна строка:
+//     OK total=<ms> queue=<ms> read=<ms> filters=<ms> write=<ms> size=<width>x<height>
+//     ERROR <причина>
+//     BUSY                  очередь соединений заполнена, запрос не принят
+// По одному соединению можно отправить несколько запросов подряд. Служебные запросы: STATS возвращает
+// строку со статистикой задержек, SHUTDOWN завершает сервер после обработки принятых соединений
+
+struct ServerOptions {
+    std::string socket_path;
+    // Сколько соединений обслуживается одновременно; фильтры внутри запроса используют общий пул потоков
+    int workers = 4;
+    // Сколько принятых соединений может ждать свободного обработчика, остальные получают BUSY
+    size_t queue = 64;
+    Storage storage = Storage::Interleaved;
+    bool quiet = false;
+};
+
+// Работает до SHUTDOWN или сигнала SIGINT/SIGTERM, затем печатает статистику. false, если не удалось
+// открыть сокет
+bool RunServer(const ServerOptions& options);
@@ -0,0 +1,222 @@
+#include "simd.h"
+
+#include "simd_impl.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IMAGE_PROCESSOR_X86_DISPATCH 1
+// Реализация в simd_avx2.cpp, который собирается с -mavx2
+const SimdKernels& GetAvx2Kernels();
+#endif
+
+namespace {
+
+SimdLevel g_max_level = SimdLevel::Avx2;
+
+struct ScalarVec {
+    using Reg = float;
+    static constexpr int kWidth = 1;
+    static Reg Load(const float* p) {
+        return *p;
+    }
+    static void Store(float* p, Reg v) {
+        *p = v;
+    }
+    static Reg Set(float v) {
+        return v;
+    }
+    static Reg Add(Reg a, Reg b) {
+        return a + b;
+    }
+    static Reg Sub(Reg a, Reg b) {
+        return a - b;
+    }
+    static Reg Mul(Reg a, Reg b) {
+        return a * b;
+    }
+    static Reg Div(Reg a, Reg b) {
+        return a / b;
+    }
+    static Reg Min(Reg a, Reg b) {
+        return b < a ? b : a;
+    }
+    static Reg Max(Reg a, Reg b) {
+        return a < b ? b : a;
+    }
+    static bool Greater(Reg a, Reg b) {
+        return a > b;
+    }
+    static Reg Select(bool mask, Reg v) {
+        return mask ? v : 0.0f;
+    }
+    static Reg Floor(Reg v) {
+        return static_cast<float>(static_cast<int>(v));
+    }
+    static Reg Gather(const float* base, Reg index) {
+        return base[static_cast<int>(index)];
+    }
+};
+
+#if defined(__SSE2__)
+struct Sse2Vec {
+    using Reg = __m128;
+    static constexpr int kWidth = 4;
+    static Reg Load(const float* p) {
+        return _mm_loadu_ps(p);
+    }
+    static void Store(float* p, Reg v) {
+        _mm_storeu_ps(p, v);
+    }
+    static Reg Set(float v) {
+        return _mm_set1_ps(v);
+    }
+    static Reg Add(Reg a, Reg b) {
+        return _mm_add_ps(a, b);
+    }
+    static Reg Sub(Reg a, Reg b) {
+        return _mm_sub_ps(a, b);
+    }
+    static Reg Mul(Reg a, Reg b) {
+        return _mm_mul_ps(a, b);
+    }
+    static Reg Div(Reg a, Reg b) {
+        return _mm_div_ps(a, b);
+    }
+    static Reg Min(Reg a, Reg b) {
+        return _mm_min_ps(a, b);
+    }
+    static Reg Max(Reg a, Reg b) {
+        return _mm_max_ps(a, b);
+    }
+    static Reg Greater(Reg a, Reg b) {
+        return _mm_cmpgt_ps(a, b);
+    }
+    static Reg Select(Reg mask, Reg v) {
+        return _mm_and_ps(mask, v);
+    }
+    static Reg Floor(Reg v) {
+        return _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    }
+    // В SSE2 нет выборки по индексам: элементы читаются по одному
+    static Reg Gather(const float* base, Reg index) {
+        alignas(16) int i[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(i), _mm_cvttps_epi32(index));
+        return _mm_setr_ps(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+    }
+};
+
+// Веса свёртки парами (kernel[k], kernel[k + 1]) в каждом 32-битном элементе для _mm_madd_epi16. У нечётного
+// числа весов последняя пара дополнена нулём
+struct WeightPairs {
+    WeightPairs(const int* kernel, int taps) {
+        for (int k = 0; k < taps; k += 2) {
+            const int next = k + 1 < taps ? kernel[k + 1] : 0;
+            pairs[k / 2] = _mm_set1_epi32(static_cast<int>((static_cast<unsigned int>(next) << 16) | kernel[k]));
+        }
+    }
+
+    __m128i pairs[kMaxGaussianRadius + 1];
+};
+
+// Горизонтальная свёртка байтов: соседние по ядру значения чередуются побайтно и перемножаются с парой весов
+// одной инструкцией madd, суммы точные, как в скалярной версии
+void ConvolveRowU8Sse2(const unsigned char* src, int step, const int* kernel, int taps, uint16_t* dst, int count) {
+    const WeightPairs weights(kernel, taps);
+    const unsigned char* first = src - (taps / 2) * step;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (kFixedKernelShift - 9));
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i sign = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i sum[4] = {round, round, round, round};
+        for (int k = 0; k < taps; k += 2) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i + k * step));
+            const __m128i b = k + 1 < taps
+                                  ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i + (k + 1) * step))
+                                  : zero;
+            const __m128i pair = weights.pairs[k / 2];
+            const __m128i lo = _mm_unpacklo_epi8(a, b);
+            const __m128i hi = _mm_unpackhi_epi8(a, b);
+            sum[0] = _mm_add_epi32(sum[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), pair));
+            sum[1] = _mm_add_epi32(sum[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), pair));
+            sum[2] = _mm_add_epi32(sum[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), pair));
+            sum[3] = _mm_add_epi32(sum[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), pair));
+        }
+        // В SSE2 нет беззнаковой упаковки 32 -> 16 бит: значения до 65280 сдвигаются в знаковый диапазон и обратно
+        for (int half = 0; half < 2; ++half) {
+            const __m128i low = _mm_sub_epi32(_mm_srli_epi32(sum[2 * half], kFixedKernelShift - 8), bias);
+            const __m128i high = _mm_sub_epi32(_mm_srli_epi32(sum[2 * half + 1], kFixedKernelShift - 8), bias);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8 * half),
+                             _mm_xor_si128(_mm_packs_epi32(low, high), sign));
+        }
+    }
+    SimdImpl<Sse2Vec>::ConvolveRowU8(src + i, step, kernel, taps, dst + i, count - i);
+}
+
+// Вертикальная свёртка значений uint16_t: madd перемножает знаковые числа, поэтому значения сдвигаются
+// на -32768, а 32768 * сумма весов возвращается в конце. Суммы точные
+void ConvolveRowsU16Sse2(const uint16_t* const* rows, const int* kernel, int taps, unsigned char* dst, int count) {
+    const WeightPairs weights(kernel, taps);
+    int total = 0;
+    for (int k = 0; k < taps; ++k) {
+        total += kernel[k];
+    }
+    const __m128i bias = _mm_set1_epi32(total << 15);
+    const __m128i sign = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i low = bias;
+        __m128i high = bias;
+        for (int k = 0; k < taps; k += 2) {
+            const uint16_t* next = k + 1 < taps ? rows[k + 1] : rows[k];
+            const __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i)), sign);
+            const __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(next + i)), sign);
+            low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights.pairs[k / 2]));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights.pairs[k / 2]));
+        }
+        const int shift = kFixedKernelShift + 8;
+        const __m128i words = _mm_packs_epi32(_mm_srli_epi32(low, shift), _mm_srli_epi32(high, shift));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(words, words));
+    }
+    SimdImpl<Sse2Vec>::ConvolveRowsU16(rows, kernel, taps, dst, i, count);
+}
+
+SimdKernels Sse2Kernels() {
+    SimdKernels kernels = SimdImpl<Sse2Vec>::Table("sse2");
+    kernels.convolve_row_u8 = ConvolveRowU8Sse2;
+    kernels.convolve_rows_u16 = ConvolveRowsU16Sse2;
+    return kernels;
+}
+#endif
+
+const SimdKernels& SelectKernels() {
+    static const SimdKernels scalar = SimdImpl<ScalarVec>::Table("scalar");
+#if defined(IMAGE_PROCESSOR_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (g_max_level >= SimdLevel::Avx2 && __builtin_cpu_supports("avx2")) {
+        return GetAvx2Kernels();
+    }
+#endif
+#if defined(__SSE2__)
+    static const SimdKernels sse2 = Sse2Kernels();
+    if (g_max_level >= SimdLevel::Sse2) {
+        return sse2;
+    }
+#endif
+    return scalar;
+}
+
+}  // namespace
+
+void SetMaxSimdLevel(SimdLevel level) {
+    g_max_level = level;
+}
+
+const SimdKernels& GetSimdKernels() {
+    static const SimdKernels& kernels = SelectKernels();
+    return kernels;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+// Таблица цветов для lut1d и lut3d: узлы по 3 float (r, g, b). Значение канала c переводится в координату
+// узла x = (v - offset[c]) * scale[c] и ограничивается отрезком [0, size - 1], NaN даёт 0
+struct LutView {
+    const float* table;
+    int size;
+    float offset[3];
+    float scale[3];
+};
+
+// Коэффициенты яркости (0.299, 0.587, 0.114) для 8-битных каналов в фиксированной точке 0.16, сумма ровно 65536.
+// Яркость пикселя BGR с 16 дробными битами: L = kGrayBlueFixed * b + kGrayGreenFixed * g + kGrayRedFixed * r
+const int kGrayRedFixed = 19595;
+const int kGrayGreenFixed = 38470;
+const int kGrayBlueFixed = 7471;
+
+// Векторные примитивы для фильтров. Реализация выбирается один раз во время выполнения по возможностям
+// процессора: AVX2, SSE2 или скалярная. Все реализации выполняют одни и те же операции в одном порядке
+// и без FMA, поэтому результаты совпадают побитово.
+struct SimdKernels {
+    const char* name;
+    // dst[i] += weight * src[i]
+    void (*axpy)(float* dst, const float* src, float weight, int count);
+    // dst[i] = weight * src[i]
+    void (*scale)(float* dst, const float* src, float weight, int count);
+    // data[i] /= divisor
+    void (*divide)(float* data, float divisor, int count);
+    // data[i] = 1 - data[i]
+    void (*negative)(float* data, int count);
+    // r[i] = g[i] = b[i] = 0.299 * r[i] + 0.587 * g[i] + 0.114 * b[i]
+    void (*grayscale)(float* r, float* g, float* b, int count);
+    // Свёртка 3x3: dst[i] = сумма weights[3 * row + col] * rows[row][i + col - 1] по ненулевым весам,
+    // слагаемые идут по строкам ядра или, при column_major, по столбцам. При clamp результат
+    // ограничивается отрезком [0, 1]
+    void (*stencil3x3)(const float* const* rows, const float* weights, float* dst, int count, bool column_major,
+                       bool clamp);
+    // dst[i] = src[i] > threshold ? 1 : 0
+    void (*threshold)(const float* src, float* dst, float threshold, int count);
+    // Одномерная таблица: каждый канал - своя кривая из size узлов с линейной интерполяцией
+    void (*lut1d)(float* r, float* g, float* b, int count, const LutView& lut);
+    // Трёхмерная таблица size^3 узлов (r меняется быстрее всего) с тетраэдральной интерполяцией.
+    // Узлы читаются выборкой по индексам (gather), индексы узлов должны быть меньше 2^24
+    void (*lut3d)(float* r, float* g, float* b, int count, const LutView& lut);
+
+    // Целочисленные примитивы 8-битного представления (ImageU8): строки BGR по байту на канал и промежуточные
+    // значения uint16_t с 8 дробными битами. Веса свёрток - целые с суммой kFixedKernelOne, ядро не длиннее
+    // гауссова: taps <= 2 * kMaxGaussianRadius + 1 (blur.h)
+    // Яркость на месте: все три канала каждого из width пикселей получают L >> 16
+    void (*grayscale_bgr8)(unsigned char* row, int width);
+    // dst[x] = (L + 128) >> 8: яркость с 8 дробными битами
+    void (*luma_bgr8)(const unsigned char* src, uint16_t* dst, int width);
+    // dst[i] = (сумма kernel[k] * src[i + (k - taps / 2) * step] + 32) >> 6 для count значений, соседи в пределах
+    // taps / 2 шагов должны быть доступны
+    void (*convolve_row_u8)(const unsigned char* src, int step, const int* kernel, int taps, uint16_t* dst,
+                            int count);
+    // dst[i] = сумма kernel[k] * rows[k][i], сдвинутая на 8 дробных бит и kFixedKernelShift бит весов
+    void (*convolve_rows_u16)(const uint16_t* const* rows, const int* kernel, int taps, unsigned char* dst,
+                              int count);
+    // Порог -edge для count пикселей над яркостью с 8 дробными битами: отклик 4 * mid[x] минус восемь соседей
+    // из up, mid и down (индексы x - 1..x + 1 должны быть доступны) сравнивается с limit, и три канала пикселя x
+    // в dst получают 255, если отклик больше, иначе 0
+    void (*edge_threshold_u16)(const uint16_t* up, const uint16_t* mid, const uint16_t* down, int32_t limit,
+                               unsigned char* dst, int count);
+};
+
+enum class SimdLevel { Scalar, Sse2, Avx2 };
+
+// Ограничивает выбор реализации сверху (например, для сравнения результатов). Вызывать до GetSimdKernels
+void SetMaxSimdLevel(SimdLevel level);
+
+const SimdKernels& GetSimdKernels();
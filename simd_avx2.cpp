@@ -0,0 +1,226 @@
+// Единица трансляции собирается с -mavx2. Код отсюда вызывается только после проверки процессора в simd.cpp
+#include "simd.h"
+
+#include "simd_impl.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+#if !defined(__AVX2__)
+#error "simd_avx2.cpp must be compiled with AVX2 enabled"
+#endif
+
+namespace {
+
+struct Avx2Vec {
+    using Reg = __m256;
+    static constexpr int kWidth = 8;
+    static Reg Load(const float* p) {
+        return _mm256_loadu_ps(p);
+    }
+    static void Store(float* p, Reg v) {
+        _mm256_storeu_ps(p, v);
+    }
+    static Reg Set(float v) {
+        return _mm256_set1_ps(v);
+    }
+    static Reg Add(Reg a, Reg b) {
+        return _mm256_add_ps(a, b);
+    }
+    static Reg Sub(Reg a, Reg b) {
+        return _mm256_sub_ps(a, b);
+    }
+    static Reg Mul(Reg a, Reg b) {
+        return _mm256_mul_ps(a, b);
+    }
+    static Reg Div(Reg a, Reg b) {
+        return _mm256_div_ps(a, b);
+    }
+    static Reg Min(Reg a, Reg b) {
+        return _mm256_min_ps(a, b);
+    }
+    static Reg Max(Reg a, Reg b) {
+        return _mm256_max_ps(a, b);
+    }
+    static Reg Greater(Reg a, Reg b) {
+        return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+    }
+    static Reg Select(Reg mask, Reg v) {
+        return _mm256_and_ps(mask, v);
+    }
+    static Reg Floor(Reg v) {
+        return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(v));
+    }
+    static Reg Gather(const float* base, Reg index) {
+        return _mm256_i32gather_ps(base, _mm256_cvttps_epi32(index), 4);
+    }
+};
+
+using Avx2Impl = SimdImpl<Avx2Vec>;
+
+// Маски _mm_shuffle_epi8 для 4 пикселей BGR (12 байт): пары (b, g) и (r, g) в 16-битных элементах.
+// Вес g делится поровну между парами, чтобы оба веса пары помещались в int16 для madd
+const __m128i kBlueGreen = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1, 6, -1, 7, -1, 9, -1, 10, -1);
+const __m128i kRedGreen = _mm_setr_epi8(2, -1, 1, -1, 5, -1, 4, -1, 8, -1, 7, -1, 11, -1, 10, -1);
+
+__m128i WeightPair(int first, int second) {
+    return _mm_set1_epi32(static_cast<int>((static_cast<unsigned int>(second) << 16) | first));
+}
+
+// Яркость L четырёх пикселей, начиная с p; читает 16 байт
+__m128i Luma4(const unsigned char* p) {
+    const __m128i blue_green = WeightPair(kGrayBlueFixed, kGrayGreenFixed / 2);
+    const __m128i red_green = WeightPair(kGrayRedFixed, kGrayGreenFixed / 2);
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    return _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(bytes, kBlueGreen), blue_green),
+                         _mm_madd_epi16(_mm_shuffle_epi8(bytes, kRedGreen), red_green));
+}
+
+// 16 байт значений пикселей - в 48 байт BGR, каждое значение во все три канала
+void StoreTriples(unsigned char* dst, __m128i values) {
+    const __m128i first = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i second = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i third = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(values, first));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_shuffle_epi8(values, second));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), _mm_shuffle_epi8(values, third));
+}
+
+// По 16 пикселей: последняя загрузка заходит на 4 байта за 48 байт группы, поэтому за группой должно
+// оставаться ещё 2 пикселя. Все загрузки группы идут до записи, так что строка обрабатывается на месте
+const int kLumaGroup = 16;
+const int kLumaReadAhead = 2;
+
+void GrayscaleBgr8Avx2(unsigned char* row, int width) {
+    int x = 0;
+    for (; x + kLumaGroup + kLumaReadAhead <= width; x += kLumaGroup) {
+        unsigned char* p = row + 3 * x;
+        const __m128i low = _mm_packs_epi32(_mm_srli_epi32(Luma4(p), 16), _mm_srli_epi32(Luma4(p + 12), 16));
+        const __m128i high = _mm_packs_epi32(_mm_srli_epi32(Luma4(p + 24), 16), _mm_srli_epi32(Luma4(p + 36), 16));
+        StoreTriples(p, _mm_packus_epi16(low, high));
+    }
+    Avx2Impl::GrayscaleBgr8(row + 3 * x, width - x);
+}
+
+void LumaBgr8Avx2(const unsigned char* src, uint16_t* dst, int width) {
+    const __m128i round = _mm_set1_epi32(128);
+    auto luma = [&](const unsigned char* p) { return _mm_srli_epi32(_mm_add_epi32(Luma4(p), round), 8); };
+    int x = 0;
+    for (; x + kLumaGroup + kLumaReadAhead <= width; x += kLumaGroup) {
+        const unsigned char* p = src + 3 * x;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi32(luma(p), luma(p + 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 8), _mm_packus_epi32(luma(p + 24), luma(p + 36)));
+    }
+    Avx2Impl::LumaBgr8(src + 3 * x, dst + x, width - x);
+}
+
+// Веса свёртки парами для _mm256_madd_epi16, как WeightPairs в simd.cpp
+struct WeightPairs {
+    WeightPairs(const int* kernel, int taps) {
+        for (int k = 0; k < taps; k += 2) {
+            pairs[k / 2] = _mm256_set1_epi32(static_cast<int>(
+                (static_cast<unsigned int>(k + 1 < taps ? kernel[k + 1] : 0) << 16) | kernel[k]));
+        }
+    }
+
+    __m256i pairs[kMaxGaussianRadius + 1];
+};
+
+void ConvolveRowU8Avx2(const unsigned char* src, int step, const int* kernel, int taps, uint16_t* dst, int count) {
+    const WeightPairs weights(kernel, taps);
+    const unsigned char* first = src - (taps / 2) * step;
+    const __m256i round = _mm256_set1_epi32(1 << (kFixedKernelShift - 9));
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i low = round;
+        __m256i high = round;
+        for (int k = 0; k < taps; k += 2) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i + k * step));
+            const __m128i b = k + 1 < taps
+                                  ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i + (k + 1) * step))
+                                  : _mm_setzero_si128();
+            const __m256i pair = weights.pairs[k / 2];
+            low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(a, b)), pair));
+            high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(a, b)), pair));
+        }
+        const int shift = kFixedKernelShift - 8;
+        // packus работает внутри 128-битных половин, перестановка возвращает значения по порядку
+        const __m256i words = _mm256_packus_epi32(_mm256_srli_epi32(low, shift), _mm256_srli_epi32(high, shift));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute4x64_epi64(words, 0xD8));
+    }
+    Avx2Impl::ConvolveRowU8(src + i, step, kernel, taps, dst + i, count - i);
+}
+
+// Значения сдвигаются на -32768 для знакового madd, как в ConvolveRowsU16Sse2
+void ConvolveRowsU16Avx2(const uint16_t* const* rows, const int* kernel, int taps, unsigned char* dst, int count) {
+    const WeightPairs weights(kernel, taps);
+    int total = 0;
+    for (int k = 0; k < taps; ++k) {
+        total += kernel[k];
+    }
+    const __m256i bias = _mm256_set1_epi32(total << 15);
+    const __m256i sign = _mm256_set1_epi16(static_cast<int16_t>(0x8000));
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i low = bias;
+        __m256i high = bias;
+        for (int k = 0; k < taps; k += 2) {
+            const uint16_t* next = k + 1 < taps ? rows[k + 1] : rows[k];
+            const __m256i a =
+                _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[k] + i)), sign);
+            const __m256i b = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(next + i)), sign);
+            low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights.pairs[k / 2]));
+            high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights.pairs[k / 2]));
+        }
+        const int shift = kFixedKernelShift + 8;
+        // unpack и packs работают внутри 128-битных половин и взаимно обратны: слова идут по порядку
+        const __m256i words = _mm256_packs_epi32(_mm256_srli_epi32(low, shift), _mm256_srli_epi32(high, shift));
+        const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(bytes));
+    }
+    Avx2Impl::ConvolveRowsU16(rows, kernel, taps, dst, i, count);
+}
+
+void EdgeThresholdU16Avx2(const uint16_t* up, const uint16_t* mid, const uint16_t* down, int32_t limit,
+                          unsigned char* dst, int count) {
+    const __m256i level = _mm256_set1_epi32(limit);
+    // Маска порога для 8 пикселей, начиная с x
+    auto mask = [&](int x) {
+        auto load = [](const uint16_t* p) {
+            return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        };
+        const __m256i center = load(mid + x);
+        __m256i neighbors = _mm256_add_epi32(load(mid + x - 1), load(mid + x + 1));
+        for (const uint16_t* row : {up, down}) {
+            neighbors = _mm256_add_epi32(neighbors, load(row + x - 1));
+            neighbors = _mm256_add_epi32(neighbors, load(row + x));
+            neighbors = _mm256_add_epi32(neighbors, load(row + x + 1));
+        }
+        return _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_slli_epi32(center, 2), neighbors), level);
+    };
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(mask(x), mask(x + 8)), 0xD8);
+        const __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        StoreTriples(dst + 3 * x, bytes);
+    }
+    Avx2Impl::EdgeThresholdU16(up + x, mid + x, down + x, limit, dst + 3 * x, count - x);
+}
+
+}  // namespace
+
+const SimdKernels& GetAvx2Kernels() {
+    static const SimdKernels kernels = [] {
+        SimdKernels table = Avx2Impl::Table("avx2");
+        table.grayscale_bgr8 = GrayscaleBgr8Avx2;
+        table.luma_bgr8 = LumaBgr8Avx2;
+        table.convolve_row_u8 = ConvolveRowU8Avx2;
+        table.convolve_rows_u16 = ConvolveRowsU16Avx2;
+        table.edge_threshold_u16 = EdgeThresholdU16Avx2;
+        return table;
+    }();
+    return kernels;
+}
+
+#endif
@@ -0,0 +1,321 @@
+#pragma once
+
+// Общая реализация векторных примитивов. V описывает набор инструкций: тип регистра, ширину и операции.
+// Файл подключается в единицах трансляции, собранных с разными флагами процессора; экземпляры шаблона
+// для разных V не пересекаются, поэтому компоновщик их не смешивает.
+// Кроме арифметики V умеет Floor для неотрицательных значений и Gather(base, index): base[index] по каждому
+// элементу, индексы - целые числа во float.
+
+#include <algorithm>
+
+#include "blur.h"
+#include "simd.h"
+
+template <class V>
+struct SimdImpl {
+    using Reg = typename V::Reg;
+
+    static void Axpy(float* dst, const float* src, float weight, int count) {
+        const Reg w = V::Set(weight);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            V::Store(dst + i, V::Add(V::Load(dst + i), V::Mul(w, V::Load(src + i))));
+        }
+        for (; i < count; ++i) {
+            dst[i] += weight * src[i];
+        }
+    }
+
+    static void Scale(float* dst, const float* src, float weight, int count) {
+        const Reg w = V::Set(weight);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            V::Store(dst + i, V::Mul(w, V::Load(src + i)));
+        }
+        for (; i < count; ++i) {
+            dst[i] = weight * src[i];
+        }
+    }
+
+    static void Divide(float* data, float divisor, int count) {
+        const Reg d = V::Set(divisor);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            V::Store(data + i, V::Div(V::Load(data + i), d));
+        }
+        for (; i < count; ++i) {
+            data[i] /= divisor;
+        }
+    }
+
+    static void Negative(float* data, int count) {
+        const Reg one = V::Set(1.0f);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            V::Store(data + i, V::Sub(one, V::Load(data + i)));
+        }
+        for (; i < count; ++i) {
+            data[i] = 1.0f - data[i];
+        }
+    }
+
+    static void Grayscale(float* r, float* g, float* b, int count) {
+        const float red = 0.299f;
+        const float green = 0.587f;
+        const float blue = 0.114f;
+        const Reg vr = V::Set(red);
+        const Reg vg = V::Set(green);
+        const Reg vb = V::Set(blue);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            const Reg gray =
+                V::Add(V::Add(V::Mul(vr, V::Load(r + i)), V::Mul(vg, V::Load(g + i))), V::Mul(vb, V::Load(b + i)));
+            V::Store(r + i, gray);
+            V::Store(g + i, gray);
+            V::Store(b + i, gray);
+        }
+        for (; i < count; ++i) {
+            const float gray = red * r[i] + green * g[i] + blue * b[i];
+            r[i] = gray;
+            g[i] = gray;
+            b[i] = gray;
+        }
+    }
+
+    static void Stencil3x3(const float* const* rows, const float* weights, float* dst, int count, bool column_major,
+                           bool clamp) {
+        // Список ненулевых отводов в нужном порядке: нулевые веса не участвуют в вычислениях
+        const float* tap_src[9];
+        float tap_weight[9];
+        int taps = 0;
+        for (int outer = 0; outer < 3; ++outer) {
+            for (int inner = 0; inner < 3; ++inner) {
+                const int row = column_major ? inner : outer;
+                const int col = column_major ? outer : inner;
+                const float weight = weights[row * 3 + col];
+                if (weight != 0.0f) {
+                    tap_src[taps] = rows[row] + col - 1;
+                    tap_weight[taps] = weight;
+                    ++taps;
+                }
+            }
+        }
+        if (taps == 0) {
+            Scale(dst, rows[1], 0.0f, count);
+            return;
+        }
+
+        const Reg zero = V::Set(0.0f);
+        const Reg one = V::Set(1.0f);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            Reg acc = V::Mul(V::Set(tap_weight[0]), V::Load(tap_src[0] + i));
+            for (int t = 1; t < taps; ++t) {
+                acc = V::Add(acc, V::Mul(V::Set(tap_weight[t]), V::Load(tap_src[t] + i)));
+            }
+            if (clamp) {
+                acc = V::Min(one, V::Max(zero, acc));
+            }
+            V::Store(dst + i, acc);
+        }
+        for (; i < count; ++i) {
+            float acc = tap_weight[0] * tap_src[0][i];
+            for (int t = 1; t < taps; ++t) {
+                acc += tap_weight[t] * tap_src[t][i];
+            }
+            if (clamp) {
+                acc = acc < 0.0f ? 0.0f : acc;
+                acc = acc > 1.0f ? 1.0f : acc;
+            }
+            dst[i] = acc;
+        }
+    }
+
+    static void Threshold(const float* src, float* dst, float threshold, int count) {
+        const Reg t = V::Set(threshold);
+        const Reg one = V::Set(1.0f);
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            V::Store(dst + i, V::Select(V::Greater(V::Load(src + i), t), one));
+        }
+        for (; i < count; ++i) {
+            dst[i] = src[i] > threshold ? 1.0f : 0.0f;
+        }
+    }
+
+    // Таблицы цветов считаются целыми регистрами: хвост копируется в буфер на регистр и дополняется нулями
+    template <class Body>
+    static void LutLoop(float* r, float* g, float* b, int count, Body body) {
+        int i = 0;
+        for (; i + V::kWidth <= count; i += V::kWidth) {
+            body(r + i, g + i, b + i);
+        }
+        if (i < count) {
+            float tail[3][V::kWidth] = {};
+            const int rest = count - i;
+            for (int k = 0; k < rest; ++k) {
+                tail[0][k] = r[i + k];
+                tail[1][k] = g[i + k];
+                tail[2][k] = b[i + k];
+            }
+            body(tail[0], tail[1], tail[2]);
+            for (int k = 0; k < rest; ++k) {
+                r[i + k] = tail[0][k];
+                g[i + k] = tail[1][k];
+                b[i + k] = tail[2][k];
+            }
+        }
+    }
+
+    // Координата узла по значению канала c. Select вместо Max, чтобы NaN тоже давал 0
+    static Reg LutCoordinate(Reg v, int c, const LutView& lut) {
+        const Reg x = V::Mul(V::Sub(v, V::Set(lut.offset[c])), V::Set(lut.scale[c]));
+        return V::Min(V::Select(V::Greater(x, V::Set(0.0f)), x), V::Set(static_cast<float>(lut.size - 1)));
+    }
+
+    static void Lut1d(float* r, float* g, float* b, int count, const LutView& lut) {
+        const Reg one = V::Set(1.0f);
+        const Reg below_last = V::Set(static_cast<float>(lut.size - 2));
+        const Reg three = V::Set(3.0f);
+        LutLoop(r, g, b, count, [&](float* pr, float* pg, float* pb) {
+            float* channels[3] = {pr, pg, pb};
+            for (int c = 0; c < 3; ++c) {
+                const Reg x = LutCoordinate(V::Load(channels[c]), c, lut);
+                const Reg node = V::Min(V::Floor(x), below_last);
+                const Reg f = V::Sub(x, node);
+                const Reg index = V::Mul(node, three);
+                const Reg low = V::Gather(lut.table + c, index);
+                const Reg high = V::Gather(lut.table + c, V::Add(index, three));
+                V::Store(channels[c], V::Add(V::Mul(V::Sub(one, f), low), V::Mul(f, high)));
+            }
+        });
+    }
+
+    // Тетраэдральная интерполяция: куб между узлами делится на 6 тетраэдров вдоль диагонали (0, 0, 0) - (1, 1, 1).
+    // Путь по тетраэдру идёт от базового узла вдоль оси с наибольшей дробной частью, затем со средней.
+    // Выбор тетраэдра без ветвлений: признаки сравнений дробных частей - числа 0 и 1, из них складываются
+    // веса и смещения узлов, все промежуточные значения точные
+    static void Lut3d(float* r, float* g, float* b, int count, const LutView& lut) {
+        const Reg one = V::Set(1.0f);
+        const Reg below_last = V::Set(static_cast<float>(lut.size - 2));
+        const float size = static_cast<float>(lut.size);
+        const Reg step_r = V::Set(3.0f);
+        const Reg step_g = V::Set(3.0f * size);
+        const Reg step_b = V::Set(3.0f * size * size);
+        const Reg diagonal = V::Add(V::Add(step_r, step_g), step_b);
+        LutLoop(r, g, b, count, [&](float* pr, float* pg, float* pb) {
+            const Reg x = LutCoordinate(V::Load(pr), 0, lut);
+            const Reg y = LutCoordinate(V::Load(pg), 1, lut);
+            const Reg z = LutCoordinate(V::Load(pb), 2, lut);
+            const Reg xi = V::Min(V::Floor(x), below_last);
+            const Reg yi = V::Min(V::Floor(y), below_last);
+            const Reg zi = V::Min(V::Floor(z), below_last);
+            const Reg fx = V::Sub(x, xi);
+            const Reg fy = V::Sub(y, yi);
+            const Reg fz = V::Sub(z, zi);
+
+            const Reg xy = V::Select(V::Greater(fx, fy), one);
+            const Reg yz = V::Select(V::Greater(fy, fz), one);
+            const Reg xz = V::Select(V::Greater(fx, fz), one);
+            // Какая ось наибольшая (max_*) и наименьшая (min_*), остальная - средняя (mid_*)
+            const Reg max_r = V::Mul(xy, xz);
+            const Reg max_g = V::Mul(V::Sub(one, xy), yz);
+            const Reg max_b = V::Sub(V::Sub(one, max_r), max_g);
+            const Reg min_r = V::Mul(V::Sub(one, xy), V::Sub(one, xz));
+            const Reg min_b = V::Mul(yz, xz);
+            const Reg min_g = V::Sub(V::Sub(one, min_r), min_b);
+            const Reg mid_r = V::Sub(V::Sub(one, max_r), min_r);
+            const Reg mid_g = V::Sub(V::Sub(one, max_g), min_g);
+            const Reg mid_b = V::Sub(V::Sub(one, max_b), min_b);
+            auto pick = [](Reg wr, Reg wg, Reg wb, Reg vr, Reg vg, Reg vb) {
+                return V::Add(V::Add(V::Mul(wr, vr), V::Mul(wg, vg)), V::Mul(wb, vb));
+            };
+            const Reg high = pick(max_r, max_g, max_b, fx, fy, fz);
+            const Reg middle = pick(mid_r, mid_g, mid_b, fx, fy, fz);
+            const Reg low = pick(min_r, min_g, min_b, fx, fy, fz);
+            const Reg w0 = V::Sub(one, high);
+            const Reg w1 = V::Sub(high, middle);
+            const Reg w2 = V::Sub(middle, low);
+
+            const Reg base = V::Add(V::Add(V::Mul(xi, step_r), V::Mul(yi, step_g)), V::Mul(zi, step_b));
+            const Reg first = V::Add(base, pick(max_r, max_g, max_b, step_r, step_g, step_b));
+            const Reg last = V::Add(base, diagonal);
+            const Reg second = V::Sub(last, pick(min_r, min_g, min_b, step_r, step_g, step_b));
+            float* channels[3] = {pr, pg, pb};
+            for (int c = 0; c < 3; ++c) {
+                const float* table = lut.table + c;
+                const Reg near = V::Add(V::Mul(w0, V::Gather(table, base)), V::Mul(w1, V::Gather(table, first)));
+                const Reg far = V::Add(V::Mul(w2, V::Gather(table, second)), V::Mul(low, V::Gather(table, last)));
+                V::Store(channels[c], V::Add(near, far));
+            }
+        });
+    }
+
+    // Целочисленные примитивы 8-битного представления здесь скалярные. Векторные версии в simd.cpp
+    // и simd_avx2.cpp считают ими остаток строки
+    static int Luma(const unsigned char* pixel) {
+        return kGrayBlueFixed * pixel[0] + kGrayGreenFixed * pixel[1] + kGrayRedFixed * pixel[2];
+    }
+
+    static void GrayscaleBgr8(unsigned char* row, int width) {
+        for (int x = 0; x < width; ++x) {
+            const unsigned char gray = static_cast<unsigned char>(Luma(row + 3 * x) >> 16);
+            row[3 * x] = gray;
+            row[3 * x + 1] = gray;
+            row[3 * x + 2] = gray;
+        }
+    }
+
+    static void LumaBgr8(const unsigned char* src, uint16_t* dst, int width) {
+        for (int x = 0; x < width; ++x) {
+            dst[x] = static_cast<uint16_t>((Luma(src + 3 * x) + 128) >> 8);
+        }
+    }
+
+    static void ConvolveRowU8(const unsigned char* src, int step, const int* kernel, int taps, uint16_t* dst,
+                              int count) {
+        const int shift = kFixedKernelShift - 8;
+        const unsigned char* first = src - (taps / 2) * step;
+        for (int i = 0; i < count; ++i) {
+            int32_t sum = 1 << (shift - 1);
+            for (int k = 0; k < taps; ++k) {
+                sum += kernel[k] * first[i + k * step];
+            }
+            dst[i] = static_cast<uint16_t>(sum >> shift);
+        }
+    }
+
+    static void ConvolveRowsU16(const uint16_t* const* rows, const int* kernel, int taps, unsigned char* dst,
+                                int count) {
+        ConvolveRowsU16(rows, kernel, taps, dst, 0, count);
+    }
+
+    // Значения [begin, end) строк
+    static void ConvolveRowsU16(const uint16_t* const* rows, const int* kernel, int taps, unsigned char* dst,
+                                int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            uint32_t sum = 0;
+            for (int k = 0; k < taps; ++k) {
+                sum += static_cast<uint32_t>(kernel[k]) * rows[k][i];
+            }
+            dst[i] = static_cast<unsigned char>(std::min<uint32_t>(255, sum >> (kFixedKernelShift + 8)));
+        }
+    }
+
+    static void EdgeThresholdU16(const uint16_t* up, const uint16_t* mid, const uint16_t* down, int32_t limit,
+                                 unsigned char* dst, int count) {
+        for (int x = 0; x < count; ++x) {
+            const int32_t edge = 4 * mid[x] - up[x - 1] - up[x] - up[x + 1] - mid[x - 1] - mid[x + 1] - down[x - 1] -
+                                 down[x] - down[x + 1];
+            const unsigned char value = edge > limit ? 255 : 0;
+            dst[3 * x] = value;
+            dst[3 * x + 1] = value;
+            dst[3 * x + 2] = value;
+        }
+    }
+
+    static SimdKernels Table(const char* name) {
+        return SimdKernels{name, Axpy, Scale, Divide, Negative, Grayscale, Stencil3x3, Threshold, Lut1d, Lut3d,
+                           GrayscaleBgr8, LumaBgr8, ConvolveRowU8, ConvolveRowsU16, EdgeThresholdU16};
+    }
+};
@@ -0,0 +1,139 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+
+#include "thread_pool.h"
+
+namespace {
+
+// Строк в куске, который копит свою статистику. Размер не зависит от числа потоков, поэтому и порядок
+// сложения кусков тоже
+const int kStatsChunkRows = 64;
+
+// Частичная статистика куска строк по одному каналу
+struct PartialStats {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    double sum = 0.0;
+    long long count = 0;
+    std::array<long long, ValueStats::kBins> histogram = {};
+};
+
+int Bin(float value, float low, float scale) {
+    const float position = (value - low) * scale;
+    // NaN и значения ниже отрезка - в первую корзину
+    if (!(position > 0.0f)) {
+        return 0;
+    }
+    return position >= ValueStats::kBins ? ValueStats::kBins - 1 : static_cast<int>(position);
+}
+
+}  // namespace
+
+std::vector<ValueStats> ComputeStats(const StatsRow& row, int height, int width, int step, int channels, float low,
+                                     float high) {
+    const int chunks = (std::max(height, 0) + kStatsChunkRows - 1) / kStatsChunkRows;
+    std::vector<PartialStats> partials(static_cast<size_t>(chunks) * channels);
+    const float scale = high > low ? ValueStats::kBins / (high - low) : 0.0f;
+    ParallelFor(chunks, 1, [&](int begin, int end) {
+        for (int chunk = begin; chunk < end; ++chunk) {
+            PartialStats* partial = &partials[static_cast<size_t>(chunk) * channels];
+            const int last = std::min(height, (chunk + 1) * kStatsChunkRows);
+            for (int y = chunk * kStatsChunkRows; y < last; ++y) {
+                const float* values = row(y);
+                // Каналы пикселя обрабатываются вместе, чтобы строка читалась из памяти один раз.
+                // Сумма строки во float, суммы строк - в double: быстро и без потери точности на больших
+                // изображениях
+                float row_sum[4] = {};
+                for (int x = 0; x < width; ++x) {
+                    const float* pixel = values + static_cast<size_t>(x) * step;
+                    for (int c = 0; c < channels; ++c) {
+                        const float value = pixel[c];
+                        partial[c].min = std::min(partial[c].min, value);
+                        partial[c].max = std::max(partial[c].max, value);
+                        row_sum[c] += value;
+                        ++partial[c].histogram[Bin(value, low, scale)];
+                    }
+                }
+                for (int c = 0; c < channels; ++c) {
+                    partial[c].sum += row_sum[c];
+                    partial[c].count += width;
+                }
+            }
+        }
+    });
+
+    std::vector<ValueStats> stats(channels);
+    for (int c = 0; c < channels; ++c) {
+        ValueStats& result = stats[c];
+        result.low = low;
+        result.high = high;
+        double sum = 0.0;
+        for (int chunk = 0; chunk < chunks; ++chunk) {
+            const PartialStats& partial = partials[static_cast<size_t>(chunk) * channels + c];
+            if (partial.count == 0) {
+                continue;
+            }
+            result.min = result.count == 0 ? partial.min : std::min(result.min, partial.min);
+            result.max = result.count == 0 ? partial.max : std::max(result.max, partial.max);
+            result.count += partial.count;
+            sum += partial.sum;
+            for (int bin = 0; bin < ValueStats::kBins; ++bin) {
+                result.histogram[bin] += partial.histogram[bin];
+            }
+        }
+        result.mean = result.count > 0 ? sum / static_cast<double>(result.count) : 0.0;
+    }
+    return stats;
+}
+
+std::array<ValueStats, 3> ComputeStats(const Image& image) {
+    const std::vector<ValueStats> stats =
+        ComputeStats([&image](int y) { return &image.Row(y)[0].r; }, image.Height(), image.Width(), 3, 3, 0.0f,
+                     1.0f);
+    return {stats[0], stats[1], stats[2]};
+}
+
+float OtsuThreshold(const ValueStats& stats) {
+    double total_sum = 0.0;
+    for (int bin = 0; bin < ValueStats::kBins; ++bin) {
+        total_sum += static_cast<double>(bin) * stats.histogram[bin];
+    }
+    double best = -1.0;
+    int best_bin = 0;
+    long long background = 0;
+    double background_sum = 0.0;
+    for (int bin = 0; bin < ValueStats::kBins; ++bin) {
+        background += stats.histogram[bin];
+        if (background == 0) {
+            continue;
+        }
+        const long long foreground = stats.count - background;
+        if (foreground == 0) {
+            break;
+        }
+        background_sum += static_cast<double>(bin) * stats.histogram[bin];
+        const double difference = background_sum / background - (total_sum - background_sum) / foreground;
+        const double between = static_cast<double>(background) * foreground * difference * difference;
+        if (between > best) {
+            best = between;
+            best_bin = bin;
+        }
+    }
+    return stats.low + static_cast<float>(best_bin + 1) * ((stats.high - stats.low) / ValueStats::kBins);
+}
+
+void PrintStats(const std::array<ValueStats, 3>& stats, std::ostream& out) {
+    const char* names[3] = {"red", "green", "blue"};
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(4);
+    for (int c = 0; c < 3; ++c) {
+        out << "Stats " << names[c] << ": min " << stats[c].min << ", max " << stats[c].max << ", mean "
+            << stats[c].mean << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include "image.h"
+
+// Статистика значений одного канала: минимум, максимум, среднее и гистограмма по отрезку [low, high].
+// Значения за пределами отрезка попадают в крайние корзины
+struct ValueStats {
+    static const int kBins = 256;
+
+    float low = 0.0f;
+    float high = 1.0f;
+    float min = 0.0f;
+    float max = 0.0f;
+    double mean = 0.0;
+    long long count = 0;
+    std::array<long long, kBins> histogram = {};
+};
+
+// Строка значений: значение пикселя x канала c лежит в row(y)[x * step + c]
+using StatsRow = std::function<const float*(int y)>;
+
+// Статистика первых channels (не больше 4) каналов строк 0..height-1 за один параллельный проход. Каждый кусок строк
+// копит свои гистограммы и суммы, куски складываются по порядку, поэтому результат (и среднее до последнего
+// бита) не зависит от числа потоков
+std::vector<ValueStats> ComputeStats(const StatsRow& row, int height, int width, int step, int channels, float low,
+                                     float high);
+
+// Каналы r, g, b изображения, гистограммы по [0, 1]
+std::array<ValueStats, 3> ComputeStats(const Image& image);
+
+// Порог Оцу: граница корзин, которая делит гистограмму на два класса с наибольшей межклассовой дисперсией
+float OtsuThreshold(const ValueStats& stats);
+
+// Печатает статистику каналов в одну строку на канал (для --stats)
+void PrintStats(const std::array<ValueStats, 3>& stats, std::ostream& out);
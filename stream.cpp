@@ -0,0 +1,630 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+#include "blur.h"
+#include "denoise.h"
+#include "resample.h"
+
+namespace {
+
+// Размер блока чтения и записи файла
+const int kIoBlockBytes = 1 << 20;
+
+class PointStage : public RowStage {
+public:
+    PointStage(PointOp op, int width, int height) : RowStage(width, height), m_op_(std::move(op)) {
+    }
+
+    void Push(Color* row) override {
+        m_op_(row, m_width_);
+        m_next_->Push(row);
+    }
+
+private:
+    PointOp m_op_;
+};
+
+class CropStage : public RowStage {
+public:
+    CropStage(int new_width, int new_height, int width, int height)
+        : RowStage(width, height),
+          m_new_width_(std::min(new_width, width)),
+          m_new_height_(std::min(new_height, height)),
+          m_received_(0) {
+    }
+
+    int OutputWidth() const override {
+        return m_new_width_;
+    }
+
+    int OutputHeight() const override {
+        return m_new_height_;
+    }
+
+    // Остаются последние new_height строк (верх изображения) и первые new_width пикселей каждой строки
+    void Push(Color* row) override {
+        if (m_received_++ >= m_height_ - m_new_height_) {
+            m_next_->Push(row);
+        }
+    }
+
+private:
+    int m_new_width_;
+    int m_new_height_;
+    int m_received_;
+};
+
+// Фильтры 3x3: хранится окно из трёх последних строк
+class StencilStage : public RowStage {
+public:
+    enum class Kind { Sharpening, Thermo, EdgeDetection };
+
+    StencilStage(Kind kind, float threshold, int width, int height)
+        : RowStage(width, height),
+          m_kind_(kind),
+          m_threshold_(threshold),
+          m_rows_(3, std::vector<Color>(width)),
+          m_output_(width),
+          m_received_(0) {
+    }
+
+    void Push(Color* row) override {
+        std::vector<Color>& slot = m_rows_[m_received_ % 3];
+        std::copy(row, row + m_width_, slot.begin());
+        if (m_kind_ == Kind::EdgeDetection) {
+            GrayscalePixels(slot.data(), m_width_);
+        }
+        ++m_received_;
+
+        if (m_received_ == 1) {
+            EmitBorder(slot);
+        }
+        if (m_received_ >= 3) {
+            const std::vector<Color>& up = m_rows_[(m_received_ - 3) % 3];
+            const std::vector<Color>& mid = m_rows_[(m_received_ - 2) % 3];
+            const std::vector<Color>& down = m_rows_[(m_received_ - 1) % 3];
+            // Крайние столбцы как у Image: нули, а у Edge Detection - серые исходные пиксели
+            if (m_kind_ == Kind::EdgeDetection) {
+                m_output_ = mid;
+                EdgeDetectionRow(up.data(), mid.data(), down.data(), m_output_.data(), m_width_, m_threshold_);
+            } else {
+                std::fill(m_output_.begin(), m_output_.end(), Color());
+                if (m_kind_ == Kind::Sharpening) {
+                    SharpeningRow(up.data(), mid.data(), down.data(), m_output_.data(), m_width_);
+                } else {
+                    ThermoRow(up.data(), mid.data(), down.data(), m_output_.data(), m_width_);
+                }
+            }
+            m_next_->Push(m_output_.data());
+        }
+        if (m_received_ == m_height_ && m_height_ > 1) {
+            EmitBorder(slot);
+        }
+    }
+
+private:
+    // Крайние строки фильтры 3x3 не обрабатывают
+    void EmitBorder(const std::vector<Color>& row) {
+        if (m_kind_ == Kind::EdgeDetection) {
+            m_output_ = row;
+        } else {
+            std::fill(m_output_.begin(), m_output_.end(), Color());
+        }
+        m_next_->Push(m_output_.data());
+    }
+
+    Kind m_kind_;
+    float m_threshold_;
+    std::vector<std::vector<Color>> m_rows_;
+    std::vector<Color> m_output_;
+    int m_received_;
+};
+
+// Фильтр, которому нужно всё изображение: строки собираются в Image, после последней строки фильтр
+// выполняется целиком и результат выдаётся по строкам. Размер изображения фильтр не меняет
+class WholeImageStage : public RowStage {
+public:
+    WholeImageStage(std::function<void(Image&)> filter, int width, int height)
+        : RowStage(width, height), m_filter_(std::move(filter)), m_image_(width, height), m_received_(0) {
+    }
+
+    void Push(Color* row) override {
+        std::copy(row, row + m_width_, m_image_.Row(m_received_));
+        if (++m_received_ < m_height_) {
+            return;
+        }
+        m_filter_(m_image_);
+        for (int y = 0; y < m_height_; ++y) {
+            m_next_->Push(m_image_.Row(y));
+        }
+    }
+
+private:
+    std::function<void(Image&)> m_filter_;
+    Image m_image_;
+    int m_received_;
+};
+
+// Гауссово размытие: горизонтальная свёртка при поступлении строки, вертикальная - по окну из 2r + 1 строк
+class GaussianStage : public RowStage {
+public:
+    GaussianStage(float sigma, int width, int height)
+        : RowStage(width, height),
+          m_kernel_(GaussianKernel(sigma)),
+          m_radius_(static_cast<int>(m_kernel_.size()) / 2),
+          m_rows_(m_kernel_.size(), std::vector<Color>(width)),
+          m_pointers_(m_kernel_.size()),
+          m_output_(width),
+          m_received_(0),
+          m_emitted_(0) {
+    }
+
+    void Push(Color* row) override {
+        ConvolveRowHorizontal(&row[0].r, &Slot(m_received_)[0].r, m_width_, 3, m_kernel_);
+        ++m_received_;
+        // Строку y можно выдать, когда пришла строка y + radius или строки закончились
+        while (m_emitted_ < m_height_ && (m_emitted_ + m_radius_ < m_received_ || m_received_ == m_height_)) {
+            for (int k = -m_radius_; k <= m_radius_; ++k) {
+                const int neighbor_y = m_emitted_ + k;
+                const bool inside = neighbor_y >= 0 && neighbor_y < m_height_;
+                m_pointers_[k + m_radius_] = inside ? &Slot(neighbor_y)[0].r : nullptr;
+            }
+            ConvolveRowsVertical(m_pointers_.data(), m_kernel_, &m_output_[0].r, m_width_ * 3);
+            m_next_->Push(m_output_.data());
+            ++m_emitted_;
+        }
+    }
+
+private:
+    std::vector<Color>& Slot(int y) {
+        return m_rows_[y % m_rows_.size()];
+    }
+
+    std::vector<float> m_kernel_;
+    int m_radius_;
+    std::vector<std::vector<Color>> m_rows_;
+    std::vector<const float*> m_pointers_;
+    std::vector<Color> m_output_;
+    int m_received_;
+    int m_emitted_;
+};
+
+// Один вертикальный box-фильтр каскада: скользящая сумма по окну из 2r + 2 последних строк
+class BoxVerticalStage : public RowStage {
+public:
+    BoxVerticalStage(int radius, int width, int height)
+        : RowStage(width, height),
+          m_radius_(radius),
+          m_rows_(2 * radius + 2, std::vector<Color>(width)),
+          m_sum_(width * 3, 0.0f),
+          m_output_(width),
+          m_window_(0),
+          m_received_(0),
+          m_emitted_(0) {
+    }
+
+    // Порядок сложений тот же, что в BoxBlurVertical
+    void Push(Color* row) override {
+        std::copy(row, row + m_width_, Slot(m_received_).begin());
+        const int y = m_received_++;
+        if (y < m_radius_) {
+            AccumulateRow(m_sum_.data(), &Slot(y)[0].r, 1.0f, m_width_ * 3);
+            ++m_window_;
+        } else {
+            Emit(true);
+        }
+        if (m_received_ == m_height_) {
+            while (m_emitted_ < m_height_) {
+                Emit(false);
+            }
+        }
+    }
+
+private:
+    void Emit(bool add) {
+        const int y = m_emitted_++;
+        if (add) {
+            AccumulateRow(m_sum_.data(), &Slot(y + m_radius_)[0].r, 1.0f, m_width_ * 3);
+            ++m_window_;
+        }
+        if (y - m_radius_ - 1 >= 0) {
+            AccumulateRow(m_sum_.data(), &Slot(y - m_radius_ - 1)[0].r, -1.0f, m_width_ * 3);
+            --m_window_;
+        }
+        AverageRow(m_sum_.data(), &m_output_[0].r, m_window_, m_width_ * 3);
+        m_next_->Push(m_output_.data());
+    }
+
+    std::vector<Color>& Slot(int y) {
+        return m_rows_[y % m_rows_.size()];
+    }
+
+    int m_radius_;
+    std::vector<std::vector<Color>> m_rows_;
+    std::vector<float> m_sum_;
+    std::vector<Color> m_output_;
+    int m_window_;
+    int m_received_;
+    int m_emitted_;
+};
+
+// Каскад box-фильтров для больших sigma: горизонтальные проходы по строке, затем три вертикальные стадии
+class BoxCascadeStage : public RowStage {
+public:
+    BoxCascadeStage(float sigma, int width, int height)
+        : RowStage(width, height), m_radii_(BoxCascadeRadii(sigma)), m_row_a_(width), m_row_b_(width), m_row_(width) {
+        for (int radius : m_radii_) {
+            m_vertical_.push_back(std::make_unique<BoxVerticalStage>(radius, width, height));
+        }
+        for (size_t i = 0; i + 1 < m_vertical_.size(); ++i) {
+            m_vertical_[i]->SetNext(m_vertical_[i + 1].get());
+        }
+    }
+
+    void SetNext(RowSink* next) override {
+        RowStage::SetNext(next);
+        m_vertical_.back()->SetNext(next);
+    }
+
+    void Push(Color* row) override {
+        BoxBlurRowHorizontal(&row[0].r, &m_row_a_[0].r, m_width_, 3, m_radii_[0]);
+        BoxBlurRowHorizontal(&m_row_a_[0].r, &m_row_b_[0].r, m_width_, 3, m_radii_[1]);
+        BoxBlurRowHorizontal(&m_row_b_[0].r, &m_row_[0].r, m_width_, 3, m_radii_[2]);
+        m_vertical_.front()->Push(m_row_.data());
+    }
+
+private:
+    std::vector<int> m_radii_;
+    std::vector<Color> m_row_a_;
+    std::vector<Color> m_row_b_;
+    std::vector<Color> m_row_;
+    std::vector<std::unique_ptr<BoxVerticalStage>> m_vertical_;
+};
+
+// Свёртка с произвольным ядром: окно из 2r + 1 строк. У разделимого ядра в окне хранятся строки после
+// горизонтального прохода, как в Image::Convolve
+class ConvolutionStage : public RowStage {
+public:
+    ConvolutionStage(Convolution convolution, int width, int height)
+        : RowStage(width, height),
+          m_convolution_(std::move(convolution)),
+          m_radius_(m_convolution_.Radius()),
+          m_rows_(2 * m_radius_ + 1, std::vector<Color>(width)),
+          m_pointers_(2 * m_radius_ + 1),
+          m_output_(width),
+          m_received_(0),
+          m_emitted_(0) {
+    }
+
+    void Push(Color* row) override {
+        if (m_convolution_.Separable()) {
+            m_convolution_.Horizontal(&row[0].r, &Slot(m_received_)[0].r, m_width_, 3);
+        } else {
+            std::copy(row, row + m_width_, Slot(m_received_).begin());
+        }
+        ++m_received_;
+        const BorderPolicy border = m_convolution_.Border();
+        while (m_emitted_ < m_height_ && (m_emitted_ + m_radius_ < m_received_ || m_received_ == m_height_)) {
+            const int y = m_emitted_++;
+            for (int k = 0; k < 2 * m_radius_ + 1; ++k) {
+                m_pointers_[k] = &Slot(BorderIndex(y + k - m_radius_, m_height_, border))[0].r;
+            }
+            if (m_convolution_.Separable()) {
+                m_convolution_.Vertical(m_pointers_.data(), &m_output_[0].r, m_width_ * 3);
+            } else {
+                if (border == BorderPolicy::Skip) {
+                    m_output_ = Slot(y);
+                }
+                if (border != BorderPolicy::Skip || (y >= m_radius_ && y < m_height_ - m_radius_)) {
+                    m_convolution_.Row(m_pointers_.data(), &m_output_[0].r, m_width_, 3);
+                }
+            }
+            m_next_->Push(m_output_.data());
+        }
+    }
+
+private:
+    std::vector<Color>& Slot(int y) {
+        return m_rows_[y % m_rows_.size()];
+    }
+
+    Convolution m_convolution_;
+    int m_radius_;
+    std::vector<std::vector<Color>> m_rows_;
+    std::vector<const float*> m_pointers_;
+    std::vector<Color> m_output_;
+    int m_received_;
+    int m_emitted_;
+};
+
+// Медиана: строки переводятся в уровни и хранятся окном из 2r + 2 последних, гистограммы столбцов сдвигаются
+// на строку, как в одной полосе MedianFilter
+class MedianStage : public RowStage {
+public:
+    MedianStage(int radius, int width, int height)
+        : RowStage(width, height),
+          m_radius_(radius),
+          m_window_(width, 3, radius),
+          m_rows_(2 * radius + 2, std::vector<unsigned char>(3 * width)),
+          m_median_(3 * width),
+          m_output_(width),
+          m_received_(0),
+          m_emitted_(0) {
+    }
+
+    void Push(Color* row) override {
+        const float* values = &row[0].r;
+        std::vector<unsigned char>& levels = Slot(m_received_++);
+        for (int i = 0; i < 3 * m_width_; ++i) {
+            levels[i] = QuantizeLevel(values[i]);
+        }
+        while (m_emitted_ < m_height_ && (m_emitted_ + m_radius_ < m_received_ || m_received_ == m_height_)) {
+            const int y = m_emitted_++;
+            if (y == 0) {
+                for (int dy = -m_radius_; dy <= m_radius_; ++dy) {
+                    m_window_.AddRow(Slot(Clamp(dy)).data());
+                }
+            } else {
+                m_window_.RemoveRow(Slot(Clamp(y - m_radius_ - 1)).data());
+                m_window_.AddRow(Slot(Clamp(y + m_radius_)).data());
+            }
+            m_window_.MedianRow(m_median_.data());
+            float* output = &m_output_[0].r;
+            for (int i = 0; i < 3 * m_width_; ++i) {
+                output[i] = LevelValue(m_median_[i]);
+            }
+            m_next_->Push(m_output_.data());
+        }
+    }
+
+private:
+    int Clamp(int y) const {
+        return std::min(std::max(y, 0), m_height_ - 1);
+    }
+
+    std::vector<unsigned char>& Slot(int y) {
+        return m_rows_[y % m_rows_.size()];
+    }
+
+    int m_radius_;
+    MedianWindow m_window_;
+    std::vector<std::vector<unsigned char>> m_rows_;
+    std::vector<unsigned char> m_median_;
+    std::vector<Color> m_output_;
+    int m_received_;
+    int m_emitted_;
+};
+
+// Масштабирование: строки сразу масштабируются по горизонтали, строка результата выпускается, как только
+// пришли все строки её окна. Окна соседних строк результата идут подряд, поэтому хватает taps последних строк
+class ResizeStage : public RowStage {
+public:
+    ResizeStage(int new_width, int new_height, int width, int height)
+        : RowStage(width, height),
+          m_new_width_(new_width),
+          m_new_height_(new_height),
+          m_horizontal_(LanczosWeights(width, new_width)),
+          m_vertical_(LanczosWeights(height, new_height)),
+          m_rows_(m_vertical_.taps, std::vector<Color>(new_width)),
+          m_pointers_(m_vertical_.taps),
+          m_output_(new_width),
+          m_received_(0),
+          m_emitted_(0) {
+    }
+
+    int OutputWidth() const override {
+        return m_new_width_;
+    }
+
+    int OutputHeight() const override {
+        return m_new_height_;
+    }
+
+    void Push(Color* row) override {
+        ResampleRowHorizontal(&row[0].r, &Slot(m_received_)[0].r, m_horizontal_, 3);
+        ++m_received_;
+        const int taps = m_vertical_.taps;
+        while (m_emitted_ < m_new_height_ && m_vertical_.first[m_emitted_] + taps <= m_received_) {
+            const int y = m_emitted_++;
+            for (int k = 0; k < taps; ++k) {
+                m_pointers_[k] = &Slot(m_vertical_.first[y] + k)[0].r;
+            }
+            const float* weights = &m_vertical_.weights[static_cast<size_t>(y) * taps];
+            ResampleRowsVertical(m_pointers_.data(), weights, taps, &m_output_[0].r, m_new_width_ * 3);
+            m_next_->Push(m_output_.data());
+        }
+    }
+
+private:
+    std::vector<Color>& Slot(int y) {
+        return m_rows_[y % m_rows_.size()];
+    }
+
+    int m_new_width_;
+    int m_new_height_;
+    ResampleWeights m_horizontal_;
+    ResampleWeights m_vertical_;
+    std::vector<std::vector<Color>> m_rows_;
+    std::vector<const float*> m_pointers_;
+    std::vector<Color> m_output_;
+    int m_received_;
+    int m_emitted_;
+};
+
+}  // namespace
+
+RowStage::RowStage(int width, int height) : m_width_(width), m_height_(height), m_next_(nullptr) {
+}
+
+void RowStage::SetNext(RowSink* next) {
+    m_next_ = next;
+}
+
+int RowStage::OutputWidth() const {
+    return m_width_;
+}
+
+int RowStage::OutputHeight() const {
+    return m_height_;
+}
+
+std::unique_ptr<RowStage> MakePointStage(PointOp op, int width, int height) {
+    return std::make_unique<PointStage>(std::move(op), width, height);
+}
+
+std::unique_ptr<RowStage> MakeCropStage(int new_width, int new_height, int width, int height) {
+    return std::make_unique<CropStage>(new_width, new_height, width, height);
+}
+
+std::unique_ptr<RowStage> MakeResizeStage(int new_width, int new_height, int width, int height) {
+    return std::make_unique<ResizeStage>(new_width, new_height, width, height);
+}
+
+std::unique_ptr<RowStage> MakeBlurStage(float sigma, int width, int height) {
+    if (UseBoxCascade(sigma)) {
+        return std::make_unique<BoxCascadeStage>(sigma, width, height);
+    }
+    return std::make_unique<GaussianStage>(sigma, width, height);
+}
+
+std::unique_ptr<RowStage> MakeSharpeningStage(int width, int height) {
+    return std::make_unique<StencilStage>(StencilStage::Kind::Sharpening, 0.0f, width, height);
+}
+
+std::unique_ptr<RowStage> MakeThermoStage(int width, int height) {
+    return std::make_unique<StencilStage>(StencilStage::Kind::Thermo, 0.0f, width, height);
+}
+
+std::unique_ptr<RowStage> MakeEdgeDetectionStage(float threshold, int width, int height) {
+    return std::make_unique<StencilStage>(StencilStage::Kind::EdgeDetection, threshold, width, height);
+}
+
+std::unique_ptr<RowStage> MakeAutoEdgeDetectionStage(int width, int height) {
+    return std::make_unique<WholeImageStage>([](Image& image) { image.AutoEdgeDetection(); }, width, height);
+}
+
+std::unique_ptr<RowStage> MakeMedianStage(int radius, int width, int height) {
+    return std::make_unique<MedianStage>(radius, width, height);
+}
+
+std::unique_ptr<RowStage> MakeBilateralStage(float sigma_spatial, float sigma_range, int width, int height) {
+    return std::make_unique<WholeImageStage>(
+        [sigma_spatial, sigma_range](Image& image) { image.Bilateral(sigma_spatial, sigma_range); }, width, height);
+}
+
+std::unique_ptr<RowStage> MakeConvolutionStage(Convolution convolution, int width, int height) {
+    return std::make_unique<ConvolutionStage>(std::move(convolution), width, height);
+}
+
+bool BmpRowReader::Open(const char* path, std::string& error) {
+    m_file_.open(path, std::ios::in | std::ios::binary);
+    if (!m_file_.is_open()) {
+        error = "This file cannot be opened";
+        return false;
+    }
+    if (!ReadBmpHeader(m_file_, m_info_, error)) {
+        return false;
+    }
+    if (m_info_.compression == kBmpRle8 || m_info_.compression == kBmpRle4) {
+        // Сжатые строки имеют разную длину, поэтому распаковываем изображение целиком в один блок
+        const bool read = ReadBmpRows(
+            m_file_, m_info_,
+            [&](int y, const unsigned char* row) {
+                m_row_size_ = BmpStoredRowSize(m_info_);
+                m_block_.resize(static_cast<size_t>(m_row_size_) * m_info_.height);
+                std::memcpy(m_block_.data() + static_cast<size_t>(y) * m_row_size_, row, m_row_size_);
+            },
+            error);
+        m_block_rows_ = m_info_.height;
+        return read;
+    }
+    m_row_size_ = BmpStoredRowSize(m_info_);
+    m_rows_left_ = m_info_.height;
+    const int block_rows = std::min(m_info_.height, std::max(1, kIoBlockBytes / m_row_size_));
+    m_block_.resize(static_cast<size_t>(m_row_size_) * block_rows);
+    return true;
+}
+
+int BmpRowReader::Width() const {
+    return m_info_.width;
+}
+
+int BmpRowReader::Height() const {
+    return m_info_.height;
+}
+
+bool BmpRowReader::ReadRow(Color* dst) {
+    if (m_block_position_ == m_block_rows_) {
+        const int capacity = static_cast<int>(m_block_.size() / m_row_size_);
+        m_block_rows_ = std::min(capacity, m_rows_left_);
+        m_block_position_ = 0;
+        const std::streamsize bytes = static_cast<std::streamsize>(m_block_rows_) * m_row_size_;
+        if (m_info_.top_down) {
+            // Строки сверху вниз: нижние строки изображения в конце файла, блоки читаются с конца
+            const std::streamoff first = static_cast<std::streamoff>(m_rows_left_ - m_block_rows_) * m_row_size_;
+            m_file_.seekg(m_info_.data_offset + first);
+        }
+        m_file_.read(reinterpret_cast<char*>(m_block_.data()), bytes);
+        if (m_block_rows_ == 0 || m_file_.gcount() != bytes) {
+            return false;
+        }
+        m_rows_left_ -= m_block_rows_;
+    }
+    const int row = m_info_.top_down ? m_block_rows_ - 1 - m_block_position_ : m_block_position_;
+    UnpackBmpRow(m_info_, m_block_.data() + static_cast<size_t>(row) * m_row_size_, dst, m_info_.width);
+    ++m_block_position_;
+    return true;
+}
+
+bool BmpRowWriter::Open(const char* path, int width, int height, std::string& error) {
+    unsigned char header[kBmpFileHeaderSize + kBmpInfoHeaderSize];
+    if (!WriteBmpHeader(header, width, height, error)) {
+        return false;
+    }
+    m_file_.open(path, std::ios::out | std::ios::binary);
+    if (!m_file_.is_open()) {
+        error = "File cannot be opened";
+        return false;
+    }
+    m_path_ = path;
+    m_file_.write(reinterpret_cast<char*>(header), sizeof(header));
+
+    m_width_ = width;
+    m_row_size_ = BmpOutputRowSize(width);
+    m_block_rows_ = std::max(1, std::min(height, static_cast<int>(kIoBlockBytes / m_row_size_)));
+    m_block_.assign(m_row_size_ * m_block_rows_, 0);
+    return true;
+}
+
+void BmpRowWriter::Push(Color* row) {
+    unsigned char* dst = m_block_.data() + m_buffered_rows_ * m_row_size_;
+    PackBmpRow(row, dst, m_width_);
+    if (++m_buffered_rows_ == m_block_rows_) {
+        Flush();
+    }
+}
+
+void BmpRowWriter::Flush() {
+    const std::streamsize bytes = static_cast<std::streamsize>(m_buffered_rows_) * m_row_size_;
+    m_file_.write(reinterpret_cast<char*>(m_block_.data()), bytes);
+    m_buffered_rows_ = 0;
+}
+
+bool BmpRowWriter::Close() {
+    Flush();
+    m_file_.close();
+    if (m_file_.fail()) {
+        std::remove(m_path_.c_str());
+        return false;
+    }
+    return true;
+}
+
+void BmpRowWriter::Discard() {
+    m_file_.close();
+    std::remove(m_path_.c_str());
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bmp.h"
+#include "convolution.h"
+#include "image.h"
+
+// Потоковая обработка: строки изображения проходят через цепочку стадий по одной, каждая стадия
+// хранит только те строки, которые нужны ей для окрестности. Порядок строк тот же, что в файле
+// (снизу вверх), результаты совпадают с обработкой изображения целиком.
+
+// Получатель строк изображения
+class RowSink {
+public:
+    virtual ~RowSink() = default;
+    // Строки приходят по порядку. Получатель может менять содержимое строки
+    virtual void Push(Color* row) = 0;
+};
+
+// Стадия обработки: получает строки размера width x height и передаёт результат следующему получателю
+class RowStage : public RowSink {
+public:
+    RowStage(int width, int height);
+
+    virtual void SetNext(RowSink* next);
+    virtual int OutputWidth() const;
+    virtual int OutputHeight() const;
+
+protected:
+    int m_width_;
+    int m_height_;
+    RowSink* m_next_;
+};
+
+std::unique_ptr<RowStage> MakePointStage(PointOp op, int width, int height);
+std::unique_ptr<RowStage> MakeCropStage(int new_width, int new_height, int width, int height);
+std::unique_ptr<RowStage> MakeResizeStage(int new_width, int new_height, int width, int height);
+std::unique_ptr<RowStage> MakeBlurStage(float sigma, int width, int height);
+std::unique_ptr<RowStage> MakeSharpeningStage(int width, int height);
+std::unique_ptr<RowStage> MakeThermoStage(int width, int height);
+std::unique_ptr<RowStage> MakeEdgeDetectionStage(float threshold, int width, int height);
+// Порог -edge auto зависит от всего изображения, поэтому эта стадия собирает строки целиком
+std::unique_ptr<RowStage> MakeAutoEdgeDetectionStage(int width, int height);
+std::unique_ptr<RowStage> MakeMedianStage(int radius, int width, int height);
+// Пиксель -bilateral зависит от строк на несколько sigma_spatial в обе стороны, поэтому стадия, как и -edge auto,
+// собирает строки целиком
+std::unique_ptr<RowStage> MakeBilateralStage(float sigma_spatial, float sigma_range, int width, int height);
+std::unique_ptr<RowStage> MakeConvolutionStage(Convolution convolution, int width, int height);
+
+// Чтение BMP по строкам с буферизацией небольшими блоками
+class BmpRowReader {
+public:
+    bool Open(const char* path, std::string& error);
+    int Width() const;
+    int Height() const;
+    // Декодирует следующую строку в dst (Width() пикселей)
+    bool ReadRow(Color* dst);
+
+private:
+    std::ifstream m_file_;
+    BmpInfo m_info_;
+    int m_row_size_ = 0;
+    int m_rows_left_ = 0;
+    int m_block_rows_ = 0;
+    int m_block_position_ = 0;
+    std::vector<unsigned char> m_block_;
+};
+
+// Запись BMP по строкам: строки кодируются в буфер и сбрасываются в файл блоками
+class BmpRowWriter : public RowSink {
+public:
+    // Проверяет размеры и только потом создаёт файл. При ошибке возвращает false и пишет причину в error
+    bool Open(const char* path, int width, int height, std::string& error);
+    void Push(Color* row) override;
+    // Дописывает буфер и закрывает файл. При ошибке записи удаляет файл и возвращает false
+    bool Close();
+    // Закрывает и удаляет недописанный файл
+    void Discard();
+
+private:
+    void Flush();
+
+    std::string m_path_;
+    std::ofstream m_file_;
+    int m_width_ = 0;
+    size_t m_row_size_ = 0;
+    int m_buffered_rows_ = 0;
+    int m_block_rows_ = 0;
+    std::vector<unsigned char> m_block_;
+};
@@ -0,0 +1,187 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+int g_thread_count = 0;
+
+// Глубина вложенности выполняемых задач в текущем потоке: время вложенных задач уже входит во внешнюю
+thread_local int t_task_depth = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads) : m_next_queue_(0), m_pending_(0), m_busy_ns_(0), m_stop_(false) {
+    if (threads <= 0) {
+        threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    // Очередь с индексом 0 общая для внешних потоков, остальные принадлежат рабочим потокам
+    for (int i = 0; i < threads; ++i) {
+        m_queues_.push_back(std::make_unique<Queue>());
+    }
+    for (int i = 1; i < threads; ++i) {
+        m_workers_.emplace_back([this, i] { WorkerLoop(static_cast<size_t>(i)); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex_);
+        m_stop_ = true;
+    }
+    m_wake_.notify_all();
+    for (auto& worker : m_workers_) {
+        worker.join();
+    }
+}
+
+int ThreadPool::Size() const {
+    return static_cast<int>(m_queues_.size());
+}
+
+long long ThreadPool::BusyNanoseconds() const {
+    return m_busy_ns_.load(std::memory_order_relaxed);
+}
+
+void ThreadPool::Push(Task task) {
+    const size_t index = m_next_queue_.fetch_add(1) % m_queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(m_queues_[index]->mutex);
+        m_queues_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wake_mutex_);
+        m_pending_.fetch_add(1);
+    }
+    m_wake_.notify_one();
+}
+
+bool ThreadPool::TryRun(size_t preferred) {
+    Task task;
+    // Своя очередь берётся с конца (свежие задачи горячее в кэше), чужие - с начала
+    for (size_t i = 0; i < m_queues_.size() && !task; ++i) {
+        Queue& queue = *m_queues_[(preferred + i) % m_queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    m_pending_.fetch_sub(1);
+    RunCounted(task);
+    return true;
+}
+
+void ThreadPool::RunCounted(const Task& task) {
+    if (t_task_depth > 0) {
+        task();
+        return;
+    }
+    // Глубина восстанавливается и тогда, когда задача бросает исключение
+    struct DepthGuard {
+        DepthGuard() {
+            ++t_task_depth;
+        }
+        ~DepthGuard() {
+            --t_task_depth;
+        }
+    };
+    const auto start = std::chrono::steady_clock::now();
+    {
+        DepthGuard guard;
+        task();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    m_busy_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                         std::memory_order_relaxed);
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    while (true) {
+        if (TryRun(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_wake_mutex_);
+        m_wake_.wait(lock, [this] { return m_stop_ || m_pending_.load() > 0; });
+        if (m_stop_) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(int count, int grain, const std::function<void(int, int)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    grain = std::max(1, grain);
+    // Несколько кусков на поток, чтобы кража задач выравнивала нагрузку
+    const int chunks_per_thread = 4;
+    const int chunks = std::min((count + grain - 1) / grain, Size() * chunks_per_thread);
+    if (chunks <= 1 || Size() == 1) {
+        RunCounted([&] { body(0, count); });
+        return;
+    }
+
+    struct Batch {
+        std::atomic<int> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;  // первое исключение из кусков
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = chunks;
+
+    for (int i = 0; i < chunks; ++i) {
+        const int begin = static_cast<int>(static_cast<long long>(count) * i / chunks);
+        const int end = static_cast<int>(static_cast<long long>(count) * (i + 1) / chunks);
+        Push([batch, begin, end, &body] {
+            try {
+                body(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                if (!batch->error) {
+                    batch->error = std::current_exception();
+                }
+            }
+            if (batch->remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                batch->done.notify_all();
+            }
+        });
+    }
+
+    // Пока куски не закончены, помогаем выполнять задачи из любых очередей
+    while (batch->remaining.load() > 0) {
+        if (TryRun(0)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait_for(lock, std::chrono::milliseconds(1), [&] { return batch->remaining.load() == 0; });
+    }
+    if (batch->error) {
+        std::rethrow_exception(batch->error);
+    }
+}
+
+void SetThreadCount(int threads) {
+    g_thread_count = threads;
+}
+
+ThreadPool& GetThreadPool() {
+    static ThreadPool pool(g_thread_count);
+    return pool;
+}
+
+void ParallelFor(int count, int grain, const std::function<void(int, int)>& body) {
+    GetThreadPool().ParallelFor(count, grain, body);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с очередью задач у каждого потока и кражей задач у соседей.
+// Поток, вызвавший ParallelFor, тоже выполняет задачи, пока ждёт, поэтому вложенные вызовы не блокируются.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // threads - общее число потоков вместе с вызывающим, 0 - по числу ядер
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int Size() const;
+
+    // Суммарное время выполнения задач всеми потоками с момента создания пула, для оценки загрузки
+    long long BusyNanoseconds() const;
+
+    // Вызывает body(begin, end) для кусков [0, count) длиной не меньше grain и ждёт завершения всех кусков.
+    // Если куски бросали исключения, после завершения всех кусков первое из них бросается в вызывающем потоке
+    void ParallelFor(int count, int grain, const std::function<void(int, int)>& body);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void Push(Task task);
+    bool TryRun(size_t preferred);
+    // Выполняет задачу и добавляет её время к m_busy_ns_
+    void RunCounted(const Task& task);
+    void WorkerLoop(size_t index);
+
+    std::vector<std::unique_ptr<Queue>> m_queues_;
+    std::vector<std::thread> m_workers_;
+    std::atomic<size_t> m_next_queue_;
+    std::atomic<int> m_pending_;
+    std::atomic<long long> m_busy_ns_;
+    std::mutex m_wake_mutex_;
+    std::condition_variable m_wake_;
+    bool m_stop_;
+};
+
+// Общий пул для фильтров. SetThreadCount нужно вызвать до первого использования пула
+void SetThreadCount(int threads);
+ThreadPool& GetThreadPool();
+
+// Сокращение для GetThreadPool().ParallelFor
+void ParallelFor(int count, int grain, const std::function<void(int, int)>& body);
@@ -0,0 +1,227 @@
+#include "tiling.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "blur.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Размер блока результата: 384 x 96 пикселей, 430 КБ. Входной и выходной буферы этапа вместе с памятью
+// горизонтального прохода размытия занимают 1-1.5 МБ и остаются в L2 между этапами цепочки
+const int kTileWidth = 384;
+const int kTileHeight = 96;
+
+// Фильтры 3x3 поверх построчных ядер. Крайние строки и столбцы изображения ядра не считают:
+// у sharp и thermo они нулевые, у edge копируются из исходника
+template <typename Kernel>
+class StencilTileFilter : public TileFilter {
+public:
+    StencilTileFilter(Kernel kernel, bool copy_border) : m_kernel_(std::move(kernel)), m_copy_border_(copy_border) {
+    }
+
+    int Radius() const override {
+        return 1;
+    }
+
+    int Passes() const override {
+        return 1;
+    }
+
+    void Apply(const TileRegion& src, const TileRegion& dst, int width, int height,
+               std::vector<Color>& workspace) const override {
+        auto border = [&](int x, int y) { return m_copy_border_ ? *src.At(x, y) : Color(); };
+        for (int y = dst.y0; y < dst.y1; ++y) {
+            Color* row = dst.At(dst.x0, y);
+            if (y == 0 || y == height - 1) {
+                for (int x = dst.x0; x < dst.x1; ++x) {
+                    row[x - dst.x0] = border(x, y);
+                }
+                continue;
+            }
+            if (dst.x0 == 0) {
+                row[0] = border(0, y);
+            }
+            if (dst.x1 == width && width > 1) {
+                row[width - 1 - dst.x0] = border(width - 1, y);
+            }
+            // Ядро пишет пиксели 1..count-2 своей строки, поэтому строка начинается на пиксель левее
+            const int begin = std::max(dst.x0, 1);
+            const int end = std::min(dst.x1, width - 1);
+            if (begin < end) {
+                m_kernel_(src.At(begin - 1, y - 1), src.At(begin - 1, y), src.At(begin - 1, y + 1),
+                          dst.At(begin - 1, y), end - begin + 2);
+            }
+        }
+    }
+
+private:
+    Kernel m_kernel_;
+    bool m_copy_border_;
+};
+
+template <typename Kernel>
+std::unique_ptr<TileFilter> MakeStencilTileFilter(Kernel kernel, bool copy_border) {
+    return std::make_unique<StencilTileFilter<Kernel>>(std::move(kernel), copy_border);
+}
+
+// Гауссово размытие прямой свёрткой: горизонтальный проход по строкам блока с гало в workspace,
+// затем вертикальный в dst, с теми же ядрами и тем же порядком операций, что и у Image::GaussianBlur
+class GaussianBlurTileFilter : public TileFilter {
+public:
+    explicit GaussianBlurTileFilter(float sigma)
+        : m_kernel_(GaussianKernel(sigma)), m_radius_(static_cast<int>(m_kernel_.size()) / 2) {
+    }
+
+    int Radius() const override {
+        return m_radius_;
+    }
+
+    int Passes() const override {
+        return 2;
+    }
+
+    void Apply(const TileRegion& src, const TileRegion& dst, int width, int height,
+               std::vector<Color>& workspace) const override {
+        const int first = std::max(0, dst.y0 - m_radius_);
+        const int last = std::min(height, dst.y1 + m_radius_);
+        const int columns = dst.Width();
+        if (workspace.size() < static_cast<size_t>(last - first) * columns) {
+            workspace.resize(static_cast<size_t>(last - first) * columns);
+        }
+        auto temporary_row = [&](int y) { return &workspace[static_cast<size_t>(y - first) * columns].r; };
+        for (int y = first; y < last; ++y) {
+            ConvolveRowHorizontal(&src.At(dst.x0, y)->r, temporary_row(y), width, 3, m_kernel_, dst.x0, dst.x1);
+        }
+
+        std::vector<const float*> rows(m_kernel_.size());
+        for (int y = dst.y0; y < dst.y1; ++y) {
+            for (int k = -m_radius_; k <= m_radius_; ++k) {
+                const int neighbor_y = y + k;
+                const bool inside = neighbor_y >= 0 && neighbor_y < height;
+                rows[k + m_radius_] = inside ? temporary_row(neighbor_y) : nullptr;
+            }
+            ConvolveRowsVertical(rows.data(), m_kernel_, &dst.At(dst.x0, y)->r, columns * 3);
+        }
+    }
+
+private:
+    std::vector<float> m_kernel_;
+    int m_radius_;
+};
+
+// Блок пикселей [x0, x1) x [y0, y1) в buffer: строки через x1 - x0 + 1 пикселей, перед каждой строкой
+// свободный пиксель для построчных ядер
+TileRegion PlaceRegion(std::vector<Color>& buffer, int x0, int y0, int x1, int y1) {
+    const int stride = x1 - x0 + 1;
+    const size_t size = static_cast<size_t>(stride) * (y1 - y0);
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return TileRegion{x0, y0, x1, y1, buffer.data() + 1, stride};
+}
+
+// Часть region внутри изображения с запасом margin с каждой стороны
+TileRegion Expand(int x0, int y0, int x1, int y1, int margin, int width, int height) {
+    return TileRegion{std::max(0, x0 - margin), std::max(0, y0 - margin), std::min(width, x1 + margin),
+                      std::min(height, y1 + margin)};
+}
+
+void ApplyToRows(const PointOp& op, const TileRegion& region) {
+    for (int y = region.y0; y < region.y1; ++y) {
+        op(region.At(region.x0, y), region.Width());
+    }
+}
+
+}  // namespace
+
+std::unique_ptr<TileFilter> MakeSharpeningTileFilter() {
+    return MakeStencilTileFilter(SharpeningRow, false);
+}
+
+std::unique_ptr<TileFilter> MakeThermoTileFilter() {
+    return MakeStencilTileFilter(ThermoRow, false);
+}
+
+std::unique_ptr<TileFilter> MakeEdgeDetectionTileFilter(float threshold) {
+    return MakeStencilTileFilter(
+        [threshold](const Color* up, const Color* mid, const Color* down, Color* dst, int width) {
+            EdgeDetectionRow(up, mid, down, dst, width, threshold);
+        },
+        true);
+}
+
+std::unique_ptr<TileFilter> MakeGaussianBlurTileFilter(float sigma) {
+    if (UseBoxCascade(sigma)) {
+        return nullptr;
+    }
+    return std::make_unique<GaussianBlurTileFilter>(sigma);
+}
+
+bool WorthTiling(const std::vector<TileStep>& steps) {
+    int passes = 0;
+    for (const auto& step : steps) {
+        passes += step.filter->Passes() + (step.prologue ? 1 : 0);
+    }
+    return passes > 1;
+}
+
+void ExecuteTiles(const std::vector<TileStep>& steps, const TileRegion& src, const TileRegion& dst, int width,
+                  int height) {
+    if (steps.empty() || width <= 0 || height <= 0) {
+        return;
+    }
+    // halo[i] - на сколько пикселей результат этапа i должен выходить за блок, чтобы хватило следующим этапам
+    const int count = static_cast<int>(steps.size());
+    std::vector<int> halo(count, 0);
+    for (int i = count - 2; i >= 0; --i) {
+        halo[i] = halo[i + 1] + steps[i + 1].filter->Radius();
+    }
+
+    const int columns = (width + kTileWidth - 1) / kTileWidth;
+    const int rows = (height + kTileHeight - 1) / kTileHeight;
+    ParallelFor(columns * rows, 1, [&](int begin, int end) {
+        // Промежуточные результаты этапов по очереди пишутся в два буфера потока
+        std::vector<Color> buffers[2];
+        std::vector<Color> workspace;
+        for (int tile = begin; tile < end; ++tile) {
+            const int x0 = tile % columns * kTileWidth;
+            const int y0 = tile / columns * kTileHeight;
+            const int x1 = std::min(width, x0 + kTileWidth);
+            const int y1 = std::min(height, y0 + kTileHeight);
+
+            TileRegion input = src;
+            int current = 0;
+            if (steps[0].prologue) {
+                // Пролог меняет пиксели, поэтому первый этап читает копию, а не исходное изображение
+                const int margin = halo[0] + steps[0].filter->Radius();
+                const TileRegion area = Expand(x0, y0, x1, y1, margin, width, height);
+                input = PlaceRegion(buffers[current], area.x0, area.y0, area.x1, area.y1);
+                for (int y = input.y0; y < input.y1; ++y) {
+                    std::copy(src.At(input.x0, y), src.At(input.x1, y), input.At(input.x0, y));
+                }
+                ApplyToRows(steps[0].prologue, input);
+                current ^= 1;
+            }
+            for (int i = 0; i < count; ++i) {
+                TileRegion output;
+                if (i + 1 == count) {
+                    output = TileRegion{x0, y0, x1, y1, dst.At(x0, y0), dst.stride};
+                } else {
+                    const TileRegion area = Expand(x0, y0, x1, y1, halo[i], width, height);
+                    output = PlaceRegion(buffers[current], area.x0, area.y0, area.x1, area.y1);
+                    current ^= 1;
+                }
+                steps[i].filter->Apply(input, output, width, height, workspace);
+                if (steps[i].epilogue) {
+                    ApplyToRows(steps[i].epilogue, output);
+                }
+                if (i + 1 < count && steps[i + 1].prologue) {
+                    ApplyToRows(steps[i + 1].prologue, output);
+                }
+                input = output;
+            }
+        }
+    });
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "image.h"
+
+// Блочное выполнение фильтров по окрестности. Изображение делится на прямоугольные блоки, рабочий набор
+// которых помещается в L2, и цепочка подряд идущих фильтров проходит блок целиком: промежуточные результаты
+// живут только в буферах блока и не пишутся в память изображения. Каждый фильтр цепочки считает свою
+// область с запасом (гало) на радиус следующих фильтров, пиксели гало соседние блоки считают повторно.
+// Результат побитово совпадает с обработкой целыми строками
+
+// Прямоугольник [x0, x1) x [y0, y1) в координатах изображения и его пиксели в буфере
+struct TileRegion {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+    Color* data = nullptr;  // пиксель (x0, y0)
+    int stride = 0;         // расстояние между строками в пикселях
+
+    Color* At(int x, int y) const {
+        return data + static_cast<ptrdiff_t>(y - y0) * stride + (x - x0);
+    }
+    int Width() const {
+        return x1 - x0;
+    }
+};
+
+// Фильтр по окрестности, который умеет считать любую прямоугольную часть результата
+class TileFilter {
+public:
+    virtual ~TileFilter() = default;
+
+    virtual int Radius() const = 0;
+    // Сколько проходов по всему изображению делает обычная реализация фильтра без пролога
+    // (у размытия два: по строкам в промежуточный буфер и по столбцам обратно)
+    virtual int Passes() const = 0;
+    // Пиксели dst по пикселям src изображения width x height. src покрывает dst с запасом Radius(),
+    // обрезанным краями изображения. Слева от dst.At(dst.x0, y) в буфере есть ещё один пиксель, его
+    // можно использовать как опору для построчных ядер, но значение там не сохраняется.
+    // workspace - память потока для промежуточных данных фильтра
+    virtual void Apply(const TileRegion& src, const TileRegion& dst, int width, int height,
+                       std::vector<Color>& workspace) const = 0;
+};
+
+// Этап цепочки: фильтр со слитыми поточечными операциями, как у этапа плана
+struct TileStep {
+    std::unique_ptr<TileFilter> filter;
+    PointOp prologue;
+    PointOp epilogue;
+};
+
+std::unique_ptr<TileFilter> MakeSharpeningTileFilter();
+std::unique_ptr<TileFilter> MakeThermoTileFilter();
+// Только свёртка с порогом: grayscale перед ней выполняется прологом этапа
+std::unique_ptr<TileFilter> MakeEdgeDetectionTileFilter(float threshold);
+// nullptr для больших sigma: каскад box-фильтров обходит изображение по столбцам и блоками не считается
+std::unique_ptr<TileFilter> MakeGaussianBlurTileFilter(float sigma);
+
+// Выигрывает ли цепочка от выполнения блоками: без них она прошла бы по изображению больше одного раза.
+// Для одного фильтра 3x3 без пролога блоки только добавляют пересчёт гало
+bool WorthTiling(const std::vector<TileStep>& steps);
+
+// Выполняет цепочку: src и dst - всё изображение width x height, dst не пересекается с src
+void ExecuteTiles(const std::vector<TileStep>& steps, const TileRegion& src, const TileRegion& dst, int width,
+                  int height);